@@ -8,6 +8,7 @@
 #define kMaxPlayers 16
 #define kTestFreeBufferDuringPlayback 0
 #define kTestAudioPause 0
+#define kLoadAsync 1
 
 typedef struct {
     mal_context *context;
@@ -64,26 +65,31 @@ static void play_sound(mal_app *app, mal_buffer *buffer, float gain) {
 #endif
 }
 
-static void mal_init(mal_app *app, ok_wav *wav) {
-    app->context = mal_context_create(44100);
-    if (!app->context) {
-        glfmLog("Error: Couldn't create audio context");
-    }
+static mal_format wav_format(const ok_wav *wav) {
     mal_format format = {
         .sample_rate = wav->sample_rate,
         .num_channels = wav->num_channels,
-        .bit_depth = wav->bit_depth};
-    if (!mal_context_format_is_valid(app->context, format)) {
-        glfmLog("Error: Audio format is invalid");
+        .bit_depth = wav->bit_depth,
+        .sample_type = wav->is_float ? MAL_SAMPLE_TYPE_FLOAT : MAL_SAMPLE_TYPE_INT,
+        .block_size = wav->block_size};
+    if (wav->encoding == OK_WAV_ENCODING_IMA_ADPCM) {
+        format.sample_type = MAL_SAMPLE_TYPE_IMA_ADPCM;
+    } else if (wav->encoding == OK_WAV_ENCODING_MS_ADPCM) {
+        format.sample_type = MAL_SAMPLE_TYPE_MS_ADPCM;
     }
-    app->buffer = mal_buffer_create_no_copy(app->context, format, (uint32_t)wav->num_frames,
-                                            wav->data, free);
-    if (!app->buffer) {
-        glfmLog("Error: Couldn't create audio buffer");
+    return format;
+}
+
+static void mal_init(mal_app *app) {
+    app->context = mal_context_create(44100);
+    if (!app->context) {
+        glfmLog("Error: Couldn't create audio context");
     }
-    wav->data = NULL; // Audio buffer is now managed by mal, don't free it
-    ok_wav_free(wav);
+}
 
+static void mal_start(mal_app *app, mal_buffer *buffer) {
+    app->buffer = buffer;
+    mal_format format = mal_buffer_get_format(buffer);
     for (int i = 0; i < kMaxPlayers; i++) {
         app->players[i] = mal_player_create(app->context, format);
     }
@@ -99,6 +105,34 @@ static void mal_init(mal_app *app, ok_wav *wav) {
     }
 }
 
+#if !kLoadAsync
+
+static mal_buffer *mal_load_buffer(mal_app *app, ok_wav_decoder *decoder) {
+    const ok_wav *wav = ok_wav_get_info(decoder);
+    mal_format format = wav_format(wav);
+    if (!mal_context_format_is_valid(app->context, format)) {
+        glfmLog("Error: Audio format is invalid");
+        return NULL;
+    }
+    // Decode directly into the buffer's storage
+    const uint32_t num_frames = (uint32_t)wav->num_frames;
+    mal_buffer *buffer = mal_buffer_create_uninitialized(app->context, format, num_frames);
+    void *data = mal_buffer_lock_data(buffer);
+    if (!data) {
+        glfmLog("Error: Couldn't create audio buffer");
+    } else if (ok_wav_read_frames(decoder, data, num_frames) != num_frames) {
+        glfmLog("Error: %s", wav->error_message);
+    } else if (!mal_buffer_commit_data(buffer)) {
+        glfmLog("Error: Couldn't commit audio buffer");
+    } else {
+        return buffer;
+    }
+    mal_buffer_free(buffer);
+    return NULL;
+}
+
+#endif
+
 // Be a good app citizen - set mal to inactive when pausing.
 static void on_app_pause(GLFMDisplay *display) {
     mal_app *app = glfmGetUserData(display);
@@ -123,6 +157,27 @@ static int glfm_asset_input_func(void *user_data, unsigned char *buffer, const i
     }
 }
 
+// Called on a loader thread
+static bool load_wav_asset(void *user_data, mal_buffer_load_result *result) {
+    const char *path = user_data;
+    GLFMAsset *asset = glfmAssetOpen(path);
+    if (!asset) {
+        return false;
+    }
+    ok_wav *wav = ok_wav_read(asset, glfm_asset_input_func, true);
+    glfmAssetClose(asset);
+    bool success = wav->data != NULL;
+    if (success) {
+        result->format = wav_format(wav);
+        result->num_frames = (uint32_t)wav->num_frames;
+        result->data = wav->data;
+        result->data_deallocator = free;
+        wav->data = NULL; // Audio data is now managed by mal, don't free it
+    }
+    ok_wav_free(wav);
+    return success;
+}
+
 static GLboolean on_touch(GLFMDisplay *display, const int touch, const GLFMTouchPhase phase,
                           const int x, const int y) {
     if (phase == GLFMTouchPhaseBegan) {
@@ -138,6 +193,16 @@ static void on_surface_created(GLFMDisplay *display, const int width, const int
 }
 
 static void on_frame(GLFMDisplay *display, const double frameTime) {
+    mal_app *app = glfmGetUserData(display);
+    mal_load_event event;
+    while (mal_context_poll_load_event(app->context, &event)) {
+        if (!event.buffer) {
+            glfmLog("Error: Couldn't load %s", (const char *)event.user_data);
+        } else {
+            mal_start(app, event.buffer);
+        }
+    }
+
     glClearColor(0.6f, 0.0f, 0.4f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 }
@@ -159,13 +224,23 @@ void glfmMain(GLFMDisplay *display) {
     glfmSetAppPausingFunc(display, on_app_pause);
     glfmSetAppResumingFunc(display, on_app_resume);
 
+    mal_init(app);
+#if kLoadAsync
+    mal_buffer_load_async(app->context, load_wav_asset, (void *)"sound.wav", 0);
+#else
     GLFMAsset *asset = glfmAssetOpen("sound.wav");
-    ok_wav *wav = ok_wav_read(asset, glfm_asset_input_func, true);
-    glfmAssetClose(asset);
+    ok_wav_decoder *decoder = ok_wav_open(asset, glfm_asset_input_func, true);
+    const ok_wav *wav = ok_wav_get_info(decoder);
 
-    if (!wav->data) {
-        glfmLog("Error: %s", wav->error_message);
+    if (!wav || wav->error_message[0] != 0) {
+        glfmLog("Error: %s", wav ? wav->error_message : "Out of memory");
     } else {
-        mal_init(app, wav);
+        mal_buffer *buffer = mal_load_buffer(app, decoder);
+        if (buffer) {
+            mal_start(app, buffer);
+        }
     }
+    ok_wav_close(decoder);
+    glfmAssetClose(asset);
+#endif
 }
@@ -19,24 +19,54 @@
  */
 
 #include "ok_wav.h"
+#include "mal_adpcm.h"
 #include <stdlib.h>
 #include <string.h>
 
+// SIMD byte swapping and conversion to float. AVX2 and SSSE3 are selected at runtime; NEON is
+// always available where it's enabled. Define OK_WAV_NO_SIMD to use the scalar code only.
+#if defined(OK_WAV_NO_SIMD)
+// No SIMD
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OK_WAV_SSSE3
+#define OK_WAV_AVX2
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define OK_WAV_NEON
+#include <arm_neon.h>
+#endif
+
 #ifndef min
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
-typedef struct {
+// Data is read (and swapped or converted) in chunks of this size
+#define OK_WAV_CHUNK_SIZE 16384
+
+struct ok_wav_decoder {
     ok_wav *wav;
 
     // Decode options
     bool convert_to_system_endian;
 
+    // Number of frames from the WAV 'fact' chunk (compressed formats), or 0 if not found
+    uint32_t fact_num_frames;
+
+    // Data chunk
+    uint64_t data_length;
+    uint64_t next_frame;
+    bool file_little_endian;
+    bool swap_data;
+
+    // Scratch space for conversions, allocated when needed
+    uint8_t *chunk;
+
     // Input
     void *input_data;
     ok_wav_input_func input_func;
+    int64_t position;
 
-} pcm_decoder;
+};
 
 static void ok_wav_error(ok_wav *wav, const char *message) {
     if (wav) {
@@ -49,8 +79,9 @@ static void ok_wav_error(ok_wav *wav, const char *message) {
     }
 }
 
-static bool ok_read(pcm_decoder *decoder, uint8_t *data, const int length) {
+static bool ok_read(ok_wav_decoder *decoder, uint8_t *data, const int length) {
     if (decoder->input_func(decoder->input_data, data, length) == length) {
+        decoder->position += length;
         return true;
     } else {
         ok_wav_error(decoder->wav, "Read error: error calling input function.");
@@ -58,12 +89,16 @@ static bool ok_read(pcm_decoder *decoder, uint8_t *data, const int length) {
     }
 }
 
-static bool ok_seek(pcm_decoder *decoder, const int length) {
+static bool ok_seek(ok_wav_decoder *decoder, const int length) {
     return ok_read(decoder, NULL, length);
 }
 
 static void decode_pcm(ok_wav *wav, void *input_data, ok_wav_input_func input_func,
                        const bool convert_to_system_endian);
+static bool read_header(ok_wav_decoder *decoder);
+static uint32_t adpcm_frames_per_block(const ok_wav *wav);
+static uint64_t read_data(ok_wav_decoder *decoder, uint8_t *dst, uint64_t length, bool swap);
+static void convert_to_float(const ok_wav *wav, const uint8_t *src, float *dst, size_t count);
 
 // Public API
 
@@ -85,6 +120,173 @@ void ok_wav_free(ok_wav *wav) {
     }
 }
 
+ok_wav_decoder *ok_wav_open(void *user_data, ok_wav_input_func input_func,
+                            const bool convert_to_system_endian) {
+    ok_wav_decoder *decoder = calloc(1, sizeof(ok_wav_decoder));
+    if (!decoder) {
+        return NULL;
+    }
+    decoder->wav = calloc(1, sizeof(ok_wav));
+    if (!decoder->wav) {
+        free(decoder);
+        return NULL;
+    }
+    decoder->input_data = user_data;
+    decoder->input_func = input_func;
+    decoder->convert_to_system_endian = convert_to_system_endian;
+    if (!input_func) {
+        ok_wav_error(decoder->wav, "Invalid argument: input_func is NULL");
+    } else {
+        read_header(decoder);
+    }
+    return decoder;
+}
+
+bool ok_wav_read_info(void *user_data, ok_wav_input_func input_func, ok_wav *info) {
+    if (!info) {
+        return false;
+    }
+    memset(info, 0, sizeof(ok_wav));
+    if (!input_func) {
+        ok_wav_error(info, "Invalid argument: input_func is NULL");
+        return false;
+    }
+    ok_wav_decoder decoder;
+    memset(&decoder, 0, sizeof(decoder));
+    decoder.wav = info;
+    decoder.input_data = user_data;
+    decoder.input_func = input_func;
+    return read_header(&decoder);
+}
+
+const ok_wav *ok_wav_get_info(const ok_wav_decoder *decoder) {
+    return decoder ? decoder->wav : NULL;
+}
+
+static bool ok_wav_decoder_is_valid(const ok_wav_decoder *decoder) {
+    return (decoder && decoder->wav->error_message[0] == 0 && decoder->wav->num_channels > 0);
+}
+
+static bool ok_wav_decoder_is_pcm(const ok_wav_decoder *decoder) {
+    return ok_wav_decoder_is_valid(decoder) && decoder->wav->encoding == OK_WAV_ENCODING_PCM;
+}
+
+static uint64_t read_adpcm_blocks(ok_wav_decoder *decoder, uint8_t *dst, uint64_t num_frames) {
+    // ADPCM data is left compressed, and is read in whole blocks. Only the last block may be
+    // partial, so next_frame is on a block boundary until the end of the data.
+    ok_wav *wav = decoder->wav;
+    const uint32_t frames_per_block = adpcm_frames_per_block(wav);
+    const uint64_t remaining_frames = wav->num_frames - decoder->next_frame;
+    if (num_frames < remaining_frames) {
+        num_frames -= num_frames % frames_per_block;
+    } else {
+        num_frames = remaining_frames;
+    }
+    if (num_frames == 0) {
+        return 0;
+    }
+    const uint64_t length = (num_frames + frames_per_block - 1) / frames_per_block *
+        wav->block_size;
+    const uint64_t offset = decoder->next_frame / frames_per_block * wav->block_size;
+    const uint64_t available = decoder->data_length > offset ? decoder->data_length - offset : 0;
+
+    // The last block may be truncated
+    const uint64_t read_length = min(length, available);
+    const uint64_t bytes_read = read_data(decoder, dst, read_length, false);
+    if (bytes_read < read_length) {
+        // Keep the whole blocks that were read
+        num_frames = min(num_frames, bytes_read / wav->block_size * frames_per_block);
+    } else if (read_length < length) {
+        memset(dst + read_length, 0, (size_t)(length - read_length));
+    }
+    decoder->next_frame += num_frames;
+    return num_frames;
+}
+
+uint64_t ok_wav_read_frames(ok_wav_decoder *decoder, void *dst, uint64_t num_frames) {
+    if (!ok_wav_decoder_is_valid(decoder) || !dst) {
+        return 0;
+    }
+    ok_wav *wav = decoder->wav;
+    if (wav->encoding != OK_WAV_ENCODING_PCM) {
+        return read_adpcm_blocks(decoder, dst, num_frames);
+    }
+    num_frames = min(num_frames, wav->num_frames - decoder->next_frame);
+    const uint64_t frame_size = (uint64_t)wav->num_channels * (wav->bit_depth / 8);
+    num_frames = read_data(decoder, dst, num_frames * frame_size, decoder->swap_data) / frame_size;
+    decoder->next_frame += num_frames;
+    return num_frames;
+}
+
+uint64_t ok_wav_read_frames_float(ok_wav_decoder *decoder, float *dst, uint64_t num_frames) {
+    if (!ok_wav_decoder_is_pcm(decoder) || !dst) {
+        return 0;
+    }
+    if (!decoder->chunk) {
+        decoder->chunk = malloc(OK_WAV_CHUNK_SIZE);
+        if (!decoder->chunk) {
+            ok_wav_error(decoder->wav, "Couldn't allocate memory for audio");
+            return 0;
+        }
+    }
+    ok_wav *wav = decoder->wav;
+    num_frames = min(num_frames, wav->num_frames - decoder->next_frame);
+    const uint32_t frame_size = (uint32_t)wav->num_channels * (wav->bit_depth / 8);
+    const uint64_t chunk_frames = OK_WAV_CHUNK_SIZE / frame_size;
+    const int n = 1;
+    const bool system_is_little_endian = *(char *)&n == 1;
+    const bool swap = decoder->file_little_endian != system_is_little_endian && wav->bit_depth > 8;
+    uint64_t frames_read = 0;
+    while (frames_read < num_frames) {
+        const uint64_t frames = min(chunk_frames, num_frames - frames_read);
+        const uint64_t frames_in_chunk = read_data(decoder, decoder->chunk, frames * frame_size,
+                                                   swap) / frame_size;
+        convert_to_float(wav, decoder->chunk, dst + frames_read * wav->num_channels,
+                         (size_t)(frames_in_chunk * wav->num_channels));
+        decoder->next_frame += frames_in_chunk;
+        frames_read += frames_in_chunk;
+        if (frames_in_chunk < frames) {
+            break;
+        }
+    }
+    return frames_read;
+}
+
+bool ok_wav_seek(ok_wav_decoder *decoder, uint64_t frame) {
+    if (!ok_wav_decoder_is_pcm(decoder)) {
+        return false;
+    }
+    ok_wav *wav = decoder->wav;
+    if (frame > wav->num_frames) {
+        frame = wav->num_frames;
+    }
+    const int64_t frame_size = (int64_t)wav->num_channels * (wav->bit_depth / 8);
+    const int64_t total_offset = ((int64_t)frame - (int64_t)decoder->next_frame) * frame_size;
+    int64_t offset = total_offset;
+    bool success = true;
+    while (offset != 0 && success) {
+        // The input function seeks with an int
+        const int64_t max_offset = 1 << 30;
+        const int length = (int)(offset > max_offset ? max_offset :
+                                 (offset < -max_offset ? -max_offset : offset));
+        success = ok_seek(decoder, length);
+        if (success) {
+            offset -= length;
+        }
+    }
+    // On failure, the decoder has failed, but next_frame still reflects the seeks that succeeded
+    decoder->next_frame += (total_offset - offset) / frame_size;
+    return success;
+}
+
+void ok_wav_close(ok_wav_decoder *decoder) {
+    if (decoder) {
+        ok_wav_free(decoder->wav);
+        free(decoder->chunk);
+        free(decoder);
+    }
+}
+
 // Decoding
 
 static inline uint16_t readBE16(const uint8_t *data) {
@@ -124,9 +326,280 @@ static bool valid_bit_depth(const ok_wav *wav) {
                 wav->bit_depth == 48 || wav->bit_depth == 64);
     }
 }
-static void decode_pcm_data(pcm_decoder *decoder) {
+
+static uint32_t adpcm_frames_per_block(const ok_wav *wav) {
+    if (wav->encoding == OK_WAV_ENCODING_IMA_ADPCM) {
+        return mal_adpcm_get_frames_per_block(MAL_SAMPLE_TYPE_IMA_ADPCM, wav->num_channels,
+                                              wav->block_size);
+    } else if (wav->encoding == OK_WAV_ENCODING_MS_ADPCM) {
+        return mal_adpcm_get_frames_per_block(MAL_SAMPLE_TYPE_MS_ADPCM, wav->num_channels,
+                                              wav->block_size);
+    } else {
+        return 0;
+    }
+}
+
+static uint64_t get_data_length(const ok_wav *wav) {
+    if (wav->encoding == OK_WAV_ENCODING_PCM) {
+        return wav->num_frames * wav->num_channels * (wav->bit_depth / 8);
+    } else {
+        const uint32_t frames_per_block = adpcm_frames_per_block(wav);
+        const uint64_t num_blocks = (wav->num_frames + frames_per_block - 1) / frames_per_block;
+        return num_blocks * wav->block_size;
+    }
+}
+
+static void swap_bytes_scalar(const int bit_depth, uint8_t *data, const size_t length) {
+    const uint8_t *data_end = data + length;
+    if (bit_depth == 16) {
+        while (data < data_end) {
+            const uint8_t t = data[0];
+            data[0] = data[1];
+            data[1] = t;
+            data += 2;
+        }
+    } else if (bit_depth == 24) {
+        while (data < data_end) {
+            const uint8_t t = data[0];
+            data[0] = data[2];
+            data[2] = t;
+            data += 3;
+        }
+    } else if (bit_depth == 32) {
+        while (data < data_end) {
+            const uint8_t t0 = data[0];
+            data[0] = data[3];
+            data[3] = t0;
+            const uint8_t t1 = data[1];
+            data[1] = data[2];
+            data[2] = t1;
+            data += 4;
+        }
+    } else if (bit_depth == 48) {
+        while (data < data_end) {
+            const uint8_t t0 = data[0];
+            data[0] = data[5];
+            data[5] = t0;
+            const uint8_t t1 = data[1];
+            data[1] = data[4];
+            data[4] = t1;
+            const uint8_t t2 = data[2];
+            data[2] = data[3];
+            data[3] = t2;
+            data += 6;
+        }
+    } else if (bit_depth == 64) {
+        while (data < data_end) {
+            const uint8_t t0 = data[0];
+            data[0] = data[7];
+            data[7] = t0;
+            const uint8_t t1 = data[1];
+            data[1] = data[6];
+            data[6] = t1;
+            const uint8_t t2 = data[2];
+            data[2] = data[5];
+            data[5] = t2;
+            const uint8_t t3 = data[3];
+            data[3] = data[4];
+            data[4] = t3;
+            data += 8;
+        }
+    }
+}
+
+// The SIMD functions swap as much of the data as they can, and return the number of bytes swapped.
+// The remainder is swapped with swap_bytes_scalar().
+
+#if defined(OK_WAV_SSSE3)
+
+__attribute__((target("ssse3")))
+static size_t swap_bytes_ssse3(const int bit_depth, uint8_t *data, const size_t length) {
+    __m128i mask;
+    if (bit_depth == 16) {
+        mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    } else if (bit_depth == 24) {
+        // Four samples per 16 bytes; the last 4 bytes are left as is. All four loads happen
+        // before the stores, which overlap, so that no load waits on an earlier store.
+        mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+        size_t i = 0;
+        for (; i + 52 <= length; i += 48) {
+            __m128i v[4];
+            for (int j = 0; j < 4; j++) {
+                v[j] = _mm_loadu_si128((const __m128i *)(data + i + j * 12));
+            }
+            for (int j = 0; j < 4; j++) {
+                _mm_storeu_si128((__m128i *)(data + i + j * 12), _mm_shuffle_epi8(v[j], mask));
+            }
+        }
+        return i;
+    } else if (bit_depth == 32) {
+        mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    } else if (bit_depth == 64) {
+        mask = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    } else {
+        return 0;
+    }
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)(data + i), _mm_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+#endif
+
+#if defined(OK_WAV_AVX2)
+
+// 16-, 32- and 64-bit samples only. Packed 24-bit samples straddle the 128-bit lanes.
+__attribute__((target("avx2")))
+static size_t swap_bytes_avx2(const int bit_depth, uint8_t *data, const size_t length) {
+    __m256i mask;
+    if (bit_depth == 16) {
+        mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    } else if (bit_depth == 32) {
+        mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    } else if (bit_depth == 64) {
+        mask = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    } else {
+        return 0;
+    }
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+#endif
+
+#if defined(OK_WAV_NEON)
+
+static size_t swap_bytes_neon(const int bit_depth, uint8_t *data, const size_t length) {
+    size_t i = 0;
+    if (bit_depth == 16) {
+        for (; i + 16 <= length; i += 16) {
+            vst1q_u8(data + i, vrev16q_u8(vld1q_u8(data + i)));
+        }
+    } else if (bit_depth == 24) {
+        // De-interleave 16 samples, and swap the first and last bytes
+        for (; i + 48 <= length; i += 48) {
+            uint8x16x3_t v = vld3q_u8(data + i);
+            const uint8x16_t t = v.val[0];
+            v.val[0] = v.val[2];
+            v.val[2] = t;
+            vst3q_u8(data + i, v);
+        }
+    } else if (bit_depth == 32) {
+        for (; i + 16 <= length; i += 16) {
+            vst1q_u8(data + i, vrev32q_u8(vld1q_u8(data + i)));
+        }
+    } else if (bit_depth == 64) {
+        for (; i + 16 <= length; i += 16) {
+            vst1q_u8(data + i, vrev64q_u8(vld1q_u8(data + i)));
+        }
+    }
+    return i;
+}
+
+#endif
+
+static void swap_bytes(const ok_wav *wav, uint8_t *data, const size_t length) {
+    size_t swapped = 0;
+#if defined(OK_WAV_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        swapped = swap_bytes_avx2(wav->bit_depth, data, length);
+    }
+#endif
+#if defined(OK_WAV_SSSE3)
+    if (__builtin_cpu_supports("ssse3")) {
+        swapped += swap_bytes_ssse3(wav->bit_depth, data + swapped, length - swapped);
+    }
+#elif defined(OK_WAV_NEON)
+    swapped = swap_bytes_neon(wav->bit_depth, data, length);
+#endif
+    swap_bytes_scalar(wav->bit_depth, data + swapped, length - swapped);
+}
+
+// Returns the number of bytes read, which is less than `length` only if the input function failed
+// (and the decoder has failed).
+static uint64_t read_data(ok_wav_decoder *decoder, uint8_t *dst, const uint64_t length,
+                          const bool swap) {
+    // Read and swap one chunk at a time, while the chunk is in the cache. Chunks hold whole
+    // samples.
+    const int sample_size = decoder->wav->bit_depth >= 8 ? decoder->wav->bit_depth / 8 : 1;
+    const uint64_t max_chunk_length = OK_WAV_CHUNK_SIZE - OK_WAV_CHUNK_SIZE % sample_size;
+    uint64_t bytes_read = 0;
+    while (bytes_read < length) {
+        const int chunk_length = (int)min(length - bytes_read, max_chunk_length);
+        if (!ok_read(decoder, dst, chunk_length)) {
+            break;
+        }
+        if (swap) {
+            swap_bytes(decoder->wav, dst, (size_t)chunk_length);
+        }
+        dst += chunk_length;
+        bytes_read += (uint64_t)chunk_length;
+    }
+    return bytes_read;
+}
+
+static void convert_to_float_scalar(const ok_wav *wav, const uint8_t *src, float *dst,
+                                    const size_t count) {
+    // The source is in the system's byte order
+    const int n = 1;
+    const bool system_is_little_endian = *(char *)&n == 1;
+    if (wav->is_float && wav->bit_depth == 32) {
+        memcpy(dst, src, count * sizeof(float));
+    } else if (wav->is_float) {
+        for (size_t i = 0; i < count; i++) {
+            double v;
+            memcpy(&v, src + i * 8, sizeof(v));
+            dst[i] = (float)v;
+        }
+    } else if (wav->bit_depth == 8) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = (float)(src[i] - 128) * (1.0f / 128.0f);
+        }
+    } else if (wav->bit_depth == 16) {
+        for (size_t i = 0; i < count; i++) {
+            int16_t v;
+            memcpy(&v, src + i * 2, sizeof(v));
+            dst[i] = (float)v * (1.0f / 32768.0f);
+        }
+    } else if (wav->bit_depth == 32) {
+        for (size_t i = 0; i < count; i++) {
+            int32_t v;
+            memcpy(&v, src + i * 4, sizeof(v));
+            dst[i] = (float)v * (1.0f / 2147483648.0f);
+        }
+    } else if (wav->bit_depth == 64) {
+        for (size_t i = 0; i < count; i++) {
+            int64_t v;
+            memcpy(&v, src + i * 8, sizeof(v));
+            dst[i] = (float)((double)v * (1.0 / 9223372036854775808.0));
+        }
+    } else {
+        // Packed 24-bit or 48-bit. Use the most significant 24 bits.
+        const int bytes = wav->bit_depth / 8;
+        const int hi = system_is_little_endian ? bytes - 1 : 0;
+        const int mid = system_is_little_endian ? bytes - 2 : 1;
+        const int lo = system_is_little_endian ? bytes - 3 : 2;
+        for (size_t i = 0; i < count; i++) {
+            const uint8_t *s = src + i * bytes;
+            const int32_t v = (int32_t)(int8_t)s[hi] * 65536 + (int32_t)s[mid] * 256 + s[lo];
+            dst[i] = (float)v * (1.0f / 8388608.0f);
+        }
+    }
+}
+
+static void decode_pcm_data(ok_wav_decoder *decoder) {
     ok_wav *wav = decoder->wav;
-    uint64_t data_length = wav->num_frames * wav->num_channels * (wav->bit_depth / 8);
+    uint64_t data_length = get_data_length(wav);
     int platform_data_length = (int)data_length;
     if (platform_data_length > 0 && (unsigned int)platform_data_length == data_length) {
         wav->data = malloc(platform_data_length);
@@ -136,76 +609,18 @@ static void decode_pcm_data(pcm_decoder *decoder) {
         return;
     }
 
-    if (!ok_read(decoder, wav->data, platform_data_length)) {
+    // The last ADPCM block may be truncated
+    const int read_length = (int)min(data_length, decoder->data_length);
+    if (read_data(decoder, wav->data, (uint64_t)read_length, decoder->swap_data) <
+        (uint64_t)read_length) {
         return;
     }
-
-    const int n = 1;
-    const bool system_is_little_endian = *(char *)&n == 1;
-    if (decoder->convert_to_system_endian && wav->little_endian != system_is_little_endian &&
-        wav->bit_depth > 8) {
-        // Swap data
-        uint8_t *data = wav->data;
-        const uint8_t *data_end = wav->data + platform_data_length;
-        if (wav->bit_depth == 16) {
-            while (data < data_end) {
-                const uint8_t t = data[0];
-                data[0] = data[1];
-                data[1] = t;
-                data += 2;
-            }
-        } else if (wav->bit_depth == 24) {
-            while (data < data_end) {
-                const uint8_t t = data[0];
-                data[0] = data[2];
-                data[2] = t;
-                data += 3;
-            }
-        } else if (wav->bit_depth == 32) {
-            while (data < data_end) {
-                const uint8_t t0 = data[0];
-                data[0] = data[3];
-                data[3] = t0;
-                const uint8_t t1 = data[1];
-                data[1] = data[2];
-                data[2] = t1;
-                data += 4;
-            }
-        } else if (wav->bit_depth == 48) {
-            while (data < data_end) {
-                const uint8_t t0 = data[0];
-                data[0] = data[5];
-                data[5] = t0;
-                const uint8_t t1 = data[1];
-                data[1] = data[4];
-                data[4] = t1;
-                const uint8_t t2 = data[2];
-                data[2] = data[3];
-                data[3] = t2;
-                data += 6;
-            }
-        } else if (wav->bit_depth == 64) {
-            while (data < data_end) {
-                const uint8_t t0 = data[0];
-                data[0] = data[7];
-                data[7] = t0;
-                const uint8_t t1 = data[1];
-                data[1] = data[6];
-                data[6] = t1;
-                const uint8_t t2 = data[2];
-                data[2] = data[5];
-                data[5] = t2;
-                const uint8_t t3 = data[3];
-                data[3] = data[4];
-                data[4] = t3;
-                data += 8;
-            }
-        }
-        wav->little_endian = system_is_little_endian;
+    if (read_length < platform_data_length) {
+        memset((uint8_t *)wav->data + read_length, 0, platform_data_length - read_length);
     }
 }
 
-static void decode_wav(pcm_decoder *decoder) {
+static void decode_wav(ok_wav_decoder *decoder) {
     ok_wav *wav = decoder->wav;
     uint8_t header[8];
     if (!ok_read(decoder, header, sizeof(header))) {
@@ -228,8 +643,8 @@ static void decode_wav(pcm_decoder *decoder) {
         uint32_t chunk_length = readLE32(chunk_header + 4);
 
         if (memcmp("fmt ", chunk_header, 4) == 0) {
-            if (chunk_length != 16) {
-                ok_wav_error(wav, "Invalid WAV file (not PCM)");
+            if (chunk_length < 16) {
+                ok_wav_error(wav, "Invalid WAV file (bad fmt)");
                 return;
             }
             uint8_t chunk_data[16];
@@ -239,23 +654,62 @@ static void decode_wav(pcm_decoder *decoder) {
             uint16_t format = readLE16(chunk_data);
             wav->num_channels = (uint8_t)readLE16(chunk_data + 2);
             wav->sample_rate = readLE32(chunk_data + 4);
+            wav->block_size = readLE16(chunk_data + 12);
             wav->bit_depth = (uint8_t)readLE16(chunk_data + 14);
             wav->is_float = format == 3;
 
-            bool validFormat = ((format == 1 || format == 3) && valid_bit_depth(wav) &&
-                                wav->num_channels > 0);
+            bool validFormat;
+            if (format == 0x11 || format == 2) {
+                // ADPCM data is left compressed. The extra format bytes (samples per block, and
+                // the MS ADPCM coefficients, which are always the standard ones) aren't needed.
+                wav->encoding = format == 0x11 ? OK_WAV_ENCODING_IMA_ADPCM :
+                    OK_WAV_ENCODING_MS_ADPCM;
+                validFormat = (wav->little_endian && wav->bit_depth == 4 &&
+                               (wav->num_channels == 1 || wav->num_channels == 2) &&
+                               adpcm_frames_per_block(wav) > 0);
+            } else {
+                wav->encoding = OK_WAV_ENCODING_PCM;
+                wav->block_size = 0;
+                validFormat = ((format == 1 || format == 3) && valid_bit_depth(wav) &&
+                               wav->num_channels > 0);
+            }
             if (!validFormat) {
-                ok_wav_error(wav, "Invalid WAV format. Must be PCM, and a bit depth of "
-                                  "8, 16, 32, 48, or 64-bit.");
+                ok_wav_error(wav, "Invalid WAV format. Must be ADPCM, or 8, 16, 32, 48, or "
+                                  "64-bit PCM.");
+                return;
+            }
+            if (chunk_length > sizeof(chunk_data) &&
+                !ok_seek(decoder, chunk_length - sizeof(chunk_data))) {
+                return;
+            }
+        } else if (memcmp("fact", chunk_header, 4) == 0 && chunk_length >= 4) {
+            uint8_t chunk_data[4];
+            if (!ok_read(decoder, chunk_data, sizeof(chunk_data))) {
+                return;
+            }
+            if (chunk_length > sizeof(chunk_data) &&
+                !ok_seek(decoder, chunk_length - sizeof(chunk_data))) {
                 return;
             }
+            decoder->fact_num_frames = readLE32(chunk_data);
         } else if (memcmp("data", chunk_header, 4) == 0) {
             if (wav->sample_rate <= 0 || wav->num_channels <= 0) {
                 ok_wav_error(wav, "Invalid WAV file (fmt not found)");
                 return;
             }
-            wav->num_frames = chunk_length / ((wav->bit_depth / 8) * wav->num_channels);
-            decode_pcm_data(decoder);
+            if (wav->encoding == OK_WAV_ENCODING_PCM) {
+                wav->num_frames = chunk_length / ((wav->bit_depth / 8) * wav->num_channels);
+            } else {
+                // Use the number of frames from the 'fact' chunk, if it fits in the blocks
+                const uint32_t frames_per_block = adpcm_frames_per_block(wav);
+                const uint32_t num_blocks = ((chunk_length + wav->block_size - 1) /
+                                             wav->block_size);
+                wav->num_frames = (uint64_t)num_blocks * frames_per_block;
+                if (decoder->fact_num_frames > 0 && decoder->fact_num_frames < wav->num_frames) {
+                    wav->num_frames = decoder->fact_num_frames;
+                }
+            }
+            decoder->data_length = chunk_length;
             return;
         } else {
             // Skip ignored chunk
@@ -267,7 +721,7 @@ static void decode_wav(pcm_decoder *decoder) {
     }
 }
 
-static void decode_caf(pcm_decoder *decoder) {
+static void decode_caf(ok_wav_decoder *decoder) {
     ok_wav *wav = decoder->wav;
     uint8_t header[4];
     if (!ok_read(decoder, header, sizeof(header))) {
@@ -344,7 +798,7 @@ static void decode_caf(pcm_decoder *decoder) {
             // Read the data and return (skip any remaining chunks)
             uint64_t data_length = chunk_length - 4;
             wav->num_frames = data_length / ((wav->bit_depth / 8) * wav->num_channels);
-            decode_pcm_data(decoder);
+            decoder->data_length = data_length;
             return;
         } else {
             // Skip ignored chunk
@@ -356,12 +810,47 @@ static void decode_caf(pcm_decoder *decoder) {
     }
 }
 
+static bool read_header(ok_wav_decoder *decoder) {
+    ok_wav *wav = decoder->wav;
+    uint8_t header[4];
+    if (!ok_read(decoder, header, sizeof(header))) {
+        return false;
+    }
+    //printf("File '%.4s'\n", header);
+    if (memcmp("RIFF", header, 4) == 0) {
+        wav->little_endian = true;
+        decode_wav(decoder);
+    } else if (memcmp("RIFX", header, 4) == 0) {
+        wav->little_endian = false;
+        decode_wav(decoder);
+    } else if (memcmp("caff", header, 4) == 0) {
+        decode_caf(decoder);
+    } else {
+        ok_wav_error(wav, "Not a PCM WAV or CAF file.");
+    }
+    if (wav->error_message[0] != 0) {
+        return false;
+    }
+    wav->data_offset = (uint64_t)decoder->position;
+
+    const int n = 1;
+    const bool system_is_little_endian = *(char *)&n == 1;
+    decoder->file_little_endian = wav->little_endian;
+    decoder->swap_data = (decoder->convert_to_system_endian &&
+                          wav->encoding == OK_WAV_ENCODING_PCM && wav->bit_depth > 8 &&
+                          wav->little_endian != system_is_little_endian);
+    if (decoder->swap_data) {
+        wav->little_endian = system_is_little_endian;
+    }
+    return true;
+}
+
 static void decode_pcm(ok_wav *wav, void *input_data, ok_wav_input_func input_func,
                        const bool convert_to_system_endian) {
     if (!wav) {
         return;
     }
-    pcm_decoder *decoder = calloc(1, sizeof(pcm_decoder));
+    ok_wav_decoder *decoder = calloc(1, sizeof(ok_wav_decoder));
     if (!decoder) {
         ok_wav_error(wav, "Couldn't allocate decoder.");
         return;
@@ -372,20 +861,225 @@ static void decode_pcm(ok_wav *wav, void *input_data, ok_wav_input_func input_fu
     decoder->input_func = input_func;
     decoder->convert_to_system_endian = convert_to_system_endian;
 
-    uint8_t header[4];
-    if (ok_read(decoder, header, sizeof(header))) {
-        //printf("File '%.4s'\n", header);
-        if (memcmp("RIFF", header, 4) == 0) {
-            wav->little_endian = true;
-            decode_wav(decoder);
-        } else if (memcmp("RIFX", header, 4) == 0) {
-            wav->little_endian = false;
-            decode_wav(decoder);
-        } else if (memcmp("caff", header, 4) == 0) {
-            decode_caf(decoder);
-        } else {
-            ok_wav_error(wav, "Not a PCM WAV or CAF file.");
-        }
+    if (read_header(decoder)) {
+        decode_pcm_data(decoder);
     }
     free(decoder);
 }
+
+// SIMD conversion to float, from little-endian 8-, 16-, 24- and 32-bit integers and 64-bit floats.
+// Each function returns the number of samples converted; the rest are converted by the scalar
+// code. The results are exactly the same as the scalar code's.
+
+#if defined(OK_WAV_SSSE3)
+
+__attribute__((target("ssse3")))
+static size_t convert_to_float_ssse3(const int bit_depth, const bool is_float, const uint8_t *src,
+                                     float *dst, const size_t count) {
+    size_t i = 0;
+    if (is_float) {
+        if (bit_depth == 64) {
+            for (; i + 4 <= count; i += 4) {
+                const __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd((const double *)(src + i * 8)));
+                const __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd((const double *)(src + i * 8 + 16)));
+                _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+            }
+        }
+    } else if (bit_depth == 8) {
+        const __m128i bias = _mm_set1_epi8((char)0x80);
+        const __m128 scale = _mm_set1_ps(1.0f / 128.0f);
+        for (; i + 16 <= count; i += 16) {
+            // Unsigned to signed, then sign-extended to 16 and 32 bits
+            const __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), bias);
+            const __m128i lo16 = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+            const __m128i hi16 = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+            const __m128i v32[4] = {
+                _mm_srai_epi32(_mm_unpacklo_epi16(lo16, lo16), 16),
+                _mm_srai_epi32(_mm_unpackhi_epi16(lo16, lo16), 16),
+                _mm_srai_epi32(_mm_unpacklo_epi16(hi16, hi16), 16),
+                _mm_srai_epi32(_mm_unpackhi_epi16(hi16, hi16), 16),
+            };
+            for (int j = 0; j < 4; j++) {
+                _mm_storeu_ps(dst + i + j * 4, _mm_mul_ps(_mm_cvtepi32_ps(v32[j]), scale));
+            }
+        }
+    } else if (bit_depth == 16) {
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+        for (; i + 8 <= count; i += 8) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+            const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+            _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+    } else if (bit_depth == 24) {
+        // Each sample to the top 24 bits of a 32-bit lane, then an arithmetic shift. Each load
+        // reads 16 bytes for 4 samples (12 bytes).
+        const __m128i mask = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+        const __m128 scale = _mm_set1_ps(1.0f / 8388608.0f);
+        for (; i + 6 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+            v = _mm_srai_epi32(_mm_shuffle_epi8(v, mask), 8);
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+        }
+    } else if (bit_depth == 32) {
+        const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+        for (; i + 4 <= count; i += 4) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+        }
+    }
+    return i;
+}
+
+#endif
+
+#if defined(OK_WAV_AVX2)
+
+__attribute__((target("avx2")))
+static size_t convert_to_float_avx2(const int bit_depth, const bool is_float, const uint8_t *src,
+                                    float *dst, const size_t count) {
+    size_t i = 0;
+    if (is_float) {
+        if (bit_depth == 64) {
+            for (; i + 8 <= count; i += 8) {
+                const double *s = (const double *)(src + i * 8);
+                const __m128 lo = _mm256_cvtpd_ps(_mm256_loadu_pd(s));
+                const __m128 hi = _mm256_cvtpd_ps(_mm256_loadu_pd(s + 4));
+                _mm256_storeu_ps(dst + i, _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1));
+            }
+        }
+    } else if (bit_depth == 8) {
+        const __m128i bias = _mm_set1_epi8((char)0x80);
+        const __m256 scale = _mm256_set1_ps(1.0f / 128.0f);
+        for (; i + 16 <= count; i += 16) {
+            const __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), bias);
+            const __m256i lo = _mm256_cvtepi8_epi32(v);
+            const __m256i hi = _mm256_cvtepi8_epi32(_mm_srli_si128(v, 8));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+            _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+        }
+    } else if (bit_depth == 16) {
+        const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+        for (; i + 16 <= count; i += 16) {
+            const __m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 2));
+            const __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+            const __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+            _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+        }
+    } else if (bit_depth == 24) {
+        // Like the SSSE3 function, with 4 samples in each 128-bit lane. The second load reads 16
+        // bytes starting at the fifth sample.
+        const __m256i mask = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                              -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+        const __m256 scale = _mm256_set1_ps(1.0f / 8388608.0f);
+        for (; i + 10 <= count; i += 8) {
+            const __m128i lo = _mm_loadu_si128((const __m128i *)(src + i * 3));
+            const __m128i hi = _mm_loadu_si128((const __m128i *)(src + i * 3 + 12));
+            __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+            v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, mask), 8);
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+        }
+    } else if (bit_depth == 32) {
+        const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+        for (; i + 8 <= count; i += 8) {
+            const __m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+        }
+    }
+    return i;
+}
+
+#endif
+
+#if defined(OK_WAV_NEON)
+
+static size_t convert_to_float_neon(const int bit_depth, const bool is_float, const uint8_t *src,
+                                    float *dst, const size_t count) {
+    size_t i = 0;
+    if (is_float) {
+#if defined(__aarch64__)
+        if (bit_depth == 64) {
+            for (; i + 4 <= count; i += 4) {
+                const float64x2_t lo = vreinterpretq_f64_u8(vld1q_u8(src + i * 8));
+                const float64x2_t hi = vreinterpretq_f64_u8(vld1q_u8(src + i * 8 + 16));
+                vst1q_f32(dst + i, vcombine_f32(vcvt_f32_f64(lo), vcvt_f32_f64(hi)));
+            }
+        }
+#endif
+    } else if (bit_depth == 8) {
+        const uint8x16_t bias = vdupq_n_u8(0x80);
+        for (; i + 16 <= count; i += 16) {
+            const int8x16_t v = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(src + i), bias));
+            const int16x8_t lo = vmovl_s8(vget_low_s8(v));
+            const int16x8_t hi = vmovl_s8(vget_high_s8(v));
+            const int32x4_t v32[4] = {
+                vmovl_s16(vget_low_s16(lo)), vmovl_s16(vget_high_s16(lo)),
+                vmovl_s16(vget_low_s16(hi)), vmovl_s16(vget_high_s16(hi)),
+            };
+            for (int j = 0; j < 4; j++) {
+                vst1q_f32(dst + i + j * 4, vmulq_n_f32(vcvtq_f32_s32(v32[j]), 1.0f / 128.0f));
+            }
+        }
+    } else if (bit_depth == 16) {
+        for (; i + 8 <= count; i += 8) {
+            const int16x8_t v = vreinterpretq_s16_u8(vld1q_u8(src + i * 2));
+            const int32x4_t lo = vmovl_s16(vget_low_s16(v));
+            const int32x4_t hi = vmovl_s16(vget_high_s16(v));
+            vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(lo), 1.0f / 32768.0f));
+            vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(hi), 1.0f / 32768.0f));
+        }
+    } else if (bit_depth == 24) {
+        // De-interleave the 3 bytes of 16 samples, then zip them into the top 24 bits of each
+        // 32-bit lane with a zero low byte.
+        const uint8x16_t zero = vdupq_n_u8(0);
+        for (; i + 16 <= count; i += 16) {
+            const uint8x16x3_t v = vld3q_u8(src + i * 3);
+            const uint8x16x2_t zero_lo = vzipq_u8(zero, v.val[0]);
+            const uint8x16x2_t mid_hi = vzipq_u8(v.val[1], v.val[2]);
+            for (int j = 0; j < 2; j++) {
+                const uint16x8x2_t w = vzipq_u16(vreinterpretq_u16_u8(zero_lo.val[j]),
+                                                 vreinterpretq_u16_u8(mid_hi.val[j]));
+                for (int k = 0; k < 2; k++) {
+                    const int32x4_t s = vshrq_n_s32(vreinterpretq_s32_u16(w.val[k]), 8);
+                    vst1q_f32(dst + i + j * 8 + k * 4,
+                              vmulq_n_f32(vcvtq_f32_s32(s), 1.0f / 8388608.0f));
+                }
+            }
+        }
+    } else if (bit_depth == 32) {
+        for (; i + 4 <= count; i += 4) {
+            const int32x4_t v = vreinterpretq_s32_u8(vld1q_u8(src + i * 4));
+            vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(v), 1.0f / 2147483648.0f));
+        }
+    }
+    return i;
+}
+
+#endif
+
+static void convert_to_float(const ok_wav *wav, const uint8_t *src, float *dst,
+                             const size_t count) {
+    const int n = 1;
+    const bool system_is_little_endian = *(char *)&n == 1;
+    size_t converted = 0;
+    if (system_is_little_endian) {
+#if defined(OK_WAV_AVX2)
+        if (__builtin_cpu_supports("avx2")) {
+            converted = convert_to_float_avx2(wav->bit_depth, wav->is_float, src, dst, count);
+        }
+#endif
+#if defined(OK_WAV_SSSE3)
+        if (__builtin_cpu_supports("ssse3")) {
+            const size_t offset = converted * (wav->bit_depth / 8);
+            converted += convert_to_float_ssse3(wav->bit_depth, wav->is_float, src + offset,
+                                                dst + converted, count - converted);
+        }
+#elif defined(OK_WAV_NEON)
+        converted = convert_to_float_neon(wav->bit_depth, wav->is_float, src, dst, count);
+#endif
+    }
+    convert_to_float_scalar(wav, src + converted * (wav->bit_depth / 8), dst + converted,
+                            count - converted);
+}
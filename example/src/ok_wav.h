@@ -23,7 +23,10 @@
 
 /**
  * @file
- * Functions to read WAV and CAF files. PCM format only.
+ * Functions to read WAV and CAF files. PCM format, or IMA ADPCM and MS ADPCM (WAV only).
+ *
+ * Files can be read all at once with #ok_wav_read(), or incrementally with #ok_wav_open() and
+ * #ok_wav_read_frames().
  *
  * Example:
  *
@@ -60,8 +63,19 @@
 extern "C" {
 #endif
 
+typedef enum {
+    OK_WAV_ENCODING_PCM = 0,
+    OK_WAV_ENCODING_IMA_ADPCM,
+    OK_WAV_ENCODING_MS_ADPCM,
+} ok_wav_encoding;
+
 /**
  * The data returned from #ok_wav_read().
+ *
+ * For ADPCM encodings, the `bit_depth` is 4, and the data is left compressed: it is a sequence of
+ * blocks, each `block_size` bytes long. The last block is padded with zeros if needed.
+ *
+ * The `data_offset` is the byte offset of the audio data from the start of the file.
  */
 typedef struct {
     double sample_rate;
@@ -69,7 +83,10 @@ typedef struct {
     uint8_t bit_depth;
     bool is_float;
     bool little_endian;
+    ok_wav_encoding encoding;
+    uint16_t block_size;
     uint64_t num_frames;
+    uint64_t data_offset;
     void *data;
     char error_message[80];
 } ok_wav;
@@ -90,7 +107,8 @@ typedef int (*ok_wav_input_func)(void *user_data, uint8_t *buffer, int count);
 
 /**
  * Reads a WAV (or CAF) audio file.
- * On success, #ok_wav.data has a length of `(num_channels * num_frames * (bit_depth/8))`.
+ * On success, #ok_wav.data has a length of `(num_channels * num_frames * (bit_depth/8))` for PCM
+ * encodings, or a whole number of blocks for ADPCM encodings.
  *
  * On failure, #ok_wav.data is `NULL` and #ok_wav.error_message is set.
  *
@@ -103,12 +121,98 @@ typedef int (*ok_wav_input_func)(void *user_data, uint8_t *buffer, int count);
  */
 ok_wav *ok_wav_read(void *user_data, ok_wav_input_func input_func, bool convert_to_system_endian);
 
+/**
+ * Reads the format of a WAV (or CAF) audio file, without reading the audio data. Only the headers
+ * are read; other chunks are skipped with the seek form of the input function.
+ *
+ * On success, the `data` of the `info` is `NULL`, and its `data_offset` is the byte offset of the
+ * audio data, which is `(num_channels * num_frames * (bit_depth/8))` bytes long for PCM encodings.
+ * The data is in the byte order of the file.
+ *
+ * @param user_data The parameter to be passed to the `input_func`.
+ * @param input_func The input function to read a WAV file from.
+ * @param info The destination for the format. On failure, its `error_message` is set.
+ * @return `true` if successful.
+ */
+bool ok_wav_read_info(void *user_data, ok_wav_input_func input_func, ok_wav *info);
+
 /**
  * Frees the audio. This function should always be called when done with the audio, even if reading 
  * failed.
  */
 void ok_wav_free(ok_wav *wav);
 
+typedef struct ok_wav_decoder ok_wav_decoder;
+
+/**
+ * Opens a WAV (or CAF) audio file for incremental decoding. Only the headers are read; the audio
+ * data is read with #ok_wav_read_frames() or #ok_wav_read_frames_float(), into memory provided by
+ * the caller. ADPCM data is left compressed and can only be read with #ok_wav_read_frames().
+ *
+ * The input function is called as frames are read, so it must remain valid until the decoder is
+ * closed.
+ *
+ * @param user_data The parameter to be passed to the `input_func`.
+ * @param input_func The input function to read a WAV file from.
+ * @param convert_to_system_endian If true, the data returned from #ok_wav_read_frames() is
+ * converted to the endianness of the system.
+ * @return a new decoder, or `NULL` if an out-of-memory error occurs. On failure, the
+ * `error_message` of #ok_wav_get_info() is set. The decoder should be closed with
+ * #ok_wav_close().
+ */
+ok_wav_decoder *ok_wav_open(void *user_data, ok_wav_input_func input_func,
+                            bool convert_to_system_endian);
+
+/**
+ * Gets the format of the audio being decoded. The `data` field is always `NULL`.
+ */
+const ok_wav *ok_wav_get_info(const ok_wav_decoder *decoder);
+
+/**
+ * Reads frames in the format of the file (see #ok_wav_get_info()). The data is swapped to the
+ * system's byte order if `convert_to_system_endian` was set in #ok_wav_open().
+ *
+ * ADPCM data is read in whole blocks, so fewer frames than requested may be read. The last block
+ * is padded with zeros if it is truncated.
+ *
+ * @param decoder The decoder.
+ * @param dst The destination, with a length of at least `(num_channels * num_frames *
+ * (bit_depth/8))` bytes. For ADPCM, the destination must have room for the blocks containing
+ * `num_frames` frames, rounded up.
+ * @param num_frames The maximum number of frames to read.
+ * @return The number of frames read. Returns 0 at the end of the data, or on error. If the input
+ * function fails, the frames read before the failure are returned, and the decoder fails: the
+ * `error_message` of #ok_wav_get_info() is set, and later reads and seeks fail.
+ */
+uint64_t ok_wav_read_frames(ok_wav_decoder *decoder, void *dst, uint64_t num_frames);
+
+/**
+ * Reads frames as interleaved 32-bit float samples, in the range -1.0 to 1.0. The data is read and
+ * converted in small chunks. Not supported for ADPCM.
+ *
+ * @param decoder The decoder.
+ * @param dst The destination, with room for `(num_channels * num_frames)` samples.
+ * @param num_frames The maximum number of frames to read.
+ * @return The number of frames read. Returns 0 at the end of the data, or on error. If the input
+ * function fails, the decoder fails, as in #ok_wav_read_frames().
+ */
+uint64_t ok_wav_read_frames_float(ok_wav_decoder *decoder, float *dst, uint64_t num_frames);
+
+/**
+ * Seeks to the specified frame, so that the next read starts at that frame. Seeking backwards
+ * requires an input function that can seek with a negative `count`. Not supported for ADPCM.
+ *
+ * @return `true` if successful. If the input function fails, the decoder fails, as in
+ * #ok_wav_read_frames().
+ */
+bool ok_wav_seek(ok_wav_decoder *decoder, uint64_t frame);
+
+/**
+ * Closes the decoder. This function should always be called when done with the decoder, even if
+ * opening failed.
+ */
+void ok_wav_close(ok_wav_decoder *decoder);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,125 @@
+/*
+ Measures the cost of playing an ADPCM buffer compressed, as the Core Audio and OpenSL ES backends
+ do: each voice decodes one block at a time with _mal_adpcm_read(), in render-sized chunks. For
+ comparison, it also measures copying 16-bit data (the cost of a voice playing decoded data), and
+ prints the memory each format takes.
+
+ Build and run from the repository root, on Linux with OpenAL Soft:
+
+     cc -std=c99 -O2 -DNDEBUG -Iinclude -Isrc example/test/mal_adpcm_bench.c -o mal_adpcm_bench \
+         -lopenal -lpthread -lm
+     ./mal_adpcm_bench
+
+ On macOS, use -framework OpenAL instead of -lopenal.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mal_audio_openal.h"
+#include <stdio.h>
+#include <time.h>
+
+#define SAMPLE_RATE 44100
+#define NUM_SECONDS 10
+#define NUM_ITERATIONS 20
+#define RENDER_FRAMES 512
+#define BLOCK_SIZE 2048
+
+static void _mal_context_did_create(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_will_dispose(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_did_set_active(mal_context *context, bool active) {
+    // Do nothing
+}
+
+// Called through a volatile pointer, so that the compiler can't skip copies it can see are unused
+static void *(*volatile copy_func)(void *, const void *, size_t) = memcpy;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static void report(const char *name, const mal_format format, const double elapsed,
+                   const uint32_t checksum) {
+    const double num_frames = (double)SAMPLE_RATE * NUM_SECONDS * NUM_ITERATIONS;
+    const double ns_per_frame = elapsed * 1000000000.0 / num_frames;
+    const double bytes_per_second = (double)mal_format_get_data_length(format, SAMPLE_RATE);
+    // The share of one core used by one voice playing in real time
+    printf("%-20s %8.2f ns/frame %8.3f%% of a core per voice %8.0f KB/s (%08x)\n", name,
+           ns_per_frame, ns_per_frame * SAMPLE_RATE / 10000000.0, bytes_per_second / 1024.0,
+           checksum);
+}
+
+// Plays the buffer from start to end, like one voice
+static void bench(const char *name, const mal_format format) {
+    const uint32_t num_frames = SAMPLE_RATE * NUM_SECONDS;
+    const size_t data_length = mal_format_get_data_length(format, num_frames);
+    uint8_t *data = malloc(data_length);
+    int16_t *block_samples = malloc(BLOCK_SIZE * 2 * format.num_channels * sizeof(int16_t));
+    int16_t out[RENDER_FRAMES * 2];
+    if (!data || !block_samples) {
+        printf("Couldn't allocate\n");
+        exit(1);
+    }
+    uint32_t seed = 1;
+    for (size_t i = 0; i < data_length; i++) {
+        seed = seed * 1664525 + 1013904223;
+        data[i] = (uint8_t)(seed >> 24);
+    }
+
+    // Only the fields _mal_adpcm_read() uses
+    mal_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.format = format;
+    buffer.num_frames = num_frames;
+    buffer.managed_data = data;
+
+    uint32_t checksum = 0;
+    const double start = now();
+    for (int i = 0; i < NUM_ITERATIONS; i++) {
+        uint32_t block_index = UINT32_MAX;
+        for (uint32_t frame = 0; frame < num_frames; frame += RENDER_FRAMES) {
+            uint32_t frames;
+            if (_mal_format_is_adpcm(format)) {
+                frames = _mal_adpcm_read(&buffer, block_samples, &block_index, frame, out,
+                                         RENDER_FRAMES);
+            } else {
+                frames = num_frames - frame < RENDER_FRAMES ? num_frames - frame : RENDER_FRAMES;
+                copy_func(out, data + (size_t)frame * format.num_channels * sizeof(int16_t),
+                          frames * format.num_channels * sizeof(int16_t));
+            }
+            checksum += (uint16_t)out[frames * format.num_channels - 1];
+        }
+    }
+    report(name, format, now() - start, checksum);
+    free(block_samples);
+    free(data);
+}
+
+int main(void) {
+    for (uint8_t num_channels = 1; num_channels <= 2; num_channels++) {
+        const mal_format pcm = {
+            .sample_rate = SAMPLE_RATE, .bit_depth = 16, .num_channels = num_channels,
+            .sample_type = MAL_SAMPLE_TYPE_INT
+        };
+        mal_format ima = pcm;
+        ima.bit_depth = 4;
+        ima.sample_type = MAL_SAMPLE_TYPE_IMA_ADPCM;
+        ima.block_size = BLOCK_SIZE;
+        mal_format ms = ima;
+        ms.sample_type = MAL_SAMPLE_TYPE_MS_ADPCM;
+
+        printf("%s:\n", num_channels == 1 ? "Mono" : "Stereo");
+        bench("16-bit (copy)", pcm);
+        bench("IMA ADPCM", ima);
+        bench("MS ADPCM", ms);
+    }
+    return 0;
+}
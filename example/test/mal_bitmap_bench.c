@@ -0,0 +1,151 @@
+/*
+ Measures allocating mixer buses with the slot bitmap in src/mal_bitmap.h, compared with the way
+ the Core Audio backend allocated them before: a flag array allocated for each player and filled
+ in by walking every player, with the mixer growing by 8 buses when full.
+
+ Each run creates N players, one bus each, starting with 8 buses. Then players are freed and
+ created at random, keeping N alive ("churn").
+
+ Build and run from the repository root:
+
+     cc -std=c99 -O2 -Isrc example/test/mal_bitmap_bench.c -o mal_bitmap_bench
+     ./mal_bitmap_bench
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mal_bitmap.h"
+#include <stdio.h>
+#include <time.h>
+
+#define INITIAL_BUSES 8
+#define MAX_PLAYERS 16384
+#define NUM_CHURN 20000
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static uint32_t seed = 1;
+
+static uint32_t next_random(void) {
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+}
+
+// The buses of the live players, like the players' input_bus fields
+static uint32_t player_buses[MAX_PLAYERS];
+
+// MARK: Before: a flag array per allocation
+
+typedef struct {
+    uint32_t num_buses;
+    uint32_t num_players;
+} scan_allocator;
+
+static uint32_t scan_acquire(scan_allocator *allocator) {
+    const uint32_t num_buses = allocator->num_buses;
+    bool *taken_buses = calloc(num_buses, sizeof(bool));
+    if (!taken_buses) {
+        printf("Couldn't allocate\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < allocator->num_players; i++) {
+        if (player_buses[i] < num_buses) {
+            taken_buses[player_buses[i]] = true;
+        }
+    }
+    uint32_t bus = UINT32_MAX;
+    for (uint32_t i = 0; i < num_buses; i++) {
+        if (!taken_buses[i]) {
+            bus = i;
+            break;
+        }
+    }
+    free(taken_buses);
+    if (bus == UINT32_MAX) {
+        allocator->num_buses += 8;
+        bus = num_buses;
+    }
+    return bus;
+}
+
+static double bench_scan(const uint32_t num_players, double *churn_elapsed) {
+    scan_allocator allocator = { INITIAL_BUSES, 0 };
+    double start = now();
+    for (uint32_t i = 0; i < num_players; i++) {
+        player_buses[i] = scan_acquire(&allocator);
+        allocator.num_players++;
+    }
+    const double create_elapsed = now() - start;
+
+    start = now();
+    for (uint32_t i = 0; i < NUM_CHURN; i++) {
+        // Free a random player by moving the last one into its place, then create one
+        const uint32_t index = next_random() % num_players;
+        player_buses[index] = player_buses[num_players - 1];
+        allocator.num_players--;
+        player_buses[num_players - 1] = scan_acquire(&allocator);
+        allocator.num_players++;
+    }
+    *churn_elapsed = now() - start;
+    return create_elapsed;
+}
+
+// MARK: After: the slot bitmap
+
+static uint32_t bitmap_acquire(mal_bitmap *bitmap) {
+    uint32_t bus = _mal_bitmap_acquire(bitmap);
+    if (bus == UINT32_MAX) {
+        // Like the Core Audio backend, double the number of buses
+        if (!_mal_bitmap_grow(bitmap, bitmap->num_slots * 2)) {
+            printf("Couldn't allocate\n");
+            exit(1);
+        }
+        bus = _mal_bitmap_acquire(bitmap);
+    }
+    return bus;
+}
+
+static double bench_bitmap(const uint32_t num_players, double *churn_elapsed) {
+    mal_bitmap bitmap;
+    _mal_bitmap_init(&bitmap);
+    double start = now();
+    if (!_mal_bitmap_grow(&bitmap, INITIAL_BUSES)) {
+        printf("Couldn't allocate\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < num_players; i++) {
+        player_buses[i] = bitmap_acquire(&bitmap);
+    }
+    const double create_elapsed = now() - start;
+
+    start = now();
+    for (uint32_t i = 0; i < NUM_CHURN; i++) {
+        const uint32_t index = next_random() % num_players;
+        _mal_bitmap_release(&bitmap, player_buses[index]);
+        player_buses[index] = player_buses[num_players - 1];
+        player_buses[num_players - 1] = bitmap_acquire(&bitmap);
+    }
+    *churn_elapsed = now() - start;
+    _mal_bitmap_deinit(&bitmap);
+    return create_elapsed;
+}
+
+int main(void) {
+    printf("%8s %-8s %16s %16s\n", "Players", "", "Create (ns each)", "Churn (ns each)");
+    for (uint32_t num_players = 256; num_players <= MAX_PLAYERS; num_players *= 4) {
+        double churn_elapsed;
+        double create_elapsed = bench_scan(num_players, &churn_elapsed);
+        printf("%8u %-8s %16.1f %16.1f\n", num_players, "Before",
+               create_elapsed * 1000000000.0 / num_players,
+               churn_elapsed * 1000000000.0 / NUM_CHURN);
+        create_elapsed = bench_bitmap(num_players, &churn_elapsed);
+        printf("%8s %-8s %16.1f %16.1f\n", "", "Bitmap",
+               create_elapsed * 1000000000.0 / num_players,
+               churn_elapsed * 1000000000.0 / NUM_CHURN);
+    }
+    return 0;
+}
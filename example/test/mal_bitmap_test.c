@@ -0,0 +1,146 @@
+/*
+ Checks the slot bitmap in src/mal_bitmap.h: acquiring until full, releasing, reacquiring the
+ lowest free slot, growing, and slots at the 64-bit word boundaries.
+
+ Build and run from the repository root:
+
+     cc -std=c99 -Isrc example/test/mal_bitmap_test.c -o mal_bitmap_test
+     ./mal_bitmap_test
+ */
+
+#include "mal_bitmap.h"
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("FAIL: line %i: %s\n", __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+// Acquires every free slot, and checks they are returned in order from `first`
+static void acquire_all(mal_bitmap *bitmap, const uint32_t first) {
+    for (uint32_t slot = first; slot < bitmap->num_slots; slot++) {
+        CHECK(_mal_bitmap_acquire(bitmap) == slot);
+    }
+    CHECK(_mal_bitmap_acquire(bitmap) == UINT32_MAX);
+    CHECK(bitmap->num_taken == bitmap->num_slots);
+}
+
+static void test_empty(void) {
+    mal_bitmap bitmap;
+    _mal_bitmap_init(&bitmap);
+    CHECK(_mal_bitmap_acquire(&bitmap) == UINT32_MAX);
+    _mal_bitmap_release(&bitmap, 0); // Out of range, ignored
+    CHECK(_mal_bitmap_grow(&bitmap, 0));
+    CHECK(_mal_bitmap_acquire(&bitmap) == UINT32_MAX);
+    _mal_bitmap_deinit(&bitmap);
+}
+
+static void test_acquire_until_full(void) {
+    mal_bitmap bitmap;
+    _mal_bitmap_init(&bitmap);
+    CHECK(_mal_bitmap_grow(&bitmap, 10));
+    acquire_all(&bitmap, 0);
+
+    // Still full after failing
+    CHECK(_mal_bitmap_acquire(&bitmap) == UINT32_MAX);
+
+    // Releasing a free or out-of-range slot changes nothing
+    _mal_bitmap_release(&bitmap, 10);
+    _mal_bitmap_release(&bitmap, UINT32_MAX);
+    CHECK(bitmap.num_taken == 10);
+    _mal_bitmap_deinit(&bitmap);
+}
+
+static void test_release_reacquires_lowest(void) {
+    mal_bitmap bitmap;
+    _mal_bitmap_init(&bitmap);
+    CHECK(_mal_bitmap_grow(&bitmap, 16));
+    acquire_all(&bitmap, 0);
+
+    _mal_bitmap_release(&bitmap, 12);
+    _mal_bitmap_release(&bitmap, 3);
+    _mal_bitmap_release(&bitmap, 7);
+    _mal_bitmap_release(&bitmap, 7); // Twice, counted once
+    CHECK(bitmap.num_taken == 13);
+    CHECK(_mal_bitmap_acquire(&bitmap) == 3);
+    CHECK(_mal_bitmap_acquire(&bitmap) == 7);
+    CHECK(_mal_bitmap_acquire(&bitmap) == 12);
+    CHECK(_mal_bitmap_acquire(&bitmap) == UINT32_MAX);
+
+    // Released slots are reused before new slots
+    _mal_bitmap_release(&bitmap, 0);
+    CHECK(_mal_bitmap_grow(&bitmap, 20));
+    CHECK(_mal_bitmap_acquire(&bitmap) == 0);
+    acquire_all(&bitmap, 16);
+
+    // Can't shrink
+    CHECK(!_mal_bitmap_grow(&bitmap, 19));
+    CHECK(bitmap.num_slots == 20);
+    _mal_bitmap_deinit(&bitmap);
+}
+
+static void test_word_boundaries(void) {
+    static const uint32_t sizes[] = { 63, 64, 65, 127, 128, 129 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        const uint32_t num_slots = sizes[i];
+        mal_bitmap bitmap;
+        _mal_bitmap_init(&bitmap);
+        CHECK(_mal_bitmap_grow(&bitmap, num_slots));
+        acquire_all(&bitmap, 0);
+
+        // Release the slots on either side of each word boundary, highest first
+        static const uint32_t boundary_slots[] = { 128, 127, 65, 64, 63, 0 };
+        for (size_t j = 0; j < sizeof(boundary_slots) / sizeof(boundary_slots[0]); j++) {
+            _mal_bitmap_release(&bitmap, boundary_slots[j]);
+        }
+        for (size_t j = sizeof(boundary_slots) / sizeof(boundary_slots[0]); j > 0; j--) {
+            const uint32_t slot = boundary_slots[j - 1];
+            if (slot < num_slots) {
+                CHECK(_mal_bitmap_acquire(&bitmap) == slot);
+            }
+        }
+        CHECK(_mal_bitmap_acquire(&bitmap) == UINT32_MAX);
+
+        // Grow past the boundary while full
+        CHECK(_mal_bitmap_grow(&bitmap, num_slots + 1));
+        CHECK(_mal_bitmap_acquire(&bitmap) == num_slots);
+        CHECK(_mal_bitmap_acquire(&bitmap) == UINT32_MAX);
+        _mal_bitmap_deinit(&bitmap);
+    }
+}
+
+static void test_grow_one_at_a_time(void) {
+    // Like adding players one by one
+    mal_bitmap bitmap;
+    _mal_bitmap_init(&bitmap);
+    for (uint32_t slot = 0; slot < 1000; slot++) {
+        CHECK(_mal_bitmap_acquire(&bitmap) == UINT32_MAX);
+        CHECK(_mal_bitmap_grow(&bitmap, slot + 1));
+        CHECK(_mal_bitmap_acquire(&bitmap) == slot);
+    }
+    CHECK(bitmap.num_taken == 1000);
+    for (uint32_t slot = 0; slot < 1000; slot++) {
+        _mal_bitmap_release(&bitmap, slot);
+    }
+    CHECK(bitmap.num_taken == 0);
+    acquire_all(&bitmap, 0);
+    _mal_bitmap_deinit(&bitmap);
+}
+
+int main(void) {
+    test_empty();
+    test_acquire_until_full();
+    test_release_reacquires_lowest();
+    test_word_boundaries();
+    test_grow_one_at_a_time();
+    if (failures > 0) {
+        printf("%i failures\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ Checks the SIMD conversion of packed 24-bit samples in src/mal_audio_abstract.h against values
+ computed independently, for lengths that aren't a multiple of the vector width, and for
+ unaligned data. Also prints the conversion throughput.
+
+ Build and run from the repository root, on Linux with OpenAL Soft:
+
+     cc -std=c99 -O2 -Iinclude -Isrc example/test/mal_convert_test.c -o mal_convert_test \
+         -lopenal -lpthread -lm
+     ./mal_convert_test
+
+ On macOS, use -framework OpenAL instead of -lopenal. On ARM, add the NEON flags if the compiler
+ doesn't enable them by default (e.g. -mfpu=neon).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mal_audio_openal.h"
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_COUNT 100
+#define MAX_OFFSET 16
+#define BENCHMARK_COUNT (64 * 1024)
+#define BENCHMARK_ITERATIONS 2000
+
+static void _mal_context_did_create(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_will_dispose(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_did_set_active(mal_context *context, bool active) {
+    // Do nothing
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+// Writes `count` packed 24-bit samples in native byte order, including the extremes
+static void make_samples(uint8_t *dst, int32_t *values, const size_t count, uint32_t seed) {
+    const bool little_endian = _mal_system_is_little_endian();
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1664525 + 1013904223;
+        int32_t v = (int32_t)(seed >> 8) - 8388608;
+        if (i % 7 == 0) {
+            v = (i % 14 == 0) ? 8388607 : -8388608;
+        }
+        values[i] = v;
+        const uint32_t u = (uint32_t)v;
+        dst[i * 3 + (little_endian ? 0 : 2)] = (uint8_t)u;
+        dst[i * 3 + 1] = (uint8_t)(u >> 8);
+        dst[i * 3 + (little_endian ? 2 : 0)] = (uint8_t)(u >> 16);
+    }
+}
+
+int main(void) {
+    const mal_format format = { .sample_rate = 44100, .bit_depth = 24, .num_channels = 1 };
+    uint8_t src[MAX_OFFSET + MAX_COUNT * 3];
+    int32_t values[MAX_COUNT];
+    float float_dst[MAX_COUNT + 1];
+    int16_t int16_dst[MAX_COUNT + 1];
+    int failures = 0;
+
+#if defined(MAL_SSSE3)
+    printf("Checking SSSE3%s\n", __builtin_cpu_supports("ssse3") ? "" : " (not supported)");
+#elif defined(MAL_NEON)
+    printf("Checking NEON\n");
+#else
+    printf("No SIMD functions in this build; checking the scalar functions only\n");
+#endif
+
+    for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+        for (size_t count = 0; count <= MAX_COUNT; count++) {
+            make_samples(src + offset, values, count, (uint32_t)(offset * 1000 + count));
+            float_dst[count] = 123.0f;
+            int16_dst[count] = 123;
+            _mal_convert_to_float(float_dst, src + offset, format, count);
+            _mal_convert_to_int16(int16_dst, src + offset, format, count);
+            for (size_t i = 0; i < count; i++) {
+                const float expected_float = (float)values[i] / 8388608.0f;
+                const int16_t expected_int16 = (int16_t)((values[i] - (values[i] & 0xff)) / 256);
+                if (float_dst[i] != expected_float || int16_dst[i] != expected_int16) {
+                    printf("FAIL: offset %zu, count %zu, sample %zu: %i -> %f, %i\n",
+                           offset, count, i, values[i], float_dst[i], int16_dst[i]);
+                    failures++;
+                    break;
+                }
+            }
+            if (float_dst[count] != 123.0f || int16_dst[count] != 123) {
+                printf("FAIL: offset %zu, count %zu: wrote past the end\n", offset, count);
+                failures++;
+            }
+        }
+    }
+
+    // Throughput, in samples per second
+    uint8_t *bench_src = malloc(BENCHMARK_COUNT * 3);
+    int32_t *bench_values = malloc(BENCHMARK_COUNT * sizeof(int32_t));
+    float *bench_float = malloc(BENCHMARK_COUNT * sizeof(float));
+    int16_t *bench_int16 = malloc(BENCHMARK_COUNT * sizeof(int16_t));
+    if (!bench_src || !bench_values || !bench_float || !bench_int16) {
+        printf("Couldn't allocate\n");
+        return 1;
+    }
+    make_samples(bench_src, bench_values, BENCHMARK_COUNT, 1);
+    double start = now();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        _mal_convert_to_float(bench_float, bench_src, format, BENCHMARK_COUNT);
+    }
+    printf("%-24s %12.0f Msamples/s\n", "24-bit to float",
+           BENCHMARK_COUNT * (double)BENCHMARK_ITERATIONS / (now() - start) / 1000000.0);
+    start = now();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        _mal_convert_to_int16(bench_int16, bench_src, format, BENCHMARK_COUNT);
+    }
+    printf("%-24s %12.0f Msamples/s\n", "24-bit to int16",
+           BENCHMARK_COUNT * (double)BENCHMARK_ITERATIONS / (now() - start) / 1000000.0);
+    free(bench_src);
+    free(bench_values);
+    free(bench_float);
+    free(bench_int16);
+
+    if (failures > 0) {
+        printf("%i failures\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
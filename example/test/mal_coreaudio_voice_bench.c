@@ -0,0 +1,152 @@
+/*
+ Measures the per-voice cost of the Core Audio backend's render callbacks with 256 voices playing:
+ each cycle calls audio_render_callback() for every bus in order, as the mixer does, with the
+ context inactive so that the mixer doesn't render at the same time. The mixing itself (done by
+ the mixer unit) isn't included.
+
+ Each case is run with the render kernel chosen for the voice's format ("Specialized"), then with
+ every voice forced to the kernel for any frame size ("Generic"). The short loop wraps several
+ times per slice.
+
+ The backend uses the RemoteIO unit, so run it on iOS, for example in the simulator. Build and run
+ from the repository root:
+
+     xcrun -sdk iphonesimulator clang -std=c99 -O2 -DNDEBUG -arch arm64 \
+         -mios-simulator-version-min=12.0 -Iinclude -Isrc \
+         example/test/mal_coreaudio_voice_bench.c -o mal_coreaudio_voice_bench \
+         -framework AudioToolbox
+     xcrun simctl spawn booted ./mal_coreaudio_voice_bench
+ */
+
+#include "mal_audio_coreaudio.h"
+#include <stdio.h>
+#include <time.h>
+
+#define NUM_VOICES 256
+#define NUM_CYCLES 2000
+#define SLICE_FRAMES 512
+#define SAMPLE_RATE 44100
+
+static void _mal_context_did_create(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_will_dispose(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_did_set_active(mal_context *context, bool active) {
+    // Do nothing
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+// Renders every voice for NUM_CYCLES slices. Returns the time per voice per slice, in ns.
+static double render(mal_player **players, AudioBufferList *buffer_list, uint32_t *checksum) {
+    AudioUnitRenderActionFlags flags = 0;
+    AudioTimeStamp timestamp;
+    memset(&timestamp, 0, sizeof(timestamp));
+    const uint8_t *out = buffer_list->mBuffers[0].mData;
+    const double start = now();
+    for (int cycle = 0; cycle < NUM_CYCLES; cycle++) {
+        for (int i = 0; i < NUM_VOICES; i++) {
+            audio_render_callback(players[i]->data.voice, &flags, &timestamp,
+                                  players[i]->data.input_bus, SLICE_FRAMES, buffer_list);
+            *checksum += out[0];
+        }
+    }
+    const double elapsed = now() - start;
+    return elapsed * 1000000000.0 / ((double)NUM_CYCLES * NUM_VOICES);
+}
+
+static void bench(mal_context *context, const char *name, const mal_format format,
+                  const uint32_t num_frames) {
+    const size_t data_length = mal_format_get_data_length(format, num_frames);
+    uint8_t *data = malloc(data_length);
+    if (!data) {
+        printf("Couldn't allocate\n");
+        exit(1);
+    }
+    uint32_t seed = 1;
+    for (size_t i = 0; i < data_length; i++) {
+        seed = seed * 1664525 + 1013904223;
+        data[i] = (uint8_t)(seed >> 24);
+    }
+    if (format.sample_type == MAL_SAMPLE_TYPE_FLOAT) {
+        float *samples = (float *)data;
+        for (size_t i = 0; i < data_length / sizeof(float); i++) {
+            samples[i] = (float)((int32_t)(i * 2654435761u) >> 8) / 8388608.0f;
+        }
+    }
+    mal_buffer *buffer = mal_buffer_create_no_copy(context, format, num_frames, data, free);
+    mal_player *players[NUM_VOICES];
+    for (int i = 0; i < NUM_VOICES; i++) {
+        players[i] = mal_player_create(context, format);
+        if (!buffer || !players[i] || !mal_player_set_buffer(players[i], buffer)) {
+            printf("Couldn't create player\n");
+            exit(1);
+        }
+        mal_player_set_looping(players[i], true);
+        if (!mal_player_set_state(players[i], MAL_PLAYER_STATE_PLAYING)) {
+            printf("Couldn't play\n");
+            exit(1);
+        }
+    }
+
+    // The mixer gives each bus a buffer for one slice
+    static uint8_t out[SLICE_FRAMES * 2 * sizeof(float)];
+    AudioBufferList buffer_list;
+    buffer_list.mNumberBuffers = 1;
+    buffer_list.mBuffers[0].mNumberChannels = format.num_channels;
+    buffer_list.mBuffers[0].mDataByteSize = (UInt32)mal_format_get_data_length(format,
+                                                                               SLICE_FRAMES);
+    buffer_list.mBuffers[0].mData = out;
+
+    uint32_t checksum = 0;
+    const double specialized_ns = render(players, &buffer_list, &checksum);
+    for (int i = 0; i < NUM_VOICES; i++) {
+        struct _mal_voice *voice = players[i]->data.voice;
+        voice->render_kernel = _mal_voice_render_pcm_0_1;
+    }
+    const double generic_ns = render(players, &buffer_list, &checksum);
+    const double slice_ns = SLICE_FRAMES * 1000000000.0 / SAMPLE_RATE;
+    printf("%-20s %12.1f %12.1f %10.2f%% (%08x)\n", name, specialized_ns, generic_ns,
+           specialized_ns * NUM_VOICES * 100.0 / slice_ns, checksum);
+
+    for (int i = 0; i < NUM_VOICES; i++) {
+        mal_player_free(players[i]);
+    }
+    mal_buffer_free(buffer);
+}
+
+int main(void) {
+    mal_context *context = mal_context_create(SAMPLE_RATE);
+    if (!context) {
+        printf("Couldn't create context\n");
+        return 1;
+    }
+    mal_context_set_active(context, false);
+    const mal_format mono16 = {
+        .sample_rate = SAMPLE_RATE, .bit_depth = 16, .num_channels = 1,
+        .sample_type = MAL_SAMPLE_TYPE_INT
+    };
+    mal_format stereo16 = mono16;
+    stereo16.num_channels = 2;
+    mal_format stereo_float = stereo16;
+    stereo_float.bit_depth = 32;
+    stereo_float.sample_type = MAL_SAMPLE_TYPE_FLOAT;
+
+    printf("%i voices, %i-frame slices at %i Hz. ns per voice per slice:\n", NUM_VOICES,
+           SLICE_FRAMES, SAMPLE_RATE);
+    printf("%-20s %12s %12s %11s\n", "", "Specialized", "Generic", "Of slice");
+    bench(context, "16-bit mono", mono16, SAMPLE_RATE);
+    bench(context, "16-bit stereo", stereo16, SAMPLE_RATE);
+    bench(context, "Float stereo", stereo_float, SAMPLE_RATE);
+    bench(context, "16-bit stereo, 64", stereo16, 64);
+    mal_context_free(context);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ Checks that downmixing quad, 5.1 and 7.1 buffers to stereo and mono in
+ src/mal_audio_abstract.h keeps full-scale signals within [-1, 1], and that the front channels
+ keep their sides.
+
+ Build and run from the repository root, on Linux with OpenAL Soft:
+
+     cc -std=c99 -Iinclude -Isrc example/test/mal_downmix_test.c -o mal_downmix_test \
+         -lopenal -lpthread -lm
+     ./mal_downmix_test
+
+ On macOS, use -framework OpenAL instead of -lopenal.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mal_audio_openal.h"
+#include <stdio.h>
+
+#define NUM_FRAMES 64
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("FAIL: line %i: %s\n", __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+static void _mal_context_did_create(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_will_dispose(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_did_set_active(mal_context *context, bool active) {
+    // Do nothing
+}
+
+// Fills every channel with full scale, with the sign of each channel taken from the bits of the
+// frame index, so that all combinations of signs are mixed.
+static void fill_full_scale(float *data, const uint8_t num_channels) {
+    for (uint32_t frame = 0; frame < NUM_FRAMES; frame++) {
+        for (uint8_t c = 0; c < num_channels; c++) {
+            const uint32_t bits = frame * 2654435761u;
+            data[frame * num_channels + c] = ((bits >> (c + 8)) & 1) ? 1.0f : -1.0f;
+        }
+    }
+    // Every channel positive, then every channel negative
+    for (uint8_t c = 0; c < num_channels; c++) {
+        data[c] = 1.0f;
+        data[num_channels + c] = -1.0f;
+    }
+}
+
+static void test_full_scale(const uint8_t src_channels, const uint8_t dst_channels) {
+    const mal_format src_format = {
+        .sample_rate = 44100, .bit_depth = 32, .num_channels = src_channels,
+        .sample_type = MAL_SAMPLE_TYPE_FLOAT
+    };
+    mal_format dst_format = src_format;
+    dst_format.num_channels = dst_channels;
+    float src[NUM_FRAMES * MAL_MAX_CHANNELS];
+    fill_full_scale(src, src_channels);
+
+    float *dst = _mal_convert_to_native_format(src, src_format, dst_format, NUM_FRAMES);
+    CHECK(dst != NULL);
+    if (dst) {
+        float peak = 0.0f;
+        for (uint32_t i = 0; i < NUM_FRAMES * dst_channels; i++) {
+            peak = fmaxf(peak, fabsf(dst[i]));
+        }
+        // Allowing for rounding of the normalized coefficients
+        if (peak > 1.0f + 1e-6f) {
+            printf("FAIL: %i to %i channels: peak %f\n", src_channels, dst_channels, peak);
+            failures++;
+        }
+        // All channels at full scale (the first frame) mix to full scale
+        for (uint8_t c = 0; c < dst_channels; c++) {
+            CHECK(fabsf(dst[c] - 1.0f) < 0.0001f);
+        }
+        free(dst);
+    }
+
+    // Also to 16-bit, which can't wrap around
+    dst_format.bit_depth = 16;
+    dst_format.sample_type = MAL_SAMPLE_TYPE_INT;
+    int16_t *dst16 = _mal_convert_to_native_format(src, src_format, dst_format, NUM_FRAMES);
+    CHECK(dst16 != NULL);
+    if (dst16) {
+        for (uint8_t c = 0; c < dst_channels; c++) {
+            CHECK(dst16[c] == 32767);
+            CHECK(dst16[dst_channels + c] == -32768);
+        }
+        free(dst16);
+    }
+}
+
+static void test_sides(const uint8_t src_channels) {
+    // Front left only: louder on the left than the right
+    float matrix[2 * MAL_MAX_CHANNELS];
+    CHECK(_mal_get_mix_matrix(matrix, src_channels, 2));
+    CHECK(matrix[0] > 0.0f);
+    CHECK(matrix[src_channels] == 0.0f);
+    CHECK(matrix[1] == 0.0f);
+    CHECK(matrix[src_channels + 1] > 0.0f);
+}
+
+int main(void) {
+    static const uint8_t layouts[] = { 1, 2, 4, 6, 8 };
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        const uint8_t src_channels = layouts[i];
+        if (src_channels > 1) {
+            test_full_scale(src_channels, 1);
+            test_sides(src_channels);
+        }
+        if (src_channels > 2) {
+            test_full_scale(src_channels, 2);
+        }
+    }
+    if (failures > 0) {
+        printf("%i failures\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ Measures how many player API calls per second the OpenAL backend handles: creating and freeing
+ players (which take sources from the pool), starting and stopping them, and setting gain.
+
+ It uses only API that predates the source pool, so to compare before and after, build it against
+ each version of mal. Build and run from the repository root, on Linux with OpenAL Soft:
+
+     cc -std=c99 -O2 -DNDEBUG -Iinclude -Isrc example/test/mal_openal_bench.c -o mal_openal_bench \
+         -lopenal -lpthread -lm
+     ./mal_openal_bench
+
+ On macOS, use -framework OpenAL instead of -lopenal.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mal_audio_openal.h"
+#include <stdio.h>
+#include <time.h>
+
+#define NUM_PLAYERS 32
+#define NUM_ITERATIONS 20000
+
+static void _mal_context_did_create(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_will_dispose(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_did_set_active(mal_context *context, bool active) {
+    // Do nothing
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static void report(const char *name, const uint32_t num_calls, const double start) {
+    const double elapsed = now() - start;
+    printf("%-24s %12.0f calls/s\n", name, num_calls / elapsed);
+}
+
+int main(void) {
+    mal_context *context = mal_context_create(44100);
+    if (!context) {
+        printf("Couldn't create context\n");
+        return 1;
+    }
+    mal_format format = { .sample_rate = 44100, .bit_depth = 16, .num_channels = 1 };
+    static int16_t data[4410];
+    mal_buffer *buffer = mal_buffer_create(context, format, 4410, data);
+    mal_player *players[NUM_PLAYERS];
+    for (int i = 0; i < NUM_PLAYERS; i++) {
+        players[i] = mal_player_create(context, format);
+        if (!players[i] || !mal_player_set_buffer(players[i], buffer)) {
+            printf("Couldn't create player\n");
+            return 1;
+        }
+        mal_player_set_gain(players[i], 0.0f);
+    }
+
+    // Create and free, keeping NUM_PLAYERS alive
+    double start = now();
+    for (uint32_t i = 0; i < NUM_ITERATIONS; i++) {
+        mal_player **player = &players[i % NUM_PLAYERS];
+        mal_player_free(*player);
+        *player = mal_player_create(context, format);
+        mal_player_set_buffer(*player, buffer);
+    }
+    report("create + free", NUM_ITERATIONS * 2, start);
+
+    start = now();
+    for (uint32_t i = 0; i < NUM_ITERATIONS; i++) {
+        mal_player *player = players[i % NUM_PLAYERS];
+        mal_player_set_state(player, MAL_PLAYER_STATE_PLAYING);
+        mal_player_set_state(player, MAL_PLAYER_STATE_STOPPED);
+    }
+    report("play + stop", NUM_ITERATIONS * 2, start);
+
+    start = now();
+    for (uint32_t i = 0; i < NUM_ITERATIONS * 10; i++) {
+        mal_player_set_gain(players[i % NUM_PLAYERS], (float)(i & 1) * 0.001f);
+    }
+    report("set gain", NUM_ITERATIONS * 10, start);
+
+    start = now();
+    uint32_t num_playing = 0;
+    for (uint32_t i = 0; i < NUM_ITERATIONS * 10; i++) {
+        num_playing += mal_player_get_state(players[i % NUM_PLAYERS]) == MAL_PLAYER_STATE_PLAYING;
+    }
+    report("get state", NUM_ITERATIONS * 10, start);
+
+    for (int i = 0; i < NUM_PLAYERS; i++) {
+        mal_player_free(players[i]);
+    }
+    mal_buffer_free(buffer);
+    mal_context_free(context);
+    return num_playing == 0 ? 0 : 1;
+}
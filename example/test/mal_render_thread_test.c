@@ -0,0 +1,137 @@
+/*
+ Checks the pacing and deadline accounting of the render thread of a loopback context:
+ - With an output that blocks for a period, like a device write, and `render_output_blocks` set,
+   the thread is paced only by the output, and deadlines are rarely missed.
+ - With an output that doesn't block, the thread sleeps between periods, and deadlines are rarely
+   missed.
+ - With an output that takes two periods without `render_output_blocks`, every period is missed.
+
+ Build and run from the repository root, on Linux with OpenAL Soft:
+
+     cc -std=c99 -Iinclude -Isrc example/test/mal_render_thread_test.c -o mal_render_thread_test \
+         -lopenal -lpthread -lm
+     ./mal_render_thread_test
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mal_audio_openal.h"
+#include <stdio.h>
+#include <time.h>
+
+#define SAMPLE_RATE 44100
+#define QUANTUM_FRAMES 256
+#define RUN_TIME 0.3
+
+// Allows for the odd period lost to preemption on a loaded machine
+#define MAX_MISSED(num_periods) ((num_periods) / 10)
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("FAIL: line %i: %s\n", __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+static void _mal_context_did_create(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_will_dispose(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_did_set_active(mal_context *context, bool active) {
+    // Do nothing
+}
+
+static const double period = (double)QUANTUM_FRAMES / SAMPLE_RATE;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static void sleep_for(const double duration) {
+    struct timespec t;
+    t.tv_sec = (time_t)duration;
+    t.tv_nsec = (long)((duration - (double)t.tv_sec) * 1000000000.0);
+    nanosleep(&t, NULL);
+}
+
+// Like a device, accepts a period of samples once per period, blocking until there's room. The
+// device's periods start half a period out of phase with the render thread's.
+static void blocking_output(void *user_data, const float *samples, uint32_t num_frames,
+                            uint32_t num_channels) {
+    double *device_time = user_data;
+    if (*device_time == 0.0) {
+        *device_time = now() + period / 2;
+    }
+    *device_time += period;
+    const double wait = *device_time - now();
+    if (wait > 0.0) {
+        sleep_for(wait);
+    }
+}
+
+static void nonblocking_output(void *user_data, const float *samples, uint32_t num_frames,
+                               uint32_t num_channels) {
+    // Do nothing
+}
+
+static void slow_output(void *user_data, const float *samples, uint32_t num_frames,
+                        uint32_t num_channels) {
+    sleep_for(period * 2);
+}
+
+// Runs a render thread for RUN_TIME seconds. Returns the number of periods expected in that time.
+static double run(const mal_render_output_func output, const bool output_blocks,
+                  mal_render_thread_stats *stats) {
+    double device_time = 0.0;
+    mal_context_options options;
+    memset(&options, 0, sizeof(options));
+    options.loopback_num_channels = 2;
+    options.render_output = output;
+    options.render_output_user_data = &device_time;
+    options.render_output_blocks = output_blocks;
+    options.render_quantum_frames = QUANTUM_FRAMES;
+    const double start = now();
+    mal_context *context = mal_context_create_ex(SAMPLE_RATE, &options);
+    CHECK(context != NULL);
+    if (!context) {
+        memset(stats, 0, sizeof(*stats));
+        return 0.0;
+    }
+    sleep_for(RUN_TIME);
+    CHECK(mal_context_get_render_thread_stats(context, stats));
+    const double elapsed = now() - start;
+    mal_context_free(context);
+    return elapsed / period;
+}
+
+int main(void) {
+    mal_render_thread_stats stats;
+
+    double expected_periods = run(blocking_output, true, &stats);
+    CHECK(stats.num_periods >= expected_periods * 0.8);
+    CHECK(stats.num_periods <= expected_periods * 1.2 + 2);
+    CHECK(stats.num_missed_deadlines <= MAX_MISSED(stats.num_periods));
+
+    expected_periods = run(nonblocking_output, false, &stats);
+    CHECK(stats.num_periods >= expected_periods * 0.8);
+    CHECK(stats.num_periods <= expected_periods * 1.2 + 2);
+    CHECK(stats.num_missed_deadlines <= MAX_MISSED(stats.num_periods));
+
+    expected_periods = run(slow_output, false, &stats);
+    CHECK(stats.num_periods >= expected_periods / 2 * 0.8);
+    CHECK(stats.num_periods <= expected_periods / 2 * 1.2 + 2);
+    CHECK(stats.num_missed_deadlines + 1 >= stats.num_periods);
+
+    if (failures == 0) {
+        printf("OK\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
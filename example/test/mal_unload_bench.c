@@ -0,0 +1,121 @@
+/*
+ Measures unloading a level: freeing every buffer (which detaches the players using it), then every
+ player, in shuffled order. Levels of several sizes are unloaded, with 4 buffers per player, so
+ that the time per object shows how unloading scales.
+
+ It uses only API that predates the player and buffer registries, so to compare before and after,
+ build it against each version of mal. Build and run from the repository root, on Linux with
+ OpenAL Soft:
+
+     cc -std=c99 -O2 -DNDEBUG -Iinclude -Isrc example/test/mal_unload_bench.c -o mal_unload_bench \
+         -lopenal -lpthread -lm
+     ./mal_unload_bench
+
+ On macOS, use -framework OpenAL instead of -lopenal.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mal_audio_openal.h"
+#include <stdio.h>
+#include <time.h>
+
+#define NUM_ITERATIONS 5
+#define BUFFERS_PER_PLAYER 4
+#define MAX_PLAYERS 2000
+
+static void _mal_context_did_create(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_will_dispose(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_did_set_active(mal_context *context, bool active) {
+    // Do nothing
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static uint32_t seed = 1;
+
+static uint32_t next_random(void) {
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+}
+
+static void shuffle(void **values, const uint32_t count) {
+    for (uint32_t i = count; i > 1; i--) {
+        const uint32_t j = next_random() % i;
+        void *t = values[i - 1];
+        values[i - 1] = values[j];
+        values[j] = t;
+    }
+}
+
+// Loads a level, then times unloading it. Returns the elapsed time.
+static double unload_level(mal_context *context, const uint32_t num_players) {
+    static mal_player *players[MAX_PLAYERS];
+    static mal_buffer *buffers[MAX_PLAYERS * BUFFERS_PER_PLAYER];
+    static int16_t data[441];
+    const uint32_t num_buffers = num_players * BUFFERS_PER_PLAYER;
+    const mal_format format = {
+        .sample_rate = 44100, .bit_depth = 16, .num_channels = 1,
+        .sample_type = MAL_SAMPLE_TYPE_INT
+    };
+
+    for (uint32_t i = 0; i < num_buffers; i++) {
+        buffers[i] = mal_buffer_create(context, format, 441, data);
+        if (!buffers[i]) {
+            printf("Couldn't create buffer\n");
+            exit(1);
+        }
+    }
+    // Each player uses a random buffer, so that some buffers have several players and most have
+    // none, like a level's sound effects
+    for (uint32_t i = 0; i < num_players; i++) {
+        mal_buffer *buffer = buffers[next_random() % num_buffers];
+        players[i] = mal_player_create(context, format);
+        if (!players[i] || !mal_player_set_buffer(players[i], buffer)) {
+            printf("Couldn't create player\n");
+            exit(1);
+        }
+    }
+    shuffle((void **)buffers, num_buffers);
+    shuffle((void **)players, num_players);
+
+    const double start = now();
+    for (uint32_t i = 0; i < num_buffers; i++) {
+        mal_buffer_free(buffers[i]);
+    }
+    for (uint32_t i = 0; i < num_players; i++) {
+        mal_player_free(players[i]);
+    }
+    return now() - start;
+}
+
+int main(void) {
+    mal_context *context = mal_context_create(44100);
+    if (!context) {
+        printf("Couldn't create context\n");
+        return 1;
+    }
+    printf("%8s %8s %12s %16s\n", "Players", "Buffers", "Unload (ms)", "ns per object");
+    for (uint32_t num_players = MAX_PLAYERS / 16; num_players <= MAX_PLAYERS; num_players *= 2) {
+        double elapsed = 0.0;
+        for (int i = 0; i < NUM_ITERATIONS; i++) {
+            elapsed += unload_level(context, num_players);
+        }
+        elapsed /= NUM_ITERATIONS;
+        const uint32_t num_objects = num_players * (1 + BUFFERS_PER_PLAYER);
+        printf("%8u %8u %12.3f %16.1f\n", num_players, num_players * BUFFERS_PER_PLAYER,
+               elapsed * 1000.0, elapsed * 1000000000.0 / num_objects);
+    }
+    mal_context_free(context);
+    return 0;
+}
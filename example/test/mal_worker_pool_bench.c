@@ -0,0 +1,168 @@
+/*
+ Measures how rendering many voices scales across the worker pool in src/mal_worker_pool.h, as
+ used by the Core Audio backend's parallel rendering (see mal_context_set_num_render_threads()).
+
+ Each render quantum, 1024 synthetic voices are rendered in chunks of 8 voices, like the Core Audio
+ backend's prerender. Each voice resamples a wavetable with linear interpolation and filters it
+ with a biquad lowpass, into its own stereo buffer. The quantum is run with 1, 2, 4, and 8 threads
+ (the calling thread plus 0, 1, 3, and 7 workers). Every thread count must produce the same
+ output.
+
+ Build and run from the repository root:
+
+     cc -std=c99 -O2 -Isrc example/test/mal_worker_pool_bench.c -o mal_worker_pool_bench \
+         -lpthread -lm
+     ./mal_worker_pool_bench
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mal_worker_pool.h"
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef M_PI
+#  define M_PI 3.14159265358979323846
+#endif
+
+#define NUM_VOICES 1024
+#define CHUNK_SIZE 8
+#define QUANTUM_FRAMES 256
+#define SAMPLE_RATE 48000
+#define NUM_QUANTA 200
+#define TABLE_SIZE 2048
+
+typedef struct {
+    double phase;
+    double step;
+    float gain_left;
+    float gain_right;
+    float b0, b1, b2, a1, a2;
+    float x1, x2, y1, y2;
+    float out[QUANTUM_FRAMES * 2];
+} voice;
+
+static float table[TABLE_SIZE + 1];
+static voice voices[NUM_VOICES];
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static void init_voices(void) {
+    for (int i = 0; i <= TABLE_SIZE; i++) {
+        const double t = 2.0 * M_PI * i / TABLE_SIZE;
+        table[i] = (float)(sin(t) + 0.5 * sin(3.0 * t) + 0.25 * sin(5.0 * t)) * 0.5f;
+    }
+    for (int i = 0; i < NUM_VOICES; i++) {
+        voice *v = &voices[i];
+        memset(v, 0, sizeof(*v));
+        // Pitches spread over a few octaves, so that every voice resamples
+        v->step = TABLE_SIZE * (55.0 * pow(2.0, (i % 48) / 12.0)) / SAMPLE_RATE;
+        v->gain_left = (float)(i % 7) / 7.0f;
+        v->gain_right = 1.0f - v->gain_left;
+
+        // Biquad lowpass (RBJ cookbook), Q of 0.707
+        const double cutoff = 500.0 + 40.0 * (i % 100);
+        const double w = 2.0 * M_PI * cutoff / SAMPLE_RATE;
+        const double alpha = sin(w) / (2.0 * 0.707);
+        const double a0 = 1.0 + alpha;
+        v->b0 = (float)((1.0 - cos(w)) / 2.0 / a0);
+        v->b1 = (float)((1.0 - cos(w)) / a0);
+        v->b2 = v->b0;
+        v->a1 = (float)(-2.0 * cos(w) / a0);
+        v->a2 = (float)((1.0 - alpha) / a0);
+    }
+}
+
+static void render_voices(void *user_data, uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; i++) {
+        voice *v = &voices[i];
+        double phase = v->phase;
+        float x1 = v->x1, x2 = v->x2, y1 = v->y1, y2 = v->y2;
+        for (int frame = 0; frame < QUANTUM_FRAMES; frame++) {
+            const int index = (int)phase;
+            const float frac = (float)(phase - index);
+            const float x = table[index] + (table[index + 1] - table[index]) * frac;
+            const float y = v->b0 * x + v->b1 * x1 + v->b2 * x2 - v->a1 * y1 - v->a2 * y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            v->out[frame * 2] = y * v->gain_left;
+            v->out[frame * 2 + 1] = y * v->gain_right;
+            phase += v->step;
+            if (phase >= TABLE_SIZE) {
+                phase -= TABLE_SIZE;
+            }
+        }
+        v->phase = phase;
+        v->x1 = x1;
+        v->x2 = x2;
+        v->y1 = y1;
+        v->y2 = y2;
+    }
+}
+
+// Sums every voice's output, so that thread counts can be compared
+static double checksum(void) {
+    double sum = 0.0;
+    for (int i = 0; i < NUM_VOICES; i++) {
+        for (int j = 0; j < QUANTUM_FRAMES * 2; j++) {
+            sum += voices[i].out[j] * (double)(j + 1);
+        }
+    }
+    return sum;
+}
+
+int main(void) {
+    static const uint32_t thread_counts[] = { 1, 2, 4, 8 };
+    const double quantum_ms = 1000.0 * QUANTUM_FRAMES / SAMPLE_RATE;
+    printf("%u voices, %u-frame quanta at %u Hz (%.2f ms), chunks of %u voices, %li CPUs\n",
+           NUM_VOICES, QUANTUM_FRAMES, SAMPLE_RATE, quantum_ms, CHUNK_SIZE,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %14s %10s %12s %9s\n", "Threads", "ms per quantum", "Speedup", "Of quantum",
+           "Timeouts");
+    double single_thread_ms = 0.0;
+    double expected_checksum = 0.0;
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+        const uint32_t num_threads = thread_counts[t];
+        mal_worker_pool *pool = _mal_worker_pool_create(num_threads - 1,
+                                                        (double)QUANTUM_FRAMES / SAMPLE_RATE);
+        if (!pool) {
+            printf("Couldn't create pool\n");
+            return 1;
+        }
+        init_voices();
+        uint32_t num_timeouts = 0;
+        double elapsed = 0.0;
+        for (int i = 0; i < NUM_QUANTA; i++) {
+            const double start = now();
+            if (!_mal_worker_pool_run(pool, NUM_VOICES, CHUNK_SIZE, render_voices, NULL, 1.0)) {
+                num_timeouts++;
+                while (_mal_worker_pool_is_busy(pool)) { }
+            }
+            elapsed += now() - start;
+        }
+        _mal_worker_pool_free(pool);
+
+        const double sum = checksum();
+        if (t == 0) {
+            expected_checksum = sum;
+        } else if (sum != expected_checksum) {
+            printf("FAIL: %u threads rendered different output\n", num_threads);
+            return 1;
+        }
+        const double ms = elapsed * 1000.0 / NUM_QUANTA;
+        if (t == 0) {
+            single_thread_ms = ms;
+        }
+        printf("%8u %14.3f %9.2fx %11.1f%% %9u\n", num_threads, ms, single_thread_ms / ms,
+               ms * 100.0 / quantum_ms, num_timeouts);
+    }
+    return 0;
+}
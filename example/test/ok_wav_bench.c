@@ -0,0 +1,193 @@
+/*
+ Measures the throughput of ok_wav on large synthetic files in memory:
+ - Swapping the samples of big-endian CAF files to the system's byte order, as ok_wav_read() does.
+   This is timed without reading the file, which is mostly page faults and copying.
+ - ok_wav_read_frames_float() of little-endian files, which converts every sample to float
+
+ To compare the SIMD functions with the scalar code, build it twice, once with
+ -DOK_WAV_NO_SIMD. Build and run from the repository root:
+
+     cc -std=c99 -O2 -Iinclude -Iexample/src example/test/ok_wav_bench.c -o ok_wav_bench
+     ./ok_wav_bench
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/ok_wav.c"
+#include <stdio.h>
+#include <time.h>
+
+#define DATA_LENGTH (96 * 1024 * 1024)
+#define NUM_ITERATIONS 5
+#define FLOAT_FRAMES 4096
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+} memory_file;
+
+static int memory_input_func(void *user_data, uint8_t *buffer, const int count) {
+    memory_file *file = user_data;
+    if (count < 0 || file->position + (size_t)count > file->length) {
+        return 0;
+    }
+    if (buffer) {
+        memcpy(buffer, file->data + file->position, (size_t)count);
+    }
+    file->position += (size_t)count;
+    return count;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static void write_be32(uint8_t *p, const uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void write_be64(uint8_t *p, const uint64_t v) {
+    write_be32(p, (uint32_t)(v >> 32));
+    write_be32(p + 4, (uint32_t)v);
+}
+
+// Writes a stereo CAF file with DATA_LENGTH bytes of noise. Returns the length of the file.
+static size_t make_caf(uint8_t *file, const uint32_t bit_depth, const bool is_float,
+                       const bool little_endian) {
+    const uint32_t num_channels = 2;
+    uint8_t *p = file;
+    memcpy(p, "caff", 4);
+    p[4] = 0;
+    p[5] = 1;
+    p[6] = 0;
+    p[7] = 0;
+    p += 8;
+
+    memcpy(p, "desc", 4);
+    write_be64(p + 4, 32);
+    union {
+        double value;
+        uint64_t bits;
+    } sample_rate;
+    sample_rate.value = 44100.0;
+    write_be64(p + 12, sample_rate.bits);
+    memcpy(p + 20, "lpcm", 4);
+    write_be32(p + 24, (is_float ? 1 : 0) | (little_endian ? 2 : 0));
+    write_be32(p + 28, bit_depth / 8 * num_channels);
+    write_be32(p + 32, 1);
+    write_be32(p + 36, num_channels);
+    write_be32(p + 40, bit_depth);
+    p += 44;
+
+    memcpy(p, "data", 4);
+    write_be64(p + 4, DATA_LENGTH + 4);
+    memset(p + 12, 0, 4);
+    p += 16;
+    uint32_t seed = bit_depth;
+    for (size_t i = 0; i < DATA_LENGTH; i++) {
+        seed = seed * 1664525 + 1013904223;
+        p[i] = (uint8_t)(seed >> 24);
+    }
+    if (is_float) {
+        // Valid floats in [-1, 1)
+        float *samples = (float *)p;
+        for (size_t i = 0; i < DATA_LENGTH / sizeof(float); i++) {
+            const float v = (float)((int32_t)(i * 2654435761u) >> 8) / 8388608.0f;
+            uint32_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            if (little_endian) {
+                memcpy(samples + i, &bits, sizeof(bits));
+            } else {
+                write_be32((uint8_t *)(samples + i), bits);
+            }
+        }
+    }
+    return (size_t)(p - file) + DATA_LENGTH;
+}
+
+// Read after each benchmark, so that the compiler can't skip the conversion
+static volatile float sink;
+
+static void report(const char *name, const double elapsed) {
+    const double mb = (double)DATA_LENGTH * NUM_ITERATIONS / (1024 * 1024);
+    printf("%-36s %8.0f MB/s\n", name, mb / elapsed);
+}
+
+static void bench_swap(uint8_t *file_data, const uint32_t bit_depth, const bool is_float) {
+    memory_file file = { file_data, make_caf(file_data, bit_depth, is_float, false), 0 };
+    ok_wav *wav = ok_wav_read(&file, memory_input_func, false);
+    if (!wav->data) {
+        printf("Error: %s\n", wav->error_message);
+        exit(1);
+    }
+    uint8_t *data = wav->data;
+    double elapsed = 0.0;
+    for (int i = 0; i < NUM_ITERATIONS; i++) {
+        const double start = now();
+        swap_bytes(wav, data, DATA_LENGTH);
+        elapsed += now() - start;
+        sink = data[i];
+    }
+    ok_wav_free(wav);
+    char name[64];
+    snprintf(name, sizeof(name), "Swap %u-bit%s", bit_depth, is_float ? " float" : "");
+    report(name, elapsed);
+}
+
+static void bench_float(uint8_t *file_data, const uint32_t bit_depth, const bool is_float) {
+    static float dst[FLOAT_FRAMES * 2];
+    memory_file file = { file_data, make_caf(file_data, bit_depth, is_float, true), 0 };
+    double elapsed = 0.0;
+    for (int i = 0; i < NUM_ITERATIONS; i++) {
+        file.position = 0;
+        const double start = now();
+        ok_wav_decoder *decoder = ok_wav_open(&file, memory_input_func, true);
+        uint64_t frames;
+        while ((frames = ok_wav_read_frames_float(decoder, dst, FLOAT_FRAMES)) > 0) {
+            sink = dst[frames * 2 - 1];
+        }
+        elapsed += now() - start;
+        if (ok_wav_get_info(decoder)->error_message[0]) {
+            printf("Error: %s\n", ok_wav_get_info(decoder)->error_message);
+            exit(1);
+        }
+        ok_wav_close(decoder);
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "Read %u-bit%s as float", bit_depth, is_float ? " float" : "");
+    report(name, elapsed);
+}
+
+int main(void) {
+    static const uint32_t int_bit_depths[] = { 8, 16, 24, 32 };
+    uint8_t *file_data = malloc(DATA_LENGTH + 256);
+    if (!file_data) {
+        printf("Couldn't allocate\n");
+        return 1;
+    }
+#if defined(OK_WAV_SSSE3)
+    printf("SSSE3%s, AVX2%s\n", __builtin_cpu_supports("ssse3") ? "" : " (not supported)",
+           __builtin_cpu_supports("avx2") ? "" : " (not supported)");
+#elif defined(OK_WAV_NEON)
+    printf("NEON\n");
+#else
+    printf("No SIMD functions in this build\n");
+#endif
+    for (size_t i = 1; i < sizeof(int_bit_depths) / sizeof(int_bit_depths[0]); i++) {
+        bench_swap(file_data, int_bit_depths[i], false);
+    }
+    bench_swap(file_data, 64, true);
+    for (size_t i = 0; i < sizeof(int_bit_depths) / sizeof(int_bit_depths[0]); i++) {
+        bench_float(file_data, int_bit_depths[i], false);
+    }
+    bench_float(file_data, 32, true);
+    bench_float(file_data, 64, true);
+    free(file_data);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ Checks that each SIMD conversion to float in ok_wav.c (AVX2, SSSE3, NEON), followed by
+ convert_to_float_scalar() for the rest, gives exactly the same floats as
+ convert_to_float_scalar() alone, for every format the SIMD functions convert, for lengths that
+ aren't a multiple of the vector width, and for unaligned data.
+
+ Build and run from the repository root:
+
+     cc -std=c99 -O2 -Iinclude -Iexample/src example/test/ok_wav_convert_test.c \
+         -o ok_wav_convert_test
+     ./ok_wav_convert_test
+
+ On ARM, add the NEON flags if the compiler doesn't enable them by default (e.g. -mfpu=neon).
+ */
+
+#include "../src/ok_wav.c"
+#include <stdio.h>
+
+#define MAX_COUNT 256
+#define MAX_OFFSET 16
+
+typedef size_t (*convert_func)(const int bit_depth, const bool is_float, const uint8_t *src,
+                               float *dst, const size_t count);
+
+static int check(const char *name, convert_func func) {
+    static const struct {
+        int bit_depth;
+        bool is_float;
+    } formats[] = { { 8, false }, { 16, false }, { 24, false }, { 32, false }, { 64, true } };
+    const int num_formats = (int)(sizeof(formats) / sizeof(formats[0]));
+    uint8_t src[MAX_OFFSET + MAX_COUNT * 8];
+    float expected[MAX_COUNT + 1];
+    float actual[MAX_COUNT + 1];
+    int failures = 0;
+
+    // Every bit pattern is a valid sample, including the extremes and, for 64-bit floats,
+    // values out of the float range.
+    uint32_t seed = 1;
+    for (size_t i = 0; i < sizeof(src); i++) {
+        seed = seed * 1664525 + 1013904223;
+        src[i] = (uint8_t)(seed >> 24);
+    }
+    memset(src + 64, 0x7f, 16);
+    memset(src + 80, 0x80, 16);
+    memset(src + 96, 0xff, 16);
+    memset(src + 112, 0x00, 16);
+
+    printf("Checking %s\n", name);
+    for (int f = 0; f < num_formats; f++) {
+        ok_wav wav;
+        memset(&wav, 0, sizeof(wav));
+        wav.bit_depth = (uint8_t)formats[f].bit_depth;
+        wav.is_float = formats[f].is_float;
+        const size_t sample_size = wav.bit_depth / 8;
+        for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+            for (size_t count = 0; count <= MAX_COUNT; count++) {
+                // One extra float, to check that nothing is written past the end
+                memset(expected, 0x55, sizeof(expected));
+                memset(actual, 0x55, sizeof(actual));
+                convert_to_float_scalar(&wav, src + offset, expected, count);
+
+                const size_t converted = func(wav.bit_depth, wav.is_float, src + offset, actual,
+                                              count);
+                if (converted > count) {
+                    printf("FAIL: %s %i-bit, offset %zu, count %zu: converted %zu\n", name,
+                           wav.bit_depth, offset, count, converted);
+                    failures++;
+                    continue;
+                }
+                convert_to_float_scalar(&wav, src + offset + converted * sample_size,
+                                        actual + converted, count - converted);
+                if (memcmp(expected, actual, sizeof(expected)) != 0) {
+                    printf("FAIL: %s %i-bit%s, offset %zu, count %zu\n", name, wav.bit_depth,
+                           wav.is_float ? " float" : "", offset, count);
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int main(void) {
+    int failures = 0;
+    int num_checked = 0;
+#if defined(OK_WAV_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        failures += check("AVX2", convert_to_float_avx2);
+        num_checked++;
+    } else {
+        printf("AVX2 not supported\n");
+    }
+#endif
+#if defined(OK_WAV_SSSE3)
+    if (__builtin_cpu_supports("ssse3")) {
+        failures += check("SSSE3", convert_to_float_ssse3);
+        num_checked++;
+    } else {
+        printf("SSSE3 not supported\n");
+    }
+#elif defined(OK_WAV_NEON)
+    failures += check("NEON", convert_to_float_neon);
+    num_checked++;
+#endif
+    if (num_checked == 0) {
+        (void)check;
+        printf("No SIMD functions in this build\n");
+    }
+
+    if (failures > 0) {
+        printf("%i failures\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
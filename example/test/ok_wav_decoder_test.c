@@ -0,0 +1,294 @@
+/*
+ Checks the incremental decoder in ok_wav.c: reads in various sizes, seeks forward and backward
+ with read/seek round trips, float reads, ADPCM block reads, and what happens when the input
+ function fails part way through a read or a seek.
+
+ Build and run from the repository root:
+
+     cc -std=c99 -Iinclude -Iexample/src example/test/ok_wav_decoder_test.c -o ok_wav_decoder_test
+     ./ok_wav_decoder_test
+ */
+
+#include "../src/ok_wav.c"
+#include <stdio.h>
+
+// More than one OK_WAV_CHUNK_SIZE of data, so reads take several chunks
+#define NUM_FRAMES 10000
+#define NUM_CHANNELS 2
+#define ADPCM_BLOCK_SIZE 256
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("FAIL: line %i: %s\n", __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+// A file in memory. Reads and seeks fail once the position would pass `fail_position`.
+typedef struct {
+    const uint8_t *data;
+    int length;
+    int position;
+    int fail_position;
+} memory_file;
+
+static int memory_input_func(void *user_data, uint8_t *buffer, const int count) {
+    memory_file *file = user_data;
+    const int end = file->position + count;
+    if (end > file->fail_position || end < 0) {
+        return 0;
+    }
+    if (buffer && count > 0) {
+        const int available = file->length - file->position;
+        const int length = count < available ? count : available;
+        memcpy(buffer, file->data + file->position, (size_t)length);
+        file->position += length;
+        return length;
+    } else {
+        file->position = end;
+        return count;
+    }
+}
+
+static void write_le16(uint8_t *p, const uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void write_le32(uint8_t *p, const uint32_t v) {
+    write_le16(p, v);
+    write_le16(p + 2, v >> 16);
+}
+
+// Writes a WAV file with the given data. Returns the length of the file.
+static int make_wav(uint8_t *file, const uint16_t format_tag, const uint16_t bit_depth,
+                    const uint16_t block_size, const uint32_t num_frames, const uint8_t *data,
+                    const uint32_t data_length) {
+    const bool adpcm = format_tag != 1;
+    const uint32_t fmt_length = adpcm ? 20 : 16;
+    uint8_t *p = file;
+    memcpy(p, "RIFF", 4);
+    memcpy(p + 8, "WAVE", 4);
+    p += 12;
+    memcpy(p, "fmt ", 4);
+    write_le32(p + 4, fmt_length);
+    write_le16(p + 8, format_tag);
+    write_le16(p + 10, NUM_CHANNELS);
+    write_le32(p + 12, 44100);
+    write_le32(p + 16, 44100 * block_size);
+    write_le16(p + 20, block_size);
+    write_le16(p + 22, bit_depth);
+    if (adpcm) {
+        // IMA ADPCM: the number of frames per block
+        write_le16(p + 24, 2);
+        write_le16(p + 26, (ADPCM_BLOCK_SIZE - 4 * NUM_CHANNELS) * 2 / NUM_CHANNELS + 1);
+    }
+    p += 8 + fmt_length;
+    if (adpcm) {
+        memcpy(p, "fact", 4);
+        write_le32(p + 4, 4);
+        write_le32(p + 8, num_frames);
+        p += 12;
+    }
+    memcpy(p, "data", 4);
+    write_le32(p + 4, data_length);
+    memcpy(p + 8, data, data_length);
+    p += 8 + data_length;
+    const int length = (int)(p - file);
+    write_le32(file + 4, (uint32_t)length - 8);
+    return length;
+}
+
+static int16_t pcm_sample(const uint32_t frame, const uint32_t channel) {
+    return (int16_t)(frame * 7 + channel * 3001);
+}
+
+static ok_wav_decoder *open_pcm(memory_file *file, uint8_t *file_data) {
+    static int16_t samples[NUM_FRAMES * NUM_CHANNELS];
+    for (uint32_t frame = 0; frame < NUM_FRAMES; frame++) {
+        for (uint32_t c = 0; c < NUM_CHANNELS; c++) {
+            write_le16((uint8_t *)&samples[frame * NUM_CHANNELS + c],
+                       (uint16_t)pcm_sample(frame, c));
+        }
+    }
+    file->data = file_data;
+    file->length = make_wav(file_data, 1, 16, NUM_CHANNELS * 2, NUM_FRAMES,
+                            (const uint8_t *)samples, sizeof(samples));
+    file->position = 0;
+    file->fail_position = INT32_MAX;
+    return ok_wav_open(file, memory_input_func, true);
+}
+
+// Checks `num_frames` frames read into `dst`, starting at `first_frame`
+static bool frames_match(const int16_t *dst, const uint32_t first_frame,
+                         const uint32_t num_frames) {
+    for (uint32_t i = 0; i < num_frames; i++) {
+        for (uint32_t c = 0; c < NUM_CHANNELS; c++) {
+            if (dst[i * NUM_CHANNELS + c] != pcm_sample(first_frame + i, c)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void test_read_sizes(void) {
+    static const uint32_t read_sizes[] = { 1, 7, 4096, 4097, NUM_FRAMES };
+    static uint8_t file_data[NUM_FRAMES * NUM_CHANNELS * 2 + 256];
+    static int16_t dst[NUM_FRAMES * NUM_CHANNELS];
+    for (size_t i = 0; i < sizeof(read_sizes) / sizeof(read_sizes[0]); i++) {
+        memory_file file;
+        ok_wav_decoder *decoder = open_pcm(&file, file_data);
+        CHECK(ok_wav_get_info(decoder)->num_frames == NUM_FRAMES);
+        uint32_t frame = 0;
+        while (frame < NUM_FRAMES) {
+            const uint64_t frames = ok_wav_read_frames(decoder, dst, read_sizes[i]);
+            const uint64_t expected = min(read_sizes[i], (uint64_t)(NUM_FRAMES - frame));
+            CHECK(frames == expected);
+            CHECK(frames_match(dst, frame, (uint32_t)frames));
+            if (frames == 0) {
+                break;
+            }
+            frame += (uint32_t)frames;
+        }
+        CHECK(ok_wav_read_frames(decoder, dst, 1) == 0);
+        ok_wav_close(decoder);
+    }
+}
+
+static void test_seek_round_trips(void) {
+    static const uint32_t seek_frames[] = { 5000, 0, 9999, 1, 4096, 4095, 8192, 3 };
+    static uint8_t file_data[NUM_FRAMES * NUM_CHANNELS * 2 + 256];
+    int16_t dst[100 * NUM_CHANNELS];
+    float dst_float[100 * NUM_CHANNELS];
+    memory_file file;
+    ok_wav_decoder *decoder = open_pcm(&file, file_data);
+    for (size_t i = 0; i < sizeof(seek_frames) / sizeof(seek_frames[0]); i++) {
+        const uint32_t frame = seek_frames[i];
+        const uint32_t expected = NUM_FRAMES - frame < 100 ? NUM_FRAMES - frame : 100;
+        CHECK(ok_wav_seek(decoder, frame));
+        CHECK(ok_wav_read_frames(decoder, dst, 100) == expected);
+        CHECK(frames_match(dst, frame, expected));
+
+        // Back to the same frame, as float
+        CHECK(ok_wav_seek(decoder, frame));
+        CHECK(ok_wav_read_frames_float(decoder, dst_float, 100) == expected);
+        for (uint32_t j = 0; j < expected * NUM_CHANNELS; j++) {
+            CHECK(dst_float[j] == dst[j] / 32768.0f);
+        }
+    }
+
+    // Seeking past the end stops at the end
+    CHECK(ok_wav_seek(decoder, NUM_FRAMES + 10));
+    CHECK(ok_wav_read_frames(decoder, dst, 1) == 0);
+    CHECK(ok_wav_seek(decoder, NUM_FRAMES - 1));
+    CHECK(ok_wav_read_frames(decoder, dst, 100) == 1);
+    CHECK(frames_match(dst, NUM_FRAMES - 1, 1));
+    CHECK(ok_wav_get_info(decoder)->error_message[0] == 0);
+    ok_wav_close(decoder);
+}
+
+static void test_read_failure(void) {
+    static uint8_t file_data[NUM_FRAMES * NUM_CHANNELS * 2 + 256];
+    static int16_t dst[NUM_FRAMES * NUM_CHANNELS];
+    memory_file file;
+    ok_wav_decoder *decoder = open_pcm(&file, file_data);
+    CHECK(ok_wav_read_frames(decoder, dst, 10) == 10);
+
+    // Fail in the second chunk of the next read. The first chunk is returned.
+    file.fail_position = file.position + OK_WAV_CHUNK_SIZE + 100;
+    const uint64_t frames = ok_wav_read_frames(decoder, dst, NUM_FRAMES);
+    CHECK(frames == OK_WAV_CHUNK_SIZE / (NUM_CHANNELS * 2));
+    CHECK(frames_match(dst, 10, (uint32_t)frames));
+    CHECK(ok_wav_get_info(decoder)->error_message[0] != 0);
+
+    // The decoder has failed
+    file.fail_position = INT32_MAX;
+    CHECK(ok_wav_read_frames(decoder, dst, 1) == 0);
+    CHECK(ok_wav_read_frames_float(decoder, (float *)dst, 1) == 0);
+    CHECK(!ok_wav_seek(decoder, 0));
+    ok_wav_close(decoder);
+
+    // The same, reading float
+    decoder = open_pcm(&file, file_data);
+    file.fail_position = file.position + OK_WAV_CHUNK_SIZE + 100;
+    static float dst_float[NUM_FRAMES * NUM_CHANNELS];
+    const uint64_t float_frames = ok_wav_read_frames_float(decoder, dst_float, NUM_FRAMES);
+    CHECK(float_frames == OK_WAV_CHUNK_SIZE / (NUM_CHANNELS * 2));
+    CHECK(dst_float[float_frames * NUM_CHANNELS - 1] ==
+          pcm_sample((uint32_t)float_frames - 1, NUM_CHANNELS - 1) / 32768.0f);
+    CHECK(ok_wav_get_info(decoder)->error_message[0] != 0);
+    ok_wav_close(decoder);
+}
+
+static void test_seek_failure(void) {
+    static uint8_t file_data[NUM_FRAMES * NUM_CHANNELS * 2 + 256];
+    int16_t dst[NUM_CHANNELS];
+    memory_file file;
+    ok_wav_decoder *decoder = open_pcm(&file, file_data);
+    file.fail_position = file.position + 100;
+    CHECK(!ok_wav_seek(decoder, 5000));
+    CHECK(ok_wav_get_info(decoder)->error_message[0] != 0);
+    file.fail_position = INT32_MAX;
+    CHECK(ok_wav_read_frames(decoder, dst, 1) == 0);
+    ok_wav_close(decoder);
+}
+
+static void test_adpcm_blocks(void) {
+    const uint32_t frames_per_block = (ADPCM_BLOCK_SIZE - 4 * NUM_CHANNELS) * 2 / NUM_CHANNELS + 1;
+    const uint32_t num_blocks = 10;
+    // The last block is truncated
+    const uint32_t num_frames = frames_per_block * (num_blocks - 1) + 10;
+    const uint32_t data_length = ADPCM_BLOCK_SIZE * (num_blocks - 1) + 100;
+    static uint8_t data[ADPCM_BLOCK_SIZE * 10];
+    static uint8_t file_data[ADPCM_BLOCK_SIZE * 10 + 256];
+    static uint8_t dst[ADPCM_BLOCK_SIZE * 10];
+    for (uint32_t i = 0; i < data_length; i++) {
+        data[i] = (uint8_t)(i * 13 + i / ADPCM_BLOCK_SIZE);
+    }
+    memory_file file = { file_data, 0, 0, INT32_MAX };
+    file.length = make_wav(file_data, 0x11, 4, ADPCM_BLOCK_SIZE, num_frames, data, data_length);
+    ok_wav_decoder *decoder = ok_wav_open(&file, memory_input_func, true);
+    CHECK(ok_wav_get_info(decoder)->encoding == OK_WAV_ENCODING_IMA_ADPCM);
+    CHECK(ok_wav_get_info(decoder)->num_frames == num_frames);
+
+    // Whole blocks only, until the end
+    CHECK(ok_wav_read_frames(decoder, dst, frames_per_block - 1) == 0);
+    CHECK(ok_wav_read_frames(decoder, dst, frames_per_block * 2 + 5) == frames_per_block * 2);
+    CHECK(memcmp(dst, data, ADPCM_BLOCK_SIZE * 2) == 0);
+
+    // Fail part way through the next read. The read is a single chunk, so no block is returned.
+    file.fail_position = file.position + ADPCM_BLOCK_SIZE * 2 + 10;
+    CHECK(ok_wav_read_frames(decoder, dst, frames_per_block * 3) == 0);
+    CHECK(ok_wav_get_info(decoder)->error_message[0] != 0);
+    ok_wav_close(decoder);
+
+    // Read the rest, including the truncated block, which is padded with zeros
+    file.position = 0;
+    file.fail_position = INT32_MAX;
+    decoder = ok_wav_open(&file, memory_input_func, true);
+    CHECK(ok_wav_read_frames(decoder, dst, num_frames + 100) == num_frames);
+    CHECK(memcmp(dst, data, data_length) == 0);
+    CHECK(dst[data_length] == 0 && dst[ADPCM_BLOCK_SIZE * num_blocks - 1] == 0);
+    CHECK(ok_wav_read_frames(decoder, dst, 1) == 0);
+
+    // Seeking isn't supported for ADPCM
+    CHECK(!ok_wav_seek(decoder, 0));
+    ok_wav_close(decoder);
+}
+
+int main(void) {
+    test_read_sizes();
+    test_seek_round_trips();
+    test_read_failure();
+    test_seek_failure();
+    test_adpcm_blocks();
+    if (failures > 0) {
+        printf("%i failures\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ Checks that each SIMD byte swapping function in ok_wav.c (AVX2, SSSE3, NEON), followed by
+ swap_bytes_scalar() for the rest, reverses every sample, for every bit depth ok_wav swaps, for
+ lengths that aren't a multiple of the vector width, and for unaligned data.
+
+ Build and run from the repository root:
+
+     cc -std=c99 -O2 -Iinclude -Iexample/src example/test/ok_wav_swap_test.c -o ok_wav_swap_test
+     ./ok_wav_swap_test
+
+ On ARM, add the NEON flags if the compiler doesn't enable them by default (e.g. -mfpu=neon).
+ */
+
+#include "../src/ok_wav.c"
+#include <stdio.h>
+
+#define MAX_LENGTH 512
+#define MAX_OFFSET 16
+
+// Reverses the bytes of each sample, independently of the functions being checked
+static void swap_bytes_reference(const int bit_depth, uint8_t *data, const size_t length) {
+    const size_t sample_size = (size_t)bit_depth / 8;
+    for (size_t i = 0; i + sample_size <= length; i += sample_size) {
+        for (size_t j = 0; j < sample_size / 2; j++) {
+            const uint8_t t = data[i + j];
+            data[i + j] = data[i + sample_size - 1 - j];
+            data[i + sample_size - 1 - j] = t;
+        }
+    }
+}
+
+static size_t swap_bytes_none(const int bit_depth, uint8_t *data, const size_t length) {
+    (void)bit_depth;
+    (void)data;
+    (void)length;
+    return 0;
+}
+
+typedef size_t (*swap_func)(const int bit_depth, uint8_t *data, const size_t length);
+
+static int check(const char *name, swap_func func) {
+    static const int bit_depths[] = { 16, 24, 32, 48, 64 };
+    const int num_bit_depths = (int)(sizeof(bit_depths) / sizeof(bit_depths[0]));
+    uint8_t expected[MAX_OFFSET + MAX_LENGTH + MAX_OFFSET];
+    uint8_t actual[MAX_OFFSET + MAX_LENGTH + MAX_OFFSET];
+    int failures = 0;
+
+    printf("Checking %s\n", name);
+    for (int d = 0; d < num_bit_depths; d++) {
+        const int bit_depth = bit_depths[d];
+        const size_t sample_size = (size_t)bit_depth / 8;
+        for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+            for (size_t length = 0; length <= MAX_LENGTH; length += sample_size) {
+                for (size_t i = 0; i < sizeof(expected); i++) {
+                    expected[i] = actual[i] = (uint8_t)(i * 37 + 11);
+                }
+                swap_bytes_reference(bit_depth, expected + offset, length);
+
+                // The SIMD function, then the scalar function for the rest
+                const size_t swapped = func(bit_depth, actual + offset, length);
+                if (swapped > length || swapped % sample_size != 0) {
+                    printf("FAIL: %s %i-bit, offset %zu, length %zu: swapped %zu bytes\n",
+                           name, bit_depth, offset, length, swapped);
+                    failures++;
+                    continue;
+                }
+                swap_bytes_scalar(bit_depth, actual + offset + swapped, length - swapped);
+                if (memcmp(expected, actual, sizeof(expected)) != 0) {
+                    printf("FAIL: %s %i-bit, offset %zu, length %zu\n", name, bit_depth, offset,
+                           length);
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int main(void) {
+    int failures = check("swap_bytes_scalar()", swap_bytes_none);
+#if defined(OK_WAV_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        failures += check("AVX2", swap_bytes_avx2);
+    } else {
+        printf("AVX2 not supported\n");
+    }
+#endif
+#if defined(OK_WAV_SSSE3)
+    if (__builtin_cpu_supports("ssse3")) {
+        failures += check("SSSE3", swap_bytes_ssse3);
+    } else {
+        printf("SSSE3 not supported\n");
+    }
+#elif defined(OK_WAV_NEON)
+    failures += check("NEON", swap_bytes_neon);
+#endif
+
+    if (failures > 0) {
+        printf("%i failures\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
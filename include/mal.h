@@ -36,6 +36,7 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -57,10 +58,40 @@ typedef enum {
     MAL_PLAYER_STATE_PAUSED,
 } mal_player_state;
 
+typedef enum {
+    MAL_SAMPLE_TYPE_INT = 0,
+    MAL_SAMPLE_TYPE_FLOAT,
+    MAL_SAMPLE_TYPE_IMA_ADPCM,
+    MAL_SAMPLE_TYPE_MS_ADPCM,
+} mal_sample_type;
+
+/**
+ * An audio format.
+ *
+ * Integer samples may have a bit depth of 8 (unsigned), 16, 24 (packed), or 32. Float samples must
+ * have a bit depth of 32.
+ *
+ * ADPCM samples (IMA or Microsoft, as found in WAV files) must have a bit depth of 4 and must be
+ * mono or stereo. The data is a sequence of blocks, each `block_size` bytes long (the WAV file's
+ * "block align"); the last block is padded to the full block size. The `block_size` is ignored for
+ * other sample types. See #mal_format_get_data_length(). Where supported, ADPCM buffers stay
+ * compressed in memory and are decoded block by block as they play (and playback positions are
+ * rounded down to a block boundary when a virtual player resumes). Otherwise, they are decoded to
+ * 16-bit or float when the buffer is created.
+ *
+ * The number of channels may be 1 (mono), 2 (stereo), 4 (quad), 6 (5.1), or 8 (7.1). Multichannel
+ * samples are interleaved in the same order as WAV files: front left, front right, front center,
+ * LFE, back left, back right, side left, side right (quad is front left, front right, back left,
+ * back right). If the underlying implementation can't play the channel layout, it is downmixed,
+ * scaled so that full-scale input doesn't clip. (Web Audio downmixes quad and 5.1 itself, without
+ * this scaling.)
+ */
 typedef struct {
     double sample_rate;
     uint8_t bit_depth;
     uint8_t num_channels;
+    mal_sample_type sample_type;
+    uint16_t block_size;
 } mal_format;
 
 typedef struct mal_context mal_context;
@@ -70,6 +101,111 @@ typedef struct mal_player mal_player;
 typedef void (*mal_deallocator_func)(void *);
 typedef void (*mal_playback_finished_func)(void *user_data, mal_player *player);
 
+/**
+ * Function that generates audio for a player created with #mal_player_create_with_render_func().
+ *
+ * The function is invoked on the audio thread (or on a render thread, see
+ * #mal_context_set_num_render_threads()), and should not block or allocate memory.
+ *
+ * @param user_data The user data passed to #mal_player_create_with_render_func().
+ * @param out The destination for interleaved 32-bit float samples, in the range -1.0 to 1.0.
+ * It has room for (`num_frames * num_channels`) samples.
+ * @param num_frames The number of frames to render.
+ * @param num_channels The number of channels in each frame.
+ * @return The number of frames rendered. If less than `num_frames`, playback finishes after the
+ * rendered frames are played.
+ */
+typedef uint32_t (*mal_render_func)(void *user_data, float *out, uint32_t num_frames,
+                                    uint32_t num_channels);
+
+/**
+ * A memory allocator for a context. See #mal_context_create_with_allocator().
+ *
+ * The `alloc` function returns uninitialized memory of at least `size` bytes, aligned to
+ * `alignment` bytes (a power of two), or `NULL` if out of memory. The `free` function releases
+ * memory returned from `alloc`, with the same `size`. Both are called on the main thread, with
+ * the `user_data` as the first parameter.
+ */
+typedef struct {
+    void *(*alloc)(void *user_data, size_t size, size_t alignment);
+    void (*free)(void *user_data, void *ptr, size_t size);
+    void *user_data;
+} mal_allocator;
+
+/**
+ * Receives audio rendered by a context's render thread. See #mal_context_create_ex().
+ *
+ * The function is invoked on the render thread. It typically writes the samples to an audio
+ * device, a pipe, or a file. If it blocks until the device needs the next period (for example, a
+ * blocking device write), set `render_output_blocks` in #mal_context_options so that the render
+ * thread is paced by it instead of by sleeping.
+ *
+ * @param user_data The `render_output_user_data` from #mal_context_options.
+ * @param samples Interleaved 32-bit float samples, (`num_frames * num_channels`) of them.
+ * @param num_frames The number of frames.
+ * @param num_channels The number of channels in each frame.
+ */
+typedef void (*mal_render_output_func)(void *user_data, const float *samples, uint32_t num_frames,
+                                       uint32_t num_channels);
+
+/**
+ * Options for #mal_context_create_ex(). Zero-initialize the struct, and set only the fields
+ * needed.
+ *
+ * The `allocator` is copied; if `NULL`, the default allocator is used (see
+ * #mal_context_create_with_allocator()). If `loopback_num_channels` is 1 or 2, the context is a
+ * loopback context (see #mal_context_create_loopback()); if 0, it outputs to a device.
+ *
+ * If `render_output` is set, the context must be a loopback context, and an internal render thread
+ * renders `render_quantum_frames` frames (256 if 0) per period and passes them to `render_output`.
+ * If `render_output_blocks` is `false`, the thread sleeps until each period is due; if `true`, it
+ * doesn't sleep, and `render_output` paces it. The thread can be tuned for low-latency,
+ * glitch-free output:
+ *
+ * - `render_thread_realtime`: Run with the `SCHED_FIFO` policy at `render_thread_priority` (or, if
+ *   0, the middle of the `SCHED_FIFO` range).
+ * - `render_thread_pin_cpu`: Pin the thread to CPU `render_thread_cpu` (Linux only, and only if
+ *   `sched_setaffinity` is declared, which glibc requires `_GNU_SOURCE` for).
+ * - `render_thread_lock_memory`: Give the thread a 512 KiB stack, and lock it and the mix buffer
+ *   with `mlock`, so that rendering doesn't page fault. The rest of the process isn't locked.
+ *
+ * These usually require privileges (like `CAP_SYS_NICE`, `CAP_IPC_LOCK`, or an `rtprio` limit).
+ * If a request can't be granted, the thread continues without it; see
+ * #mal_context_get_render_thread_stats() for the settings actually achieved.
+ */
+typedef struct {
+    const mal_allocator *allocator;
+    uint8_t loopback_num_channels;
+    mal_render_output_func render_output;
+    void *render_output_user_data;
+    bool render_output_blocks;
+    uint32_t render_quantum_frames;
+    bool render_thread_realtime;
+    int render_thread_priority;
+    bool render_thread_pin_cpu;
+    uint32_t render_thread_cpu;
+    bool render_thread_lock_memory;
+} mal_context_options;
+
+/**
+ * Statistics for a context's render thread. See #mal_context_get_render_thread_stats().
+ *
+ * The `realtime` and `priority` fields are the thread's actual scheduling policy (`SCHED_FIFO`)
+ * and priority. The thread is pinned to `cpu` if `pinned` is `true`. If `memory_locked` is `true`,
+ * the mix buffer and the thread's stack are locked. A missed deadline is a period that finished
+ * rendering and output after the time it was due or, if `render_output_blocks` is set, a period
+ * that took longer than its duration to render (not counting output).
+ */
+typedef struct {
+    bool realtime;
+    int priority;
+    bool pinned;
+    uint32_t cpu;
+    bool memory_locked;
+    uint64_t num_periods;
+    uint64_t num_missed_deadlines;
+} mal_render_thread_stats;
+
 // MARK: Context
 
 /**
@@ -80,6 +216,69 @@ typedef void (*mal_playback_finished_func)(void *user_data, mal_player *player);
  */
 mal_context *mal_context_create(double sample_rate);
 
+/**
+ * Creates an audio context that allocates its objects with the specified allocator.
+ *
+ * The context, players, and buffers are allocated from pools of cache-line-aligned slots. The
+ * pools grow in slabs from the allocator, and slots are reused as objects are freed. The slabs are
+ * returned to the allocator after the context and all its players and buffers are freed.
+ *
+ * Buffer data, and memory used internally by containers and by the underlying implementation,
+ * still come from `malloc`.
+ *
+ * @param sample_rate The output sample rate, typically 44100 or 22050.
+ * @param allocator The allocator, which is copied. If `NULL`, the default allocator is used.
+ * @return The context, or `NULL` if the allocator's functions are `NULL` or the context couldn't
+ * be created.
+ */
+mal_context *mal_context_create_with_allocator(double sample_rate, const mal_allocator *allocator);
+
+/**
+ * Creates an audio context that isn't connected to an audio device. Instead, audio is rendered on
+ * demand with #mal_context_render(), as fast as the caller wants. This is useful for headless
+ * environments, like servers or continuous integration, that have no sound card.
+ *
+ * Currently only the OpenAL implementation supports loopback contexts (it requires the
+ * `ALC_SOFT_loopback` extension).
+ *
+ * @param sample_rate The output sample rate, typically 44100 or 22050.
+ * @param num_channels The number of output channels, either 1 or 2.
+ * @return The context, or `NULL` if loopback contexts are not supported.
+ */
+mal_context *mal_context_create_loopback(double sample_rate, uint8_t num_channels);
+
+/**
+ * Creates an audio context with the specified options. See #mal_context_options.
+ *
+ * @param sample_rate The output sample rate, typically 44100 or 22050.
+ * @param options The options. If `NULL`, this is the same as #mal_context_create().
+ * @return The context, or `NULL` if the options are invalid, loopback contexts are not supported,
+ * or the render thread couldn't be created.
+ */
+mal_context *mal_context_create_ex(double sample_rate, const mal_context_options *options);
+
+/**
+ * Gets statistics of the render thread of a context created with #mal_context_create_ex().
+ *
+ * @param context The audio context.
+ * @param out_stats The location to store the statistics.
+ * @return `true` if successful, `false` if the context doesn't have a render thread.
+ */
+bool mal_context_get_render_thread_stats(const mal_context *context,
+                                         mal_render_thread_stats *out_stats);
+
+/**
+ * Renders audio from a loopback context created with #mal_context_create_loopback().
+ *
+ * @param context The audio context. If `NULL`, this function returns `false`.
+ * @param out The output buffer of interleaved float samples. It must have room for
+ * (`num_frames * num_channels`) samples.
+ * @param num_frames The number of frames to render.
+ * @return `true` if successful, `false` if the context is not a loopback context, or if the
+ * context has a render thread (see #mal_context_create_ex()).
+ */
+bool mal_context_render(mal_context *context, float *out, uint32_t num_frames);
+
 /**
  * Activates or deactivates the audio context. The context should be deactivated when the app enters
  * the background. By default, a newly created context is active.
@@ -151,6 +350,177 @@ bool mal_context_format_is_valid(const mal_context *context, mal_format format);
  */
 bool mal_formats_equal(mal_format format1, mal_format format2);
 
+/**
+ * Gets the byte length of audio data in the specified format.
+ *
+ * For ADPCM formats, this is the length of the blocks needed to hold `num_frames` frames.
+ *
+ * @return The byte length, or 0 if the format is invalid.
+ */
+size_t mal_format_get_data_length(mal_format format, uint32_t num_frames);
+
+/**
+ * Sets the gain below which a playing player becomes virtual. A virtual player is not mixed and
+ * releases its platform voice, but its playback position keeps advancing while the context is
+ * active. When the player becomes audible again, it resumes at the position it would have reached.
+ *
+ * The audible gain of a player is the player's gain multiplied by the context's gain, or 0 if
+ * either is muted. Players created with #mal_player_create_with_render_func() are never virtual.
+ *
+ * Virtualization is enabled when the threshold is greater than 0 or the maximum number of real
+ * players is set with #mal_context_set_max_real_players(). By default, it is disabled.
+ * While enabled, call #mal_context_update() regularly (for example, once per frame).
+ *
+ * @param context The audio context. If `NULL`, this function does nothing.
+ * @param gain The audibility threshold, typically around 0.001.
+ */
+void mal_context_set_audible_gain_threshold(mal_context *context, float gain);
+
+/**
+ * Gets the gain below which a playing player becomes virtual.
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ * @return The audibility threshold.
+ */
+float mal_context_get_audible_gain_threshold(const mal_context *context);
+
+/**
+ * Sets the maximum number of players that hold a platform voice (a Core Audio mixer bus, an
+ * OpenSL ES player, an OpenAL source, etc.). When more players are playing than the maximum, the
+ * players with the lowest audible gain become virtual.
+ *
+ * While a maximum is set, #mal_player_create() succeeds even if no platform voice is available.
+ *
+ * @param context The audio context. If `NULL`, this function does nothing.
+ * @param max_real_players The maximum number of real players, or 0 for no maximum (the default).
+ */
+void mal_context_set_max_real_players(mal_context *context, uint32_t max_real_players);
+
+/**
+ * Gets the maximum number of real players.
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ * @return The maximum number of real players, or 0 if there is no maximum.
+ */
+uint32_t mal_context_get_max_real_players(const mal_context *context);
+
+/**
+ * Updates virtual players. Players that became audible are made real, players that became
+ * inaudible are made virtual, and the finished function is called for virtual players that
+ * reached the end of their buffer.
+ *
+ * On OpenAL, this function also detects players that reached the end of their buffer: their
+ * state changes to #MAL_PLAYER_STATE_STOPPED, and their finished functions are invoked.
+ *
+ * This function should be called on the main thread.
+ *
+ * @param context The audio context. If `NULL`, this function does nothing.
+ */
+void mal_context_update(mal_context *context);
+
+/**
+ * Gets the number of players that were playing or paused using a platform voice, as of the last
+ * call to #mal_context_update().
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ */
+uint32_t mal_context_get_num_real_players(const mal_context *context);
+
+/**
+ * Gets the number of players that were playing or paused virtually, as of the last call to
+ * #mal_context_update().
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ */
+uint32_t mal_context_get_num_virtual_players(const mal_context *context);
+
+/**
+ * Sets the number of threads that render voices. With more than one thread, before each mix the
+ * playing render function players (see #mal_player_create_with_render_func()) are split into
+ * chunks, and the audio thread and a pool of worker threads render the chunks in parallel. This
+ * helps when there are many render function players and their render functions are expensive.
+ *
+ * Only render function players are rendered in parallel. Players of buffers are always rendered
+ * on the audio thread. A render function player is rendered on the audio thread, too, when its
+ * sample rate differs from the output sample rate, when it is locked by another thread at the
+ * time, or when a worker hasn't rendered it by the time the audio thread stops waiting (half the
+ * render quantum).
+ *
+ * Currently only the Core Audio implementation renders voices in parallel.
+ *
+ * @param context The audio context. If `NULL`, this function returns `false`.
+ * @param num_threads The number of threads, including the audio thread, or 0 to use one thread
+ * per CPU. The default is 1.
+ * @return `true` if successful, `false` if parallel rendering isn't supported or the worker
+ * threads couldn't be created.
+ */
+bool mal_context_set_num_render_threads(mal_context *context, uint32_t num_threads);
+
+/**
+ * Gets the number of threads that render voices.
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ */
+uint32_t mal_context_get_num_render_threads(const mal_context *context);
+
+/**
+ * Sets the maximum memory used by native caches (see #mal_buffer_set_native_cache()). When the
+ * budget is exceeded, the least recently played caches are evicted, and those buffers play from
+ * their original data until they are cached again. The default budget is 16 MB.
+ *
+ * @param context The audio context. If `NULL`, this function does nothing.
+ * @param max_bytes The maximum number of bytes used by native caches.
+ */
+void mal_context_set_native_cache_budget(mal_context *context, size_t max_bytes);
+
+/**
+ * Gets the maximum memory used by native caches.
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ */
+size_t mal_context_get_native_cache_budget(const mal_context *context);
+
+/**
+ * Gets the memory currently used by native caches.
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ */
+size_t mal_context_get_native_cache_size(const mal_context *context);
+
+/**
+ * Enables or disables buffer deduplication. When enabled, the data passed to #mal_buffer_create()
+ * and #mal_buffer_create_no_copy() (and the data of async loads) is hashed. If a buffer with the
+ * same content already exists, the new buffer is an alias that shares the existing buffer's
+ * storage, and the new data isn't kept. Buffers created with #mal_buffer_create_uninitialized()
+ * are not deduplicated.
+ *
+ * Aliases behave like separate buffers, and each should be freed with #mal_buffer_free(). Shared
+ * storage is freed when the last buffer using it is freed.
+ *
+ * Content is matched by format, number of frames, and a 64-bit hash of the data, and then
+ * confirmed by comparing the data. Only buffers whose data is kept in memory (rather than only
+ * uploaded to the audio system) can be shared. Deduplication is disabled by default.
+ *
+ * @param context The audio context. If `NULL`, this function does nothing.
+ * @param enabled `true` to enable deduplication.
+ */
+void mal_context_set_buffer_dedup(mal_context *context, bool enabled);
+
+/**
+ * Checks if buffer deduplication is enabled.
+ *
+ * @param context The audio context. If `NULL`, this function returns `false`.
+ */
+bool mal_context_get_buffer_dedup(const mal_context *context);
+
+/**
+ * Gets the number of bytes of buffer data saved by deduplication, that is, the total size of the
+ * existing aliases.
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ */
+size_t mal_context_get_dedup_bytes_saved(const mal_context *context);
+
 /**
  * Frees the context. All buffers and players created with the context will no longer be valid.
  *
@@ -163,8 +533,11 @@ void mal_context_free(mal_context *context);
 /**
  * Creates a new audio buffer from the provided data. The data buffer is copied.
  *
- * The data must be in signed linear PCM format. The byte order must be the same as the native
- * byte order (usually little endian). If stereo, the data must be interleaved.
+ * The data must be in linear PCM or ADPCM format. The byte order must be the same as the native
+ * byte order (usually little endian). Multichannel data must be interleaved.
+ *
+ * If the format isn't supported natively by the underlying implementation, the data is converted
+ * when the buffer is created. See #mal_buffer_get_format().
  *
  * The buffer should be freed with #mal_buffer_free().
  *
@@ -172,7 +545,7 @@ void mal_context_free(mal_context *context);
  * @param format The format of the provided data.
  * @param num_frames The number of frames in the provided data.
  * @param data The data buffer. The data buffer must have the same byte order as the native CPU, and
- * it must have a byte length of (`format.bit_depth / 8 * format.num_channels * num_frames`).
+ * it must have a byte length of `mal_format_get_data_length(format, num_frames)`.
  * @return If successful, returns the audio buffer. Returns `NULL` if the format is invalid,
  * `num_frames` is zero, `data` is `NULL`, or an out-of-memory error occurs.
  */
@@ -182,12 +555,14 @@ mal_buffer *mal_buffer_create(mal_context *context, mal_format format, uint32_t
 /**
  * Creates a new audio buffer from the provided data.
  *
- * The data must be in signed linear PCM format. The byte order must be the same as the native
- * byte order (usually little endian). If stereo, the data must be interleaved.
+ * The data must be in linear PCM or ADPCM format. The byte order must be the same as the native
+ * byte order (usually little endian). Multichannel data must be interleaved.
  *
- * If possible, the data is used directly without copying. When the original data is no longer
- * needed, the `data_deallocator` function is called. If the underlying implementation must copy
- * buffers, the `data_deallocator` function is called immediately, before returning.
+ * If possible, the data is used directly without copying. If the format isn't supported natively
+ * by the underlying implementation, the data is converted. When the original data is no longer
+ * needed, the `data_deallocator` function is called. If the data is converted, or if the
+ * underlying implementation must copy buffers, the `data_deallocator` function is called
+ * immediately, before returning.
  *
  * The `data_deallocator` is not called if this function returns `NULL`.
  *
@@ -197,7 +572,7 @@ mal_buffer *mal_buffer_create(mal_context *context, mal_format format, uint32_t
  * @param format The format of the provided data.
  * @param num_frames The number of frames in the provided data.
  * @param data The data buffer. The data buffer must have the same byte order as the native CPU, and
- * it must have a byte length of (`format.bit_depth / 8 * format.num_channels * num_frames`).
+ * it must have a byte length of `mal_format_get_data_length(format, num_frames)`.
  * @param data_deallocator The deallocator to call when the data is no longer needed. May be `NULL`.
  * @return If successful, returns the audio buffer. Returns `NULL` if the format is invalid,
  * `num_frames` is zero, `data` is `NULL`, or an out-of-memory error occurs.
@@ -205,11 +580,56 @@ mal_buffer *mal_buffer_create(mal_context *context, mal_format format, uint32_t
 mal_buffer *mal_buffer_create_no_copy(mal_context *context, mal_format format, uint32_t num_frames,
                                       void *data, mal_deallocator_func data_deallocator);
 
+/**
+ * Creates a new audio buffer with uninitialized storage, so that audio can be decoded directly into
+ * the buffer without an intermediate copy. Get the storage with #mal_buffer_lock_data(), write the
+ * data, and then call #mal_buffer_commit_data(). The buffer can't be attached to a player until
+ * the data is committed.
+ *
+ * The data must be in linear PCM or ADPCM format. The byte order must be the same as the native
+ * byte order (usually little endian). Multichannel data must be interleaved.
+ *
+ * If the format is supported natively and the underlying implementation doesn't copy buffers, the
+ * storage is used directly by the buffer. Otherwise, the data is converted or copied when it is
+ * committed, and the storage is freed.
+ *
+ * The buffer should be freed with #mal_buffer_free().
+ *
+ * @param context The audio context. If `NULL`, this function returns `NULL`.
+ * @param format The format of the data that will be written.
+ * @param num_frames The number of frames in the buffer.
+ * @return If successful, returns the audio buffer. Returns `NULL` if the format is invalid,
+ * `num_frames` is zero, or an out-of-memory error occurs.
+ */
+mal_buffer *mal_buffer_create_uninitialized(mal_context *context, mal_format format,
+                                            uint32_t num_frames);
+
+/**
+ * Gets the storage of a buffer created with #mal_buffer_create_uninitialized(). The storage has a
+ * byte length of `mal_format_get_data_length(format, num_frames)`.
+ *
+ * @param buffer The audio buffer. If `NULL`, this function returns `NULL`.
+ * @return The storage to write to, or `NULL` if the buffer's data was already committed.
+ */
+void *mal_buffer_lock_data(mal_buffer *buffer);
+
+/**
+ * Commits the data written to the storage returned by #mal_buffer_lock_data(). After this call,
+ * the storage must not be accessed, and the buffer can be attached to players.
+ *
+ * @param buffer The audio buffer. If `NULL`, this function returns `false`.
+ * @return `true` if successful. Returns `false` if the data was already committed, or if an
+ * error occurs, in which case the storage remains locked.
+ */
+bool mal_buffer_commit_data(mal_buffer *buffer);
+
 /**
  * Gets the format of the buffer.
  * 
  * The sample rate of the returned format may be slightly different than the one specified in 
- * #mal_buffer_create() or #mal_buffer_create_no_copy().
+ * #mal_buffer_create() or #mal_buffer_create_no_copy(). If the data was converted to a format
+ * supported natively by the underlying implementation, the returned format is the converted
+ * format.
  *
  * @param buffer The audio buffer. If `NULL`, the returned format will have a sample rate of 0.
  * @return The audio format of the buffer.
@@ -234,12 +654,271 @@ uint32_t mal_buffer_get_num_frames(const mal_buffer *buffer);
 void *mal_buffer_get_data(const mal_buffer *buffer);
 
 /**
- * Frees the buffer. Any players using the buffer are stopped.
+ * Enables or disables the native cache for a buffer. A native cache is a copy of the buffer
+ * converted to 32-bit float and resampled to the context's sample rate, so that the mixer doesn't
+ * convert the buffer every time it is played. This is useful for short sounds that are played
+ * often.
+ *
+ * The cache is created on a background thread and is attached to the buffer during
+ * #mal_context_update(). Players that start playing after the cache is attached use the cache.
+ * The cache counts against the context's budget (see #mal_context_set_native_cache_budget()).
+ *
+ * Currently only the Core Audio implementation uses native caches. Other implementations convert
+ * buffers once, when they are created.
+ *
+ * @param buffer The audio buffer. If `NULL`, this function returns `false`.
+ * @param enabled `true` to create the native cache, `false` to release it.
+ * @return `true` if successful, `false` if native caches are not supported.
+ */
+bool mal_buffer_set_native_cache(mal_buffer *buffer, bool enabled);
+
+/**
+ * Checks if the buffer's native cache is ready.
+ *
+ * @param buffer The audio buffer. If `NULL`, this function returns `false`.
+ */
+bool mal_buffer_has_native_cache(const mal_buffer *buffer);
+
+/**
+ * Frees the buffer. Any players using the buffer are stopped. If the buffer is in a buffer cache,
+ * it is removed from the cache.
  *
  * @param buffer The audio buffer. If `NULL`, this function returns nothing.
  */
 void mal_buffer_free(mal_buffer *buffer);
 
+// MARK: Buffer cache
+
+typedef struct mal_buffer_cache mal_buffer_cache;
+
+/**
+ * Counters for a buffer cache. See #mal_buffer_cache_get_stats().
+ *
+ * A hit is a call to #mal_buffer_cache_get() that found the asset, and a miss is a call that
+ * didn't (whether or not the asset was reloaded). An eviction is a buffer freed to keep the cache
+ * within its budget.
+ */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} mal_buffer_cache_stats;
+
+/**
+ * A function that creates a buffer for an asset that isn't in the cache, usually because it was
+ * evicted. Called on the main thread from #mal_buffer_cache_get().
+ *
+ * @param user_data The `user_data` passed to #mal_buffer_cache_set_reload_func().
+ * @param context The cache's audio context.
+ * @param asset_id The asset id.
+ * @return The new buffer, which is owned by the cache, or `NULL` if the asset couldn't be loaded.
+ */
+typedef mal_buffer *(*mal_buffer_cache_reload_func)(void *user_data, mal_context *context,
+                                                    const char *asset_id);
+
+/**
+ * Creates a cache of buffers keyed by asset id. When the total size of the buffers exceeds the
+ * budget, the least recently used buffers are freed. Buffers attached to players (see
+ * #mal_player_set_buffer()) are pinned, and are not evicted until no players use them. The most
+ * recently used buffer is never evicted.
+ *
+ * The cache should be freed with #mal_buffer_cache_free(), before the context is freed.
+ *
+ * @param context The audio context. If `NULL`, this function returns `NULL`.
+ * @param max_bytes The maximum number of bytes of buffer data kept in the cache.
+ * @return The cache, or `NULL` if an out-of-memory error occurs.
+ */
+mal_buffer_cache *mal_buffer_cache_create(mal_context *context, size_t max_bytes);
+
+/**
+ * Sets the function called when an asset that isn't in the cache is requested.
+ *
+ * @param cache The buffer cache. If `NULL`, this function does nothing.
+ * @param reload_func The reload function. May be `NULL`.
+ * @param user_data The parameter to be passed to the `reload_func`.
+ */
+void mal_buffer_cache_set_reload_func(mal_buffer_cache *cache,
+                                      mal_buffer_cache_reload_func reload_func, void *user_data);
+
+/**
+ * Adds a buffer to the cache. The cache owns the buffer: it may be freed when evicted, and it is
+ * freed when the cache is freed. If the buffer is freed with #mal_buffer_free(), it is removed
+ * from the cache.
+ *
+ * @param cache The buffer cache. If `NULL`, this function returns `false`.
+ * @param asset_id The asset id. The string is copied.
+ * @param buffer The buffer, created with the cache's context.
+ * @return `true` if successful. Returns `false` if the asset id is already in the cache, the
+ * buffer is already in a cache, or an out-of-memory error occurs.
+ */
+bool mal_buffer_cache_add(mal_buffer_cache *cache, const char *asset_id, mal_buffer *buffer);
+
+/**
+ * Gets the buffer for an asset, and marks it as the most recently used. If the asset isn't in the
+ * cache and a reload function is set, the asset is reloaded and added to the cache.
+ *
+ * @param cache The buffer cache. If `NULL`, this function returns `NULL`.
+ * @param asset_id The asset id.
+ * @return The buffer, or `NULL` if the asset isn't in the cache and couldn't be reloaded.
+ */
+mal_buffer *mal_buffer_cache_get(mal_buffer_cache *cache, const char *asset_id);
+
+/**
+ * Checks if an asset is in the cache, without affecting the least recently used order or the
+ * counters.
+ *
+ * @param cache The buffer cache. If `NULL`, this function returns `false`.
+ */
+bool mal_buffer_cache_contains(const mal_buffer_cache *cache, const char *asset_id);
+
+/**
+ * Sets the maximum number of bytes of buffer data kept in the cache. If the cache is over the new
+ * budget, buffers are evicted.
+ *
+ * @param cache The buffer cache. If `NULL`, this function does nothing.
+ */
+void mal_buffer_cache_set_budget(mal_buffer_cache *cache, size_t max_bytes);
+
+/**
+ * Gets the maximum number of bytes of buffer data kept in the cache.
+ *
+ * @param cache The buffer cache. If `NULL`, this function returns 0.
+ */
+size_t mal_buffer_cache_get_budget(const mal_buffer_cache *cache);
+
+/**
+ * Gets the number of bytes of buffer data currently in the cache. This may exceed the budget if
+ * buffers are pinned.
+ *
+ * @param cache The buffer cache. If `NULL`, this function returns 0.
+ */
+size_t mal_buffer_cache_get_size(const mal_buffer_cache *cache);
+
+/**
+ * Evicts buffers until the cache is within budget. Buffers are evicted automatically when they are
+ * added or the budget changes; call this function after players release pinned buffers, for
+ * example, once per frame or after a level is unloaded.
+ *
+ * @param cache The buffer cache. If `NULL`, this function does nothing.
+ */
+void mal_buffer_cache_trim(mal_buffer_cache *cache);
+
+/**
+ * Gets the cache's counters.
+ *
+ * @param cache The buffer cache. If `NULL`, the returned counters are all 0.
+ */
+mal_buffer_cache_stats mal_buffer_cache_get_stats(const mal_buffer_cache *cache);
+
+/**
+ * Frees the cache and all buffers in it. Any players using the buffers are stopped.
+ *
+ * @param cache The buffer cache. If `NULL`, this function does nothing.
+ */
+void mal_buffer_cache_free(mal_buffer_cache *cache);
+
+// MARK: Loading
+
+/**
+ * The audio data produced by a #mal_buffer_load_func. The `data` must be in a format accepted by
+ * #mal_buffer_create_no_copy(), with a byte length of
+ * `mal_format_get_data_length(format, num_frames)`. The `data_deallocator` is called when the data
+ * is no longer needed, and may be `NULL`.
+ */
+typedef struct {
+    mal_format format;
+    uint32_t num_frames;
+    void *data;
+    mal_deallocator_func data_deallocator;
+} mal_buffer_load_result;
+
+/**
+ * A function that loads (and usually decodes) audio data. The function is called on a loader
+ * thread, so it must not call other mal functions.
+ *
+ * @param user_data The `user_data` passed to #mal_buffer_load_async().
+ * @param result The result to fill in. The `data` is owned by mal, even if the function fails.
+ * @return `true` if successful.
+ */
+typedef bool (*mal_buffer_load_func)(void *user_data, mal_buffer_load_result *result);
+
+/**
+ * Identifies a load started with #mal_buffer_load_async(). Zero is never a valid id.
+ */
+typedef uint32_t mal_load_id;
+
+/**
+ * An event for a finished load. See #mal_context_poll_load_event().
+ *
+ * The `user_data` is the parameter passed to #mal_buffer_load_async(). The `buffer` is the new
+ * buffer, or `NULL` if loading failed. The buffer should be freed with #mal_buffer_free().
+ */
+typedef struct {
+    mal_load_id load_id;
+    void *user_data;
+    mal_buffer *buffer;
+} mal_load_event;
+
+/**
+ * Sets the number of loader threads used by #mal_buffer_load_async(). If the loader threads are
+ * running, they are restarted after their current loads finish. If no threads could be restarted,
+ * the loads that haven't started fail, and their events are returned from
+ * #mal_context_poll_load_event() with a `NULL` buffer.
+ *
+ * @param context The audio context. If `NULL`, this function does nothing.
+ * @param num_threads The number of threads, or 0 to use one thread per CPU (the default).
+ */
+void mal_context_set_num_load_threads(mal_context *context, uint32_t num_threads);
+
+/**
+ * Gets the number of loader threads.
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ */
+uint32_t mal_context_get_num_load_threads(const mal_context *context);
+
+/**
+ * Loads a buffer on a loader thread. The `load_func` is called on a loader thread. Its format is
+ * validated on the main thread, in #mal_context_poll_load_event(), and if the data isn't in a
+ * format supported natively by the underlying implementation, it is converted on a loader thread,
+ * too. The buffer is created when its event is returned from #mal_context_poll_load_event().
+ *
+ * Loads with a higher priority start first. Loads with the same priority start in the order they
+ * were requested. The loader threads are started on the first load.
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ * @param load_func The function that loads the data. If `NULL`, this function returns 0.
+ * @param user_data The parameter to be passed to the `load_func`, and returned in the event.
+ * @param priority The priority of the load.
+ * @return The load id, or 0 if the load couldn't be started.
+ */
+mal_load_id mal_buffer_load_async(mal_context *context, mal_buffer_load_func load_func,
+                                  void *user_data, int priority);
+
+/**
+ * Cancels a load. No event is returned for a canceled load. If the load is in progress, it
+ * continues on its loader thread, but the result is discarded.
+ *
+ * @param context The audio context. If `NULL`, this function returns `false`.
+ * @param load_id The id returned from #mal_buffer_load_async().
+ * @return `true` if the load was canceled, `false` if the load id is not pending (for example, if
+ * its event was already returned).
+ */
+bool mal_buffer_load_cancel(mal_context *context, mal_load_id load_id);
+
+/**
+ * Gets the next finished load, and creates its buffer. Events are returned in the order the loads
+ * finished.
+ *
+ * This function should be called on the main thread, usually once per frame until it returns
+ * `false`.
+ *
+ * @param context The audio context. If `NULL`, this function returns `false`.
+ * @param event The event to fill in.
+ * @return `true` if an event was returned, `false` if no loads have finished.
+ */
+bool mal_context_poll_load_event(mal_context *context, mal_load_event *event);
+
 // MARK: Players
 
 /**
@@ -256,9 +935,40 @@ void mal_buffer_free(mal_buffer *buffer);
  */
 mal_player *mal_player_create(mal_context *context, mal_format format);
 
+/**
+ * Creates a new player that plays audio generated by a render function instead of a buffer.
+ *
+ * The player has the same gain, mute, state, and finished callback behavior as a buffer player.
+ * Buffers cannot be attached to the player, and looping has no effect. The player finishes when
+ * `render_func` renders fewer frames than requested.
+ *
+ * The `sample_rate` and `num_channels` of the format are used for rendering. The `bit_depth` must
+ * be valid, but the render function always outputs 32-bit float samples.
+ *
+ * Render functions can stream long audio, like music, from a decoder so that the entire audio
+ * doesn't need to be in memory.
+ *
+ * The Core Audio, OpenSL ES, and OpenAL implementations support render functions. On OpenAL, the
+ * render function is invoked on the OpenAL mixer thread if the `AL_SOFT_callback_buffer` extension
+ * is available, otherwise on a streaming thread that refills a small queue of buffers.
+ *
+ * The player should be freed with #mal_player_free().
+ *
+ * @param context The audio context. If `NULL`, this function returns `NULL`.
+ * @param format The format of the player to create.
+ * @param render_func The function that generates audio. If `NULL`, this function returns `NULL`.
+ * @param user_data The user data to pass to the render function. May be `NULL`.
+ * @return The player, or `NULL` if the player could not be created.
+ */
+mal_player *mal_player_create_with_render_func(mal_context *context, mal_format format,
+                                               mal_render_func render_func, void *user_data);
+
 /**
  * Gets the playback format of the player.
  *
+ * Like buffers, the player's format is converted to a format supported natively by the underlying
+ * implementation, so a player and a buffer created with the same format have equal formats.
+ *
  * @param player The audio player. If `NULL`, this function returns a format with a sample rate of 
  * 0.
  * @return The audio format of the player.
@@ -282,7 +992,8 @@ bool mal_player_set_format(mal_player *player, mal_format format);
 /**
  * Attaches a buffer to the player. Any existing buffer is removed.
  *
- * A buffer may be attached to multiple players.
+ * A buffer may be attached to multiple players. Buffers cannot be attached to players created
+ * with #mal_player_create_with_render_func().
  *
  * On OpenAL and Web Audio implementations, the player's playback format is set to the buffer's 
  * format.
@@ -314,7 +1025,8 @@ const mal_buffer *mal_player_get_buffer(const mal_player *player);
  * The player may still be in the #MAL_PLAYER_STATE_PLAYING state when this function is called.
  *
  * The function is invoked on the main thread. On Android, the main thread is the thread that
- * invoked #mal_context_set_active().
+ * invoked #mal_context_set_active(). On OpenAL, the function is invoked from
+ * #mal_context_update().
  *
  * @param player The player. If `NULL`, this function does nothing.
  * @param on_finished The callback function, or `NULL`.
@@ -393,11 +1105,23 @@ bool mal_player_set_state(mal_player *player, mal_player_state state);
 /**
  * Gets the state of the player.
  *
+ * On OpenAL, a player that reached the end of its buffer is reported as playing until the next
+ * call to #mal_context_update().
+ *
  * @param player The audio player. If `NULL`, this function returns #MAL_PLAYER_STATE_STOPPED.
  * @return The current state of the player.
  */
 mal_player_state mal_player_get_state(mal_player *player);
 
+/**
+ * Checks if the player is virtual. A virtual player is playing or paused, but is not mixed.
+ * See #mal_context_set_audible_gain_threshold().
+ *
+ * @param player The audio player. If `NULL`, this function returns `false`.
+ * @return `true` if the player is virtual.
+ */
+bool mal_player_is_virtual(const mal_player *player);
+
 /**
  * Frees the player.
  *
@@ -405,6 +1129,54 @@ mal_player_state mal_player_get_state(mal_player *player);
  */
 void mal_player_free(mal_player *player);
 
+// MARK: Generators
+
+typedef enum {
+    MAL_GENERATOR_SINE = 0,
+    MAL_GENERATOR_SQUARE,
+    MAL_GENERATOR_NOISE,
+} mal_generator_type;
+
+/**
+ * A simple tone or noise generator, for use as the user data of #mal_generator_render().
+ *
+ * The `frequency` and `amplitude` fields may be modified while playing.
+ */
+typedef struct {
+    mal_generator_type type;
+    double sample_rate;
+    float frequency;
+    float amplitude;
+    double phase;
+    uint32_t seed;
+} mal_generator;
+
+/**
+ * Initializes a generator with an amplitude of 1.0.
+ *
+ * @param generator The generator. If `NULL`, this function does nothing.
+ * @param type The waveform type.
+ * @param sample_rate The sample rate of the player the generator is used with.
+ * @param frequency The frequency, in Hz. Ignored for #MAL_GENERATOR_NOISE.
+ */
+void mal_generator_init(mal_generator *generator, mal_generator_type type, double sample_rate,
+                        float frequency);
+
+/**
+ * A #mal_render_func that renders a #mal_generator. The generator never finishes.
+ *
+ * Example:
+ *
+ *     mal_generator_init(&app->tone, MAL_GENERATOR_SINE, 44100, 440);
+ *     mal_format format = { .sample_rate = 44100, .bit_depth = 16, .num_channels = 1 };
+ *     mal_player *player = mal_player_create_with_render_func(context, format,
+ *                                                             mal_generator_render, &app->tone);
+ *
+ * @param user_data A pointer to a #mal_generator.
+ */
+uint32_t mal_generator_render(void *user_data, float *out, uint32_t num_frames,
+                              uint32_t num_channels);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,73 @@
+/*
+ mal
+ https://github.com/brackeen/mal
+ Copyright (c) 2014-2016 David Brackeen
+
+ This software is provided 'as-is', without any express or implied warranty.
+ In no event will the authors be held liable for any damages arising from the
+ use of this software. Permission is granted to anyone to use this software
+ for any purpose, including commercial applications, and to alter it and
+ redistribute it freely, subject to the following restrictions:
+
+ 1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software in a
+    product, an acknowledgment in the product documentation would be appreciated
+    but is not required.
+ 2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+ 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _MAL_ADPCM_H_
+#define _MAL_ADPCM_H_
+
+/**
+ * @file
+ * ADPCM block layout, shared by mal and WAV decoders.
+ *
+ * The functions in this file are inline, so a decoder can use them without linking mal.
+ */
+
+#include "mal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Gets the number of frames in each block of ADPCM data.
+ *
+ * @param sample_type Either #MAL_SAMPLE_TYPE_IMA_ADPCM or #MAL_SAMPLE_TYPE_MS_ADPCM.
+ * @param num_channels The number of channels.
+ * @param block_size The size of each block, in bytes (the WAV file's "block align").
+ * @return The number of frames, or 0 if the block size is invalid for the sample type.
+ */
+static inline uint32_t mal_adpcm_get_frames_per_block(const mal_sample_type sample_type,
+                                                      const uint32_t num_channels,
+                                                      const uint32_t block_size) {
+    if (num_channels == 0) {
+        return 0;
+    } else if (sample_type == MAL_SAMPLE_TYPE_IMA_ADPCM) {
+        // A 4-byte header per channel (the first frame), then 8 frames per 4 bytes per channel
+        const uint32_t header_size = 4 * num_channels;
+        if (block_size <= header_size || (block_size - header_size) % header_size != 0) {
+            return 0;
+        }
+        return (block_size - header_size) * 2 / num_channels + 1;
+    } else if (sample_type == MAL_SAMPLE_TYPE_MS_ADPCM) {
+        // A 7-byte header per channel (the first two frames), then 2 samples per byte
+        const uint32_t header_size = 7 * num_channels;
+        if (block_size < header_size || ((block_size - header_size) * 2) % num_channels != 0) {
+            return 0;
+        }
+        return (block_size - header_size) * 2 / num_channels + 2;
+    } else {
+        return 0;
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
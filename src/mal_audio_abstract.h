@@ -22,13 +22,32 @@
 #define _MAL_AUDIO_ABSTRACT_H_
 
 #include "mal.h"
+#include "mal_adpcm.h"
 #include "ok_lib.h"
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef M_PI
+#  define M_PI 3.14159265358979323846
+#endif
+
+#if defined(__EMSCRIPTEN__)
+#  include <emscripten/emscripten.h>
+#elif defined(__APPLE__)
+#  include <mach/mach_time.h>
+#else
+#  include <time.h>
+#endif
 
 // If MAL_USE_MUTEX is defined, modifications to mal_player objects are locked.
 // Define MAL_USE_MUTEX if a player's buffer data is read on a different thread than the main
 // thread.
 #ifdef MAL_USE_MUTEX
-#  include <pthread.h>
 #    define MAL_LOCK(player) pthread_mutex_lock(&player->mutex)
 #    define MAL_UNLOCK(player) pthread_mutex_unlock(&player->mutex)
 #  else
@@ -36,6 +55,24 @@
 #    define MAL_UNLOCK(player) do { } while(0)
 #endif
 
+// SIMD conversion of packed 24-bit samples. On x86, SSSE3 is selected at runtime.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define MAL_SSSE3
+#  include <tmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define MAL_NEON
+#  include <arm_neon.h>
+#endif
+
+// Fields that are written on one thread and read on another without locking.
+#if defined(__GNUC__) || defined(__clang__)
+#  define MAL_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#  define MAL_ATOMIC_STORE(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#else
+#  define MAL_ATOMIC_LOAD(ptr) (*(ptr))
+#  define MAL_ATOMIC_STORE(ptr, value) (*(ptr) = (value))
+#endif
+
 //#define MAL_DEBUG_LOG
 #ifdef MAL_DEBUG_LOG
 #  ifdef ANDROID
@@ -64,6 +101,50 @@ static void _mal_context_dispose(mal_context *context);
 static void _mal_context_set_active(mal_context *context, const bool active);
 static void _mal_context_set_mute(mal_context *context, const bool mute);
 static void _mal_context_set_gain(mal_context *context, const float gain);
+/**
+ Checks if the subsystem can play the format. The sample type and bit depth are already known to
+ be valid; formats that aren't supported natively are converted using
+ #_mal_context_get_native_format().
+ */
+static bool _mal_context_format_is_valid(const mal_context *context, mal_format format);
+/**
+ Gets the format that buffers and players use for the specified format. The sample rate must not
+ change. The sample type must be 8-bit or 16-bit integer, or 32-bit float. The number of channels
+ may be reduced to 1 or 2 if the channel layout isn't supported. Buffer data is converted (and
+ downmixed) to this format when the buffer is created.
+ ADPCM formats may be returned as is if the subsystem decodes them as they play (see
+ #_mal_adpcm_read()).
+ */
+static mal_format _mal_context_get_native_format(const mal_context *context, mal_format format);
+/**
+ Gets the format of a buffer's native cache (see #mal_buffer_set_native_cache()). The cache format
+ should be 32-bit float at the sample rate the subsystem mixes at. Returns `false` if the
+ subsystem doesn't read from native caches.
+ */
+static bool _mal_context_get_native_cache_format(const mal_context *context, mal_format format,
+                                                 mal_format *cache_format);
+/**
+ Called before and after changing several parameters of one or more players, so that the
+ subsystem can apply the changes as a batch.
+ */
+static void _mal_context_begin_update(mal_context *context);
+static void _mal_context_end_update(mal_context *context);
+/**
+ Called on the main thread from #mal_context_update().
+ */
+static void _mal_context_update(mal_context *context);
+/**
+ Renders interleaved float samples from a loopback context. If the context's
+ #loopback_num_channels is non-zero, #_mal_context_init() should create a loopback context (or
+ return `false` if not supported).
+ */
+static bool _mal_context_render(mal_context *context, float *out, uint32_t num_frames);
+/**
+ Sets the number of threads that render voices, including the audio thread. Called only when the
+ number changes. Returns `false` if the threads couldn't be created, or if the subsystem doesn't
+ render voices in parallel and `num_threads` is greater than 1.
+ */
+static bool _mal_context_set_num_render_threads(mal_context *context, uint32_t num_threads);
 
 /**
  Either `copied_data` or `managed_data` will be non-null, but not both. If `copied_data` is set,
@@ -75,6 +156,10 @@ static bool _mal_buffer_init(mal_context *context, mal_buffer *buffer,
                              mal_deallocator_func data_deallocator);
 static void _mal_buffer_dispose(mal_buffer *buffer);
 
+/**
+ If the player's #render_func is set, the player has no buffer, and its audio is generated by the
+ render function on the audio thread. Return `false` if render functions are not supported.
+ */
 static bool _mal_player_init(mal_player *player);
 static void _mal_player_dispose(mal_player *player);
 static bool _mal_player_set_format(mal_player *player, mal_format format);
@@ -86,12 +171,28 @@ static void _mal_player_did_set_finished_callback(mal_player *player);
 static mal_player_state _mal_player_get_state(const mal_player *player);
 static bool _mal_player_set_state(mal_player *player, mal_player_state old_state,
                                   mal_player_state state);
+/**
+ Gets the playback position, in frames, of the attached buffer.
+ */
+static uint32_t _mal_player_get_position(const mal_player *player);
+/**
+ Sets the position, in frames, where playback starts the next time the player is played from the
+ stopped state.
+ */
+static void _mal_player_set_position(mal_player *player, uint32_t frame);
 
 // MARK: Globals
 
 typedef struct ok_vec_of(mal_player *) mal_player_vec_t;
 typedef struct ok_vec_of(mal_buffer *) mal_buffer_vec_t;
+typedef struct mal_native_cache_worker mal_native_cache_worker;
+typedef struct mal_loader mal_loader;
+typedef struct mal_heap mal_heap;
+typedef struct mal_render_thread mal_render_thread;
+typedef struct mal_buffer_cache_entry mal_buffer_cache_entry;
+typedef struct ok_map_of(const char *, mal_buffer_cache_entry *) mal_buffer_cache_map_t;
 typedef struct ok_map_of(uint64_t, mal_player *) mal_callback_map_t;
+typedef struct ok_map_of(uint64_t, mal_buffer *) mal_buffer_map_t;
 
 static mal_callback_map_t *global_active_callbacks = NULL;
 static uint64_t next_finished_callback_id = 1;
@@ -99,6 +200,13 @@ static uint64_t next_finished_callback_id = 1;
 static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+static void _mal_handle_on_finished_callback(uint64_t on_finished_id);
+/**
+ Subsystems call this, on any thread, when a player stops because playback reached the end.
+ */
+static void _mal_player_did_finish(mal_player *player);
+static void _mal_buffer_cache_remove(mal_buffer *buffer);
+
 // MARK: Structs
 
 struct mal_context {
@@ -109,6 +217,42 @@ struct mal_context {
     bool mute;
     bool active;
     double sample_rate;
+    uint8_t loopback_num_channels;
+
+    // Virtualization
+    float audible_gain_threshold;
+    uint32_t max_real_players;
+    uint32_t num_voices;
+    uint32_t num_real_players;
+    uint32_t num_virtual_players;
+    mal_player_vec_t playing_players;
+    double virtual_clock; // Seconds the context has been active, as of virtual_clock_start
+    double virtual_clock_start; // When the context became active, or negative if inactive
+    uint32_t num_render_threads; // Including the audio thread
+
+    // Native cache
+    size_t native_cache_budget;
+    size_t native_cache_size;
+    // Buffers with a native cache, linked through their native_cache_lru_link, least recently
+    // used first
+    mal_buffer *native_cache_lru_first;
+    mal_buffer *native_cache_lru_last;
+    mal_native_cache_worker *native_cache_worker;
+
+    // Async loading
+    uint32_t num_load_threads; // 0 for the number of CPUs
+    mal_loader *loader;
+
+    // Allocation of the context, players, and buffers
+    mal_heap *heap;
+
+    // Render thread for loopback contexts created with mal_context_create_ex()
+    mal_render_thread *render_thread;
+
+    // Deduplication
+    bool dedup_enabled;
+    mal_buffer_map_t dedup_buffers; // Content hash to buffer
+    size_t dedup_bytes_saved;
 
 #ifdef MAL_USE_MUTEX
     pthread_mutex_t mutex;
@@ -119,26 +263,103 @@ struct mal_context {
 
 struct mal_buffer {
     mal_context *context;
+    mal_heap *heap;
+    size_t context_index; // Index in the context's buffers
     mal_format format;
     uint32_t num_frames;
     void *managed_data;
     mal_deallocator_func managed_data_deallocator;
 
+    // Storage from mal_buffer_create_uninitialized(), until the data is committed.
+    void *uncommitted_data;
+
+    // Players the buffer is attached to (linked through the players' buffer_link)
+    uint32_t num_players;
+    mal_player *first_player;
+
+    // The cache entry that owns the buffer, if any
+    mal_buffer_cache_entry *cache_entry;
+
+    // Deduplication. An alias shares the data of its owner. If the owner is freed while it has
+    // aliases, it is marked as freed, and its data is kept until the last alias is freed.
+    bool dedup_registered;
+    uint64_t content_hash;
+    mal_format content_format; // The format of the data before conversion
+    mal_buffer *owner;
+    uint32_t num_aliases;
+    bool freed;
+
+    // Native cache. The cache data is only freed when no players are using the buffer.
+    bool native_cache_enabled;
+    bool native_cache_pending;
+    void *native_cache_data;
+    size_t native_cache_size;
+    mal_format native_cache_format;
+    uint32_t native_cache_num_frames;
+    struct {
+        mal_buffer *prev;
+        mal_buffer *next;
+    } native_cache_lru_link;
+
     struct _mal_buffer data;
 };
 
+struct mal_buffer_cache_entry {
+    mal_buffer_cache *cache;
+    char *asset_id;
+    mal_buffer *buffer;
+    size_t size;
+    struct {
+        mal_buffer_cache_entry *prev;
+        mal_buffer_cache_entry *next;
+    } lru_link;
+};
+
+struct mal_buffer_cache {
+    mal_context *context;
+    size_t budget;
+    size_t size;
+    mal_buffer_cache_map_t entries;
+    // Entries linked through their lru_link, least recently used first
+    mal_buffer_cache_entry *lru_first;
+    mal_buffer_cache_entry *lru_last;
+    mal_buffer_cache_reload_func reload_func;
+    void *reload_user_data;
+    mal_buffer_cache_stats stats;
+};
+
 struct mal_player {
     mal_context *context;
+    mal_heap *heap;
+    size_t context_index; // Index in the context's players
     mal_format format;
     const mal_buffer *buffer;
+    struct {
+        mal_player *prev;
+        mal_player *next;
+    } buffer_link; // Other players attached to the same buffer
     float gain;
     bool mute;
     bool looping;
 
+    mal_render_func render_func;
+    void *render_user_data;
+
     mal_playback_finished_func on_finished;
     void *on_finished_user_data;
     uint64_t on_finished_id;
 
+    // The subsystem's state, cached so that it can be read without locking or calling into the
+    // subsystem. Accessed with MAL_ATOMIC_LOAD and MAL_ATOMIC_STORE.
+    mal_player_state state;
+
+    // Virtualization. If `has_voice` is false, the backend player is not initialized.
+    bool has_voice;
+    bool is_virtual;
+    mal_player_state virtual_state;
+    double virtual_frame;
+    double virtual_time;
+
 #ifdef MAL_USE_MUTEX
     pthread_mutex_t mutex;
 #endif
@@ -146,216 +367,2894 @@ struct mal_player {
     struct _mal_player data;
 };
 
-// MARK: Context
+// MARK: Allocation
+
+#define MAL_CACHE_LINE_SIZE 64
+#define MAL_POOL_SLOTS_PER_SLAB 32
+
+// A pool of fixed-size slots. Slabs are allocated as needed and kept until the heap is released.
+// Each slab starts with a cache line for the slab header, followed by the slots.
+typedef struct mal_pool_slab {
+    struct mal_pool_slab *next;
+} mal_pool_slab;
+
+typedef struct {
+    size_t slot_size;
+    void *free_slots; // Linked through the first word of each free slot
+    mal_pool_slab *slabs;
+} mal_object_pool;
+
+// The heap is shared by a context and its players and buffers, which may outlive the context.
+struct mal_heap {
+    mal_allocator allocator;
+    mal_object_pool player_pool;
+    mal_object_pool buffer_pool;
+    uint32_t ref_count; // The context, plus each player and buffer
+};
+
+static void *_mal_default_alloc(void *user_data, const size_t size, size_t alignment) {
+    (void)user_data;
+    if (alignment < sizeof(void *)) {
+        alignment = sizeof(void *);
+    }
+    void *ptr = NULL;
+    return posix_memalign(&ptr, alignment, size) == 0 ? ptr : NULL;
+}
+
+static void _mal_default_free(void *user_data, void *ptr, const size_t size) {
+    (void)user_data;
+    (void)size;
+    free(ptr);
+}
+
+static size_t _mal_pool_slab_size(const mal_object_pool *pool) {
+    return MAL_CACHE_LINE_SIZE + pool->slot_size * MAL_POOL_SLOTS_PER_SLAB;
+}
+
+static void _mal_pool_init(mal_object_pool *pool, const size_t object_size) {
+    pool->slot_size = ((object_size + MAL_CACHE_LINE_SIZE - 1) / MAL_CACHE_LINE_SIZE *
+                       MAL_CACHE_LINE_SIZE);
+    pool->free_slots = NULL;
+    pool->slabs = NULL;
+}
+
+static void _mal_pool_deinit(mal_heap *heap, mal_object_pool *pool) {
+    const size_t slab_size = _mal_pool_slab_size(pool);
+    while (pool->slabs) {
+        mal_pool_slab *slab = pool->slabs;
+        pool->slabs = slab->next;
+        heap->allocator.free(heap->allocator.user_data, slab, slab_size);
+    }
+    pool->free_slots = NULL;
+}
+
+static mal_heap *_mal_heap_create(const mal_allocator *allocator) {
+    mal_allocator a = { _mal_default_alloc, _mal_default_free, NULL };
+    if (allocator) {
+        if (!allocator->alloc || !allocator->free) {
+            return NULL;
+        }
+        a = *allocator;
+    }
+    mal_heap *heap = a.alloc(a.user_data, sizeof(mal_heap), MAL_CACHE_LINE_SIZE);
+    if (heap) {
+        memset(heap, 0, sizeof(mal_heap));
+        heap->allocator = a;
+        heap->ref_count = 1;
+        _mal_pool_init(&heap->player_pool, sizeof(mal_player));
+        _mal_pool_init(&heap->buffer_pool, sizeof(mal_buffer));
+    }
+    return heap;
+}
+
+static void _mal_heap_release(mal_heap *heap) {
+    heap->ref_count--;
+    if (heap->ref_count == 0) {
+        _mal_pool_deinit(heap, &heap->player_pool);
+        _mal_pool_deinit(heap, &heap->buffer_pool);
+        heap->allocator.free(heap->allocator.user_data, heap, sizeof(mal_heap));
+    }
+}
+
+// Returns a zeroed slot, or NULL if out of memory. The slot holds a reference to the heap.
+static void *_mal_pool_alloc(mal_heap *heap, mal_object_pool *pool) {
+    if (!pool->free_slots) {
+        mal_pool_slab *slab = heap->allocator.alloc(heap->allocator.user_data,
+                                                    _mal_pool_slab_size(pool),
+                                                    MAL_CACHE_LINE_SIZE);
+        if (!slab) {
+            return NULL;
+        }
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        uint8_t *slots = (uint8_t *)slab + MAL_CACHE_LINE_SIZE;
+        for (size_t i = MAL_POOL_SLOTS_PER_SLAB; i > 0; i--) {
+            void *slot = slots + (i - 1) * pool->slot_size;
+            *(void **)slot = pool->free_slots;
+            pool->free_slots = slot;
+        }
+    }
+    void *slot = pool->free_slots;
+    pool->free_slots = *(void **)slot;
+    memset(slot, 0, pool->slot_size);
+    heap->ref_count++;
+    return slot;
+}
+
+static void _mal_pool_free(mal_heap *heap, mal_object_pool *pool, void *slot) {
+    *(void **)slot = pool->free_slots;
+    pool->free_slots = slot;
+    _mal_heap_release(heap);
+}
+
+static mal_buffer *_mal_buffer_pool_alloc(mal_context *context) {
+    mal_buffer *buffer = _mal_pool_alloc(context->heap, &context->heap->buffer_pool);
+    if (buffer) {
+        buffer->heap = context->heap;
+    }
+    return buffer;
+}
+
+static void _mal_buffer_pool_free(mal_buffer *buffer) {
+    _mal_pool_free(buffer->heap, &buffer->heap->buffer_pool, buffer);
+}
+
+// MARK: Registries
+
+// Players and buffers store their index in the context's vectors, so they are removed by moving
+// the last element into their place.
+
+static void _mal_context_add_player(mal_context *context, mal_player *player) {
+    player->context_index = context->players.count;
+    ok_vec_push(&context->players, player);
+}
+
+static void _mal_context_remove_player(mal_context *context, mal_player *player) {
+    const size_t index = player->context_index;
+    if (index < context->players.count && context->players.values[index] == player) {
+        mal_player *last = context->players.values[context->players.count - 1];
+        context->players.values[index] = last;
+        last->context_index = index;
+        context->players.count--;
+    }
+}
+
+static void _mal_context_add_buffer(mal_context *context, mal_buffer *buffer) {
+    buffer->context_index = context->buffers.count;
+    ok_vec_push(&context->buffers, buffer);
+}
+
+static void _mal_context_remove_buffer(mal_context *context, mal_buffer *buffer) {
+    const size_t index = buffer->context_index;
+    if (index < context->buffers.count && context->buffers.values[index] == buffer) {
+        mal_buffer *last = context->buffers.values[context->buffers.count - 1];
+        context->buffers.values[index] = last;
+        last->context_index = index;
+        context->buffers.count--;
+    }
+}
+
+// MARK: Sample conversion
+
+// These loops have no dependencies between iterations so that compilers can vectorize them.
+
+static inline void _mal_convert_float_to_int16(int16_t *dst, const float *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        float v = src[i] * 32768.0f;
+        if (v >= 32767.0f) {
+            dst[i] = 32767;
+        } else if (v <= -32768.0f) {
+            dst[i] = -32768;
+        } else {
+            dst[i] = (int16_t)v;
+        }
+    }
+}
+
+static bool _mal_system_is_little_endian(void) {
+    const int n = 1;
+    return *(const char *)&n == 1;
+}
+
+// Compilers don't vectorize the packed 24-bit loops, which read three bytes per sample. These
+// functions convert as many little-endian 24-bit samples as they can, and return the number
+// converted. The scalar loops convert the rest, with the same results.
+
+#if defined(MAL_SSSE3)
+
+// Moves each 24-bit sample into the high bytes of a 32-bit lane, so that an arithmetic shift
+// sign-extends it.
+#define MAL_INT24_SHUFFLE_MASK _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11)
+
+__attribute__((target("ssse3")))
+static size_t _mal_convert_int24_to_float_ssse3(float *dst, const uint8_t *src,
+                                                const size_t count) {
+    const __m128i mask = MAL_INT24_SHUFFLE_MASK;
+    const __m128 scale = _mm_set1_ps(1.0f / 8388608.0f);
+    size_t i = 0;
+    // Each load reads 16 bytes, and converts the first 12 (four samples)
+    for (; i + 6 <= count; i += 4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        const __m128i samples = _mm_srai_epi32(_mm_shuffle_epi8(v, mask), 8);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(samples), scale));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t _mal_convert_int24_to_int16_ssse3(int16_t *dst, const uint8_t *src,
+                                                const size_t count) {
+    const __m128i mask = MAL_INT24_SHUFFLE_MASK;
+    size_t i = 0;
+    for (; i + 10 <= count; i += 8) {
+        const __m128i v0 = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        const __m128i v1 = _mm_loadu_si128((const __m128i *)(src + i * 3 + 12));
+        const __m128i s0 = _mm_srai_epi32(_mm_shuffle_epi8(v0, mask), 16);
+        const __m128i s1 = _mm_srai_epi32(_mm_shuffle_epi8(v1, mask), 16);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(s0, s1));
+    }
+    return i;
+}
+
+#elif defined(MAL_NEON)
+
+static inline void _mal_convert_int24_to_float_neon4(float *dst, const int16x4_t high,
+                                                     const uint8x8_t low, const bool upper) {
+    const uint16x8_t low16 = vmovl_u8(low);
+    const uint32x4_t low32 = vmovl_u16(upper ? vget_high_u16(low16) : vget_low_u16(low16));
+    const int32x4_t samples = vorrq_s32(vshlq_n_s32(vmovl_s16(high), 8),
+                                        vreinterpretq_s32_u32(low32));
+    vst1q_f32(dst, vmulq_n_f32(vcvtq_f32_s32(samples), 1.0f / 8388608.0f));
+}
+
+static size_t _mal_convert_int24_to_float_neon(float *dst, const uint8_t *src,
+                                               const size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        // De-interleave 16 samples. The high and middle bytes form 16-bit samples.
+        const uint8x16x3_t v = vld3q_u8(src + i * 3);
+        const uint8x16x2_t high = vzipq_u8(v.val[1], v.val[2]);
+        const int16x8_t high0 = vreinterpretq_s16_u8(high.val[0]);
+        const int16x8_t high1 = vreinterpretq_s16_u8(high.val[1]);
+        _mal_convert_int24_to_float_neon4(dst + i, vget_low_s16(high0),
+                                          vget_low_u8(v.val[0]), false);
+        _mal_convert_int24_to_float_neon4(dst + i + 4, vget_high_s16(high0),
+                                          vget_low_u8(v.val[0]), true);
+        _mal_convert_int24_to_float_neon4(dst + i + 8, vget_low_s16(high1),
+                                          vget_high_u8(v.val[0]), false);
+        _mal_convert_int24_to_float_neon4(dst + i + 12, vget_high_s16(high1),
+                                          vget_high_u8(v.val[0]), true);
+    }
+    return i;
+}
+
+static size_t _mal_convert_int24_to_int16_neon(int16_t *dst, const uint8_t *src,
+                                               const size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const uint8x16x3_t v = vld3q_u8(src + i * 3);
+        const uint8x16x2_t high = vzipq_u8(v.val[1], v.val[2]);
+        vst1q_u8((uint8_t *)(dst + i), high.val[0]);
+        vst1q_u8((uint8_t *)(dst + i + 8), high.val[1]);
+    }
+    return i;
+}
 
-mal_context *mal_context_create(double output_sample_rate) {
-    mal_context *context = calloc(1, sizeof(mal_context));
-    if (context) {
-#ifdef MAL_USE_MUTEX
-        pthread_mutex_init(&context->mutex, NULL);
 #endif
-        context->mute = false;
-        context->gain = 1.0f;
-        context->sample_rate = output_sample_rate;
-        ok_vec_init(&context->players);
-        ok_vec_init(&context->buffers);
-        bool success = _mal_context_init(context);
-        if (success) {
-            _mal_context_did_create(context);
-            mal_context_set_active(context, true);
+
+static size_t _mal_convert_int24_to_float_simd(float *dst, const uint8_t *src,
+                                               const size_t count) {
+    if (!_mal_system_is_little_endian()) {
+        return 0;
+    }
+#if defined(MAL_SSSE3)
+    if (__builtin_cpu_supports("ssse3")) {
+        return _mal_convert_int24_to_float_ssse3(dst, src, count);
+    }
+#elif defined(MAL_NEON)
+    return _mal_convert_int24_to_float_neon(dst, src, count);
+#else
+    (void)dst;
+    (void)src;
+    (void)count;
+#endif
+    return 0;
+}
+
+static size_t _mal_convert_int24_to_int16_simd(int16_t *dst, const uint8_t *src,
+                                               const size_t count) {
+    if (!_mal_system_is_little_endian()) {
+        return 0;
+    }
+#if defined(MAL_SSSE3)
+    if (__builtin_cpu_supports("ssse3")) {
+        return _mal_convert_int24_to_int16_ssse3(dst, src, count);
+    }
+#elif defined(MAL_NEON)
+    return _mal_convert_int24_to_int16_neon(dst, src, count);
+#else
+    (void)dst;
+    (void)src;
+    (void)count;
+#endif
+    return 0;
+}
+
+static void _mal_convert_to_float(float *restrict dst, const void *restrict src,
+                                  const mal_format src_format, const size_t count) {
+    if (src_format.sample_type == MAL_SAMPLE_TYPE_FLOAT) {
+        memcpy(dst, src, count * sizeof(float));
+    } else if (src_format.bit_depth == 8) {
+        const uint8_t *s = src;
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = (float)(s[i] - 128) * (1.0f / 128.0f);
+        }
+    } else if (src_format.bit_depth == 16) {
+        const int16_t *s = src;
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = (float)s[i] * (1.0f / 32768.0f);
+        }
+    } else if (src_format.bit_depth == 24) {
+        const uint8_t *s = src;
+        const int hi = _mal_system_is_little_endian() ? 2 : 0;
+        const int lo = 2 - hi;
+        for (size_t i = _mal_convert_int24_to_float_simd(dst, s, count); i < count; i++) {
+            const int32_t v = ((int32_t)(int8_t)s[i * 3 + hi] * 65536 +
+                               (int32_t)s[i * 3 + 1] * 256 + (int32_t)s[i * 3 + lo]);
+            dst[i] = (float)v * (1.0f / 8388608.0f);
+        }
+    } else if (src_format.bit_depth == 32) {
+        const int32_t *s = src;
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = (float)s[i] * (1.0f / 2147483648.0f);
+        }
+    }
+}
+
+static void _mal_convert_to_int16(int16_t *restrict dst, const void *restrict src,
+                                  const mal_format src_format, const size_t count) {
+    if (src_format.sample_type == MAL_SAMPLE_TYPE_FLOAT) {
+        _mal_convert_float_to_int16(dst, src, count);
+    } else if (src_format.bit_depth == 8) {
+        const uint8_t *s = src;
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = (int16_t)((s[i] - 128) * 256);
+        }
+    } else if (src_format.bit_depth == 16) {
+        memcpy(dst, src, count * sizeof(int16_t));
+    } else if (src_format.bit_depth == 24) {
+        const uint8_t *s = src;
+        const int hi = _mal_system_is_little_endian() ? 2 : 0;
+        for (size_t i = _mal_convert_int24_to_int16_simd(dst, s, count); i < count; i++) {
+            dst[i] = (int16_t)((int8_t)s[i * 3 + hi] * 256 + s[i * 3 + 1]);
+        }
+    } else if (src_format.bit_depth == 32) {
+        const int32_t *s = src;
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = (int16_t)(s[i] >> 16);
+        }
+    }
+}
+
+// MARK: ADPCM
+
+static const int16_t _mal_ima_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+    73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449,
+    494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272,
+    2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493,
+    10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t _mal_ima_index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int16_t _mal_ms_adaptation_table[16] = {
+    230, 230, 230, 230, 307, 409, 512, 614, 768, 614, 512, 409, 307, 230, 230, 230
+};
+
+static const int16_t _mal_ms_coefficients[7][2] = {
+    { 256, 0 }, { 512, -256 }, { 0, 0 }, { 192, 64 }, { 240, 0 }, { 460, -208 }, { 392, -232 }
+};
+
+static inline bool _mal_format_is_adpcm(const mal_format format) {
+    return (format.sample_type == MAL_SAMPLE_TYPE_IMA_ADPCM ||
+            format.sample_type == MAL_SAMPLE_TYPE_MS_ADPCM);
+}
+
+/**
+ Gets the format of decoded data: 16-bit integer for ADPCM formats, otherwise the format itself.
+ */
+static mal_format _mal_format_decoded(mal_format format) {
+    if (_mal_format_is_adpcm(format)) {
+        format.sample_type = MAL_SAMPLE_TYPE_INT;
+        format.bit_depth = 16;
+        format.block_size = 0;
+    }
+    return format;
+}
+
+/**
+ Gets the native format from the subsystem, clearing the block size if the data is decoded.
+ */
+static mal_format _mal_native_format(const mal_context *context, const mal_format format) {
+    mal_format native_format = _mal_context_get_native_format(context, format);
+    if (!_mal_format_is_adpcm(native_format)) {
+        native_format.block_size = 0;
+    }
+    return native_format;
+}
+
+/**
+ Gets the number of frames in each block, or 0 if the block size is invalid for the format.
+ */
+static uint32_t _mal_adpcm_frames_per_block(const mal_format format) {
+    return mal_adpcm_get_frames_per_block(format.sample_type, format.num_channels,
+                                          format.block_size);
+}
+
+static inline int16_t _mal_clamp_int16(const int32_t value) {
+    return (int16_t)(value < -32768 ? -32768 : (value > 32767 ? 32767 : value));
+}
+
+static void _mal_ima_adpcm_decode_block(const uint8_t *block, const uint32_t num_channels,
+                                        const uint32_t frames_per_block, int16_t *dst) {
+    int32_t predictor[2];
+    int32_t step_index[2];
+    for (uint32_t c = 0; c < num_channels; c++) {
+        predictor[c] = (int16_t)(block[0] | (block[1] << 8));
+        step_index[c] = block[2] > 88 ? 88 : block[2];
+        dst[c] = (int16_t)predictor[c];
+        block += 4;
+    }
+    // Each channel has 4 bytes (8 samples, low nibble first) in turn
+    const uint32_t num_groups = (frames_per_block - 1) / 8;
+    for (uint32_t group = 0; group < num_groups; group++) {
+        for (uint32_t c = 0; c < num_channels; c++) {
+            int16_t *out = dst + (1 + group * 8) * num_channels + c;
+            for (uint32_t i = 0; i < 8; i++) {
+                const uint8_t nibble = (block[i / 2] >> ((i & 1) * 4)) & 0x0f;
+                const int32_t step = _mal_ima_step_table[step_index[c]];
+                int32_t diff = step >> 3;
+                if (nibble & 4) {
+                    diff += step;
+                }
+                if (nibble & 2) {
+                    diff += step >> 1;
+                }
+                if (nibble & 1) {
+                    diff += step >> 2;
+                }
+                predictor[c] = _mal_clamp_int16(predictor[c] + ((nibble & 8) ? -diff : diff));
+                step_index[c] += _mal_ima_index_table[nibble];
+                step_index[c] = step_index[c] < 0 ? 0 : (step_index[c] > 88 ? 88 : step_index[c]);
+                *out = (int16_t)predictor[c];
+                out += num_channels;
+            }
+            block += 4;
+        }
+    }
+}
+
+static void _mal_ms_adpcm_decode_block(const uint8_t *block, const uint32_t num_channels,
+                                       const uint32_t frames_per_block, int16_t *dst) {
+    int32_t coefficient1[2];
+    int32_t coefficient2[2];
+    int32_t delta[2];
+    int32_t sample1[2];
+    int32_t sample2[2];
+    for (uint32_t c = 0; c < num_channels; c++) {
+        const uint8_t predictor = block[c] > 6 ? 6 : block[c];
+        coefficient1[c] = _mal_ms_coefficients[predictor][0];
+        coefficient2[c] = _mal_ms_coefficients[predictor][1];
+    }
+    block += num_channels;
+    for (uint32_t c = 0; c < num_channels; c++) {
+        delta[c] = (int16_t)(block[0] | (block[1] << 8));
+        block += 2;
+    }
+    for (uint32_t c = 0; c < num_channels; c++) {
+        sample1[c] = (int16_t)(block[0] | (block[1] << 8));
+        block += 2;
+    }
+    for (uint32_t c = 0; c < num_channels; c++) {
+        sample2[c] = (int16_t)(block[0] | (block[1] << 8));
+        block += 2;
+    }
+    // The header holds the first two frames, older first
+    for (uint32_t c = 0; c < num_channels; c++) {
+        dst[c] = (int16_t)sample2[c];
+        dst[num_channels + c] = (int16_t)sample1[c];
+    }
+    // Samples are interleaved by channel, high nibble first
+    const uint32_t num_samples = (frames_per_block - 2) * num_channels;
+    int16_t *out = dst + 2 * num_channels;
+    for (uint32_t i = 0; i < num_samples; i++) {
+        const uint32_t c = i % num_channels;
+        const uint8_t nibble = (block[i / 2] >> ((i & 1) ? 0 : 4)) & 0x0f;
+        const int32_t signed_nibble = nibble >= 8 ? nibble - 16 : nibble;
+        const int32_t prediction = ((sample1[c] * coefficient1[c] +
+                                     sample2[c] * coefficient2[c]) >> 8);
+        const int32_t sample = _mal_clamp_int16(prediction + signed_nibble * delta[c]);
+        sample2[c] = sample1[c];
+        sample1[c] = sample;
+        delta[c] = (_mal_ms_adaptation_table[nibble] * delta[c]) >> 8;
+        if (delta[c] < 16) {
+            delta[c] = 16;
+        } else if (delta[c] > INT32_MAX / 768) {
+            // Only malformed data gets here. The largest adaptation factor is 768 / 256.
+            delta[c] = INT32_MAX / 768;
+        }
+        out[i] = (int16_t)sample;
+    }
+}
+
+/**
+ Decodes one block to interleaved 16-bit samples. The `dst` buffer must have room for
+ (`frames_per_block * num_channels`) samples.
+ */
+static void _mal_adpcm_decode_block(const mal_format format, const uint32_t frames_per_block,
+                                    const uint8_t *block, int16_t *dst) {
+    if (format.sample_type == MAL_SAMPLE_TYPE_IMA_ADPCM) {
+        _mal_ima_adpcm_decode_block(block, format.num_channels, frames_per_block, dst);
+    } else {
+        _mal_ms_adpcm_decode_block(block, format.num_channels, frames_per_block, dst);
+    }
+}
+
+/**
+ Decodes all of the ADPCM data. Returns a newly allocated buffer of interleaved 16-bit samples (or
+ `NULL` if an out-of-memory error occurs).
+ */
+static int16_t *_mal_adpcm_decode(const void *src, const mal_format format,
+                                  const uint32_t num_frames) {
+    const uint32_t frames_per_block = _mal_adpcm_frames_per_block(format);
+    const uint32_t num_channels = format.num_channels;
+    int16_t *dst = malloc((size_t)num_frames * num_channels * sizeof(int16_t));
+    int16_t *block_samples = malloc((size_t)frames_per_block * num_channels * sizeof(int16_t));
+    if (!dst || !block_samples || frames_per_block == 0) {
+        free(dst);
+        free(block_samples);
+        return NULL;
+    }
+    const uint8_t *block = src;
+    for (uint32_t frame = 0; frame < num_frames; frame += frames_per_block) {
+        const uint32_t frames = (num_frames - frame < frames_per_block ?
+                                 num_frames - frame : frames_per_block);
+        _mal_adpcm_decode_block(format, frames_per_block, block, block_samples);
+        memcpy(dst + (size_t)frame * num_channels, block_samples,
+               (size_t)frames * num_channels * sizeof(int16_t));
+        block += format.block_size;
+    }
+    free(block_samples);
+    return dst;
+}
+
+/**
+ Reads frames from an ADPCM buffer, starting at `frame`, as interleaved 16-bit samples. Decoding
+ is done one block at a time: `block_samples` holds the decoded block `*block_index` (or
+ `UINT32_MAX` if no block is decoded), and must have room for one block. Returns the number of
+ frames read, which is less than `num_frames` only at the end of the buffer.
+
+ Doesn't allocate, so it may be called on the audio thread. Inline, because only the backends
+ that decode ADPCM as it plays call it.
+ */
+static inline uint32_t _mal_adpcm_read(const mal_buffer *buffer, int16_t *block_samples,
+                                       uint32_t *block_index, uint32_t frame, int16_t *dst,
+                                       const uint32_t num_frames) {
+    const mal_format format = buffer->format;
+    const uint32_t frames_per_block = _mal_adpcm_frames_per_block(format);
+    const uint32_t num_channels = format.num_channels;
+    uint32_t frames_read = 0;
+    while (frames_read < num_frames && frame < buffer->num_frames && frames_per_block > 0) {
+        const uint32_t index = frame / frames_per_block;
+        if (*block_index != index) {
+            const uint8_t *block = ((const uint8_t *)buffer->managed_data +
+                                    (size_t)index * format.block_size);
+            _mal_adpcm_decode_block(format, frames_per_block, block, block_samples);
+            *block_index = index;
+        }
+        const uint32_t offset = frame - index * frames_per_block;
+        uint32_t frames = frames_per_block - offset;
+        if (frames > buffer->num_frames - frame) {
+            frames = buffer->num_frames - frame;
+        }
+        if (frames > num_frames - frames_read) {
+            frames = num_frames - frames_read;
+        }
+        memcpy(dst, block_samples + offset * num_channels, frames * num_channels * sizeof(int16_t));
+        dst += frames * num_channels;
+        frame += frames;
+        frames_read += frames;
+    }
+    return frames_read;
+}
+
+// MARK: Channel mixing
+
+#define MAL_MAX_CHANNELS 8
+
+static bool _mal_channel_layout_is_valid(const uint8_t num_channels) {
+    return (num_channels == 1 || num_channels == 2 || num_channels == 4 || num_channels == 6 ||
+            num_channels == 8);
+}
+
+// Stereo downmix matrices (ITU-R BS.775), in WAV channel order. The LFE channel is dropped.
+// The rows sum to more than 1, so #_mal_get_mix_matrix() normalizes them.
+static const float _mal_stereo_mix_quad[2][4] = {
+    { 1.0f, 0.0f, 0.7071f, 0.0f },
+    { 0.0f, 1.0f, 0.0f, 0.7071f },
+};
+static const float _mal_stereo_mix_5_1[2][6] = {
+    { 1.0f, 0.0f, 0.7071f, 0.0f, 0.7071f, 0.0f },
+    { 0.0f, 1.0f, 0.7071f, 0.0f, 0.0f, 0.7071f },
+};
+static const float _mal_stereo_mix_7_1[2][8] = {
+    { 1.0f, 0.0f, 0.7071f, 0.0f, 0.7071f, 0.0f, 0.7071f, 0.0f },
+    { 0.0f, 1.0f, 0.7071f, 0.0f, 0.0f, 0.7071f, 0.0f, 0.7071f },
+};
+
+/**
+ Gets the matrix (`dst_channels` rows by `src_channels` columns) that mixes the source layout to
+ a mono or stereo layout. Returns `false` if the mix isn't supported.
+
+ Each row is scaled so that its coefficients sum to 1, so a full-scale source can't mix to more
+ than full scale. This keeps the relative levels of BS.775, but is quieter than a plain BS.775
+ mix (by about 7.7 dB for 5.1), which would clip when several channels are loud at once.
+ */
+static bool _mal_get_mix_matrix(float *matrix, const uint8_t src_channels,
+                                const uint8_t dst_channels) {
+    if (dst_channels != 1 && dst_channels != 2) {
+        return false;
+    }
+    float stereo[2][MAL_MAX_CHANNELS];
+    switch (src_channels) {
+        case 1:
+            stereo[0][0] = 1.0f;
+            stereo[1][0] = 1.0f;
+            break;
+        case 2:
+            stereo[0][0] = 1.0f;
+            stereo[0][1] = 0.0f;
+            stereo[1][0] = 0.0f;
+            stereo[1][1] = 1.0f;
+            break;
+        case 4:
+            memcpy(stereo[0], _mal_stereo_mix_quad[0], sizeof(_mal_stereo_mix_quad[0]));
+            memcpy(stereo[1], _mal_stereo_mix_quad[1], sizeof(_mal_stereo_mix_quad[1]));
+            break;
+        case 6:
+            memcpy(stereo[0], _mal_stereo_mix_5_1[0], sizeof(_mal_stereo_mix_5_1[0]));
+            memcpy(stereo[1], _mal_stereo_mix_5_1[1], sizeof(_mal_stereo_mix_5_1[1]));
+            break;
+        case 8:
+            memcpy(stereo[0], _mal_stereo_mix_7_1[0], sizeof(_mal_stereo_mix_7_1[0]));
+            memcpy(stereo[1], _mal_stereo_mix_7_1[1], sizeof(_mal_stereo_mix_7_1[1]));
+            break;
+        default:
+            return false;
+    }
+    float sums[2] = { 0.0f, 0.0f };
+    for (uint8_t i = 0; i < src_channels; i++) {
+        sums[0] += stereo[0][i];
+        sums[1] += stereo[1][i];
+    }
+    for (uint8_t i = 0; i < src_channels; i++) {
+        const float left = stereo[0][i] / sums[0];
+        const float right = stereo[1][i] / sums[1];
+        if (dst_channels == 1) {
+            matrix[i] = 0.5f * (left + right);
         } else {
-            mal_context_free(context);
-            context = NULL;
+            matrix[i] = left;
+            matrix[src_channels + i] = right;
+        }
+    }
+    return true;
+}
+
+static void _mal_mix_channels(float *restrict dst, const float *restrict src,
+                              const float *restrict matrix, const uint8_t src_channels,
+                              const uint8_t dst_channels, const uint32_t num_frames) {
+    for (uint32_t frame = 0; frame < num_frames; frame++) {
+        for (uint8_t out = 0; out < dst_channels; out++) {
+            const float *row = matrix + out * src_channels;
+            float sum = 0.0f;
+            for (uint8_t in = 0; in < src_channels; in++) {
+                sum += row[in] * src[in];
+            }
+            dst[out] = sum;
+        }
+        src += src_channels;
+        dst += dst_channels;
+    }
+}
+
+/**
+ Converts the data to the native format. Returns a newly allocated buffer (or `NULL` if the
+ conversion isn't supported or an out-of-memory error occurs).
+ */
+static void *_mal_convert_to_native_format(const void *src, const mal_format src_format,
+                                           const mal_format dst_format, const uint32_t num_frames) {
+    if (_mal_format_is_adpcm(src_format)) {
+        int16_t *decoded = _mal_adpcm_decode(src, src_format, num_frames);
+        const mal_format decoded_format = _mal_format_decoded(src_format);
+        if (!decoded || mal_formats_equal(decoded_format, dst_format)) {
+            return decoded;
+        }
+        void *dst = _mal_convert_to_native_format(decoded, decoded_format, dst_format, num_frames);
+        free(decoded);
+        return dst;
+    }
+    const bool dst_float = dst_format.sample_type == MAL_SAMPLE_TYPE_FLOAT;
+    if (!((dst_float && dst_format.bit_depth == 32) ||
+          (!dst_float && dst_format.bit_depth == 16))) {
+        return NULL;
+    }
+    const size_t dst_count = (size_t)num_frames * dst_format.num_channels;
+    void *dst = malloc(dst_count * (dst_format.bit_depth / 8));
+    if (!dst) {
+        return NULL;
+    }
+    if (src_format.num_channels == dst_format.num_channels) {
+        if (dst_float) {
+            _mal_convert_to_float(dst, src, src_format, dst_count);
+        } else {
+            _mal_convert_to_int16(dst, src, src_format, dst_count);
         }
+        return dst;
+    }
+
+    // Downmix in float
+    float matrix[2 * MAL_MAX_CHANNELS];
+    const size_t src_count = (size_t)num_frames * src_format.num_channels;
+    float *src_float = malloc(src_count * sizeof(float));
+    float *mixed = dst_float ? dst : malloc(dst_count * sizeof(float));
+    const bool success = (src_float && mixed &&
+                          _mal_get_mix_matrix(matrix, src_format.num_channels,
+                                              dst_format.num_channels));
+    if (success) {
+        _mal_convert_to_float(src_float, src, src_format, src_count);
+        _mal_mix_channels(mixed, src_float, matrix, src_format.num_channels,
+                          dst_format.num_channels, num_frames);
+        if (!dst_float) {
+            _mal_convert_float_to_int16(dst, mixed, dst_count);
+        }
+    }
+    free(src_float);
+    if (mixed != dst) {
+        free(mixed);
+    }
+    if (!success) {
+        free(dst);
+        return NULL;
+    }
+    return dst;
+}
+
+// MARK: Native cache
+
+#ifndef MAL_DEFAULT_NATIVE_CACHE_BUDGET
+#define MAL_DEFAULT_NATIVE_CACHE_BUDGET (16 * 1024 * 1024)
+#endif
+
+#define MAL_NATIVE_CACHE_ALIGNMENT 16
+
+typedef struct {
+    mal_buffer *buffer;
+    const void *src_data;
+    mal_format src_format;
+    uint32_t src_num_frames;
+    mal_format cache_format;
+    void *cache_data;
+    uint32_t cache_num_frames;
+} mal_native_cache_job;
+
+typedef struct ok_vec_of(mal_native_cache_job *) mal_native_cache_job_vec_t;
+
+struct mal_native_cache_worker {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    mal_native_cache_job_vec_t pending_jobs;
+    mal_native_cache_job_vec_t finished_jobs;
+    mal_native_cache_job *current_job;
+    bool quit;
+};
+
+// Converts and resamples (linear interpolation) the source data. Called on the worker thread.
+static void _mal_native_cache_job_run(mal_native_cache_job *job) {
+    const uint8_t num_channels = job->src_format.num_channels;
+    const size_t src_count = (size_t)job->src_num_frames * num_channels;
+    float *src = NULL;
+    if (job->src_format.sample_type == MAL_SAMPLE_TYPE_FLOAT) {
+        src = (float *)job->src_data;
+    } else if (_mal_format_is_adpcm(job->src_format)) {
+        src = _mal_convert_to_native_format(job->src_data, job->src_format,
+                                            job->cache_format, job->src_num_frames);
+        if (!src) {
+            return;
+        }
+    } else {
+        src = malloc(src_count * sizeof(float));
+        if (!src) {
+            return;
+        }
+        _mal_convert_to_float(src, job->src_data, job->src_format, src_count);
+    }
+
+    const double ratio = job->src_format.sample_rate / job->cache_format.sample_rate;
+    const uint32_t dst_num_frames = (ratio == 1.0 ? job->src_num_frames :
+                                     (uint32_t)(job->src_num_frames / ratio));
+    const size_t dst_count = (size_t)dst_num_frames * num_channels;
+    void *dst = NULL;
+    if (dst_count > 0 &&
+        posix_memalign(&dst, MAL_NATIVE_CACHE_ALIGNMENT, dst_count * sizeof(float)) == 0) {
+        if (ratio == 1.0) {
+            memcpy(dst, src, dst_count * sizeof(float));
+        } else {
+            float *out = dst;
+            const uint32_t last_frame = job->src_num_frames - 1;
+            for (uint32_t frame = 0; frame < dst_num_frames; frame++) {
+                const double position = frame * ratio;
+                uint32_t i0 = (uint32_t)position;
+                if (i0 > last_frame) {
+                    i0 = last_frame;
+                }
+                const uint32_t i1 = i0 < last_frame ? i0 + 1 : last_frame;
+                const float t = (float)(position - i0);
+                const float *s0 = src + (size_t)i0 * num_channels;
+                const float *s1 = src + (size_t)i1 * num_channels;
+                for (uint8_t c = 0; c < num_channels; c++) {
+                    out[c] = s0[c] + (s1[c] - s0[c]) * t;
+                }
+                out += num_channels;
+            }
+        }
+        job->cache_data = dst;
+        job->cache_num_frames = dst_num_frames;
+    }
+    if (src != job->src_data) {
+        free(src);
+    }
+}
+
+static void *_mal_native_cache_thread_func(void *user_data) {
+    mal_native_cache_worker *worker = user_data;
+    pthread_mutex_lock(&worker->mutex);
+    while (true) {
+        while (!worker->quit && worker->pending_jobs.count == 0) {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+        if (worker->quit) {
+            break;
+        }
+        mal_native_cache_job *job = worker->pending_jobs.values[0];
+        ok_vec_remove_at(&worker->pending_jobs, 0);
+        worker->current_job = job;
+        pthread_mutex_unlock(&worker->mutex);
+
+        _mal_native_cache_job_run(job);
+
+        pthread_mutex_lock(&worker->mutex);
+        worker->current_job = NULL;
+        ok_vec_push(&worker->finished_jobs, job);
+        pthread_cond_broadcast(&worker->cond);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return NULL;
+}
+
+static bool _mal_native_cache_start(mal_context *context) {
+    if (!context->native_cache_worker) {
+        mal_native_cache_worker *worker = calloc(1, sizeof(mal_native_cache_worker));
+        if (!worker) {
+            return false;
+        }
+        pthread_mutex_init(&worker->mutex, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+        ok_vec_init(&worker->pending_jobs);
+        ok_vec_init(&worker->finished_jobs);
+        if (pthread_create(&worker->thread, NULL, _mal_native_cache_thread_func, worker) != 0) {
+            MAL_LOG("Couldn't create native cache thread");
+            pthread_cond_destroy(&worker->cond);
+            pthread_mutex_destroy(&worker->mutex);
+            free(worker);
+            return false;
+        }
+        context->native_cache_worker = worker;
+    }
+    return true;
+}
+
+static void _mal_native_cache_job_free(mal_native_cache_job *job) {
+    free(job->cache_data);
+    free(job);
+}
+
+static void _mal_native_cache_stop(mal_context *context) {
+    mal_native_cache_worker *worker = context->native_cache_worker;
+    if (worker) {
+        pthread_mutex_lock(&worker->mutex);
+        worker->quit = true;
+        pthread_cond_broadcast(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+        pthread_join(worker->thread, NULL);
+
+        ok_vec_foreach(&worker->pending_jobs, mal_native_cache_job *job) {
+            job->buffer->native_cache_pending = false;
+            _mal_native_cache_job_free(job);
+        }
+        ok_vec_foreach(&worker->finished_jobs, mal_native_cache_job *job) {
+            job->buffer->native_cache_pending = false;
+            _mal_native_cache_job_free(job);
+        }
+        ok_vec_deinit(&worker->pending_jobs);
+        ok_vec_deinit(&worker->finished_jobs);
+        pthread_cond_destroy(&worker->cond);
+        pthread_mutex_destroy(&worker->mutex);
+        free(worker);
+        context->native_cache_worker = NULL;
+    }
+}
+
+static void _mal_native_cache_enqueue(mal_context *context, mal_buffer *buffer) {
+    mal_format cache_format;
+    if (buffer->native_cache_pending || buffer->native_cache_data || !buffer->managed_data ||
+        !_mal_context_get_native_cache_format(context, buffer->format, &cache_format) ||
+        !_mal_native_cache_start(context)) {
+        return;
+    }
+    mal_native_cache_job *job = calloc(1, sizeof(mal_native_cache_job));
+    if (job) {
+        job->buffer = buffer;
+        job->src_data = buffer->managed_data;
+        job->src_format = buffer->format;
+        job->src_num_frames = buffer->num_frames;
+        job->cache_format = cache_format;
+
+        mal_native_cache_worker *worker = context->native_cache_worker;
+        pthread_mutex_lock(&worker->mutex);
+        ok_vec_push(&worker->pending_jobs, job);
+        pthread_cond_broadcast(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+        buffer->native_cache_pending = true;
+    }
+}
+
+// Removes any jobs for the buffer, waiting for the job to finish if it's running.
+static void _mal_native_cache_cancel(mal_context *context, mal_buffer *buffer) {
+    mal_native_cache_worker *worker = context->native_cache_worker;
+    if (!worker || !buffer->native_cache_pending) {
+        return;
+    }
+    pthread_mutex_lock(&worker->mutex);
+    while (worker->current_job && worker->current_job->buffer == buffer) {
+        pthread_cond_wait(&worker->cond, &worker->mutex);
+    }
+    mal_native_cache_job_vec_t *vecs[2] = { &worker->pending_jobs, &worker->finished_jobs };
+    for (int i = 0; i < 2; i++) {
+        size_t j = 0;
+        while (j < vecs[i]->count) {
+            mal_native_cache_job *job = vecs[i]->values[j];
+            if (job->buffer == buffer) {
+                _mal_native_cache_job_free(job);
+                ok_vec_remove_at(vecs[i], j);
+            } else {
+                j++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    buffer->native_cache_pending = false;
+}
+
+static bool _mal_buffer_is_in_use(const mal_buffer *buffer) {
+    if (buffer->context) {
+        for (mal_player *player = buffer->first_player; player; player = player->buffer_link.next) {
+            if (player->has_voice &&
+                MAL_ATOMIC_LOAD(&player->state) != MAL_PLAYER_STATE_STOPPED) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void _mal_native_cache_lru_remove(mal_context *context, mal_buffer *buffer) {
+    if (buffer->native_cache_lru_link.prev) {
+        buffer->native_cache_lru_link.prev->native_cache_lru_link.next =
+            buffer->native_cache_lru_link.next;
+    } else {
+        context->native_cache_lru_first = buffer->native_cache_lru_link.next;
+    }
+    if (buffer->native_cache_lru_link.next) {
+        buffer->native_cache_lru_link.next->native_cache_lru_link.prev =
+            buffer->native_cache_lru_link.prev;
+    } else {
+        context->native_cache_lru_last = buffer->native_cache_lru_link.prev;
+    }
+    buffer->native_cache_lru_link.prev = NULL;
+    buffer->native_cache_lru_link.next = NULL;
+}
+
+// Adds the buffer as the most recently used
+static void _mal_native_cache_lru_push(mal_context *context, mal_buffer *buffer) {
+    buffer->native_cache_lru_link.prev = context->native_cache_lru_last;
+    buffer->native_cache_lru_link.next = NULL;
+    if (context->native_cache_lru_last) {
+        context->native_cache_lru_last->native_cache_lru_link.next = buffer;
+    } else {
+        context->native_cache_lru_first = buffer;
+    }
+    context->native_cache_lru_last = buffer;
+}
+
+static void _mal_native_cache_release(mal_buffer *buffer) {
+    if (buffer->native_cache_data) {
+        mal_context *context = buffer->context;
+        if (context) {
+            context->native_cache_size -= buffer->native_cache_size;
+            _mal_native_cache_lru_remove(context, buffer);
+        }
+        free(buffer->native_cache_data);
+        buffer->native_cache_data = NULL;
+        buffer->native_cache_size = 0;
+        buffer->native_cache_num_frames = 0;
+    }
+}
+
+// Evicts least recently used caches until the cache size is within budget. Caches of buffers that
+// no longer want a cache are released, too.
+static void _mal_native_cache_trim(mal_context *context) {
+    mal_buffer *buffer = context->native_cache_lru_first;
+    while (buffer) {
+        mal_buffer *next = buffer->native_cache_lru_link.next;
+        const bool evict = (!buffer->native_cache_enabled ||
+                            context->native_cache_size > context->native_cache_budget);
+        if (evict && !_mal_buffer_is_in_use(buffer)) {
+            _mal_native_cache_release(buffer);
+        }
+        buffer = next;
+    }
+}
+
+// Marks the buffer as recently used. If the buffer's cache was evicted, it is created again.
+static void _mal_native_cache_touch(mal_context *context, mal_buffer *buffer) {
+    if (buffer->native_cache_enabled) {
+        if (buffer->native_cache_data) {
+            _mal_native_cache_lru_remove(context, buffer);
+            _mal_native_cache_lru_push(context, buffer);
+        } else {
+            _mal_native_cache_enqueue(context, buffer);
+        }
+    }
+}
+
+// Attaches finished caches to their buffers. Called on the main thread.
+static void _mal_native_cache_update(mal_context *context) {
+    mal_native_cache_worker *worker = context->native_cache_worker;
+    if (!worker) {
+        return;
+    }
+    pthread_mutex_lock(&worker->mutex);
+    mal_native_cache_job_vec_t finished_jobs = worker->finished_jobs;
+    ok_vec_init(&worker->finished_jobs);
+    pthread_mutex_unlock(&worker->mutex);
+    if (finished_jobs.count == 0) {
+        return;
+    }
+
+    ok_vec_foreach(&finished_jobs, mal_native_cache_job *job) {
+        mal_buffer *buffer = job->buffer;
+        buffer->native_cache_pending = false;
+        if (job->cache_data && buffer->native_cache_enabled) {
+            buffer->native_cache_data = job->cache_data;
+            buffer->native_cache_format = job->cache_format;
+            buffer->native_cache_num_frames = job->cache_num_frames;
+            buffer->native_cache_size = ((size_t)job->cache_num_frames *
+                                         job->cache_format.num_channels * sizeof(float));
+            context->native_cache_size += buffer->native_cache_size;
+            _mal_native_cache_lru_push(context, buffer);
+            job->cache_data = NULL;
+        }
+        _mal_native_cache_job_free(job);
+    }
+    ok_vec_deinit(&finished_jobs);
+    _mal_native_cache_trim(context);
+}
+
+// MARK: Loader
+
+typedef struct {
+    mal_context *context;
+    mal_load_id load_id;
+    int priority;
+    mal_buffer_load_func load_func;
+    void *user_data;
+    mal_buffer_load_result result;
+    mal_format native_format; // Set on the main thread when the loaded data needs conversion
+    bool loaded;
+    bool success;
+    bool canceled;
+} mal_load_job;
+
+typedef struct ok_vec_of(mal_load_job *) mal_load_job_vec_t;
+
+struct mal_loader {
+    pthread_t *threads;
+    uint32_t num_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    mal_load_job_vec_t pending_jobs; // Highest priority first
+    mal_load_job_vec_t running_jobs;
+    mal_load_job_vec_t finished_jobs;
+    mal_load_id next_load_id;
+    bool quit;
+};
+
+static void _mal_load_result_dispose(mal_buffer_load_result *result) {
+    if (result->data && result->data_deallocator) {
+        result->data_deallocator(result->data);
+    }
+    result->data = NULL;
+    result->data_deallocator = NULL;
+}
+
+// Called on a loader thread, in two stages. First, the data is loaded. Then, if the main thread
+// found that the data isn't in the native format, it is converted to the job's native_format, so
+// that the buffer can be created on the main thread without conversion. The context isn't used
+// here; the format is validated on the main thread, in mal_context_poll_load_event().
+static void _mal_load_job_run(mal_load_job *job) {
+    mal_buffer_load_result *result = &job->result;
+    if (!job->loaded) {
+        job->loaded = true;
+        job->success = job->load_func(job->user_data, result);
+        if (!job->success || !result->data || result->num_frames == 0) {
+            _mal_load_result_dispose(result);
+            job->success = false;
+        }
+    } else {
+        void *converted_data = _mal_convert_to_native_format(result->data, result->format,
+                                                             job->native_format,
+                                                             result->num_frames);
+        _mal_load_result_dispose(result);
+        if (converted_data) {
+            result->format = job->native_format;
+            result->data = converted_data;
+            result->data_deallocator = free;
+        } else {
+            job->success = false;
+        }
+    }
+}
+
+// Adds a job to the pending jobs, sorted by priority. Jobs with the same priority run in order.
+// Called with the loader locked.
+static void _mal_loader_add_pending_job(mal_loader *loader, mal_load_job *job) {
+    ok_vec_push(&loader->pending_jobs, job);
+    mal_load_job **jobs = loader->pending_jobs.values;
+    size_t index = loader->pending_jobs.count - 1;
+    while (index > 0 && jobs[index - 1]->priority < job->priority) {
+        jobs[index] = jobs[index - 1];
+        index--;
+    }
+    jobs[index] = job;
+    pthread_cond_signal(&loader->cond);
+}
+
+// Fails all pending jobs, so that their events are returned. Used when no loader threads could be
+// started. Called with the loader locked.
+static void _mal_loader_fail_pending_jobs(mal_loader *loader) {
+    ok_vec_foreach(&loader->pending_jobs, mal_load_job *job) {
+        _mal_load_result_dispose(&job->result);
+        job->success = false;
+        ok_vec_push(&loader->finished_jobs, job);
+    }
+    ok_vec_clear(&loader->pending_jobs);
+}
+
+static void *_mal_loader_thread_func(void *user_data) {
+    mal_loader *loader = user_data;
+    pthread_mutex_lock(&loader->mutex);
+    while (true) {
+        while (!loader->quit && loader->pending_jobs.count == 0) {
+            pthread_cond_wait(&loader->cond, &loader->mutex);
+        }
+        if (loader->quit) {
+            break;
+        }
+        mal_load_job *job = loader->pending_jobs.values[0];
+        ok_vec_remove_at(&loader->pending_jobs, 0);
+        ok_vec_push(&loader->running_jobs, job);
+        pthread_mutex_unlock(&loader->mutex);
+
+        _mal_load_job_run(job);
+
+        pthread_mutex_lock(&loader->mutex);
+        (void)ok_vec_remove(&loader->running_jobs, job);
+        if (job->canceled) {
+            _mal_load_result_dispose(&job->result);
+            free(job);
+        } else {
+            ok_vec_push(&loader->finished_jobs, job);
+        }
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    return NULL;
+}
+
+static uint32_t _mal_num_cpus(void) {
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return num_cpus > 0 ? (uint32_t)num_cpus : 1;
+}
+
+// Starts the loader threads, if they aren't already running. Returns false if no threads could be
+// started.
+static bool _mal_loader_start(mal_context *context) {
+    mal_loader *loader = context->loader;
+    if (!loader) {
+        loader = calloc(1, sizeof(mal_loader));
+        if (!loader) {
+            return false;
+        }
+        pthread_mutex_init(&loader->mutex, NULL);
+        pthread_cond_init(&loader->cond, NULL);
+        ok_vec_init(&loader->pending_jobs);
+        ok_vec_init(&loader->running_jobs);
+        ok_vec_init(&loader->finished_jobs);
+        loader->next_load_id = 1;
+        context->loader = loader;
+    }
+    if (loader->num_threads == 0) {
+        const uint32_t num_threads = (context->num_load_threads > 0 ? context->num_load_threads :
+                                      _mal_num_cpus());
+        loader->threads = calloc(num_threads, sizeof(pthread_t));
+        if (!loader->threads) {
+            return false;
+        }
+        for (uint32_t i = 0; i < num_threads; i++) {
+            if (pthread_create(&loader->threads[i], NULL, _mal_loader_thread_func, loader) != 0) {
+                MAL_LOG("Couldn't create loader thread");
+                break;
+            }
+            loader->num_threads++;
+        }
+        if (loader->num_threads == 0) {
+            free(loader->threads);
+            loader->threads = NULL;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Stops the loader threads after their current jobs finish. Pending jobs are kept.
+static void _mal_loader_stop_threads(mal_loader *loader) {
+    pthread_mutex_lock(&loader->mutex);
+    loader->quit = true;
+    pthread_cond_broadcast(&loader->cond);
+    pthread_mutex_unlock(&loader->mutex);
+    for (uint32_t i = 0; i < loader->num_threads; i++) {
+        pthread_join(loader->threads[i], NULL);
+    }
+    free(loader->threads);
+    loader->threads = NULL;
+    loader->num_threads = 0;
+    loader->quit = false;
+}
+
+static void _mal_loader_stop(mal_context *context) {
+    mal_loader *loader = context->loader;
+    if (loader) {
+        _mal_loader_stop_threads(loader);
+        mal_load_job_vec_t *vecs[2] = { &loader->pending_jobs, &loader->finished_jobs };
+        for (int i = 0; i < 2; i++) {
+            ok_vec_foreach(vecs[i], mal_load_job *job) {
+                _mal_load_result_dispose(&job->result);
+                free(job);
+            }
+            ok_vec_deinit(vecs[i]);
+        }
+        ok_vec_deinit(&loader->running_jobs);
+        pthread_cond_destroy(&loader->cond);
+        pthread_mutex_destroy(&loader->mutex);
+        free(loader);
+        context->loader = NULL;
+    }
+}
+
+// MARK: Time
+
+static double _mal_time(void) {
+#if defined(__EMSCRIPTEN__)
+    return emscripten_get_now() / 1000.0;
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t timebase = {0, 0};
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return (double)mach_absolute_time() * timebase.numer / timebase.denom / 1000000000.0;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+#endif
+}
+
+// MARK: Render thread
+
+#define MAL_DEFAULT_RENDER_QUANTUM_FRAMES 256
+#define MAL_RENDER_THREAD_STACK_SIZE (512 * 1024)
+
+struct mal_render_thread {
+    pthread_t thread;
+    mal_context *context;
+    mal_context_options options;
+    float *samples;
+    size_t samples_size;
+    bool quit;
+
+    // Memory locked for the render thread, which is unlocked when it stops. The stack is allocated
+    // only if it's locked.
+    bool samples_locked;
+    void *stack;
+    size_t stack_size;
+
+    // Written on the render thread, read with MAL_ATOMIC_LOAD
+    mal_render_thread_stats stats;
+};
+
+// Sleeps until `deadline`, in the same clock as _mal_time(). The sleep is absolute, so the time
+// spent rendering and waking up doesn't accumulate as drift.
+static void _mal_sleep_until(double deadline) {
+#if defined(__EMSCRIPTEN__)
+    const double sleep_time = deadline - _mal_time();
+    if (sleep_time > 0.0) {
+        struct timespec t;
+        t.tv_sec = (time_t)sleep_time;
+        t.tv_nsec = (long)((sleep_time - (double)t.tv_sec) * 1000000000.0);
+        nanosleep(&t, NULL);
+    }
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t timebase = {0, 0};
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    mach_wait_until((uint64_t)(deadline * 1000000000.0 * timebase.denom / timebase.numer));
+#else
+    struct timespec t;
+    t.tv_sec = (time_t)deadline;
+    t.tv_nsec = (long)((deadline - (double)t.tv_sec) * 1000000000.0);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) { }
+#endif
+}
+
+// Locks the mix buffer, and allocates and locks a stack for the render thread, so that rendering
+// doesn't page fault. mlock() faults the pages in. Called before the thread is created. Failures
+// are logged, and the thread is created without the locked memory.
+static void _mal_render_thread_lock_memory(mal_render_thread *render_thread,
+                                           pthread_attr_t *attr) {
+    render_thread->samples_locked = mlock(render_thread->samples,
+                                          render_thread->samples_size) == 0;
+
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t stack_size = MAL_RENDER_THREAD_STACK_SIZE;
+    if (stack_size < (size_t)PTHREAD_STACK_MIN) {
+        stack_size = (size_t)PTHREAD_STACK_MIN;
+    }
+    stack_size = (stack_size + page_size - 1) / page_size * page_size;
+    void *stack = NULL;
+    if (posix_memalign(&stack, page_size, stack_size) == 0) {
+        if (mlock(stack, stack_size) != 0) {
+            free(stack);
+        } else if (pthread_attr_setstack(attr, stack, stack_size) != 0) {
+            munlock(stack, stack_size);
+            free(stack);
+        } else {
+            render_thread->stack = stack;
+            render_thread->stack_size = stack_size;
+        }
+    }
+
+    if (!render_thread->samples_locked || !render_thread->stack) {
+        MAL_LOG("Couldn't lock the render thread's %s",
+                !render_thread->stack ? "stack" : "mix buffer");
+    }
+    render_thread->stats.memory_locked = render_thread->samples_locked && render_thread->stack;
+}
+
+// Unlocks the mix buffer, and frees the stack. Called after the thread has exited (or if it
+// couldn't be created).
+static void _mal_render_thread_unlock_memory(mal_render_thread *render_thread) {
+    if (render_thread->samples_locked) {
+        munlock(render_thread->samples, render_thread->samples_size);
+        render_thread->samples_locked = false;
+    }
+    if (render_thread->stack) {
+        munlock(render_thread->stack, render_thread->stack_size);
+        free(render_thread->stack);
+        render_thread->stack = NULL;
+    }
+}
+
+// Applies the requested scheduling and affinity. Each request that fails (usually for lack of
+// privileges) is logged and skipped. Called on the render thread.
+static void _mal_render_thread_setup(mal_render_thread *render_thread) {
+    const mal_context_options *options = &render_thread->options;
+    mal_render_thread_stats *stats = &render_thread->stats;
+    pthread_t self = pthread_self();
+
+    if (options->render_thread_realtime) {
+        const int min_priority = sched_get_priority_min(SCHED_FIFO);
+        const int max_priority = sched_get_priority_max(SCHED_FIFO);
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        if (options->render_thread_priority <= 0) {
+            param.sched_priority = (min_priority + max_priority) / 2;
+        } else if (options->render_thread_priority < min_priority) {
+            param.sched_priority = min_priority;
+        } else if (options->render_thread_priority > max_priority) {
+            param.sched_priority = max_priority;
+        } else {
+            param.sched_priority = options->render_thread_priority;
+        }
+        int err = pthread_setschedparam(self, SCHED_FIFO, &param);
+        if (err != 0) {
+            MAL_LOG("Couldn't set render thread to SCHED_FIFO priority %i (error %i)",
+                    param.sched_priority, err);
+        }
+    }
+    int policy;
+    struct sched_param param;
+    if (pthread_getschedparam(self, &policy, &param) == 0) {
+        MAL_ATOMIC_STORE(&stats->realtime, policy == SCHED_FIFO);
+        MAL_ATOMIC_STORE(&stats->priority, param.sched_priority);
+    }
+
+    if (options->render_thread_pin_cpu) {
+#if defined(__linux__) && defined(CPU_SET)
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(options->render_thread_cpu, &cpu_set);
+        if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+            MAL_ATOMIC_STORE(&stats->cpu, options->render_thread_cpu);
+            MAL_ATOMIC_STORE(&stats->pinned, true);
+        } else {
+            MAL_LOG("Couldn't pin render thread to CPU %u", options->render_thread_cpu);
+        }
+#else
+        MAL_LOG("Pinning the render thread to a CPU isn't supported on this platform");
+#endif
+    }
+}
+
+static void *_mal_render_thread_func(void *user_data) {
+    mal_render_thread *render_thread = user_data;
+    mal_context *context = render_thread->context;
+    const mal_render_output_func output = render_thread->options.render_output;
+    void *output_user_data = render_thread->options.render_output_user_data;
+    const bool output_blocks = render_thread->options.render_output_blocks;
+    const uint32_t num_frames = render_thread->options.render_quantum_frames;
+    const uint32_t num_channels = context->loopback_num_channels;
+    float *samples = render_thread->samples;
+
+    _mal_render_thread_setup(render_thread);
+
+    // If the output blocks, it paces the thread, and a period is missed if rendering it took longer
+    // than the period. Otherwise, the thread sleeps until each period is due, one period after the
+    // previous one, and a period is missed if rendering and output finished after it was due.
+    // After a missed deadline, the schedule restarts from the current time rather than rendering
+    // late periods back-to-back.
+    const double period = num_frames / context->sample_rate;
+    uint64_t num_periods = 0;
+    uint64_t num_missed_deadlines = 0;
+    double deadline = _mal_time() + period;
+    while (!MAL_ATOMIC_LOAD(&render_thread->quit)) {
+        const double start = output_blocks ? _mal_time() : 0.0;
+        if (!_mal_context_render(context, samples, num_frames)) {
+            memset(samples, 0, sizeof(float) * num_frames * num_channels);
+        }
+        bool missed;
+        if (output_blocks) {
+            missed = _mal_time() - start > period;
+            output(output_user_data, samples, num_frames, num_channels);
+        } else {
+            output(output_user_data, samples, num_frames, num_channels);
+            const double now = _mal_time();
+            missed = now > deadline;
+            if (missed) {
+                deadline = now + period;
+            } else {
+                _mal_sleep_until(deadline);
+                deadline += period;
+            }
+        }
+        MAL_ATOMIC_STORE(&render_thread->stats.num_periods, ++num_periods);
+        if (missed) {
+            MAL_ATOMIC_STORE(&render_thread->stats.num_missed_deadlines, ++num_missed_deadlines);
+        }
+    }
+    return NULL;
+}
+
+static bool _mal_render_thread_start(mal_context *context, const mal_context_options *options) {
+    mal_render_thread *render_thread = calloc(1, sizeof(mal_render_thread));
+    if (!render_thread) {
+        return false;
+    }
+    render_thread->context = context;
+    render_thread->options = *options;
+    if (render_thread->options.render_quantum_frames == 0) {
+        render_thread->options.render_quantum_frames = MAL_DEFAULT_RENDER_QUANTUM_FRAMES;
+    }
+    render_thread->samples_size = (sizeof(float) * render_thread->options.render_quantum_frames *
+                                   context->loopback_num_channels);
+    void *samples = NULL;
+    if (posix_memalign(&samples, MAL_CACHE_LINE_SIZE, render_thread->samples_size) != 0) {
+        free(render_thread);
+        return false;
+    }
+    memset(samples, 0, render_thread->samples_size);
+    render_thread->samples = samples;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (options->render_thread_lock_memory) {
+        _mal_render_thread_lock_memory(render_thread, &attr);
+    }
+    context->render_thread = render_thread;
+    const int err = pthread_create(&render_thread->thread, &attr, _mal_render_thread_func,
+                                   render_thread);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        MAL_LOG("Couldn't create render thread");
+        context->render_thread = NULL;
+        _mal_render_thread_unlock_memory(render_thread);
+        free(render_thread->samples);
+        free(render_thread);
+        return false;
+    }
+    return true;
+}
+
+static void _mal_render_thread_stop(mal_context *context) {
+    mal_render_thread *render_thread = context->render_thread;
+    if (render_thread) {
+        MAL_ATOMIC_STORE(&render_thread->quit, true);
+        pthread_join(render_thread->thread, NULL);
+        _mal_render_thread_unlock_memory(render_thread);
+        free(render_thread->samples);
+        free(render_thread);
+        context->render_thread = NULL;
+    }
+}
+
+// MARK: Context
+
+static mal_context *_mal_context_create_internal(double output_sample_rate,
+                                                 uint8_t loopback_num_channels,
+                                                 const mal_allocator *allocator) {
+    mal_heap *heap = _mal_heap_create(allocator);
+    if (!heap) {
+        return NULL;
+    }
+    mal_context *context = heap->allocator.alloc(heap->allocator.user_data, sizeof(mal_context),
+                                                 MAL_CACHE_LINE_SIZE);
+    if (!context) {
+        _mal_heap_release(heap);
+    } else {
+        memset(context, 0, sizeof(mal_context));
+        context->heap = heap;
+#ifdef MAL_USE_MUTEX
+        pthread_mutex_init(&context->mutex, NULL);
+#endif
+        context->mute = false;
+        context->gain = 1.0f;
+        context->sample_rate = output_sample_rate;
+        context->loopback_num_channels = loopback_num_channels;
+        context->num_render_threads = 1;
+        context->virtual_clock_start = -1.0;
+        context->native_cache_budget = MAL_DEFAULT_NATIVE_CACHE_BUDGET;
+        ok_vec_init(&context->players);
+        ok_vec_init(&context->buffers);
+        ok_vec_init(&context->playing_players);
+        ok_map_init_custom(&context->dedup_buffers, ok_uint64_hash, ok_64bit_equals);
+        bool success = _mal_context_init(context);
+        if (success) {
+            _mal_context_did_create(context);
+            mal_context_set_active(context, true);
+        } else {
+            mal_context_free(context);
+            context = NULL;
+        }
+    }
+    return context;
+}
+
+mal_context *mal_context_create(double output_sample_rate) {
+    return _mal_context_create_internal(output_sample_rate, 0, NULL);
+}
+
+mal_context *mal_context_create_with_allocator(double output_sample_rate,
+                                               const mal_allocator *allocator) {
+    return _mal_context_create_internal(output_sample_rate, 0, allocator);
+}
+
+mal_context *mal_context_create_loopback(double output_sample_rate, uint8_t num_channels) {
+    if (output_sample_rate <= 0 || num_channels < 1 || num_channels > 2) {
+        return NULL;
+    }
+    return _mal_context_create_internal(output_sample_rate, num_channels, NULL);
+}
+
+mal_context *mal_context_create_ex(double output_sample_rate, const mal_context_options *options) {
+    if (!options) {
+        return _mal_context_create_internal(output_sample_rate, 0, NULL);
+    }
+    const uint8_t num_channels = options->loopback_num_channels;
+    if (num_channels > 2 || (num_channels > 0 && output_sample_rate <= 0) ||
+        (options->render_output && num_channels == 0)) {
+        return NULL;
+    }
+    mal_context *context = _mal_context_create_internal(output_sample_rate, num_channels,
+                                                        options->allocator);
+    if (context && options->render_output && !_mal_render_thread_start(context, options)) {
+        mal_context_free(context);
+        context = NULL;
+    }
+    return context;
+}
+
+bool mal_context_get_render_thread_stats(const mal_context *context,
+                                         mal_render_thread_stats *out_stats) {
+    if (!context || !context->render_thread || !out_stats) {
+        return false;
+    }
+    const mal_render_thread_stats *stats = &context->render_thread->stats;
+    out_stats->realtime = MAL_ATOMIC_LOAD(&stats->realtime);
+    out_stats->priority = MAL_ATOMIC_LOAD(&stats->priority);
+    out_stats->pinned = MAL_ATOMIC_LOAD(&stats->pinned);
+    out_stats->cpu = MAL_ATOMIC_LOAD(&stats->cpu);
+    out_stats->memory_locked = MAL_ATOMIC_LOAD(&stats->memory_locked);
+    out_stats->num_periods = MAL_ATOMIC_LOAD(&stats->num_periods);
+    out_stats->num_missed_deadlines = MAL_ATOMIC_LOAD(&stats->num_missed_deadlines);
+    return true;
+}
+
+bool mal_context_render(mal_context *context, float *out, uint32_t num_frames) {
+    if (!context || !out || context->loopback_num_channels == 0 || context->render_thread) {
+        return false;
+    }
+    if (num_frames == 0) {
+        return true;
+    }
+    return _mal_context_render(context, out, num_frames);
+}
+
+// Virtual players advance by this clock, which stops while the context is inactive.
+static double _mal_context_get_virtual_clock(const mal_context *context) {
+    if (context->virtual_clock_start < 0) {
+        return context->virtual_clock;
+    } else {
+        return context->virtual_clock + (_mal_time() - context->virtual_clock_start);
+    }
+}
+
+void mal_context_set_active(mal_context *context, const bool active) {
+    if (context) {
+        if (active && context->virtual_clock_start < 0) {
+            context->virtual_clock_start = _mal_time();
+        } else if (!active && context->virtual_clock_start >= 0) {
+            context->virtual_clock = _mal_context_get_virtual_clock(context);
+            context->virtual_clock_start = -1.0;
+        }
+        MAL_LOCK(context);
+        _mal_context_set_active(context, active);
+        context->active = active;
+        MAL_UNLOCK(context);
+        _mal_context_did_set_active(context, active);
+    }
+}
+
+bool mal_context_get_mute(const mal_context *context) {
+    return context ? context->mute : false;
+}
+
+void mal_context_set_mute(mal_context *context, const bool mute) {
+    if (context) {
+        context->mute = mute;
+        _mal_context_set_mute(context, mute);
+    }
+}
+
+float mal_context_get_gain(const mal_context *context) {
+    return context ? context->gain : 1.0f;
+}
+
+void mal_context_set_gain(mal_context *context, const float gain) {
+    if (context) {
+        context->gain = gain;
+        _mal_context_set_gain(context, gain);
+    }
+}
+
+bool mal_context_format_is_valid(const mal_context *context, const mal_format format) {
+    bool sample_type_valid;
+    if (format.sample_type == MAL_SAMPLE_TYPE_FLOAT) {
+        sample_type_valid = (format.bit_depth == 32);
+    } else if (_mal_format_is_adpcm(format)) {
+        sample_type_valid = (format.bit_depth == 4 &&
+                             (format.num_channels == 1 || format.num_channels == 2) &&
+                             _mal_adpcm_frames_per_block(format) > 0);
+    } else {
+        sample_type_valid = (format.sample_type == MAL_SAMPLE_TYPE_INT &&
+                             (format.bit_depth == 8 || format.bit_depth == 16 ||
+                              format.bit_depth == 24 || format.bit_depth == 32));
+    }
+    return (context && sample_type_valid && _mal_channel_layout_is_valid(format.num_channels) &&
+            format.sample_rate > 0 && _mal_context_format_is_valid(context, format));
+}
+
+bool mal_context_is_route_enabled(const mal_context *context, const mal_route route) {
+    if (context && route < NUM_MAL_ROUTES) {
+        return context->routes[route];
+    } else {
+        return false;
+    }
+}
+
+void mal_context_free(mal_context *context) {
+    if (context) {
+        _mal_render_thread_stop(context);
+
+        // Delete players
+        ok_vec_foreach(&context->players, mal_player *player) {
+            mal_player_set_buffer(player, NULL);
+            MAL_LOCK(player);
+            if (player->has_voice) {
+                _mal_player_dispose(player);
+                player->has_voice = false;
+            }
+            player->context = NULL;
+            MAL_UNLOCK(player);
+        }
+        ok_vec_deinit(&context->players);
+        ok_vec_deinit(&context->playing_players);
+
+        // Delete buffers
+        _mal_loader_stop(context);
+        _mal_native_cache_stop(context);
+        ok_vec_foreach(&context->buffers, mal_buffer *buffer) {
+            if (!buffer->owner) {
+                _mal_buffer_dispose(buffer);
+            }
+            buffer->context = NULL;
+        }
+        ok_vec_deinit(&context->buffers);
+        ok_map_deinit(&context->dedup_buffers);
+
+        // Dispose and free
+        _mal_context_will_dispose(context);
+        mal_context_set_active(context, false);
+        MAL_LOCK(context);
+        _mal_context_dispose(context);
+        MAL_UNLOCK(context);
+
+#ifdef MAL_USE_MUTEX
+        pthread_mutex_destroy(&context->mutex);
+#endif
+        mal_heap *heap = context->heap;
+        heap->allocator.free(heap->allocator.user_data, context, sizeof(mal_context));
+        _mal_heap_release(heap);
+    }
+}
+
+void mal_context_set_audible_gain_threshold(mal_context *context, const float gain) {
+    if (context) {
+        context->audible_gain_threshold = gain;
+    }
+}
+
+float mal_context_get_audible_gain_threshold(const mal_context *context) {
+    return context ? context->audible_gain_threshold : 0.0f;
+}
+
+void mal_context_set_max_real_players(mal_context *context, const uint32_t max_real_players) {
+    if (context) {
+        context->max_real_players = max_real_players;
+    }
+}
+
+uint32_t mal_context_get_max_real_players(const mal_context *context) {
+    return context ? context->max_real_players : 0;
+}
+
+uint32_t mal_context_get_num_real_players(const mal_context *context) {
+    return context ? context->num_real_players : 0;
+}
+
+uint32_t mal_context_get_num_virtual_players(const mal_context *context) {
+    return context ? context->num_virtual_players : 0;
+}
+
+bool mal_context_set_num_render_threads(mal_context *context, uint32_t num_threads) {
+    if (!context) {
+        return false;
+    }
+    if (num_threads == 0) {
+        num_threads = _mal_num_cpus();
+    }
+    if (num_threads == context->num_render_threads) {
+        return true;
+    }
+    if (!_mal_context_set_num_render_threads(context, num_threads)) {
+        return false;
+    }
+    context->num_render_threads = num_threads;
+    return true;
+}
+
+uint32_t mal_context_get_num_render_threads(const mal_context *context) {
+    return context ? context->num_render_threads : 0;
+}
+
+void mal_context_set_native_cache_budget(mal_context *context, const size_t max_bytes) {
+    if (context) {
+        context->native_cache_budget = max_bytes;
+        _mal_native_cache_trim(context);
+    }
+}
+
+size_t mal_context_get_native_cache_budget(const mal_context *context) {
+    return context ? context->native_cache_budget : 0;
+}
+
+size_t mal_context_get_native_cache_size(const mal_context *context) {
+    return context ? context->native_cache_size : 0;
+}
+
+void mal_context_set_buffer_dedup(mal_context *context, const bool enabled) {
+    if (context) {
+        context->dedup_enabled = enabled;
+    }
+}
+
+bool mal_context_get_buffer_dedup(const mal_context *context) {
+    return context && context->dedup_enabled;
+}
+
+size_t mal_context_get_dedup_bytes_saved(const mal_context *context) {
+    return context ? context->dedup_bytes_saved : 0;
+}
+
+bool mal_formats_equal(const mal_format format1, const mal_format format2) {
+    return (format1.bit_depth == format2.bit_depth &&
+            format1.sample_type == format2.sample_type &&
+            format1.num_channels == format2.num_channels &&
+            format1.sample_rate == format2.sample_rate &&
+            (!_mal_format_is_adpcm(format1) || format1.block_size == format2.block_size));
+}
+
+size_t mal_format_get_data_length(const mal_format format, const uint32_t num_frames) {
+    if (_mal_format_is_adpcm(format)) {
+        const uint32_t frames_per_block = _mal_adpcm_frames_per_block(format);
+        if (frames_per_block == 0) {
+            return 0;
+        }
+        const size_t num_blocks = ((size_t)num_frames + frames_per_block - 1) / frames_per_block;
+        return num_blocks * format.block_size;
+    } else {
+        return (size_t)num_frames * format.num_channels * (format.bit_depth / 8);
+    }
+}
+
+// MARK: Deduplication
+
+#define MAL_PRIME64_1 0x9E3779B185EBCA87ULL
+#define MAL_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define MAL_PRIME64_3 0x165667B19E3779F9ULL
+#define MAL_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define MAL_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t _mal_rotl64(const uint64_t x, const int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t _mal_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t _mal_hash64_round(uint64_t acc, const uint64_t input) {
+    acc += input * MAL_PRIME64_2;
+    acc = _mal_rotl64(acc, 31);
+    return acc * MAL_PRIME64_1;
+}
+
+static inline uint64_t _mal_hash64_merge(uint64_t acc, const uint64_t value) {
+    acc ^= _mal_hash64_round(0, value);
+    return acc * MAL_PRIME64_1 + MAL_PRIME64_4;
+}
+
+// xxHash64. The main loop hashes four independent 64-bit lanes, so the multiplies pipeline.
+// The hash is only compared within a process, so words are read in the CPU's byte order.
+static uint64_t _mal_hash64(const void *data, const size_t length) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + length;
+    uint64_t h;
+    if (length >= 32) {
+        uint64_t v1 = MAL_PRIME64_1 + MAL_PRIME64_2;
+        uint64_t v2 = MAL_PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - MAL_PRIME64_1;
+        const uint8_t *limit = end - 32;
+        do {
+            v1 = _mal_hash64_round(v1, _mal_read64(p));
+            v2 = _mal_hash64_round(v2, _mal_read64(p + 8));
+            v3 = _mal_hash64_round(v3, _mal_read64(p + 16));
+            v4 = _mal_hash64_round(v4, _mal_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = _mal_rotl64(v1, 1) + _mal_rotl64(v2, 7) + _mal_rotl64(v3, 12) + _mal_rotl64(v4, 18);
+        h = _mal_hash64_merge(h, v1);
+        h = _mal_hash64_merge(h, v2);
+        h = _mal_hash64_merge(h, v3);
+        h = _mal_hash64_merge(h, v4);
+    } else {
+        h = MAL_PRIME64_5;
+    }
+    h += length;
+    while (p + 8 <= end) {
+        h ^= _mal_hash64_round(0, _mal_read64(p));
+        h = _mal_rotl64(h, 27) * MAL_PRIME64_1 + MAL_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        h ^= v * MAL_PRIME64_1;
+        h = _mal_rotl64(h, 23) * MAL_PRIME64_2 + MAL_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= *p * MAL_PRIME64_5;
+        h = _mal_rotl64(h, 11) * MAL_PRIME64_1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= MAL_PRIME64_2;
+    h ^= h >> 29;
+    h *= MAL_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Returns a new alias of a buffer with the same content, or NULL if there isn't one. If
+// deduplication is enabled, the content hash is set, to register the buffer if it is created.
+static mal_buffer *_mal_buffer_dedup(mal_context *context, const void *data,
+                                     const mal_format format, const uint32_t num_frames,
+                                     uint64_t *content_hash) {
+    if (!context->dedup_enabled || !data) {
+        return NULL;
+    }
+    *content_hash = _mal_hash64(data, mal_format_get_data_length(format, num_frames));
+    mal_buffer *owner = ok_map_get(&context->dedup_buffers, *content_hash);
+    if (!owner || owner->num_frames != num_frames ||
+        !mal_formats_equal(owner->content_format, format) || !owner->managed_data) {
+        return NULL;
+    }
+    // The hash may collide, so compare the data. The owner keeps its data in the native format.
+    const size_t data_length = mal_format_get_data_length(owner->format, num_frames);
+    if (mal_formats_equal(owner->format, format)) {
+        if (memcmp(owner->managed_data, data, data_length) != 0) {
+            return NULL;
+        }
+    } else {
+        void *native_data = _mal_convert_to_native_format(data, format, owner->format, num_frames);
+        const bool equal = native_data && memcmp(owner->managed_data, native_data,
+                                                 data_length) == 0;
+        free(native_data);
+        if (!equal) {
+            return NULL;
+        }
+    }
+    mal_buffer *alias = _mal_buffer_pool_alloc(context);
+    if (alias) {
+        _mal_context_add_buffer(context, alias);
+        alias->context = context;
+        alias->format = owner->format;
+        alias->num_frames = owner->num_frames;
+        alias->managed_data = owner->managed_data;
+        alias->data = owner->data;
+        alias->owner = owner;
+        owner->num_aliases++;
+        context->dedup_bytes_saved += mal_format_get_data_length(owner->format,
+                                                                 owner->num_frames);
+    }
+    return alias;
+}
+
+static void _mal_buffer_dedup_register(mal_buffer *buffer, const uint64_t content_hash,
+                                       const mal_format content_format) {
+    mal_context *context = buffer->context;
+    // Only buffers that keep their data can be compared with new content
+    if (context->dedup_enabled && buffer->managed_data &&
+        !ok_map_contains(&context->dedup_buffers, content_hash)) {
+        if (ok_map_put(&context->dedup_buffers, content_hash, buffer)) {
+            buffer->dedup_registered = true;
+            buffer->content_hash = content_hash;
+            buffer->content_format = content_format;
+        }
+    }
+}
+
+static void _mal_buffer_dedup_unregister(mal_buffer *buffer) {
+    mal_context *context = buffer->context;
+    if (buffer->dedup_registered && context) {
+        ok_map_remove(&context->dedup_buffers, buffer->content_hash);
+        buffer->dedup_registered = false;
+    }
+}
+
+// MARK: Buffer
+
+static mal_buffer *_mal_buffer_alloc(mal_context *context, const mal_format format,
+                                     const uint32_t num_frames) {
+    if (!context || !mal_context_format_is_valid(context, format) || num_frames == 0) {
+        return NULL;
+    }
+    mal_buffer *buffer = _mal_buffer_pool_alloc(context);
+    if (buffer) {
+        _mal_context_add_buffer(context, buffer);
+        buffer->context = context;
+        buffer->format = format;
+        buffer->num_frames = num_frames;
+    }
+    return buffer;
+}
+
+// Converts the data to the native format, if needed, and passes it to the implementation. On
+// failure, the buffer's format is unchanged and the managed data is not deallocated.
+static bool _mal_buffer_set_data(mal_buffer *buffer, const void *copied_data, void *managed_data,
+                                 const mal_deallocator_func data_deallocator) {
+    mal_context *context = buffer->context;
+    const mal_format format = buffer->format;
+    const mal_format native_format = _mal_native_format(context, format);
+    void *converted_data = NULL;
+    if (!mal_formats_equal(format, native_format)) {
+        converted_data = _mal_convert_to_native_format(copied_data ? copied_data : managed_data,
+                                                       format, native_format,
+                                                       buffer->num_frames);
+        if (!converted_data) {
+            return false;
+        }
+    }
+    buffer->format = native_format;
+
+    bool success;
+    if (converted_data) {
+        success = _mal_buffer_init(context, buffer, NULL, converted_data, free);
+        if (!success) {
+            free(converted_data);
+        } else if (managed_data && data_deallocator) {
+            data_deallocator(managed_data);
+        }
+    } else {
+        success = _mal_buffer_init(context, buffer, copied_data, managed_data, data_deallocator);
+    }
+    if (!success) {
+        _mal_buffer_dispose(buffer);
+        buffer->format = format;
+    }
+    return success;
+}
+
+static mal_buffer *_mal_buffer_create_internal(mal_context *context, const mal_format format,
+                                               const uint32_t num_frames, const void *copied_data,
+                                               void *managed_data,
+                                               const mal_deallocator_func data_deallocator) {
+    if ((copied_data == NULL) == (managed_data == NULL) || !context ||
+        !mal_context_format_is_valid(context, format) || num_frames == 0) {
+        return NULL;
+    }
+    uint64_t content_hash = 0;
+    mal_buffer *alias = _mal_buffer_dedup(context, copied_data ? copied_data : managed_data,
+                                          format, num_frames, &content_hash);
+    if (alias) {
+        if (managed_data && data_deallocator) {
+            data_deallocator(managed_data);
+        }
+        return alias;
+    }
+    mal_buffer *buffer = _mal_buffer_alloc(context, format, num_frames);
+    if (buffer && !_mal_buffer_set_data(buffer, copied_data, managed_data, data_deallocator)) {
+        mal_buffer_free(buffer);
+        buffer = NULL;
+    }
+    if (buffer) {
+        _mal_buffer_dedup_register(buffer, content_hash, format);
+    }
+    return buffer;
+}
+
+mal_buffer *mal_buffer_create(mal_context *context, const mal_format format,
+                              const uint32_t num_frames, const void *data) {
+    return _mal_buffer_create_internal(context, format, num_frames, data, NULL, NULL);
+}
+
+mal_buffer *mal_buffer_create_no_copy(mal_context *context, const mal_format format,
+                                      const uint32_t num_frames, void *data,
+                                      const mal_deallocator_func data_deallocator) {
+    return _mal_buffer_create_internal(context, format, num_frames, NULL, data, data_deallocator);
+}
+
+mal_buffer *mal_buffer_create_uninitialized(mal_context *context, const mal_format format,
+                                            const uint32_t num_frames) {
+    mal_buffer *buffer = _mal_buffer_alloc(context, format, num_frames);
+    if (buffer) {
+        buffer->uncommitted_data = malloc(mal_format_get_data_length(format, num_frames));
+        if (!buffer->uncommitted_data) {
+            mal_buffer_free(buffer);
+            buffer = NULL;
+        }
+    }
+    return buffer;
+}
+
+void *mal_buffer_lock_data(mal_buffer *buffer) {
+    return buffer ? buffer->uncommitted_data : NULL;
+}
+
+bool mal_buffer_commit_data(mal_buffer *buffer) {
+    if (!buffer || !buffer->context || !buffer->uncommitted_data) {
+        return false;
+    }
+    // When the format is native and the implementation doesn't copy buffers, the storage becomes
+    // the buffer's managed data.
+    void *data = buffer->uncommitted_data;
+    buffer->uncommitted_data = NULL;
+    if (!_mal_buffer_set_data(buffer, NULL, data, free)) {
+        buffer->uncommitted_data = data;
+        return false;
+    }
+    return true;
+}
+
+mal_format mal_buffer_get_format(const mal_buffer *buffer) {
+    if (buffer) {
+        return buffer->format;
+    } else {
+        static const mal_format null_format = {0, 0, 0};
+        return null_format;
+    }
+}
+
+uint32_t mal_buffer_get_num_frames(const mal_buffer *buffer) {
+    return buffer ? buffer->num_frames : 0;
+}
+
+void *mal_buffer_get_data(const mal_buffer *buffer) {
+    return buffer ? buffer->managed_data : NULL;
+}
+
+bool mal_buffer_set_native_cache(mal_buffer *buffer, const bool enabled) {
+    if (!buffer || !buffer->context) {
+        return false;
+    }
+    mal_context *context = buffer->context;
+    if (enabled) {
+        mal_format cache_format;
+        if (!buffer->managed_data ||
+            !_mal_context_get_native_cache_format(context, buffer->format, &cache_format)) {
+            return false;
+        }
+        buffer->native_cache_enabled = true;
+        _mal_native_cache_enqueue(context, buffer);
+        return buffer->native_cache_pending || buffer->native_cache_data;
+    } else {
+        buffer->native_cache_enabled = false;
+        _mal_native_cache_cancel(context, buffer);
+        _mal_native_cache_trim(context);
+        return true;
+    }
+}
+
+bool mal_buffer_has_native_cache(const mal_buffer *buffer) {
+    return buffer && buffer->native_cache_data;
+}
+
+// Frees the buffer, after its players are stopped and its aliases are freed
+static void _mal_buffer_free_internal(mal_buffer *buffer) {
+    mal_context *context = buffer->context;
+    if (context) {
+        _mal_context_remove_buffer(context, buffer);
+        _mal_native_cache_cancel(context, buffer);
+    }
+    _mal_native_cache_release(buffer);
+    _mal_buffer_cache_remove(buffer);
+    _mal_buffer_dedup_unregister(buffer);
+    if (!buffer->owner) {
+        _mal_buffer_dispose(buffer);
+    }
+    free(buffer->uncommitted_data);
+    buffer->uncommitted_data = NULL;
+    if (buffer->managed_data) {
+        if (buffer->managed_data_deallocator) {
+            buffer->managed_data_deallocator(buffer->managed_data);
+        }
+        buffer->managed_data = NULL;
+    }
+    mal_buffer *owner = buffer->owner;
+    if (owner) {
+        if (context) {
+            context->dedup_bytes_saved -= mal_format_get_data_length(buffer->format,
+                                                                     buffer->num_frames);
+        }
+        owner->num_aliases--;
+        if (owner->freed && owner->num_aliases == 0) {
+            _mal_buffer_free_internal(owner);
+        }
+    }
+    _mal_buffer_pool_free(buffer);
+}
+
+void mal_buffer_free(mal_buffer *buffer) {
+    if (buffer && !buffer->freed) {
+        if (buffer->context) {
+            // First, stop all players that are using this buffer.
+            while (buffer->first_player) {
+                mal_player_set_buffer(buffer->first_player, NULL);
+            }
+        }
+        if (buffer->num_aliases > 0) {
+            // The data is still used by aliases
+            buffer->freed = true;
+            if (buffer->context) {
+                _mal_native_cache_cancel(buffer->context, buffer);
+            }
+            buffer->native_cache_enabled = false;
+            _mal_native_cache_release(buffer);
+            _mal_buffer_cache_remove(buffer);
+        } else {
+            _mal_buffer_free_internal(buffer);
+        }
+    }
+}
+
+// MARK: Buffer cache
+
+static bool _mal_buffer_cache_is_pinned(const mal_buffer_cache_entry *entry) {
+    return entry->buffer->num_players > 0;
+}
+
+static void _mal_buffer_cache_lru_remove(mal_buffer_cache *cache, mal_buffer_cache_entry *entry) {
+    if (entry->lru_link.prev) {
+        entry->lru_link.prev->lru_link.next = entry->lru_link.next;
+    } else {
+        cache->lru_first = entry->lru_link.next;
+    }
+    if (entry->lru_link.next) {
+        entry->lru_link.next->lru_link.prev = entry->lru_link.prev;
+    } else {
+        cache->lru_last = entry->lru_link.prev;
+    }
+    entry->lru_link.prev = NULL;
+    entry->lru_link.next = NULL;
+}
+
+// Adds the entry as the most recently used
+static void _mal_buffer_cache_lru_push(mal_buffer_cache *cache, mal_buffer_cache_entry *entry) {
+    entry->lru_link.prev = cache->lru_last;
+    entry->lru_link.next = NULL;
+    if (cache->lru_last) {
+        cache->lru_last->lru_link.next = entry;
+    } else {
+        cache->lru_first = entry;
+    }
+    cache->lru_last = entry;
+}
+
+// Removes the buffer's entry, without freeing the buffer
+static void _mal_buffer_cache_remove(mal_buffer *buffer) {
+    mal_buffer_cache_entry *entry = buffer->cache_entry;
+    if (!entry) {
+        return;
+    }
+    mal_buffer_cache *cache = entry->cache;
+    ok_map_remove(&cache->entries, entry->asset_id);
+    _mal_buffer_cache_lru_remove(cache, entry);
+    cache->size -= entry->size;
+    free(entry->asset_id);
+    free(entry);
+    buffer->cache_entry = NULL;
+}
+
+// Frees least recently used buffers until the cache is within budget. Buffers attached to players
+// are not evicted, and neither is the most recently used buffer.
+static void _mal_buffer_cache_trim(mal_buffer_cache *cache) {
+    mal_buffer_cache_entry *entry = cache->lru_first;
+    while (cache->size > cache->budget && entry && entry != cache->lru_last) {
+        mal_buffer_cache_entry *next = entry->lru_link.next;
+        if (!_mal_buffer_cache_is_pinned(entry)) {
+            cache->stats.evictions++;
+            mal_buffer_free(entry->buffer);
+        }
+        entry = next;
+    }
+}
+
+mal_buffer_cache *mal_buffer_cache_create(mal_context *context, const size_t max_bytes) {
+    if (!context) {
+        return NULL;
+    }
+    mal_buffer_cache *cache = calloc(1, sizeof(mal_buffer_cache));
+    if (cache) {
+        cache->context = context;
+        cache->budget = max_bytes;
+        ok_map_init(&cache->entries);
+    }
+    return cache;
+}
+
+void mal_buffer_cache_set_reload_func(mal_buffer_cache *cache,
+                                      const mal_buffer_cache_reload_func reload_func,
+                                      void *user_data) {
+    if (cache) {
+        cache->reload_func = reload_func;
+        cache->reload_user_data = user_data;
+    }
+}
+
+bool mal_buffer_cache_add(mal_buffer_cache *cache, const char *asset_id, mal_buffer *buffer) {
+    if (!cache || !asset_id || !buffer || buffer->cache_entry ||
+        buffer->context != cache->context || buffer->uncommitted_data ||
+        ok_map_contains(&cache->entries, asset_id)) {
+        return false;
+    }
+    mal_buffer_cache_entry *entry = calloc(1, sizeof(mal_buffer_cache_entry));
+    if (!entry) {
+        return false;
+    }
+    entry->asset_id = strdup(asset_id);
+    if (!entry->asset_id || !ok_map_put(&cache->entries, entry->asset_id, entry)) {
+        free(entry->asset_id);
+        free(entry);
+        return false;
+    }
+    entry->cache = cache;
+    entry->buffer = buffer;
+    entry->size = mal_format_get_data_length(buffer->format, buffer->num_frames);
+    _mal_buffer_cache_lru_push(cache, entry);
+    cache->size += entry->size;
+    buffer->cache_entry = entry;
+    _mal_buffer_cache_trim(cache);
+    return true;
+}
+
+mal_buffer *mal_buffer_cache_get(mal_buffer_cache *cache, const char *asset_id) {
+    if (!cache || !asset_id) {
+        return NULL;
+    }
+    mal_buffer_cache_entry *entry = ok_map_get(&cache->entries, asset_id);
+    if (entry) {
+        cache->stats.hits++;
+        _mal_buffer_cache_lru_remove(cache, entry);
+        _mal_buffer_cache_lru_push(cache, entry);
+        return entry->buffer;
+    }
+    cache->stats.misses++;
+    if (!cache->reload_func || !cache->context) {
+        return NULL;
     }
-    return context;
+    mal_buffer *buffer = cache->reload_func(cache->reload_user_data, cache->context, asset_id);
+    if (buffer && !mal_buffer_cache_add(cache, asset_id, buffer)) {
+        mal_buffer_free(buffer);
+        buffer = NULL;
+    }
+    return buffer;
 }
 
-void mal_context_set_active(mal_context *context, const bool active) {
-    if (context) {
-        MAL_LOCK(context);
-        _mal_context_set_active(context, active);
-        context->active = active;
-        MAL_UNLOCK(context);
-        _mal_context_did_set_active(context, active);
+bool mal_buffer_cache_contains(const mal_buffer_cache *cache, const char *asset_id) {
+    // The map's lookup macros use the map's scratch entry, so the map isn't const
+    return cache && asset_id && ok_map_contains(&((mal_buffer_cache *)cache)->entries, asset_id);
+}
+
+void mal_buffer_cache_set_budget(mal_buffer_cache *cache, const size_t max_bytes) {
+    if (cache) {
+        cache->budget = max_bytes;
+        _mal_buffer_cache_trim(cache);
     }
 }
 
-bool mal_context_get_mute(const mal_context *context) {
-    return context ? context->mute : false;
+size_t mal_buffer_cache_get_budget(const mal_buffer_cache *cache) {
+    return cache ? cache->budget : 0;
 }
 
-void mal_context_set_mute(mal_context *context, const bool mute) {
-    if (context) {
-        context->mute = mute;
-        _mal_context_set_mute(context, mute);
+size_t mal_buffer_cache_get_size(const mal_buffer_cache *cache) {
+    return cache ? cache->size : 0;
+}
+
+void mal_buffer_cache_trim(mal_buffer_cache *cache) {
+    if (cache) {
+        _mal_buffer_cache_trim(cache);
     }
 }
 
-float mal_context_get_gain(const mal_context *context) {
-    return context ? context->gain : 1.0f;
+mal_buffer_cache_stats mal_buffer_cache_get_stats(const mal_buffer_cache *cache) {
+    if (cache) {
+        return cache->stats;
+    } else {
+        static const mal_buffer_cache_stats null_stats = {0, 0, 0};
+        return null_stats;
+    }
 }
 
-void mal_context_set_gain(mal_context *context, const float gain) {
-    if (context) {
-        context->gain = gain;
-        _mal_context_set_gain(context, gain);
+void mal_buffer_cache_free(mal_buffer_cache *cache) {
+    if (cache) {
+        while (cache->lru_last) {
+            mal_buffer_free(cache->lru_last->buffer);
+        }
+        ok_map_deinit(&cache->entries);
+        free(cache);
     }
 }
 
-bool mal_context_format_is_valid(const mal_context *context, const mal_format format) {
-    // TODO: Move to subsystem
-    return ((format.bit_depth == 8 || format.bit_depth == 16) &&
-            (format.num_channels == 1 || format.num_channels == 2) &&
-            format.sample_rate > 0);
+// MARK: Loading
+
+void mal_context_set_num_load_threads(mal_context *context, const uint32_t num_threads) {
+    if (context && context->num_load_threads != num_threads) {
+        context->num_load_threads = num_threads;
+        if (context->loader && context->loader->num_threads > 0) {
+            // Restart with the new number of threads. If no threads could be started, the pending
+            // loads fail instead of waiting for the next call to mal_buffer_load_async().
+            _mal_loader_stop_threads(context->loader);
+            if (!_mal_loader_start(context)) {
+                MAL_LOG("Couldn't restart loader threads");
+                pthread_mutex_lock(&context->loader->mutex);
+                _mal_loader_fail_pending_jobs(context->loader);
+                pthread_mutex_unlock(&context->loader->mutex);
+            }
+        }
+    }
 }
 
-bool mal_context_is_route_enabled(const mal_context *context, const mal_route route) {
-    if (context && route < NUM_MAL_ROUTES) {
-        return context->routes[route];
+uint32_t mal_context_get_num_load_threads(const mal_context *context) {
+    if (!context) {
+        return 0;
+    } else if (context->loader && context->loader->num_threads > 0) {
+        return context->loader->num_threads;
+    } else if (context->num_load_threads > 0) {
+        return context->num_load_threads;
     } else {
-        return false;
+        return _mal_num_cpus();
     }
 }
 
-void mal_context_free(mal_context *context) {
-    if (context) {
-        // Delete players
-        ok_vec_foreach(&context->players, mal_player *player) {
-            mal_player_set_buffer(player, NULL);
-            MAL_LOCK(player);
-            _mal_player_dispose(player);
-            player->context = NULL;
-            MAL_UNLOCK(player);
+mal_load_id mal_buffer_load_async(mal_context *context, const mal_buffer_load_func load_func,
+                                  void *user_data, const int priority) {
+    if (!context || !load_func || !_mal_loader_start(context)) {
+        return 0;
+    }
+    mal_load_job *job = calloc(1, sizeof(mal_load_job));
+    if (!job) {
+        return 0;
+    }
+    mal_loader *loader = context->loader;
+    job->context = context;
+    job->priority = priority;
+    job->load_func = load_func;
+    job->user_data = user_data;
+
+    pthread_mutex_lock(&loader->mutex);
+    job->load_id = loader->next_load_id++;
+    if (loader->next_load_id == 0) {
+        loader->next_load_id = 1;
+    }
+    _mal_loader_add_pending_job(loader, job);
+    pthread_mutex_unlock(&loader->mutex);
+    return job->load_id;
+}
+
+static mal_load_job *_mal_load_job_remove(mal_load_job_vec_t *jobs, const mal_load_id load_id) {
+    for (size_t i = 0; i < jobs->count; i++) {
+        mal_load_job *job = jobs->values[i];
+        if (job->load_id == load_id) {
+            ok_vec_remove_at(jobs, i);
+            return job;
         }
-        ok_vec_deinit(&context->players);
+    }
+    return NULL;
+}
 
-        // Delete buffers
-        ok_vec_foreach(&context->buffers, mal_buffer *buffer) {
-            _mal_buffer_dispose(buffer);
-            buffer->context = NULL;
+bool mal_buffer_load_cancel(mal_context *context, const mal_load_id load_id) {
+    if (!context || !context->loader || load_id == 0) {
+        return false;
+    }
+    mal_loader *loader = context->loader;
+    bool canceled = false;
+    pthread_mutex_lock(&loader->mutex);
+    mal_load_job *job = _mal_load_job_remove(&loader->pending_jobs, load_id);
+    if (!job) {
+        job = _mal_load_job_remove(&loader->finished_jobs, load_id);
+    }
+    if (job) {
+        _mal_load_result_dispose(&job->result);
+        free(job);
+        canceled = true;
+    } else {
+        // The loader thread discards the result when the job finishes
+        ok_vec_foreach(&loader->running_jobs, mal_load_job *running_job) {
+            if (running_job->load_id == load_id && !running_job->canceled) {
+                running_job->canceled = true;
+                canceled = true;
+            }
         }
-        ok_vec_deinit(&context->buffers);
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    return canceled;
+}
 
-        // Dispose and free
-        _mal_context_will_dispose(context);
-        mal_context_set_active(context, false);
-        MAL_LOCK(context);
-        _mal_context_dispose(context);
-        MAL_UNLOCK(context);
+bool mal_context_poll_load_event(mal_context *context, mal_load_event *event) {
+    if (!context || !context->loader || !event) {
+        return false;
+    }
+    mal_loader *loader = context->loader;
+    mal_load_job *job = NULL;
+    pthread_mutex_lock(&loader->mutex);
+    while (loader->finished_jobs.count > 0) {
+        job = loader->finished_jobs.values[0];
+        ok_vec_remove_at(&loader->finished_jobs, 0);
+        if (!job->success || job->native_format.sample_rate > 0) {
+            // Failed, or already converted
+            break;
+        }
+        // Just loaded. Validate the format here, on the main thread, since it depends on the
+        // context.
+        mal_buffer_load_result *result = &job->result;
+        if (!mal_context_format_is_valid(context, result->format)) {
+            _mal_load_result_dispose(result);
+            job->success = false;
+            break;
+        }
+        const mal_format native_format = _mal_native_format(context, result->format);
+        if (mal_formats_equal(result->format, native_format)) {
+            break;
+        }
+        // Convert on a loader thread, ahead of loads with a lower priority
+        job->native_format = native_format;
+        if (loader->num_threads == 0) {
+            _mal_load_result_dispose(result);
+            job->success = false;
+            break;
+        }
+        _mal_loader_add_pending_job(loader, job);
+        job = NULL;
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    if (!job) {
+        return false;
+    }
 
-#ifdef MAL_USE_MUTEX
-        pthread_mutex_destroy(&context->mutex);
-#endif
-        free(context);
+    // The data is in the native format
+    mal_buffer *buffer = NULL;
+    if (job->success) {
+        mal_buffer_load_result *result = &job->result;
+        buffer = _mal_buffer_create_internal(context, result->format, result->num_frames, NULL,
+                                             result->data, result->data_deallocator);
+        if (buffer) {
+            result->data = NULL;
+        }
     }
+    event->load_id = job->load_id;
+    event->user_data = job->user_data;
+    event->buffer = buffer;
+    _mal_load_result_dispose(&job->result);
+    free(job);
+    return true;
 }
 
-bool mal_formats_equal(const mal_format format1, const mal_format format2) {
-    return (format1.bit_depth == format2.bit_depth &&
-            format1.num_channels == format2.num_channels &&
-            format1.sample_rate == format2.sample_rate);
+// MARK: Player
+
+static inline bool _mal_player_has_source(const mal_player *player) {
+    return player->buffer != NULL || player->render_func != NULL;
 }
 
-// MARK: Buffer
+// Updates the cached state from the subsystem. Called with the player locked, after the
+// subsystem's state changes.
+static void _mal_player_update_state(mal_player *player) {
+    MAL_ATOMIC_STORE(&player->state, _mal_player_get_state(player));
+}
 
-static mal_buffer *_mal_buffer_create_internal(mal_context *context, const mal_format format,
-                                               const uint32_t num_frames, const void *copied_data,
-                                               void *managed_data,
-                                               const mal_deallocator_func data_deallocator) {
-    // Check params
-    const bool oneNonNullData = (copied_data == NULL) != (managed_data == NULL);
-    if (!context || !mal_context_format_is_valid(context, format) || num_frames == 0 ||
-        !oneNonNullData) {
-        return NULL;
+static void _mal_player_did_finish(mal_player *player) {
+    MAL_ATOMIC_STORE(&player->state, MAL_PLAYER_STATE_STOPPED);
+}
+
+static float _mal_player_audible_gain(const mal_player *player) {
+    if (player->mute || !player->context || player->context->mute) {
+        return 0.0f;
+    } else {
+        return player->gain * player->context->gain;
     }
-    mal_buffer *buffer = calloc(1, sizeof(mal_buffer));
-    if (buffer) {
-        ok_vec_push(&context->buffers, buffer);
-        buffer->context = context;
-        buffer->format = format;
-        buffer->num_frames = num_frames;
+}
 
-        bool success = _mal_buffer_init(context, buffer, copied_data, managed_data,
-                                        data_deallocator);
-        if (!success) {
-            mal_buffer_free(buffer);
-            buffer = NULL;
+static bool _mal_player_is_audible(const mal_player *player) {
+    return (!player->context ||
+            _mal_player_audible_gain(player) >= player->context->audible_gain_threshold);
+}
+
+static void _mal_player_release_voice(mal_player *player) {
+    if (player->has_voice) {
+        MAL_LOCK(player);
+        _mal_player_dispose(player);
+        player->has_voice = false;
+        MAL_UNLOCK(player);
+        if (player->context) {
+            player->context->num_voices--;
         }
     }
-    return buffer;
 }
 
-mal_buffer *mal_buffer_create(mal_context *context, const mal_format format,
-                              const uint32_t num_frames, const void *data) {
-    return _mal_buffer_create_internal(context, format, num_frames, data, NULL, NULL);
-}
+static bool _mal_player_acquire_voice(mal_player *player) {
+    mal_context *context = player->context;
+    if (player->has_voice) {
+        return true;
+    } else if (!context) {
+        return false;
+    }
+    if (context->max_real_players > 0 && context->num_voices >= context->max_real_players) {
+        // Take the voice of a stopped player
+        mal_player *stopped_player = NULL;
+        ok_vec_foreach(&context->players, mal_player *curr_player) {
+            if (curr_player->has_voice && !curr_player->render_func &&
+                mal_player_get_state(curr_player) == MAL_PLAYER_STATE_STOPPED) {
+                stopped_player = curr_player;
+                break;
+            }
+        }
+        if (!stopped_player) {
+            return false;
+        }
+        _mal_player_release_voice(stopped_player);
+    }
 
-mal_buffer *mal_buffer_create_no_copy(mal_context *context, const mal_format format,
-                                      const uint32_t num_frames, void *data,
-                                      const mal_deallocator_func data_deallocator) {
-    return _mal_buffer_create_internal(context, format, num_frames, NULL, data, data_deallocator);
+    _mal_context_begin_update(context);
+    MAL_LOCK(player);
+    bool success = _mal_player_init(player);
+    if (success) {
+        success = _mal_player_set_format(player, player->format);
+    }
+    if (success && player->buffer) {
+        success = _mal_player_set_buffer(player, player->buffer);
+    }
+    if (success) {
+        MAL_ATOMIC_STORE(&player->state, MAL_PLAYER_STATE_STOPPED);
+        player->has_voice = true;
+        context->num_voices++;
+        _mal_player_set_mute(player, player->mute);
+        _mal_player_set_gain(player, player->gain);
+        _mal_player_set_looping(player, player->looping);
+    } else {
+        _mal_player_dispose(player);
+    }
+    MAL_UNLOCK(player);
+    _mal_context_end_update(context);
+    if (success) {
+        _mal_player_did_set_finished_callback(player);
+    }
+    return success;
 }
 
-mal_format mal_buffer_get_format(const mal_buffer *buffer) {
-    if (buffer) {
-        return buffer->format;
+// Returns the position of a virtual player, or a negative value if the player reached the end.
+static double _mal_player_virtual_position(const mal_player *player, const double now) {
+    if (player->virtual_state != MAL_PLAYER_STATE_PLAYING) {
+        return player->virtual_frame;
+    }
+    const double num_frames = player->buffer ? player->buffer->num_frames : 0;
+    double frame = (player->virtual_frame +
+                    (now - player->virtual_time) * player->format.sample_rate);
+    if (frame < num_frames) {
+        return frame;
+    } else if (player->looping && num_frames > 0) {
+        return fmod(frame, num_frames);
     } else {
-        static const mal_format null_format = {0, 0, 0};
-        return null_format;
+        return -1.0;
     }
 }
 
-uint32_t mal_buffer_get_num_frames(const mal_buffer *buffer) {
-    return buffer ? buffer->num_frames : 0;
+static void _mal_player_virtualize(mal_player *player, const mal_player_state state,
+                                   const double frame, const double now) {
+    if (player->has_voice) {
+        MAL_LOCK(player);
+        mal_player_state old_state = _mal_player_get_state(player);
+        if (old_state != MAL_PLAYER_STATE_STOPPED) {
+            _mal_player_set_state(player, old_state, MAL_PLAYER_STATE_STOPPED);
+        }
+        MAL_UNLOCK(player);
+        _mal_player_release_voice(player);
+    }
+    player->is_virtual = true;
+    player->virtual_state = state;
+    player->virtual_frame = frame;
+    player->virtual_time = now;
 }
 
-void *mal_buffer_get_data(const mal_buffer *buffer) {
-    return buffer ? buffer->managed_data : NULL;
+static bool _mal_player_devirtualize(mal_player *player, const double now) {
+    const double frame = _mal_player_virtual_position(player, now);
+    if (frame < 0 || !_mal_player_acquire_voice(player)) {
+        return false;
+    }
+    MAL_LOCK(player);
+    uint32_t position = (uint32_t)frame;
+    if (player->buffer && _mal_format_is_adpcm(player->buffer->format)) {
+        // ADPCM is decoded from the start of a block
+        const uint32_t frames_per_block = _mal_adpcm_frames_per_block(player->buffer->format);
+        position -= position % frames_per_block;
+    }
+    _mal_player_set_position(player, position);
+    bool success = _mal_player_set_state(player, MAL_PLAYER_STATE_STOPPED,
+                                         MAL_PLAYER_STATE_PLAYING);
+    if (success && player->virtual_state == MAL_PLAYER_STATE_PAUSED) {
+        success = _mal_player_set_state(player, MAL_PLAYER_STATE_PLAYING,
+                                        MAL_PLAYER_STATE_PAUSED);
+    }
+    if (!success) {
+        // Stay virtual, and give the voice back
+        const mal_player_state state = _mal_player_get_state(player);
+        if (state != MAL_PLAYER_STATE_STOPPED) {
+            _mal_player_set_state(player, state, MAL_PLAYER_STATE_STOPPED);
+        }
+        MAL_UNLOCK(player);
+        _mal_player_release_voice(player);
+        return false;
+    }
+    player->is_virtual = false;
+    _mal_player_update_state(player);
+    MAL_UNLOCK(player);
+    return true;
 }
 
-void mal_buffer_free(mal_buffer *buffer) {
-    if (buffer) {
-        if (buffer->context) {
-            // First, stop all players that are using this buffer.
-            ok_vec_foreach(&buffer->context->players, mal_player *player) {
-                if (player->buffer == buffer) {
-                    mal_player_set_buffer(player, NULL);
+static int _mal_player_compare_audible_gain(const void *a, const void *b) {
+    const float gain_a = _mal_player_audible_gain(*(const mal_player * const *)a);
+    const float gain_b = _mal_player_audible_gain(*(const mal_player * const *)b);
+    return (gain_a < gain_b) - (gain_a > gain_b);
+}
+
+void mal_context_update(mal_context *context) {
+    if (!context) {
+        return;
+    }
+    _mal_context_update(context);
+    _mal_native_cache_update(context);
+    const double now = _mal_context_get_virtual_clock(context);
+    uint32_t num_real_players = 0;
+    uint32_t num_virtual_players = 0;
+
+    // Find playing players. Finish virtual players that reached the end.
+    ok_vec_clear(&context->playing_players);
+    ok_vec_foreach(&context->players, mal_player *player) {
+        if (player->is_virtual) {
+            if (_mal_player_virtual_position(player, now) < 0) {
+                player->is_virtual = false;
+                if (player->on_finished_id) {
+                    ok_vec_push(&context->playing_players, player);
                 }
+            } else if (player->virtual_state == MAL_PLAYER_STATE_PAUSED) {
+                num_virtual_players++;
+            }
+        } else if (player->has_voice && !player->render_func) {
+            mal_player_state state = mal_player_get_state(player);
+            if (state == MAL_PLAYER_STATE_PAUSED) {
+                num_real_players++;
             }
-            ok_vec_remove(&buffer->context->buffers, buffer);
         }
-        _mal_buffer_dispose(buffer);
-        if (buffer->managed_data) {
-            if (buffer->managed_data_deallocator) {
-                buffer->managed_data_deallocator(buffer->managed_data);
+    }
+    if (ok_vec_count(&context->playing_players) > 0) {
+        // Callbacks may free players, so send them by id.
+        uint64_t *ids = malloc(ok_vec_count(&context->playing_players) * sizeof(uint64_t));
+        size_t num_ids = 0;
+        if (ids) {
+            ok_vec_foreach(&context->playing_players, mal_player *player) {
+                ids[num_ids++] = player->on_finished_id;
             }
-            buffer->managed_data = NULL;
         }
-        free(buffer);
+        ok_vec_clear(&context->playing_players);
+        for (size_t i = 0; i < num_ids; i++) {
+            _mal_handle_on_finished_callback(ids[i]);
+        }
+        free(ids);
+    }
+    ok_vec_foreach(&context->players, mal_player *player) {
+        if (player->is_virtual) {
+            if (player->virtual_state == MAL_PLAYER_STATE_PLAYING) {
+                ok_vec_push(&context->playing_players, player);
+            }
+        } else if (player->has_voice && !player->render_func &&
+                   mal_player_get_state(player) == MAL_PLAYER_STATE_PLAYING) {
+            ok_vec_push(&context->playing_players, player);
+        }
     }
-}
 
-// MARK: Player
+    // Loudest players first
+    if (context->playing_players.count > 1) {
+        ok_vec_sort(&context->playing_players, _mal_player_compare_audible_gain);
+    }
+    _mal_context_begin_update(context);
 
-mal_player *mal_player_create(mal_context *context, const mal_format format) {
+    // Make players virtual first, so that their voices can be used by other players.
+    size_t max_real = SIZE_MAX;
+    if (context->max_real_players > 0) {
+        max_real = context->max_real_players;
+    }
+    size_t index = 0;
+    ok_vec_foreach(&context->playing_players, mal_player *player) {
+        bool should_be_real = _mal_player_is_audible(player) && index < max_real;
+        if (!should_be_real && !player->is_virtual) {
+            double frame = 0;
+            if (player->has_voice) {
+                MAL_LOCK(player);
+                frame = _mal_player_get_position(player);
+                MAL_UNLOCK(player);
+            }
+            _mal_player_virtualize(player, MAL_PLAYER_STATE_PLAYING, frame, now);
+        }
+        if (should_be_real) {
+            index++;
+        }
+    }
+    index = 0;
+    ok_vec_foreach(&context->playing_players, mal_player *player) {
+        bool should_be_real = _mal_player_is_audible(player) && index < max_real;
+        if (should_be_real && player->is_virtual) {
+            _mal_player_devirtualize(player, now);
+        }
+        if (should_be_real) {
+            index++;
+        }
+        if (player->is_virtual) {
+            num_virtual_players++;
+        } else {
+            num_real_players++;
+        }
+    }
+    ok_vec_clear(&context->playing_players);
+    _mal_context_end_update(context);
+
+    context->num_real_players = num_real_players;
+    context->num_virtual_players = num_virtual_players;
+}
+
+static mal_player *_mal_player_create_internal(mal_context *context, const mal_format format,
+                                               const mal_render_func render_func,
+                                               void *render_user_data) {
     // Check params
     if (!context || !mal_context_format_is_valid(context, format)) {
         return NULL;
     }
-    mal_player *player = calloc(1, sizeof(mal_player));
+    mal_player *player = _mal_pool_alloc(context->heap, &context->heap->player_pool);
     if (player) {
 #ifdef MAL_USE_MUTEX
         pthread_mutex_init(&player->mutex, NULL);
 #endif
-        ok_vec_push(&context->players, player);
+        player->heap = context->heap;
+        _mal_context_add_player(context, player);
         player->context = context;
-        player->format = format;
+        player->format = _mal_native_format(context, format);
         player->gain = 1.0f;
+        player->render_func = render_func;
+        player->render_user_data = render_user_data;
 
-        bool success = _mal_player_init(player);
-        if (success) {
-            success = _mal_player_set_format(player, format);
+        bool success = true;
+        if (render_func || context->max_real_players == 0 ||
+            context->num_voices < context->max_real_players) {
+            player->has_voice = true;
+            context->num_voices++;
+            MAL_LOCK(player);
+            success = _mal_player_init(player);
+            if (success) {
+                success = _mal_player_set_format(player, player->format);
+            }
+            MAL_UNLOCK(player);
         }
         if (!success) {
             mal_player_free(player);
@@ -365,6 +3264,19 @@ mal_player *mal_player_create(mal_context *context, const mal_format format) {
     return player;
 }
 
+mal_player *mal_player_create(mal_context *context, const mal_format format) {
+    return _mal_player_create_internal(context, format, NULL, NULL);
+}
+
+mal_player *mal_player_create_with_render_func(mal_context *context, const mal_format format,
+                                               const mal_render_func render_func,
+                                               void *user_data) {
+    if (!render_func) {
+        return NULL;
+    }
+    return _mal_player_create_internal(context, format, render_func, user_data);
+}
+
 mal_format mal_player_get_format(const mal_player *player) {
     if (player) {
         return player->format;
@@ -376,9 +3288,10 @@ mal_format mal_player_get_format(const mal_player *player) {
 
 bool mal_player_set_format(mal_player *player, mal_format format) {
     if (player && mal_context_format_is_valid(player->context, format)) {
+        format = _mal_native_format(player->context, format);
         mal_player_set_state(player, MAL_PLAYER_STATE_STOPPED);
         MAL_LOCK(player);
-        bool success = _mal_player_set_format(player, format);
+        bool success = !player->has_voice || _mal_player_set_format(player, format);
         if (success) {
             player->format = format;
         }
@@ -388,18 +3301,50 @@ bool mal_player_set_format(mal_player *player, mal_format format) {
     return false;
 }
 
+// Sets the player's buffer, and keeps the list of players attached to each buffer
+static void _mal_player_attach_buffer(mal_player *player, const mal_buffer *buffer) {
+    mal_buffer *old_buffer = (mal_buffer *)player->buffer;
+    if (old_buffer) {
+        if (player->buffer_link.prev) {
+            player->buffer_link.prev->buffer_link.next = player->buffer_link.next;
+        } else {
+            old_buffer->first_player = player->buffer_link.next;
+        }
+        if (player->buffer_link.next) {
+            player->buffer_link.next->buffer_link.prev = player->buffer_link.prev;
+        }
+        player->buffer_link.prev = NULL;
+        player->buffer_link.next = NULL;
+        old_buffer->num_players--;
+    }
+    player->buffer = buffer;
+    if (buffer) {
+        mal_buffer *new_buffer = (mal_buffer *)buffer;
+        player->buffer_link.next = new_buffer->first_player;
+        if (new_buffer->first_player) {
+            new_buffer->first_player->buffer_link.prev = player;
+        }
+        new_buffer->first_player = player;
+        new_buffer->num_players++;
+    }
+}
+
 bool mal_player_set_buffer(mal_player *player, const mal_buffer *buffer) {
-    if (!player) {
+    if (!player || (buffer && buffer->uncommitted_data)) {
         return false;
+    } else if (player->render_func) {
+        mal_player_set_state(player, MAL_PLAYER_STATE_STOPPED);
+        return buffer == NULL;
     } else {
         mal_player_set_state(player, MAL_PLAYER_STATE_STOPPED);
         MAL_LOCK(player);
-        bool success = _mal_player_set_buffer(player, buffer);
-        if (success) {
-            player->buffer = buffer;
+        bool success;
+        if (player->has_voice) {
+            success = _mal_player_set_buffer(player, buffer);
         } else {
-            player->buffer = NULL;
+            success = !buffer || mal_context_format_is_valid(player->context, buffer->format);
         }
+        _mal_player_attach_buffer(player, success ? buffer : NULL);
         MAL_UNLOCK(player);
         return success;
     }
@@ -434,7 +3379,9 @@ void mal_player_set_finished_func(mal_player *player, mal_playback_finished_func
 #ifdef MAL_USE_MUTEX
         pthread_mutex_unlock(&global_mutex);
 #endif
-        _mal_player_did_set_finished_callback(player);
+        if (player->has_voice) {
+            _mal_player_did_set_finished_callback(player);
+        }
     }
 }
 
@@ -468,7 +3415,9 @@ void mal_player_set_mute(mal_player *player, bool mute) {
     if (player) {
         MAL_LOCK(player);
         player->mute = mute;
-        _mal_player_set_mute(player, mute);
+        if (player->has_voice) {
+            _mal_player_set_mute(player, mute);
+        }
         MAL_UNLOCK(player);
     }
 }
@@ -481,7 +3430,9 @@ void mal_player_set_gain(mal_player *player, float gain) {
     if (player) {
         MAL_LOCK(player);
         player->gain = gain;
-        _mal_player_set_gain(player, gain);
+        if (player->has_voice) {
+            _mal_player_set_gain(player, gain);
+        }
         MAL_UNLOCK(player);
     }
 }
@@ -494,34 +3445,85 @@ void mal_player_set_looping(mal_player *player, bool looping) {
     if (player) {
         MAL_LOCK(player);
         player->looping = looping;
-        _mal_player_set_looping(player, looping);
+        if (player->has_voice) {
+            _mal_player_set_looping(player, looping);
+        }
         MAL_UNLOCK(player);
     }
 }
 
+static bool _mal_player_set_virtual_state(mal_player *player, mal_player_state state) {
+    const double now = _mal_context_get_virtual_clock(player->context);
+    const double frame = _mal_player_virtual_position(player, now);
+    if (state == MAL_PLAYER_STATE_STOPPED || frame < 0) {
+        player->is_virtual = false;
+    } else if (state != player->virtual_state) {
+        player->virtual_state = state;
+        player->virtual_frame = frame;
+        player->virtual_time = now;
+        if (state == MAL_PLAYER_STATE_PLAYING && _mal_player_is_audible(player)) {
+            _mal_player_devirtualize(player, now);
+        }
+    }
+    return true;
+}
+
 bool mal_player_set_state(mal_player *player, mal_player_state state) {
-    if (!player || !player->buffer) {
+    if (!player || !_mal_player_has_source(player)) {
         return false;
-    } else {
-        MAL_LOCK(player);
-        mal_player_state old_state = _mal_player_get_state(player);
-        bool success = true;
-        if (state != old_state) {
-            success = _mal_player_set_state(player, old_state, state);
+    } else if (player->is_virtual) {
+        return _mal_player_set_virtual_state(player, state);
+    } else if (state == MAL_PLAYER_STATE_PLAYING && !player->render_func &&
+               (!player->has_voice || !_mal_player_is_audible(player))) {
+        // Start virtually if inaudible or if no voice is available
+        if (!_mal_player_is_audible(player) || !_mal_player_acquire_voice(player)) {
+            double frame = 0;
+            if (player->has_voice) {
+                MAL_LOCK(player);
+                if (_mal_player_get_state(player) != MAL_PLAYER_STATE_STOPPED) {
+                    frame = _mal_player_get_position(player);
+                }
+                MAL_UNLOCK(player);
+            }
+            _mal_player_virtualize(player, state, frame,
+                                   _mal_context_get_virtual_clock(player->context));
+            return true;
         }
-        MAL_UNLOCK(player);
-        return success;
     }
+    if (!player->has_voice) {
+        // Stopped, and not virtual
+        return true;
+    }
+    if (state == MAL_PLAYER_STATE_PLAYING && player->buffer &&
+        player->buffer->native_cache_enabled) {
+        // The cache is mutable state of the buffer
+        _mal_native_cache_touch(player->context, (mal_buffer *)player->buffer);
+    }
+    MAL_LOCK(player);
+    mal_player_state old_state = _mal_player_get_state(player);
+    bool success = true;
+    if (state != old_state) {
+        success = _mal_player_set_state(player, old_state, state);
+    }
+    _mal_player_update_state(player);
+    MAL_UNLOCK(player);
+    return success;
 }
 
 mal_player_state mal_player_get_state(mal_player *player) {
-    if (!player || !player->buffer) {
+    if (!player || !_mal_player_has_source(player)) {
+        return MAL_PLAYER_STATE_STOPPED;
+    } else if (player->is_virtual) {
+        if (_mal_player_virtual_position(player,
+                                         _mal_context_get_virtual_clock(player->context)) < 0) {
+            return MAL_PLAYER_STATE_STOPPED;
+        } else {
+            return player->virtual_state;
+        }
+    } else if (!player->has_voice) {
         return MAL_PLAYER_STATE_STOPPED;
     } else {
-        MAL_LOCK(player);
-        mal_player_state state = _mal_player_get_state(player);
-        MAL_UNLOCK(player);
-        return state;
+        return MAL_ATOMIC_LOAD(&player->state);
     }
 }
 
@@ -529,18 +3531,83 @@ void mal_player_free(mal_player *player) {
     if (player) {
         mal_player_set_buffer(player, NULL);
         MAL_LOCK(player);
+        mal_player_set_finished_func(player, NULL, NULL);
+        if (player->has_voice) {
+            // Dispose while the context is set, so the subsystem can release shared resources
+            _mal_player_dispose(player);
+            player->has_voice = false;
+            if (player->context) {
+                player->context->num_voices--;
+            }
+        }
         if (player->context) {
-            ok_vec_remove(&player->context->players, player);
+            _mal_context_remove_player(player->context, player);
             player->context = NULL;
         }
-        mal_player_set_finished_func(player, NULL, NULL);
-        _mal_player_dispose(player);
         MAL_UNLOCK(player);
 #ifdef MAL_USE_MUTEX
         pthread_mutex_destroy(&player->mutex);
 #endif
-        free(player);
+        _mal_pool_free(player->heap, &player->heap->player_pool, player);
+    }
+}
+
+bool mal_player_is_virtual(const mal_player *player) {
+    return player && player->is_virtual;
+}
+
+// MARK: Generators
+
+void mal_generator_init(mal_generator *generator, const mal_generator_type type,
+                        const double sample_rate, const float frequency) {
+    if (generator) {
+        generator->type = type;
+        generator->sample_rate = sample_rate;
+        generator->frequency = frequency;
+        generator->amplitude = 1.0f;
+        generator->phase = 0.0;
+        generator->seed = 0x9e3779b9;
+    }
+}
+
+uint32_t mal_generator_render(void *user_data, float *out, const uint32_t num_frames,
+                              const uint32_t num_channels) {
+    mal_generator *generator = user_data;
+    if (!generator || generator->sample_rate <= 0) {
+        memset(out, 0, num_frames * num_channels * sizeof(float));
+        return num_frames;
+    }
+    const float amplitude = generator->amplitude;
+    const double phase_delta = generator->frequency / generator->sample_rate;
+    double phase = generator->phase;
+    uint32_t seed = generator->seed ? generator->seed : 1;
+    for (uint32_t i = 0; i < num_frames; i++) {
+        float v;
+        switch (generator->type) {
+            case MAL_GENERATOR_SINE:
+            default:
+                v = sinf((float)(2.0 * M_PI * phase));
+                break;
+            case MAL_GENERATOR_SQUARE:
+                v = phase < 0.5 ? 1.0f : -1.0f;
+                break;
+            case MAL_GENERATOR_NOISE:
+                // xorshift32
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                v = (float)((int32_t)seed) / 2147483648.0f;
+                break;
+        }
+        phase += phase_delta;
+        phase -= floor(phase);
+        for (uint32_t c = 0; c < num_channels; c++) {
+            *out++ = v * amplitude;
+        }
     }
+    generator->phase = phase;
+    generator->seed = seed;
+    return num_frames;
 }
 
 #endif
@@ -22,6 +22,8 @@
 #define _MAL_AUDIO_COREAUDIO_H_
 
 #include "mal.h"
+#include "mal_bitmap.h"
+#include "mal_worker_pool.h"
 #include <AudioToolbox/AudioToolbox.h>
 
 struct _ramp {
@@ -30,6 +32,54 @@ struct _ramp {
     uint32_t frames_position;
 };
 
+#define MAL_COREAUDIO_VOICES_PER_CHUNK 64
+#define MAL_COREAUDIO_MAX_VOICE_CHUNKS 64
+#define MAL_COREAUDIO_PRERENDER_CHUNK_SIZE 8
+
+struct _mal_voice;
+typedef void (*mal_voice_render_kernel)(struct _mal_voice *voice, AudioBufferList *data);
+
+// The state a player's render callback reads and writes. Voices are kept in per-context tables
+// indexed by input bus, and each bus's render callback is given its voice, so the render thread
+// never reads the player object or takes its mutex. The fields are set with the voice locked.
+struct _mal_voice {
+    pthread_mutex_t mutex; // Kept when the voice is cleared
+    mal_context *context; // NULL if no player is using the voice
+    mal_voice_render_kernel render_kernel; // Chosen when the source or looping changes
+    const void *source_data;
+    uint32_t source_num_frames;
+    uint32_t source_frame_size;
+    uint32_t next_frame;
+    uint32_t num_channels;
+    mal_player_state state;
+    bool looping;
+    bool finished; // Playback reached the end since the player's source was last set
+
+    // Copied from the player. When playback ends, the render thread stores to the player's
+    // atomic `state` through `player_state`, and posts `on_finished_id` to the main queue.
+    mal_player_state *player_state;
+    uint64_t on_finished_id;
+
+    // ADPCM source data is decoded one block at a time on the render thread.
+    uint32_t adpcm_block_index;
+    int16_t *adpcm_block;
+    const mal_buffer *adpcm_buffer;
+
+    // Render function players
+    mal_render_func render_func;
+    void *render_user_data;
+
+    float gain;
+    struct _ramp ramp;
+
+    // Render function players rendered in parallel before the mix. `prerender_data` is set with
+    // the context locked, too.
+    float *prerender_data;
+    uint32_t prerender_cycle; // The render cycle `prerender_data` is for, or 0
+    uint32_t pulled_cycle; // The last render cycle the mixer pulled the voice in
+    uint32_t prerender_frames;
+} __attribute__((aligned(64)));
+
 struct _mal_context {
     AUGraph graph;
     AudioUnit mixer_unit;
@@ -37,10 +87,19 @@ struct _mal_context {
 
     bool first_time;
 
-    uint32_t num_buses;
+    mal_bitmap buses; // Mixer input buses taken by players
+    struct _mal_voice *voice_chunks[MAL_COREAUDIO_MAX_VOICE_CHUNKS]; // Indexed by input bus
     bool can_ramp_input_gain;
     bool can_ramp_output_gain;
     struct _ramp ramp;
+
+    // Parallel rendering. See _mal_context_prerender().
+    mal_worker_pool *render_pool;
+    struct _mal_voice **prerender_voices;
+    uint32_t prerender_num_frames;
+    uint32_t render_cycle; // Incremented before each mix. Read by workers with MAL_ATOMIC_LOAD.
+    double output_sample_rate;
+    uint32_t max_frames_per_slice;
 };
 
 struct _mal_buffer {
@@ -48,12 +107,18 @@ struct _mal_buffer {
 };
 
 struct _mal_player {
+    // The player's slot in the context's voice tables. NULL if the player has no bus.
+    struct _mal_voice *voice;
+
     uint32_t input_bus;
+    mal_format bus_format;
 
-    uint32_t next_frame;
-    mal_player_state state;
+    // The voice plays the buffer's data, or its native cache. Set when playback starts.
+    double source_frame_scale;
+    size_t adpcm_block_length;
 
-    struct _ramp ramp;
+    // Where playback starts the next time the player is played from the stopped state
+    uint32_t start_frame;
 };
 
 #define MAL_USE_MUTEX
@@ -66,6 +131,10 @@ static OSStatus render_notification(void *user_data, AudioUnitRenderActionFlags
                                     UInt32 in_frames, AudioBufferList *data);
 
 static bool _mal_context_init(mal_context *context) {
+    if (context->loopback_num_channels > 0) {
+        // Not supported
+        return false;
+    }
     context->data.first_time = true;
     context->active = false;
 
@@ -164,25 +233,52 @@ static bool _mal_context_init(mal_context *context) {
     } else {
         context->data.can_ramp_output_gain = false;
     }
-    if (context->data.can_ramp_output_gain) {
-        status = AudioUnitAddRenderNotify(context->data.mixer_unit, render_notification, context);
-        if (status != noErr) {
-            context->data.can_ramp_output_gain = false;
-        }
+
+    // The render notification ramps the output gain, and renders voices in parallel
+    status = AudioUnitAddRenderNotify(context->data.mixer_unit, render_notification, context);
+    if (status != noErr) {
+        MAL_LOG("Ignoring: Couldn't add render notification (err %i)", (int)status);
+        context->data.can_ramp_output_gain = false;
     }
 
+    // Get the output sample rate and slice size, for parallel rendering
+    UInt32 property_size = sizeof(context->data.output_sample_rate);
+    status = AudioUnitGetProperty(context->data.mixer_unit,
+                                  kAudioUnitProperty_SampleRate,
+                                  kAudioUnitScope_Output,
+                                  0,
+                                  &context->data.output_sample_rate,
+                                  &property_size);
+    if (status != noErr) {
+        context->data.output_sample_rate = 0;
+    }
+    UInt32 max_frames_per_slice = 0;
+    property_size = sizeof(max_frames_per_slice);
+    status = AudioUnitGetProperty(context->data.mixer_unit,
+                                  kAudioUnitProperty_MaximumFramesPerSlice,
+                                  kAudioUnitScope_Global,
+                                  0,
+                                  &max_frames_per_slice,
+                                  &property_size);
+    context->data.max_frames_per_slice = status == noErr ? max_frames_per_slice : 0;
+
     // Get bus count
-    UInt32 bus_size = sizeof(context->data.num_buses);
+    UInt32 num_buses = 0;
+    UInt32 bus_size = sizeof(num_buses);
     status = AudioUnitGetProperty(context->data.mixer_unit,
                                   kAudioUnitProperty_ElementCount,
                                   kAudioUnitScope_Input,
                                   0,
-                                  &context->data.num_buses,
+                                  &num_buses,
                                   &bus_size);
     if (status != noErr) {
         MAL_LOG("Couldn't get mixer unit (err %i)", (int)status);
         return false;
     }
+    _mal_bitmap_deinit(&context->data.buses);
+    if (!_mal_bitmap_grow(&context->data.buses, num_buses)) {
+        return false;
+    }
 
     // Set output volume
     _mal_context_set_gain(context, context->gain);
@@ -210,12 +306,33 @@ static void _mal_context_dispose(mal_context *context) {
         context->data.graph = NULL;
         context->data.mixer_unit = NULL;
     }
+    _mal_worker_pool_free(context->data.render_pool);
+    context->data.render_pool = NULL;
+    free(context->data.prerender_voices);
+    context->data.prerender_voices = NULL;
+    _mal_bitmap_deinit(&context->data.buses);
+    for (int i = 0; i < MAL_COREAUDIO_MAX_VOICE_CHUNKS; i++) {
+        struct _mal_voice *voices = context->data.voice_chunks[i];
+        if (voices) {
+            for (int j = 0; j < MAL_COREAUDIO_VOICES_PER_CHUNK; j++) {
+                pthread_mutex_destroy(&voices[j].mutex);
+            }
+            free(voices);
+            context->data.voice_chunks[i] = NULL;
+        }
+    }
 }
 
+static void _mal_player_set_source(mal_player *player);
+
 static void _mal_context_reset(mal_context *context) {
     bool active = context->active;
     ok_vec_foreach(&context->players, mal_player *player) {
-        _mal_player_dispose(player);
+        if (player->has_voice) {
+            // Continue from the current position
+            player->data.start_frame = _mal_player_get_position(player);
+            _mal_player_dispose(player);
+        }
     }
     MAL_LOCK(context);
     _mal_context_dispose(context);
@@ -223,18 +340,35 @@ static void _mal_context_reset(mal_context *context) {
     _mal_context_set_mute(context, context->mute);
     _mal_context_set_gain(context, context->gain);
     MAL_UNLOCK(context);
+    if (context->num_render_threads > 1 &&
+        !_mal_context_set_num_render_threads(context, context->num_render_threads)) {
+        MAL_LOG("Couldn't restart render threads");
+    }
     mal_context_set_active(context, active);
     ok_vec_foreach(&context->players, mal_player *player) {
+        if (!player->has_voice) {
+            continue;
+        }
         bool success = _mal_player_init(player);
         if (!success) {
             MAL_LOG("Couldn't reset player");
         } else {
             _mal_player_set_mute(player, player->mute);
             _mal_player_set_gain(player, player->gain);
+            MAL_LOCK(player);
             _mal_player_set_format(player, player->format);
-            if (player->data.state == MAL_PLAYER_STATE_PLAYING) {
-                player->data.state = MAL_PLAYER_STATE_STOPPED;
+            MAL_UNLOCK(player);
+            _mal_player_set_looping(player, player->looping);
+            mal_player_state state = MAL_ATOMIC_LOAD(&player->state);
+            if (state == MAL_PLAYER_STATE_PLAYING) {
                 mal_player_set_state(player, MAL_PLAYER_STATE_PLAYING);
+            } else if (state == MAL_PLAYER_STATE_PAUSED) {
+                MAL_LOCK(player);
+                _mal_player_set_source(player);
+                MAL_LOCK(player->data.voice);
+                player->data.voice->state = MAL_PLAYER_STATE_PAUSED;
+                MAL_UNLOCK(player->data.voice);
+                MAL_UNLOCK(player);
             }
         }
     }
@@ -296,6 +430,38 @@ static void _mal_context_set_gain(mal_context *context, float gain) {
     }
 }
 
+static bool _mal_context_format_is_valid(const mal_context *context, mal_format format) {
+    // Multichannel formats are downmixed by _mal_context_get_native_format()
+    return true;
+}
+
+static mal_format _mal_context_get_native_format(const mal_context *context, mal_format format) {
+    // The mixer output is stereo.
+    if (format.num_channels > 2) {
+        format.num_channels = 2;
+    }
+    // The mixer converts 8-bit and 16-bit integer, and float. ADPCM is decoded to 16-bit integer
+    // on the render thread. Other formats are converted to float.
+    if (_mal_format_is_adpcm(format) ||
+        (format.sample_type == MAL_SAMPLE_TYPE_INT &&
+         (format.bit_depth == 8 || format.bit_depth == 16))) {
+        return format;
+    }
+    format.sample_type = MAL_SAMPLE_TYPE_FLOAT;
+    format.bit_depth = 32;
+    return format;
+}
+
+static bool _mal_context_get_native_cache_format(const mal_context *context, mal_format format,
+                                                 mal_format *cache_format) {
+    // The mixer's canonical format
+    cache_format->sample_rate = context->sample_rate;
+    cache_format->num_channels = format.num_channels;
+    cache_format->bit_depth = 32;
+    cache_format->sample_type = MAL_SAMPLE_TYPE_FLOAT;
+    return context->sample_rate > 0;
+}
+
 static bool _mal_ramp(mal_context *context, AudioUnitScope scope, AudioUnitElement bus,
                       uint32_t in_frames, double gain, struct _ramp *ramp) {
     uint32_t t = ramp->frames;
@@ -330,11 +496,84 @@ static bool _mal_ramp(mal_context *context, AudioUnitScope scope, AudioUnitEleme
     return done;
 }
 
+// Renders a range of the voices collected by _mal_context_prerender(). Called on the audio thread
+// and on worker threads.
+static void _mal_context_prerender_voices(void *user_data, uint32_t begin, uint32_t end) {
+    mal_context *context = user_data;
+    const uint32_t num_frames = context->data.prerender_num_frames;
+    const uint32_t cycle = MAL_ATOMIC_LOAD(&context->data.render_cycle);
+    for (uint32_t i = begin; i < end; i++) {
+        struct _mal_voice *voice = context->data.prerender_voices[i];
+        // Don't wait for a voice locked by another thread; it's rendered in its render callback
+        if (pthread_mutex_trylock(&voice->mutex) != 0) {
+            continue;
+        }
+        // A worker late to a run that timed out skips voices the mixer already pulled
+        if (voice->context && voice->prerender_data && voice->render_func &&
+            voice->state == MAL_PLAYER_STATE_PLAYING && voice->pulled_cycle != cycle) {
+            uint32_t frames = voice->render_func(voice->render_user_data, voice->prerender_data,
+                                                 num_frames, voice->num_channels);
+            voice->prerender_frames = frames < num_frames ? frames : num_frames;
+            voice->prerender_cycle = cycle;
+        }
+        MAL_UNLOCK(voice);
+    }
+}
+
+// Before each mix, renders the playing render function players on the audio thread and the
+// worker threads in parallel. The mixer then pulls each player's prerendered frames in
+// audio_render_callback(). The mixer pulls as many frames from a bus as it outputs only if the
+// bus's sample rate is the output sample rate, so only those players have a `prerender_data`
+// buffer.
+//
+// This never blocks the audio thread: if the context is locked (while players are created or
+// disposed), the players are rendered by audio_render_callback() as usual. The audio thread waits
+// for workers for up to half the slice. If a worker is still rendering after that, the mix starts
+// anyway, the voices that weren't rendered yet are rendered by audio_render_callback(), and
+// prerendering is skipped until the worker is done.
+static void _mal_context_prerender(mal_context *context, UInt32 in_frames) {
+    uint32_t cycle = context->data.render_cycle + 1;
+    if (cycle == 0) {
+        cycle = 1;
+    }
+    MAL_ATOMIC_STORE(&context->data.render_cycle, cycle);
+    if (!context->data.render_pool || in_frames > context->data.max_frames_per_slice ||
+        context->data.output_sample_rate <= 0 ||
+        _mal_worker_pool_is_busy(context->data.render_pool)) {
+        return;
+    }
+    if (pthread_mutex_trylock(&context->mutex) != 0) {
+        return;
+    }
+    if (context->data.render_pool && context->data.prerender_voices) {
+        uint32_t count = 0;
+        for (int i = 0; i < MAL_COREAUDIO_MAX_VOICE_CHUNKS; i++) {
+            struct _mal_voice *voices = context->data.voice_chunks[i];
+            if (!voices) {
+                continue;
+            }
+            for (int j = 0; j < MAL_COREAUDIO_VOICES_PER_CHUNK; j++) {
+                struct _mal_voice *voice = voices + j;
+                if (voice->prerender_data && voice->state == MAL_PLAYER_STATE_PLAYING) {
+                    context->data.prerender_voices[count++] = voice;
+                }
+            }
+        }
+        context->data.prerender_num_frames = in_frames;
+        const double timeout = in_frames / context->data.output_sample_rate / 2;
+        _mal_worker_pool_run(context->data.render_pool, count,
+                             MAL_COREAUDIO_PRERENDER_CHUNK_SIZE,
+                             _mal_context_prerender_voices, context, timeout);
+    }
+    MAL_UNLOCK(context);
+}
+
 static OSStatus render_notification(void *user_data, AudioUnitRenderActionFlags *flags,
                                     const AudioTimeStamp *timestamp, UInt32 bus,
                                     UInt32 in_frames, AudioBufferList *data) {
     if (*flags & kAudioUnitRenderAction_PreRender) {
         mal_context *context = user_data;
+        _mal_context_prerender(context, in_frames);
         if (context->data.ramp.value != 0) {
             MAL_LOCK(context);
             // Double-checked locking
@@ -355,6 +594,61 @@ static OSStatus render_notification(void *user_data, AudioUnitRenderActionFlags
     return noErr;
 };
 
+static void _mal_context_begin_update(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_end_update(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_update(mal_context *context) {
+    // Do nothing
+}
+
+static bool _mal_context_render(mal_context *context, float *out, uint32_t num_frames) {
+    // Not supported
+    return false;
+}
+
+static void _mal_player_update_prerender(mal_player *player);
+
+static bool _mal_context_set_num_render_threads(mal_context *context, uint32_t num_threads) {
+    mal_worker_pool *pool = NULL;
+    if (num_threads > 1) {
+        if (!context->data.prerender_voices) {
+            context->data.prerender_voices = malloc(sizeof(struct _mal_voice *) *
+                                                    MAL_COREAUDIO_VOICES_PER_CHUNK *
+                                                    MAL_COREAUDIO_MAX_VOICE_CHUNKS);
+            if (!context->data.prerender_voices) {
+                return false;
+            }
+        }
+        double period = 0.0;
+        if (context->data.max_frames_per_slice > 0 && context->data.output_sample_rate > 0) {
+            period = context->data.max_frames_per_slice / context->data.output_sample_rate;
+        }
+        pool = _mal_worker_pool_create(num_threads - 1, period);
+        if (!pool) {
+            MAL_LOG("Couldn't create render threads");
+            return false;
+        }
+    }
+    MAL_LOCK(context);
+    mal_worker_pool *old_pool = context->data.render_pool;
+    context->data.render_pool = pool;
+    MAL_UNLOCK(context);
+    _mal_worker_pool_free(old_pool);
+
+    // Lock each player, so its voice's source isn't changed as its buffer is replaced
+    ok_vec_foreach(&context->players, mal_player *player) {
+        MAL_LOCK(player);
+        _mal_player_update_prerender(player);
+        MAL_UNLOCK(player);
+    }
+    return true;
+}
+
 // MARK: Buffer
 
 static bool _mal_buffer_init(mal_context *context, mal_buffer *buffer,
@@ -364,8 +658,8 @@ static bool _mal_buffer_init(mal_context *context, mal_buffer *buffer,
         buffer->managed_data = managed_data;
         buffer->managed_data_deallocator = data_deallocator;
     } else {
-        const size_t data_length = ((buffer->format.bit_depth / 8) *
-                                    buffer->format.num_channels * buffer->num_frames);
+        // ADPCM data is copied compressed; it is decoded one block at a time as it plays.
+        const size_t data_length = mal_format_get_data_length(buffer->format, buffer->num_frames);
         void *new_buffer = malloc(data_length);
         if (!new_buffer) {
             return false;
@@ -384,179 +678,411 @@ static void _mal_buffer_dispose(mal_buffer *buffer) {
 // MARK: Player
 
 static void _mal_handle_on_finished(void *user_data) {
+#if UINTPTR_MAX >= UINT64_MAX
+    _mal_handle_on_finished_callback((uint64_t)(uintptr_t)user_data);
+#else
     uint64_t *on_finished_id = user_data;
     _mal_handle_on_finished_callback(*on_finished_id);
     free(on_finished_id);
+#endif
 }
 
-static OSStatus audio_render_callback(void *user_data, AudioUnitRenderActionFlags *flags,
-                                      const AudioTimeStamp *timestamp, UInt32 bus,
-                                      UInt32 in_frames, AudioBufferList *data) {
-    mal_player *player = user_data;
+static void _mal_render_silence(AudioBufferList *data) {
+    for (int i = 0; i < data->mNumberBuffers; i++) {
+        memset(data->mBuffers[i].mData, 0, data->mBuffers[i].mDataByteSize);
+    }
+}
 
-    MAL_LOCK(player);
-    mal_player_state state = player->data.state;
-    if (player->buffer == NULL || player->buffer->managed_data == NULL ||
-        state == MAL_PLAYER_STATE_STOPPED ||
-        player->data.next_frame >= player->buffer->num_frames) {
-        // Silence for end of playback, or because the player is paused.
-        for (int i = 0; i < data->mNumberBuffers; i++) {
-            memset(data->mBuffers[i].mData, 0, data->mBuffers[i].mDataByteSize);
+// Called from the render thread when playback has ended (or when the buffer was removed).
+// Like _mal_player_did_finish(), but through the voice.
+static void _mal_voice_render_did_stop(struct _mal_voice *voice, UInt32 bus,
+                                       mal_player_state old_state) {
+    voice->state = MAL_PLAYER_STATE_STOPPED;
+    voice->next_frame = 0;
+    voice->finished = true;
+    MAL_ATOMIC_STORE(voice->player_state, MAL_PLAYER_STATE_STOPPED);
+
+    if (voice->context->data.graph) {
+        AUGraphDisconnectNodeInput(voice->context->data.graph, voice->context->data.mixer_node,
+                                   bus);
+    }
+
+    if (old_state == MAL_PLAYER_STATE_PLAYING && voice->on_finished_id) {
+        ok_static_assert(sizeof(voice->on_finished_id) == sizeof(uint64_t),
+                         "on_finished_id expected to be 64-bit");
+#if UINTPTR_MAX >= UINT64_MAX
+        // Pass the id as the context pointer, so nothing is allocated on the render thread
+        dispatch_async_f(dispatch_get_main_queue(), (void *)(uintptr_t)voice->on_finished_id,
+                         &_mal_handle_on_finished);
+#else
+        uint64_t *on_finished_id = malloc(sizeof(uint64_t));
+        if (on_finished_id) {
+            *on_finished_id = voice->on_finished_id;
+            dispatch_async_f(dispatch_get_main_queue(), on_finished_id,
+                             &_mal_handle_on_finished);
         }
+#endif
+    }
+}
 
-        if (state == MAL_PLAYER_STATE_PLAYING ||
-            player->buffer == NULL || player->buffer->managed_data == NULL) {
-            // Stop
-            player->data.state = MAL_PLAYER_STATE_STOPPED;
-            player->data.next_frame = 0;
+static void _mal_voice_render_ramp(struct _mal_voice *voice, UInt32 bus, UInt32 in_frames) {
+    if (voice->ramp.value != 0) {
+        mal_context *context = voice->context;
+        bool done = _mal_ramp(context, kAudioUnitScope_Input, bus, in_frames, voice->gain,
+                              &voice->ramp);
+        if (done && voice->state == MAL_PLAYER_STATE_PAUSED && context->data.graph) {
+            AUGraphDisconnectNodeInput(context->data.graph, context->data.mixer_node, bus);
+            Boolean updated;
+            AUGraphUpdate(context->data.graph, &updated);
+        }
+    }
+}
 
-            if (player->context && player->context->data.graph) {
-                AUGraphDisconnectNodeInput(player->context->data.graph,
-                                           player->context->data.mixer_node,
-                                           player->data.input_bus);
-            }
+static void _mal_voice_render_func(struct _mal_voice *voice, UInt32 bus, UInt32 in_frames,
+                                   AudioBufferList *data) {
+    mal_player_state state = voice->state;
+    if (state == MAL_PLAYER_STATE_STOPPED || data->mNumberBuffers == 0) {
+        _mal_render_silence(data);
+        return;
+    }
 
-            if (state == MAL_PLAYER_STATE_PLAYING && player->on_finished_id) {
-                ok_static_assert(sizeof(player->on_finished_id) == sizeof(uint64_t),
-                                 "on_finished_id expected to be 64-bit");
-                uint64_t *on_finished_id = malloc(sizeof(uint64_t));
-                if (on_finished_id) {
-                    *on_finished_id = player->on_finished_id;
-                    dispatch_async_f(dispatch_get_main_queue(), on_finished_id,
-                                     &_mal_handle_on_finished);
-                }
-            }
+    // The stream format is interleaved float, so there is only one buffer.
+    AudioBuffer *buffer = &data->mBuffers[0];
+    const uint32_t num_channels = voice->num_channels;
+    uint32_t max_frames = buffer->mDataByteSize / (sizeof(float) * num_channels);
+    if (max_frames > in_frames) {
+        max_frames = in_frames;
+    }
+    uint32_t frames;
+    voice->pulled_cycle = voice->context->data.render_cycle;
+    if (voice->prerender_cycle != 0 && max_frames == in_frames &&
+        voice->prerender_cycle == voice->context->data.render_cycle &&
+        in_frames == voice->context->data.prerender_num_frames) {
+        // Rendered before the mix. See _mal_context_prerender().
+        frames = voice->prerender_frames;
+        memcpy(buffer->mData, voice->prerender_data, frames * sizeof(float) * num_channels);
+        voice->prerender_cycle = 0;
+    } else {
+        frames = voice->render_func(voice->render_user_data, buffer->mData, max_frames,
+                                    num_channels);
+        if (frames > max_frames) {
+            frames = max_frames;
         }
+    }
+    const uint32_t rendered_bytes = frames * sizeof(float) * num_channels;
+    memset((uint8_t *)buffer->mData + rendered_bytes, 0, buffer->mDataByteSize - rendered_bytes);
+
+    if (frames < max_frames) {
+        _mal_voice_render_did_stop(voice, bus, state);
     } else {
-        const uint32_t num_frames = player->buffer->num_frames;
-        const uint32_t frame_size = ((player->buffer->format.bit_depth / 8) *
-                                     player->buffer->format.num_channels);
-        for (int i = 0; i < data->mNumberBuffers; i++) {
-            void *dst = data->mBuffers[i].mData;
-            uint32_t dst_remaining = data->mBuffers[i].mDataByteSize;
-
-            void *src = player->buffer->managed_data + player->data.next_frame * frame_size;
-            while (dst_remaining > 0) {
-                uint32_t player_frames = num_frames - player->data.next_frame;
-                uint32_t max_frames = dst_remaining / frame_size;
-                uint32_t copy_frames = player_frames < max_frames ? player_frames : max_frames;
-                uint32_t copy_bytes = copy_frames * frame_size;
-
-                if (copy_bytes == 0) {
-                    break;
-                }
+        _mal_voice_render_ramp(voice, bus, in_frames);
+    }
+}
 
-                memcpy(dst, src, copy_bytes);
-                player->data.next_frame += copy_frames;
-                dst += copy_bytes;
-                src += copy_bytes;
-                dst_remaining -= copy_bytes;
-
-                if (player->data.next_frame >= player->buffer->num_frames) {
-                    if (player->looping) {
-                        player->data.next_frame = 0;
-                        src = player->buffer->managed_data;
-                    } else {
-                        break;
-                    }
-                }
+static void _mal_voice_render_adpcm(struct _mal_voice *voice, AudioBufferList *data) {
+    // The stream format is interleaved 16-bit, so there is only one buffer.
+    AudioBuffer *buffer = &data->mBuffers[0];
+    const uint32_t num_channels = voice->num_channels;
+    const uint32_t num_frames = voice->source_num_frames;
+    int16_t *dst = buffer->mData;
+    uint32_t dst_frames = buffer->mDataByteSize / (sizeof(int16_t) * num_channels);
+    while (dst_frames > 0) {
+        uint32_t frames = _mal_adpcm_read(voice->adpcm_buffer, voice->adpcm_block,
+                                          &voice->adpcm_block_index, voice->next_frame,
+                                          dst, dst_frames);
+        voice->next_frame += frames;
+        dst += frames * num_channels;
+        dst_frames -= frames;
+
+        if (voice->next_frame >= num_frames && voice->looping) {
+            voice->next_frame = 0;
+        } else if (frames == 0 || voice->next_frame >= num_frames) {
+            break;
+        }
+    }
+    if (dst_frames > 0) {
+        // Silence
+        memset(dst, 0, dst_frames * sizeof(int16_t) * num_channels);
+    }
+}
+
+// Copies PCM source data. Specialized by the kernels below, which pass constant arguments: a
+// `fixed_frame_size` of 0 reads the frame size from the voice.
+static inline __attribute__((always_inline))
+void _mal_voice_render_pcm(struct _mal_voice *voice, AudioBufferList *data,
+                           const uint32_t fixed_frame_size, const bool looping) {
+    const uint32_t num_frames = voice->source_num_frames;
+    const uint32_t frame_size = fixed_frame_size ? fixed_frame_size : voice->source_frame_size;
+    for (int i = 0; i < data->mNumberBuffers; i++) {
+        void *dst = data->mBuffers[i].mData;
+        uint32_t dst_remaining = data->mBuffers[i].mDataByteSize;
+
+        const uint8_t *src = ((const uint8_t *)voice->source_data +
+                              voice->next_frame * frame_size);
+        while (dst_remaining > 0) {
+            uint32_t player_frames = num_frames - voice->next_frame;
+            uint32_t max_frames = dst_remaining / frame_size;
+            uint32_t copy_frames = player_frames < max_frames ? player_frames : max_frames;
+            uint32_t copy_bytes = copy_frames * frame_size;
+
+            if (copy_bytes == 0) {
+                break;
             }
 
-            if (dst_remaining > 0) {
-                // Silence
-                memset(dst, 0, dst_remaining);
+            memcpy(dst, src, copy_bytes);
+            voice->next_frame += copy_frames;
+            dst += copy_bytes;
+            src += copy_bytes;
+            dst_remaining -= copy_bytes;
+
+            if (voice->next_frame >= num_frames) {
+                if (looping) {
+                    voice->next_frame = 0;
+                    src = voice->source_data;
+                } else {
+                    break;
+                }
             }
         }
-        if (player->data.ramp.value != 0) {
-            bool done = _mal_ramp(player->context, kAudioUnitScope_Input, player->data.input_bus,
-                                  in_frames, player->gain, &player->data.ramp);
-            if (done && player->data.state == MAL_PLAYER_STATE_PAUSED &&
-                player->context && player->context->data.graph) {
-                AUGraphDisconnectNodeInput(player->context->data.graph,
-                                           player->context->data.mixer_node,
-                                           player->data.input_bus);
-                Boolean updated;
-                AUGraphUpdate(player->context->data.graph, &updated);
-            }
+
+        if (dst_remaining > 0) {
+            // Silence
+            memset(dst, 0, dst_remaining);
         }
     }
-    MAL_UNLOCK(player);
+}
+
+#define MAL_VOICE_PCM_KERNEL(frame_size, looping) \
+    static void _mal_voice_render_pcm_##frame_size##_##looping(struct _mal_voice *voice, \
+                                                              AudioBufferList *data) { \
+        _mal_voice_render_pcm(voice, data, frame_size, looping); \
+    }
+
+// Frame sizes of the mono and stereo bus formats: 8-bit, 16-bit, and float.
+MAL_VOICE_PCM_KERNEL(1, 0)
+MAL_VOICE_PCM_KERNEL(1, 1)
+MAL_VOICE_PCM_KERNEL(2, 0)
+MAL_VOICE_PCM_KERNEL(2, 1)
+MAL_VOICE_PCM_KERNEL(4, 0)
+MAL_VOICE_PCM_KERNEL(4, 1)
+MAL_VOICE_PCM_KERNEL(8, 0)
+MAL_VOICE_PCM_KERNEL(8, 1)
+MAL_VOICE_PCM_KERNEL(0, 0)
+MAL_VOICE_PCM_KERNEL(0, 1)
+
+#undef MAL_VOICE_PCM_KERNEL
+
+// Chooses the render kernel for the voice's source. Called with the voice locked.
+// Kernels copy whole frames without converting samples, so they're keyed by frame size rather
+// than by bit depth and channels (8-bit stereo and 16-bit mono share a kernel). Ramps aren't part
+// of the key: they're scheduled as mixer parameter events after the copy, once per slice.
+static void _mal_voice_select_render_kernel(struct _mal_voice *voice) {
+    static const mal_voice_render_kernel pcm_kernels[][2] = {
+        { _mal_voice_render_pcm_0_0, _mal_voice_render_pcm_0_1 },
+        { _mal_voice_render_pcm_1_0, _mal_voice_render_pcm_1_1 },
+        { _mal_voice_render_pcm_2_0, _mal_voice_render_pcm_2_1 },
+        { _mal_voice_render_pcm_0_0, _mal_voice_render_pcm_0_1 },
+        { _mal_voice_render_pcm_4_0, _mal_voice_render_pcm_4_1 },
+        { _mal_voice_render_pcm_0_0, _mal_voice_render_pcm_0_1 },
+        { _mal_voice_render_pcm_0_0, _mal_voice_render_pcm_0_1 },
+        { _mal_voice_render_pcm_0_0, _mal_voice_render_pcm_0_1 },
+        { _mal_voice_render_pcm_8_0, _mal_voice_render_pcm_8_1 },
+    };
+    const uint32_t frame_size = voice->source_frame_size;
+    if (voice->adpcm_buffer) {
+        voice->render_kernel = _mal_voice_render_adpcm;
+    } else if (frame_size < sizeof(pcm_kernels) / sizeof(*pcm_kernels)) {
+        voice->render_kernel = pcm_kernels[frame_size][voice->looping];
+    } else {
+        voice->render_kernel = pcm_kernels[0][voice->looping];
+    }
+}
+
+// The `user_data` is the bus's voice. The voice outlives its player: voice tables are freed with
+// the context.
+static OSStatus audio_render_callback(void *user_data, AudioUnitRenderActionFlags *flags,
+                                      const AudioTimeStamp *timestamp, UInt32 bus,
+                                      UInt32 in_frames, AudioBufferList *data) {
+    struct _mal_voice *voice = user_data;
+
+    MAL_LOCK(voice);
+    if (!voice->context) {
+        // The player was disposed
+        _mal_render_silence(data);
+        MAL_UNLOCK(voice);
+        return noErr;
+    }
+    mal_player_state state = voice->state;
+    if (voice->render_func) {
+        _mal_voice_render_func(voice, bus, in_frames, data);
+    } else if (voice->source_data == NULL || state == MAL_PLAYER_STATE_STOPPED ||
+               voice->next_frame >= voice->source_num_frames) {
+        // Silence for end of playback, or because the player is paused.
+        _mal_render_silence(data);
+
+        if (state == MAL_PLAYER_STATE_PLAYING || voice->source_data == NULL) {
+            _mal_voice_render_did_stop(voice, bus, state);
+        }
+    } else {
+        voice->render_kernel(voice, data);
+        _mal_voice_render_ramp(voice, bus, in_frames);
+    }
+    MAL_UNLOCK(voice);
 
     return noErr;
 }
 
+// Gets the voice for an input bus, allocating the bus's table if needed.
+static struct _mal_voice *_mal_context_get_voice(mal_context *context, uint32_t bus) {
+    const uint32_t chunk = bus / MAL_COREAUDIO_VOICES_PER_CHUNK;
+    if (chunk >= MAL_COREAUDIO_MAX_VOICE_CHUNKS) {
+        return NULL;
+    }
+    if (!context->data.voice_chunks[chunk]) {
+        struct _mal_voice *voices = NULL;
+        const size_t size = sizeof(struct _mal_voice) * MAL_COREAUDIO_VOICES_PER_CHUNK;
+        if (posix_memalign((void **)&voices, MAL_CACHE_LINE_SIZE, size) != 0) {
+            return NULL;
+        }
+        // Cleared before it's published, because _mal_context_prerender() scans the table
+        memset(voices, 0, size);
+        for (int i = 0; i < MAL_COREAUDIO_VOICES_PER_CHUNK; i++) {
+            pthread_mutex_init(&voices[i].mutex, NULL);
+        }
+        MAL_LOCK(context);
+        context->data.voice_chunks[chunk] = voices;
+        MAL_UNLOCK(context);
+    }
+    return context->data.voice_chunks[chunk] + bus % MAL_COREAUDIO_VOICES_PER_CHUNK;
+}
+
+// Clears every field of the voice except its mutex. Called with the voice locked.
+static void _mal_voice_clear(struct _mal_voice *voice) {
+    const size_t offset = offsetof(struct _mal_voice, context);
+    memset((uint8_t *)voice + offset, 0, sizeof(struct _mal_voice) - offset);
+}
+
+static bool _mal_player_init_voice(mal_player *player) {
+    struct _mal_voice *voice = _mal_context_get_voice(player->context, player->data.input_bus);
+    if (!voice) {
+        _mal_bitmap_release(&player->context->data.buses, player->data.input_bus);
+        player->data.input_bus = UINT32_MAX;
+        return false;
+    }
+    MAL_LOCK(voice);
+    _mal_voice_clear(voice);
+    voice->context = player->context;
+    voice->state = MAL_PLAYER_STATE_STOPPED;
+    voice->num_channels = player->format.num_channels;
+    voice->looping = player->looping;
+    voice->gain = player->gain;
+    voice->render_func = player->render_func;
+    voice->render_user_data = player->render_user_data;
+    voice->player_state = &player->state;
+    voice->on_finished_id = player->on_finished_id;
+    MAL_UNLOCK(voice);
+    player->data.voice = voice;
+    return true;
+}
+
 static bool _mal_player_init(mal_player *player) {
     player->data.input_bus = UINT32_MAX;
+    player->data.voice = NULL;
 
     mal_context *context = player->context;
-    if (!context || context->data.num_buses == 0) {
+    if (!context || context->data.buses.num_slots == 0) {
         return false;
     }
 
-    // Find a free bus
-    int num_buses = context->data.num_buses;
-    bool *taken_buses = calloc(num_buses, sizeof(bool));
-    if (!taken_buses) {
-        return false;
-    }
-    ok_vec_foreach(&context->players, mal_player *curr_player) {
-        if (curr_player != player) {
-            taken_buses[curr_player->data.input_bus] = true;
-        }
-    }
-    for (int i = 0; i < num_buses; i++) {
-        if (!taken_buses[i]) {
-            player->data.input_bus = i;
-            break;
-        }
-    }
-    free(taken_buses);
+    // Take the lowest free bus
+    player->data.input_bus = _mal_bitmap_acquire(&context->data.buses);
     if (player->data.input_bus != UINT32_MAX) {
-        return true;
+        return _mal_player_init_voice(player);
     }
 
-    // Try to increase the number of buses (by 8)
-    UInt32 bus_size = sizeof(UInt32);
-    UInt32 new_bus_count = num_buses + 8;
-    OSStatus status = AudioUnitSetProperty(context->data.mixer_unit,
-                                           kAudioUnitProperty_ElementCount,
-                                           kAudioUnitScope_Input,
-                                           0,
-                                           &new_bus_count,
-                                           bus_size);
-    if (status == noErr) {
-        context->data.num_buses = new_bus_count;
-        player->data.input_bus = num_buses;
-        return true;
-    } else {
-        return false;
+    // Try to increase the number of buses. Double the count, so creating many players doesn't
+    // resize the mixer each time, or add a single bus if the mixer can't grow that much.
+    const uint32_t num_buses = context->data.buses.num_slots;
+    const uint32_t new_bus_counts[2] = { num_buses * 2, num_buses + 1 };
+    for (int i = 0; i < 2; i++) {
+        UInt32 new_bus_count = new_bus_counts[i];
+        OSStatus status = AudioUnitSetProperty(context->data.mixer_unit,
+                                               kAudioUnitProperty_ElementCount,
+                                               kAudioUnitScope_Input,
+                                               0,
+                                               &new_bus_count,
+                                               sizeof(new_bus_count));
+        if (status == noErr) {
+            if (!_mal_bitmap_grow(&context->data.buses, new_bus_count)) {
+                return false;
+            }
+            player->data.input_bus = _mal_bitmap_acquire(&context->data.buses);
+            return player->data.input_bus != UINT32_MAX && _mal_player_init_voice(player);
+        }
     }
+    return false;
 }
 
 static void _mal_player_dispose(mal_player *player) {
-    // Do nothing
+    // Release the bus
+    mal_context *context = player->context;
+    if (player->data.input_bus != UINT32_MAX && context && context->data.graph) {
+        AUGraphDisconnectNodeInput(context->data.graph, context->data.mixer_node,
+                                   player->data.input_bus);
+        Boolean updated;
+        AUGraphUpdate(context->data.graph, &updated);
+    }
+    if (player->data.input_bus != UINT32_MAX && context) {
+        _mal_bitmap_release(&context->data.buses, player->data.input_bus);
+    }
+    player->data.input_bus = UINT32_MAX;
+    struct _mal_voice *voice = player->data.voice;
+    if (voice) {
+        // The context is locked because _mal_context_prerender() reads `prerender_data`
+        const bool lock_context = voice->prerender_data && context;
+        if (lock_context) {
+            MAL_LOCK(context);
+        }
+        MAL_LOCK(voice);
+        free(voice->adpcm_block);
+        free(voice->prerender_data);
+        _mal_voice_clear(voice);
+        MAL_UNLOCK(voice);
+        if (lock_context) {
+            MAL_UNLOCK(context);
+        }
+        player->data.voice = NULL;
+    }
+    player->data.adpcm_block_length = 0;
 }
 
 static void _mal_player_did_set_finished_callback(mal_player *player) {
-    // Do nothing
-}
-
-static bool _mal_player_set_format(mal_player *player, mal_format format) {
-    if (!player->context) {
-        return false;
+    struct _mal_voice *voice = player->data.voice;
+    if (voice) {
+        MAL_LOCK(voice);
+        voice->on_finished_id = player->on_finished_id;
+        MAL_UNLOCK(voice);
     }
+}
 
+static bool _mal_player_set_bus_format(mal_player *player, mal_format format) {
     AudioStreamBasicDescription stream_desc;
     memset(&stream_desc, 0, sizeof(stream_desc));
     stream_desc.mFormatID = kAudioFormatLinearPCM;
     stream_desc.mFramesPerPacket = 1;
     stream_desc.mSampleRate = format.sample_rate;
-    stream_desc.mBitsPerChannel = format.bit_depth;
     stream_desc.mChannelsPerFrame = format.num_channels;
-    stream_desc.mBytesPerFrame = (format.bit_depth / 8) * format.num_channels;
+    if (format.sample_type == MAL_SAMPLE_TYPE_FLOAT) {
+        stream_desc.mBitsPerChannel = 32;
+        stream_desc.mFormatFlags = (kLinearPCMFormatFlagIsFloat |
+                                    kAudioFormatFlagsNativeEndian | kLinearPCMFormatFlagIsPacked);
+    } else {
+        stream_desc.mBitsPerChannel = format.bit_depth;
+        stream_desc.mFormatFlags = (kLinearPCMFormatFlagIsSignedInteger |
+                                    kAudioFormatFlagsNativeEndian | kLinearPCMFormatFlagIsPacked);
+    }
+    stream_desc.mBytesPerFrame = (stream_desc.mBitsPerChannel / 8) * format.num_channels;
     stream_desc.mBytesPerPacket = stream_desc.mBytesPerFrame;
-    stream_desc.mFormatFlags = (kLinearPCMFormatFlagIsSignedInteger |
-                                kAudioFormatFlagsNativeEndian | kLinearPCMFormatFlagIsPacked);
     OSStatus status = AudioUnitSetProperty(player->context->data.mixer_unit,
                                            kAudioUnitProperty_StreamFormat,
                                            kAudioUnitScope_Input,
@@ -568,9 +1094,108 @@ static bool _mal_player_set_format(mal_player *player, mal_format format) {
         return false;
     }
 
+    player->data.bus_format = format;
+    if (player->render_func) {
+        _mal_player_update_prerender(player);
+    }
     return true;
 }
 
+// Allocates the voice's prerender buffer if it can be rendered in parallel, or frees it otherwise.
+// The buffer is set with both the context and the voice locked. See _mal_context_prerender().
+static void _mal_player_update_prerender(mal_player *player) {
+    mal_context *context = player->context;
+    struct _mal_voice *voice = player->data.voice;
+    if (!context || !voice) {
+        return;
+    }
+    const bool prerender = (context->data.render_pool && voice->render_func &&
+                            context->data.max_frames_per_slice > 0 &&
+                            player->data.bus_format.sample_rate ==
+                            context->data.output_sample_rate);
+    if (!prerender && !voice->prerender_data) {
+        return;
+    }
+    float *prerender_data = NULL;
+    if (prerender) {
+        prerender_data = malloc(sizeof(float) * context->data.max_frames_per_slice *
+                                voice->num_channels);
+    }
+    MAL_LOCK(context);
+    MAL_LOCK(voice);
+    free(voice->prerender_data);
+    voice->prerender_data = prerender_data;
+    voice->prerender_cycle = 0;
+    MAL_UNLOCK(voice);
+    MAL_UNLOCK(context);
+}
+
+static bool _mal_player_set_format(mal_player *player, mal_format format) {
+    if (!player->context) {
+        return false;
+    }
+    if (player->render_func) {
+        // Render functions output interleaved float
+        format.sample_type = MAL_SAMPLE_TYPE_FLOAT;
+        format.bit_depth = 32;
+    }
+    return _mal_player_set_bus_format(player, _mal_format_decoded(format));
+}
+
+// Chooses the data to play from: the buffer's native cache if it's ready, otherwise the buffer's
+// data. Called when playback starts from the stopped state.
+static void _mal_player_set_source(mal_player *player) {
+    struct _mal_voice *voice = player->data.voice;
+    const mal_buffer *buffer = player->buffer;
+    mal_format bus_format = _mal_format_decoded(player->format);
+    MAL_LOCK(voice);
+    voice->adpcm_buffer = NULL;
+    if (!buffer) {
+        voice->source_data = NULL;
+        voice->source_num_frames = 0;
+        player->data.source_frame_scale = 1.0;
+    } else if (buffer->native_cache_data) {
+        bus_format = buffer->native_cache_format;
+        voice->source_data = buffer->native_cache_data;
+        voice->source_num_frames = buffer->native_cache_num_frames;
+        voice->source_frame_size = sizeof(float) * bus_format.num_channels;
+        player->data.source_frame_scale = bus_format.sample_rate / buffer->format.sample_rate;
+    } else if (_mal_format_is_adpcm(buffer->format)) {
+        const size_t block_length = (_mal_adpcm_frames_per_block(buffer->format) *
+                                     buffer->format.num_channels);
+        if (player->data.adpcm_block_length != block_length) {
+            free(voice->adpcm_block);
+            voice->adpcm_block = malloc(block_length * sizeof(int16_t));
+            player->data.adpcm_block_length = voice->adpcm_block ? block_length : 0;
+        }
+        bus_format = _mal_format_decoded(buffer->format);
+        voice->source_data = voice->adpcm_block ? buffer->managed_data : NULL;
+        voice->source_num_frames = buffer->num_frames;
+        voice->source_frame_size = sizeof(int16_t) * bus_format.num_channels;
+        voice->adpcm_buffer = voice->adpcm_block ? buffer : NULL;
+        voice->adpcm_block_index = UINT32_MAX;
+        player->data.source_frame_scale = 1.0;
+    } else {
+        voice->source_data = buffer->managed_data;
+        voice->source_num_frames = buffer->num_frames;
+        voice->source_frame_size = ((buffer->format.bit_depth / 8) *
+                                    buffer->format.num_channels);
+        player->data.source_frame_scale = 1.0;
+    }
+    voice->num_channels = bus_format.num_channels;
+    _mal_voice_select_render_kernel(voice);
+    if (voice->finished) {
+        // Played to the end since the position was last set
+        player->data.start_frame = 0;
+        voice->finished = false;
+    }
+    voice->next_frame = (uint32_t)(player->data.start_frame * player->data.source_frame_scale);
+    MAL_UNLOCK(voice);
+    if (!player->render_func && !mal_formats_equal(bus_format, player->data.bus_format)) {
+        _mal_player_set_bus_format(player, bus_format);
+    }
+}
+
 static bool _mal_player_set_buffer(mal_player *player, const mal_buffer *buffer) {
     // Do nothing
     return true;
@@ -581,6 +1206,11 @@ static void _mal_player_set_mute(mal_player *player, bool mute) {
 }
 
 static void _mal_player_set_gain(mal_player *player, float gain) {
+    if (player && player->data.voice) {
+        MAL_LOCK(player->data.voice);
+        player->data.voice->gain = gain;
+        MAL_UNLOCK(player->data.voice);
+    }
     if (player && player->context && player->context->data.mixer_unit) {
         float total_gain = player->mute ? 0.0f : gain;
         OSStatus status = AudioUnitSetParameter(player->context->data.mixer_unit,
@@ -596,16 +1226,58 @@ static void _mal_player_set_gain(mal_player *player, float gain) {
 }
 
 static void _mal_player_set_looping(mal_player *player, bool looping) {
-    // Do nothing
+    struct _mal_voice *voice = player->data.voice;
+    if (voice) {
+        MAL_LOCK(voice);
+        voice->looping = looping;
+        _mal_voice_select_render_kernel(voice);
+        MAL_UNLOCK(voice);
+    }
 }
 
 static mal_player_state _mal_player_get_state(const mal_player *player) {
-    return player->data.state;
+    struct _mal_voice *voice = player->data.voice;
+    if (!voice) {
+        return MAL_PLAYER_STATE_STOPPED;
+    }
+    MAL_LOCK(voice);
+    const mal_player_state state = voice->state;
+    MAL_UNLOCK(voice);
+    return state;
+}
+
+static uint32_t _mal_player_get_position(const mal_player *player) {
+    struct _mal_voice *voice = player->data.voice;
+    if (!voice) {
+        return player->data.start_frame;
+    }
+    MAL_LOCK(voice);
+    uint32_t position;
+    if (voice->state == MAL_PLAYER_STATE_STOPPED) {
+        position = voice->finished ? 0 : player->data.start_frame;
+    } else if (player->data.source_frame_scale > 0) {
+        position = (uint32_t)(voice->next_frame / player->data.source_frame_scale);
+    } else {
+        position = voice->next_frame;
+    }
+    MAL_UNLOCK(voice);
+    return position;
+}
+
+static void _mal_player_set_position(mal_player *player, uint32_t frame) {
+    player->data.start_frame = frame;
+    struct _mal_voice *voice = player->data.voice;
+    if (voice) {
+        MAL_LOCK(voice);
+        voice->finished = false;
+        MAL_UNLOCK(voice);
+    }
 }
 
 static bool _mal_player_set_state(mal_player *player, mal_player_state old_state,
                                   mal_player_state state) {
-    if (!player->context || !player->context->data.graph) {
+    struct _mal_voice *voice = player->data.voice;
+    if (!player->context || !player->context->data.graph || !voice) {
         return false;
     }
 
@@ -617,15 +1289,20 @@ static bool _mal_player_set_state(mal_player *player, mal_player_state old_state
                                        player->data.input_bus);
             Boolean updated;
             AUGraphUpdate(player->context->data.graph, &updated);
-            player->data.next_frame = 0;
+            MAL_LOCK(voice);
+            voice->next_frame = 0;
+            MAL_UNLOCK(voice);
+            player->data.start_frame = 0;
             break;
         }
         case MAL_PLAYER_STATE_PAUSED:
             if (player->context->data.can_ramp_input_gain) {
                 // Fade out
-                player->data.ramp.value = -1;
-                player->data.ramp.frames = player->buffer->format.sample_rate * 0.1;
-                player->data.ramp.frames_position = 0;
+                MAL_LOCK(voice);
+                voice->ramp.value = -1;
+                voice->ramp.frames = player->data.bus_format.sample_rate * 0.1;
+                voice->ramp.frames_position = 0;
+                MAL_UNLOCK(voice);
             } else {
                 AUGraphDisconnectNodeInput(player->context->data.graph,
                                            player->context->data.mixer_node,
@@ -636,13 +1313,14 @@ static bool _mal_player_set_state(mal_player *player, mal_player_state old_state
             break;
         case MAL_PLAYER_STATE_PLAYING: {
             if (old_state == MAL_PLAYER_STATE_STOPPED) {
+                _mal_player_set_source(player);
                 AudioUnitReset(player->context->data.mixer_unit, kAudioUnitScope_Input, player->data.input_bus);
             }
 
             AURenderCallbackStruct render_callback;
             memset(&render_callback, 0, sizeof(render_callback));
             render_callback.inputProc = audio_render_callback;
-            render_callback.inputProcRefCon = player;
+            render_callback.inputProcRefCon = voice;
             AUGraphSetNodeInputCallback(player->context->data.graph,
                                         player->context->data.mixer_node,
                                         player->data.input_bus,
@@ -652,14 +1330,18 @@ static bool _mal_player_set_state(mal_player *player, mal_player_state old_state
             if (old_state == MAL_PLAYER_STATE_PAUSED &&
                 player->context->data.can_ramp_input_gain) {
                 // Fade in
-                player->data.ramp.value = 1;
-                player->data.ramp.frames = player->buffer->format.sample_rate * 0.05;
-                player->data.ramp.frames_position = 0;
+                MAL_LOCK(voice);
+                voice->ramp.value = 1;
+                voice->ramp.frames = player->data.bus_format.sample_rate * 0.05;
+                voice->ramp.frames_position = 0;
+                MAL_UNLOCK(voice);
             }
             break;
         }
     }
-    player->data.state = state;
+    MAL_LOCK(voice);
+    voice->state = state;
+    MAL_UNLOCK(voice);
     return true;
 }
 
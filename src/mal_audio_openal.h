@@ -21,7 +21,9 @@
 #ifndef _MAL_AUDIO_OPENAL_H_
 #define _MAL_AUDIO_OPENAL_H_
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <time.h>
 
 #ifdef __APPLE__
 #include <OpenAL/al.h>
@@ -34,16 +36,155 @@
 #ifndef AL_APIENTRY
 #define AL_APIENTRY
 #endif
+#ifndef ALC_APIENTRY
+#define ALC_APIENTRY
+#endif
+
+#include "ok_lib.h"
+
+// Number of sources created when the context is created. More sources are created as needed.
+#ifndef MAL_OPENAL_SOURCE_POOL_SIZE
+#define MAL_OPENAL_SOURCE_POOL_SIZE 32
+#endif
+
+// Minimum interval for polling sources for finished playback in mal_context_update(), if
+// AL_SOFT_events isn't available.
+#ifndef MAL_OPENAL_POLL_INTERVAL_MS
+#define MAL_OPENAL_POLL_INTERVAL_MS 50
+#endif
+
+// Streaming for render function players: the number of frames per buffer, the number of buffers
+// queued (if AL_SOFT_callback_buffer isn't available), and the interval for refilling buffers.
+#ifndef MAL_OPENAL_STREAM_FRAMES
+#define MAL_OPENAL_STREAM_FRAMES 2048
+#endif
+#ifndef MAL_OPENAL_STREAM_BUFFERS
+#define MAL_OPENAL_STREAM_BUFFERS 4
+#endif
+#ifndef MAL_OPENAL_STREAM_INTERVAL_MS
+#define MAL_OPENAL_STREAM_INTERVAL_MS 10
+#endif
+
+// OpenAL's error state is sticky: an error stays set until alGetError() is called. Errors from
+// calls that cannot fail with valid arguments (like setting a source's gain) aren't checked, so the
+// error is cleared before each call whose error is checked (like creating buffers).
+#define MAL_AL_CLEAR_ERROR() ((void)alGetError())
 
 typedef ALvoid AL_APIENTRY (*alcMacOSXMixerOutputRateProcPtr)(const ALdouble value);
 typedef ALvoid AL_APIENTRY (*alBufferDataStaticProcPtr)(ALint bid, ALenum format,
                                                         const ALvoid *data, ALsizei size,
                                                         ALsizei freq);
 
+// AL_SOFT_events
+#ifndef AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT
+#define AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT 0x19A5
+#endif
+typedef void AL_APIENTRY (*alEventProcSOFTPtr)(ALenum event_type, ALuint object, ALuint param,
+                                               ALsizei length, const ALchar *message,
+                                               void *user_param);
+typedef void AL_APIENTRY (*alEventControlSOFTProcPtr)(ALsizei count, const ALenum *types,
+                                                      ALboolean enable);
+typedef void AL_APIENTRY (*alEventCallbackSOFTProcPtr)(alEventProcSOFTPtr callback,
+                                                       void *user_param);
+
+// AL_EXT_FLOAT32
+#ifndef AL_FORMAT_MONO_FLOAT32
+#define AL_FORMAT_MONO_FLOAT32 0x10010
+#define AL_FORMAT_STEREO_FLOAT32 0x10011
+#endif
+
+// AL_EXT_MCFORMATS
+#ifndef AL_FORMAT_QUAD16
+#define AL_FORMAT_QUAD8 0x1204
+#define AL_FORMAT_QUAD16 0x1205
+#define AL_FORMAT_QUAD32 0x1206
+#define AL_FORMAT_51CHN8 0x120A
+#define AL_FORMAT_51CHN16 0x120B
+#define AL_FORMAT_51CHN32 0x120C
+#define AL_FORMAT_71CHN8 0x1210
+#define AL_FORMAT_71CHN16 0x1211
+#define AL_FORMAT_71CHN32 0x1212
+#endif
+
+// AL_EXT_IMA4, AL_SOFT_MSADPCM, and AL_SOFT_block_alignment
+#ifndef AL_FORMAT_MONO_IMA4
+#define AL_FORMAT_MONO_IMA4 0x1300
+#define AL_FORMAT_STEREO_IMA4 0x1301
+#endif
+#ifndef AL_FORMAT_MONO_MSADPCM_SOFT
+#define AL_FORMAT_MONO_MSADPCM_SOFT 0x1302
+#define AL_FORMAT_STEREO_MSADPCM_SOFT 0x1303
+#endif
+#ifndef AL_UNPACK_BLOCK_ALIGNMENT_SOFT
+#define AL_UNPACK_BLOCK_ALIGNMENT_SOFT 0x200C
+#endif
+
+// AL_SOFT_callback_buffer
+typedef ALsizei AL_APIENTRY (*alBufferCallbackProcSOFTPtr)(ALvoid *user_data, ALvoid *data,
+                                                           ALsizei num_bytes);
+typedef void AL_APIENTRY (*alBufferCallbackSOFTProcPtr)(ALuint buffer, ALenum format,
+                                                        ALsizei freq,
+                                                        alBufferCallbackProcSOFTPtr callback,
+                                                        ALvoid *user_data);
+
+// ALC_SOFT_loopback
+#ifndef ALC_FORMAT_CHANNELS_SOFT
+#define ALC_FORMAT_CHANNELS_SOFT 0x1990
+#define ALC_FORMAT_TYPE_SOFT 0x1991
+#define ALC_MONO_SOFT 0x1500
+#define ALC_STEREO_SOFT 0x1501
+#define ALC_FLOAT_SOFT 0x1406
+#endif
+typedef ALCdevice *ALC_APIENTRY (*alcLoopbackOpenDeviceSOFTProcPtr)(const ALCchar *device_name);
+typedef ALCboolean ALC_APIENTRY (*alcIsRenderFormatSupportedSOFTProcPtr)(ALCdevice *device,
+                                                                         ALCsizei freq,
+                                                                         ALCenum channels,
+                                                                         ALCenum type);
+typedef void ALC_APIENTRY (*alcRenderSamplesSOFTProcPtr)(ALCdevice *device, ALCvoid *buffer,
+                                                         ALCsizei samples);
+
+typedef struct ok_vec_of(ALuint) mal_al_source_vec_t;
+typedef struct {
+    struct mal_player *player;
+    uint64_t on_finished_id; // 0 if the player has no finished callback
+} mal_al_watched_source;
+typedef struct ok_map_of(uint32_t, mal_al_watched_source) mal_al_watched_source_map_t;
+typedef struct ok_vec_of(uint64_t) mal_al_finished_id_vec_t;
+typedef struct ok_vec_of(struct mal_player *) mal_al_player_vec_t;
+
 struct _mal_context {
     ALCcontext *al_context;
     alBufferDataStaticProcPtr alBufferDataStaticProc;
     alcMacOSXMixerOutputRateProcPtr alcMacOSXMixerOutputRateProc;
+    alEventCallbackSOFTProcPtr alEventCallbackSOFTProc;
+    alcRenderSamplesSOFTProcPtr alcRenderSamplesSOFTProc;
+    alBufferCallbackSOFTProcPtr alBufferCallbackSOFTProc;
+    bool float32_supported;
+    bool multichannel_supported;
+    bool ima_adpcm_supported;
+    bool ms_adpcm_supported;
+
+    mal_al_source_vec_t all_sources;
+    mal_al_source_vec_t free_sources;
+    int update_depth;
+
+    // Sources that are playing (source -> player). Only used on the main thread.
+    mal_al_watched_source_map_t watched_sources;
+    mal_al_source_vec_t checked_sources;
+    double last_poll_time;
+
+    // Sources that AL_SOFT_events reported as stopped, and the ids of finished players waiting to
+    // be sent on the main thread. Guarded by `finished_mutex`.
+    pthread_mutex_t finished_mutex;
+    mal_al_source_vec_t stopped_sources;
+    mal_al_finished_id_vec_t finished_ids;
+
+    // Render function players streaming through a buffer queue. Guarded by `stream_mutex`.
+    pthread_mutex_t stream_mutex;
+    mal_al_player_vec_t stream_players;
+    bool stream_thread_running;
+    bool stream_thread_quit;
+    pthread_t stream_thread;
 };
 
 struct _mal_buffer {
@@ -54,14 +195,138 @@ struct _mal_buffer {
 struct _mal_player {
     ALuint al_source;
     bool al_source_valid;
+
+    // Render function players
+    ALuint stream_buffers[MAL_OPENAL_STREAM_BUFFERS];
+    ALsizei num_stream_buffers;
+    void *stream_data;
+    float *stream_scratch;
+    bool stream_float;
+    bool stream_finished;
+    // Held while the stream thread renders the player, so the player isn't stopped meanwhile. Lock
+    // it before the context's `stream_mutex`.
+    pthread_mutex_t stream_render_mutex;
+    bool stream_render_mutex_valid;
+    // Guarded by the context's `stream_mutex`
+    bool stream_active;
+    uint64_t stream_on_finished_id;
 };
 
 #include "mal_audio_abstract.h"
 
 // MARK: Context
 
+static void _mal_context_create_sources(mal_context *context, ALsizei count) {
+    if (!ok_vec_ensure_capacity(&context->data.all_sources, count) ||
+        !ok_vec_ensure_capacity(&context->data.free_sources, count)) {
+        return;
+    }
+    // Create as many as possible, up to `count`
+    while (count > 0) {
+        ALuint *sources = context->data.all_sources.values + context->data.all_sources.count;
+        MAL_AL_CLEAR_ERROR();
+        alGenSources(count, sources);
+        if (alGetError() == AL_NO_ERROR) {
+            for (ALsizei i = 0; i < count; i++) {
+                ok_vec_push(&context->data.free_sources, sources[i]);
+            }
+            context->data.all_sources.count += count;
+            break;
+        }
+        count /= 2;
+    }
+}
+
+// Called on an OpenAL thread. Only records the source: the event may be stale (the source may
+// have been played again since), so the state is checked on the main thread.
+static void AL_APIENTRY _mal_al_event_callback(ALenum event_type, ALuint object, ALuint param,
+                                               ALsizei length, const ALchar *message,
+                                               void *user_param) {
+    mal_context *context = user_param;
+    if (event_type == AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT && param == AL_STOPPED) {
+        pthread_mutex_lock(&context->data.finished_mutex);
+        ok_vec_push(&context->data.stopped_sources, object);
+        pthread_mutex_unlock(&context->data.finished_mutex);
+    }
+}
+
+static void _mal_context_init_finished_events(mal_context *context) {
+    if (alIsExtensionPresent("AL_SOFT_events")) {
+        alEventControlSOFTProcPtr alEventControlSOFTProc =
+            ((alEventControlSOFTProcPtr)alGetProcAddress("alEventControlSOFT"));
+        context->data.alEventCallbackSOFTProc =
+            ((alEventCallbackSOFTProcPtr)alGetProcAddress("alEventCallbackSOFT"));
+        if (alEventControlSOFTProc && context->data.alEventCallbackSOFTProc) {
+            const ALenum types[] = { AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT };
+            MAL_AL_CLEAR_ERROR();
+            context->data.alEventCallbackSOFTProc(_mal_al_event_callback, context);
+            alEventControlSOFTProc(1, types, AL_TRUE);
+            if (alGetError() == AL_NO_ERROR) {
+                return;
+            }
+            context->data.alEventCallbackSOFTProc(NULL, NULL);
+        }
+        context->data.alEventCallbackSOFTProc = NULL;
+    }
+    // Fallback: watched sources are polled in _mal_context_update()
+}
+
+static ALCdevice *_mal_context_open_loopback_device(mal_context *context,
+                                                    ALCint *attributes) {
+    if (!alcIsExtensionPresent(NULL, "ALC_SOFT_loopback")) {
+        MAL_LOG("ALC_SOFT_loopback not available");
+        return NULL;
+    }
+    alcLoopbackOpenDeviceSOFTProcPtr alcLoopbackOpenDeviceSOFTProc =
+        ((alcLoopbackOpenDeviceSOFTProcPtr)alcGetProcAddress(NULL, "alcLoopbackOpenDeviceSOFT"));
+    const ALCchar *format_supported_name = "alcIsRenderFormatSupportedSOFT";
+    alcIsRenderFormatSupportedSOFTProcPtr alcIsRenderFormatSupportedSOFTProc =
+        ((alcIsRenderFormatSupportedSOFTProcPtr)alcGetProcAddress(NULL, format_supported_name));
+    context->data.alcRenderSamplesSOFTProc =
+        ((alcRenderSamplesSOFTProcPtr)alcGetProcAddress(NULL, "alcRenderSamplesSOFT"));
+    if (!alcLoopbackOpenDeviceSOFTProc || !alcIsRenderFormatSupportedSOFTProc ||
+        !context->data.alcRenderSamplesSOFTProc) {
+        return NULL;
+    }
+    ALCdevice *device = alcLoopbackOpenDeviceSOFTProc(NULL);
+    if (!device) {
+        return NULL;
+    }
+    const ALCsizei freq = (ALCsizei)context->sample_rate;
+    const ALCenum channels = (context->loopback_num_channels == 2 ? ALC_STEREO_SOFT :
+                              ALC_MONO_SOFT);
+    if (!alcIsRenderFormatSupportedSOFTProc(device, freq, channels, ALC_FLOAT_SOFT)) {
+        MAL_LOG("Loopback render format not supported");
+        alcCloseDevice(device);
+        return NULL;
+    }
+    attributes[0] = ALC_FORMAT_CHANNELS_SOFT;
+    attributes[1] = channels;
+    attributes[2] = ALC_FORMAT_TYPE_SOFT;
+    attributes[3] = ALC_FLOAT_SOFT;
+    attributes[4] = ALC_FREQUENCY;
+    attributes[5] = freq;
+    attributes[6] = 0;
+    return device;
+}
+
 static bool _mal_context_init(mal_context *context) {
-    ALCdevice *device = alcOpenDevice(NULL);
+    ok_vec_init(&context->data.all_sources);
+    ok_vec_init(&context->data.free_sources);
+    ok_vec_init(&context->data.finished_ids);
+    ok_vec_init(&context->data.stopped_sources);
+    ok_vec_init(&context->data.checked_sources);
+    ok_map_init_custom(&context->data.watched_sources, ok_uint32_hash, ok_32bit_equals);
+    pthread_mutex_init(&context->data.finished_mutex, NULL);
+    ok_vec_init(&context->data.stream_players);
+    pthread_mutex_init(&context->data.stream_mutex, NULL);
+    ALCint loopback_attributes[7];
+    ALCdevice *device;
+    if (context->loopback_num_channels > 0) {
+        device = _mal_context_open_loopback_device(context, loopback_attributes);
+    } else {
+        device = alcOpenDevice(NULL);
+    }
     if (!device) {
         return false;
     } else {
@@ -70,17 +335,60 @@ static bool _mal_context_init(mal_context *context) {
         context->data.alcMacOSXMixerOutputRateProc =
             ((alcMacOSXMixerOutputRateProcPtr)alcGetProcAddress(NULL, "alcMacOSXMixerOutputRate"));
 
-        if (context->data.alcMacOSXMixerOutputRateProc && context->sample_rate > 0) {
-            context->data.alcMacOSXMixerOutputRateProc(context->sample_rate);
+        if (context->loopback_num_channels > 0) {
+            context->data.al_context = alcCreateContext(device, loopback_attributes);
+        } else {
+            if (context->data.alcMacOSXMixerOutputRateProc && context->sample_rate > 0) {
+                context->data.alcMacOSXMixerOutputRateProc(context->sample_rate);
+            }
+            context->data.al_context = alcCreateContext(device, 0);
+        }
+        if (!context->data.al_context) {
+            alcCloseDevice(device);
+            return false;
         }
 
-        context->data.al_context = alcCreateContext(device, 0);
-        return (context->data.al_context != NULL);
+        // Create the source pool
+        ALCcontext *current_context = alcGetCurrentContext();
+        alcMakeContextCurrent(context->data.al_context);
+        _mal_context_create_sources(context, MAL_OPENAL_SOURCE_POOL_SIZE);
+        _mal_context_init_finished_events(context);
+        context->data.float32_supported = alIsExtensionPresent("AL_EXT_FLOAT32");
+        context->data.multichannel_supported = alIsExtensionPresent("AL_EXT_MCFORMATS");
+        if (alIsExtensionPresent("AL_SOFT_block_alignment")) {
+            context->data.ima_adpcm_supported = alIsExtensionPresent("AL_EXT_IMA4");
+            context->data.ms_adpcm_supported = alIsExtensionPresent("AL_SOFT_MSADPCM");
+        }
+        if (alIsExtensionPresent("AL_SOFT_callback_buffer")) {
+            context->data.alBufferCallbackSOFTProc =
+                ((alBufferCallbackSOFTProcPtr)alGetProcAddress("alBufferCallbackSOFT"));
+        }
+        alcMakeContextCurrent(current_context);
+        return true;
     }
 }
 
 static void _mal_context_dispose(mal_context *context) {
+    if (context->data.stream_thread_running) {
+        pthread_mutex_lock(&context->data.stream_mutex);
+        context->data.stream_thread_quit = true;
+        pthread_mutex_unlock(&context->data.stream_mutex);
+        pthread_join(context->data.stream_thread, NULL);
+        context->data.stream_thread_running = false;
+    }
     if (context->data.al_context) {
+        ALCcontext *current_context = alcGetCurrentContext();
+        alcMakeContextCurrent(context->data.al_context);
+        if (context->data.alEventCallbackSOFTProc) {
+            context->data.alEventCallbackSOFTProc(NULL, NULL);
+            context->data.alEventCallbackSOFTProc = NULL;
+        }
+        if (context->data.all_sources.count > 0) {
+            alDeleteSources((ALsizei)context->data.all_sources.count,
+                            context->data.all_sources.values);
+            alGetError();
+        }
+        alcMakeContextCurrent(current_context == context->data.al_context ? NULL : current_context);
         ALCdevice *device = alcGetContextsDevice(context->data.al_context);
         alcDestroyContext(context->data.al_context);
         if (device) {
@@ -89,6 +397,15 @@ static void _mal_context_dispose(mal_context *context) {
         alGetError();
         context->data.al_context = NULL;
     }
+    ok_vec_deinit(&context->data.all_sources);
+    ok_vec_deinit(&context->data.free_sources);
+    ok_vec_deinit(&context->data.finished_ids);
+    ok_vec_deinit(&context->data.stopped_sources);
+    ok_vec_deinit(&context->data.checked_sources);
+    ok_map_deinit(&context->data.watched_sources);
+    pthread_mutex_destroy(&context->data.finished_mutex);
+    ok_vec_deinit(&context->data.stream_players);
+    pthread_mutex_destroy(&context->data.stream_mutex);
 }
 
 static void _mal_context_set_active(mal_context *context, const bool active) {
@@ -103,32 +420,189 @@ static void _mal_context_set_active(mal_context *context, const bool active) {
 
 static void _mal_context_set_mute(mal_context *context, const bool mute) {
     alListenerf(AL_GAIN, context->mute ? 0 : context->gain);
-    alGetError();
 }
 
 static void _mal_context_set_gain(mal_context *context, const float gain) {
     alListenerf(AL_GAIN, context->mute ? 0 : context->gain);
-    alGetError();
+}
+
+static bool _mal_context_format_is_valid(const mal_context *context, mal_format format) {
+    // Multichannel formats are downmixed by _mal_context_get_native_format()
+    return true;
+}
+
+static mal_format _mal_context_get_native_format(const mal_context *context, mal_format format) {
+    // Quad, 5.1, and 7.1 are supported with AL_EXT_MCFORMATS. OpenAL mixes them to the device's
+    // speaker layout.
+    if (format.num_channels > 2 && !context->data.multichannel_supported) {
+        format.num_channels = 2;
+    }
+    // ADPCM buffers are kept compressed with AL_EXT_IMA4 and AL_SOFT_MSADPCM (OpenAL Soft decodes
+    // them as they play). Otherwise, they are decoded when the buffer is created.
+    if ((format.sample_type == MAL_SAMPLE_TYPE_IMA_ADPCM && context->data.ima_adpcm_supported) ||
+        (format.sample_type == MAL_SAMPLE_TYPE_MS_ADPCM && context->data.ms_adpcm_supported)) {
+        return format;
+    }
+    // 8-bit and 16-bit integer are always supported. Float is supported with AL_EXT_FLOAT32.
+    if (format.sample_type == MAL_SAMPLE_TYPE_INT &&
+        (format.bit_depth == 8 || format.bit_depth == 16)) {
+        return format;
+    }
+    if (context->data.float32_supported) {
+        format.sample_type = MAL_SAMPLE_TYPE_FLOAT;
+        format.bit_depth = 32;
+    } else {
+        format.sample_type = MAL_SAMPLE_TYPE_INT;
+        format.bit_depth = 16;
+    }
+    return format;
+}
+
+static bool _mal_context_get_native_cache_format(const mal_context *context, mal_format format,
+                                                 mal_format *cache_format) {
+    // Not supported. OpenAL converts buffers when they are created.
+    return false;
+}
+
+static void _mal_context_begin_update(mal_context *context) {
+    // Defer processing while several parameters are changed. A suspended (inactive) context is
+    // left alone.
+    if (context->data.update_depth++ == 0 && context->active && context->data.al_context) {
+        alcSuspendContext(context->data.al_context);
+    }
+}
+
+static void _mal_context_end_update(mal_context *context) {
+    if (--context->data.update_depth == 0 && context->active && context->data.al_context) {
+        alcProcessContext(context->data.al_context);
+    }
+}
+
+static bool _mal_context_render(mal_context *context, float *out, uint32_t num_frames) {
+    if (!context->data.al_context || !context->data.alcRenderSamplesSOFTProc) {
+        return false;
+    }
+    ALCdevice *device = alcGetContextsDevice(context->data.al_context);
+    if (!device) {
+        return false;
+    }
+    context->data.alcRenderSamplesSOFTProc(device, out, (ALCsizei)num_frames);
+    return true;
+}
+
+static bool _mal_context_set_num_render_threads(mal_context *context, uint32_t num_threads) {
+    // Not supported
+    return num_threads <= 1;
+}
+
+// Checks the state of sources that may have stopped. Sources that stopped are no longer watched,
+// and their players are finished.
+static void _mal_context_check_sources(mal_context *context) {
+    mal_al_source_vec_t *sources = &context->data.checked_sources;
+    ok_vec_clear(sources);
+    if (context->data.alEventCallbackSOFTProc) {
+        pthread_mutex_lock(&context->data.finished_mutex);
+        ok_vec_push_all(sources, &context->data.stopped_sources);
+        ok_vec_clear(&context->data.stopped_sources);
+        pthread_mutex_unlock(&context->data.finished_mutex);
+    } else {
+        const double now = _mal_time();
+        if (now - context->data.last_poll_time < MAL_OPENAL_POLL_INTERVAL_MS / 1000.0) {
+            return;
+        }
+        context->data.last_poll_time = now;
+        ok_map_foreach(&context->data.watched_sources, uint32_t source,
+                       mal_al_watched_source watched) {
+            (void)watched;
+            ok_vec_push(sources, source);
+        }
+    }
+    ok_vec_foreach(sources, ALuint source) {
+        mal_al_watched_source *watched = ok_map_get_ptr(&context->data.watched_sources, source);
+        if (!watched) {
+            continue;
+        }
+        ALint state = AL_STOPPED;
+        alGetSourcei(source, AL_SOURCE_STATE, &state);
+        if (state == AL_STOPPED) {
+            _mal_player_did_finish(watched->player);
+            if (watched->on_finished_id) {
+                pthread_mutex_lock(&context->data.finished_mutex);
+                ok_vec_push(&context->data.finished_ids, watched->on_finished_id);
+                pthread_mutex_unlock(&context->data.finished_mutex);
+            }
+            ok_map_remove(&context->data.watched_sources, source);
+        }
+    }
+}
+
+static void _mal_context_update(mal_context *context) {
+    if (context->active) {
+        _mal_context_check_sources(context);
+    }
+    pthread_mutex_lock(&context->data.finished_mutex);
+    if (context->data.finished_ids.count == 0) {
+        pthread_mutex_unlock(&context->data.finished_mutex);
+        return;
+    }
+    mal_al_finished_id_vec_t finished_ids = context->data.finished_ids;
+    ok_vec_init(&context->data.finished_ids);
+    pthread_mutex_unlock(&context->data.finished_mutex);
+
+    ok_vec_foreach(&finished_ids, uint64_t on_finished_id) {
+        _mal_handle_on_finished_callback(on_finished_id);
+    }
+    ok_vec_deinit(&finished_ids);
 }
 
 // MARK: Buffer
 
+static ALenum _mal_al_format(const uint8_t num_channels, const uint8_t bit_depth,
+                             const bool is_float) {
+    static const ALenum formats[5][3] = {
+        { AL_FORMAT_MONO8, AL_FORMAT_MONO16, AL_FORMAT_MONO_FLOAT32 },
+        { AL_FORMAT_STEREO8, AL_FORMAT_STEREO16, AL_FORMAT_STEREO_FLOAT32 },
+        { AL_FORMAT_QUAD8, AL_FORMAT_QUAD16, AL_FORMAT_QUAD32 },
+        { AL_FORMAT_51CHN8, AL_FORMAT_51CHN16, AL_FORMAT_51CHN32 },
+        { AL_FORMAT_71CHN8, AL_FORMAT_71CHN16, AL_FORMAT_71CHN32 },
+    };
+    const int layout = (num_channels == 1 ? 0 : num_channels == 2 ? 1 :
+                        num_channels == 4 ? 2 : num_channels == 6 ? 3 : 4);
+    const int type = is_float ? 2 : (bit_depth == 8 ? 0 : 1);
+    return formats[layout][type];
+}
+
+static ALenum _mal_al_adpcm_format(const mal_format format) {
+    const bool stereo = format.num_channels == 2;
+    if (format.sample_type == MAL_SAMPLE_TYPE_IMA_ADPCM) {
+        return stereo ? AL_FORMAT_STEREO_IMA4 : AL_FORMAT_MONO_IMA4;
+    } else {
+        return stereo ? AL_FORMAT_STEREO_MSADPCM_SOFT : AL_FORMAT_MONO_MSADPCM_SOFT;
+    }
+}
+
 static bool _mal_buffer_init(mal_context *context, mal_buffer *buffer,
                              const void *copied_data, void *managed_data,
                              const mal_deallocator_func data_deallocator) {
+    MAL_AL_CLEAR_ERROR();
     alGenBuffers(1, &buffer->data.al_buffer);
     ALenum error;
     if ((error = alGetError()) != AL_NO_ERROR) {
         return false;
     } else {
         buffer->data.al_buffer_valid = true;
-        const ALsizei data_length = ((buffer->format.bit_depth / 8) *
-                                     buffer->format.num_channels * buffer->num_frames);
-        const ALenum al_format = (buffer->format.bit_depth == 8 ?
-                                  (buffer->format.num_channels == 2 ? AL_FORMAT_STEREO8 :
-                                   AL_FORMAT_MONO8) :
-                                  (buffer->format.num_channels == 2 ? AL_FORMAT_STEREO16 :
-                                   AL_FORMAT_MONO16));
+        const ALsizei data_length = (ALsizei)mal_format_get_data_length(buffer->format,
+                                                                        buffer->num_frames);
+        ALenum al_format;
+        if (_mal_format_is_adpcm(buffer->format)) {
+            // The block alignment is in frames
+            al_format = _mal_al_adpcm_format(buffer->format);
+            alBufferi(buffer->data.al_buffer, AL_UNPACK_BLOCK_ALIGNMENT_SOFT,
+                      (ALint)_mal_adpcm_frames_per_block(buffer->format));
+        } else {
+            al_format = _mal_al_format(buffer->format.num_channels, buffer->format.bit_depth,
+                                       buffer->format.sample_type == MAL_SAMPLE_TYPE_FLOAT);
+        }
         const ALsizei freq = (ALsizei)buffer->format.sample_rate;
         if (copied_data) {
             alBufferData(buffer->data.al_buffer, al_format, copied_data, data_length, freq);
@@ -170,30 +644,339 @@ static void _mal_buffer_dispose(mal_buffer *buffer) {
     }
 }
 
+// MARK: Streaming
+
+// Render function players stream through AL_SOFT_callback_buffer if available. Otherwise, a queue
+// of buffers is refilled on the stream thread.
+static bool _mal_player_uses_stream_queue(const mal_player *player) {
+    return player->render_func && !player->context->data.alBufferCallbackSOFTProc;
+}
+
+static ALenum _mal_player_stream_al_format(const mal_player *player) {
+    return _mal_al_format(player->format.num_channels, 16, player->data.stream_float);
+}
+
+static uint32_t _mal_player_stream_frame_size(const mal_player *player) {
+    return ((player->data.stream_float ? sizeof(float) : sizeof(int16_t)) *
+            player->format.num_channels);
+}
+
+// Renders up to `num_frames` frames in the stream format. Returns the number of frames rendered.
+static uint32_t _mal_player_stream_render(mal_player *player, void *out, uint32_t num_frames) {
+    const uint32_t num_channels = player->format.num_channels;
+    if (player->data.stream_float) {
+        uint32_t frames = player->render_func(player->render_user_data, out, num_frames,
+                                              num_channels);
+        return frames < num_frames ? frames : num_frames;
+    }
+    int16_t *dst = out;
+    uint32_t total_frames = 0;
+    while (total_frames < num_frames) {
+        uint32_t request_frames = num_frames - total_frames;
+        if (request_frames > MAL_OPENAL_STREAM_FRAMES) {
+            request_frames = MAL_OPENAL_STREAM_FRAMES;
+        }
+        uint32_t frames = player->render_func(player->render_user_data,
+                                              player->data.stream_scratch, request_frames,
+                                              num_channels);
+        if (frames > request_frames) {
+            frames = request_frames;
+        }
+        _mal_convert_float_to_int16(dst, player->data.stream_scratch, frames * num_channels);
+        dst += frames * num_channels;
+        total_frames += frames;
+        if (frames < request_frames) {
+            break;
+        }
+    }
+    return total_frames;
+}
+
+// Called on the OpenAL mixer thread
+static ALsizei AL_APIENTRY _mal_al_buffer_callback(ALvoid *user_data, ALvoid *data,
+                                                   ALsizei num_bytes) {
+    mal_player *player = user_data;
+    const uint32_t frame_size = _mal_player_stream_frame_size(player);
+    const uint32_t frames = _mal_player_stream_render(player, data,
+                                                      (uint32_t)num_bytes / frame_size);
+    return (ALsizei)(frames * frame_size);
+}
+
+static void _mal_player_stream_queue_buffer(mal_player *player, ALuint buffer) {
+    const uint32_t frames = _mal_player_stream_render(player, player->data.stream_data,
+                                                      MAL_OPENAL_STREAM_FRAMES);
+    if (frames < MAL_OPENAL_STREAM_FRAMES) {
+        player->data.stream_finished = true;
+    }
+    if (frames > 0) {
+        alBufferData(buffer, _mal_player_stream_al_format(player), player->data.stream_data,
+                     (ALsizei)(frames * _mal_player_stream_frame_size(player)),
+                     (ALsizei)player->format.sample_rate);
+        alSourceQueueBuffers(player->data.al_source, 1, &buffer);
+    }
+}
+
+// Called on the stream thread. Returns `false` if the player finished playing.
+static bool _mal_player_stream_update(mal_player *player) {
+    const ALuint source = player->data.al_source;
+
+    // Get the state first: if stopped, every queued buffer has been processed.
+    ALint state = AL_PLAYING;
+    ALint processed = 0;
+    alGetSourcei(source, AL_SOURCE_STATE, &state);
+    alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+    while (processed-- > 0) {
+        ALuint buffer = 0;
+        alSourceUnqueueBuffers(source, 1, &buffer);
+        if (buffer && !player->data.stream_finished) {
+            _mal_player_stream_queue_buffer(player, buffer);
+        }
+    }
+    if (state == AL_STOPPED) {
+        ALint queued = 0;
+        alGetSourcei(source, AL_BUFFERS_QUEUED, &queued);
+        if (queued == 0) {
+            return false;
+        }
+        // Buffer underrun
+        alSourcePlay(source);
+    }
+    return true;
+}
+
+static void *_mal_stream_thread_func(void *user_data) {
+    mal_context *context = user_data;
+    const struct timespec interval = {
+        .tv_sec = 0,
+        .tv_nsec = MAL_OPENAL_STREAM_INTERVAL_MS * 1000000L
+    };
+    while (true) {
+        nanosleep(&interval, NULL);
+
+        // Render one player at a time, without holding `stream_mutex`, so that a slow render
+        // function doesn't block the main thread. A player that is being stopped is skipped.
+        for (size_t i = 0; ; i++) {
+            pthread_mutex_lock(&context->data.stream_mutex);
+            if (context->data.stream_thread_quit) {
+                pthread_mutex_unlock(&context->data.stream_mutex);
+                return NULL;
+            } else if (i >= context->data.stream_players.count) {
+                pthread_mutex_unlock(&context->data.stream_mutex);
+                break;
+            }
+            mal_player *player = context->data.stream_players.values[i];
+            const bool locked = pthread_mutex_trylock(&player->data.stream_render_mutex) == 0;
+            pthread_mutex_unlock(&context->data.stream_mutex);
+            if (!locked) {
+                continue;
+            }
+            if (!_mal_player_stream_update(player)) {
+                pthread_mutex_lock(&context->data.stream_mutex);
+                if (player->data.stream_active) {
+                    player->data.stream_active = false;
+                    _mal_player_did_finish(player);
+                    if (player->data.stream_on_finished_id) {
+                        pthread_mutex_lock(&context->data.finished_mutex);
+                        ok_vec_push(&context->data.finished_ids,
+                                    player->data.stream_on_finished_id);
+                        pthread_mutex_unlock(&context->data.finished_mutex);
+                    }
+                    (void)ok_vec_remove(&context->data.stream_players, player);
+                    i--;
+                }
+                pthread_mutex_unlock(&context->data.stream_mutex);
+            }
+            pthread_mutex_unlock(&player->data.stream_render_mutex);
+        }
+    }
+}
+
+static bool _mal_context_start_stream_thread(mal_context *context) {
+    if (!context->data.stream_thread_running) {
+        context->data.stream_thread_quit = false;
+        context->data.stream_thread_running = (pthread_create(&context->data.stream_thread, NULL,
+                                                              _mal_stream_thread_func,
+                                                              context) == 0);
+        if (!context->data.stream_thread_running) {
+            MAL_LOG("Couldn't create stream thread");
+        }
+    }
+    return context->data.stream_thread_running;
+}
+
+static bool _mal_player_stream_start(mal_player *player) {
+    mal_context *context = player->context;
+    const ALuint source = player->data.al_source;
+    MAL_AL_CLEAR_ERROR();
+    alSourcei(source, AL_BUFFER, AL_NONE);
+    if (!_mal_player_uses_stream_queue(player)) {
+        context->data.alBufferCallbackSOFTProc(player->data.stream_buffers[0],
+                                               _mal_player_stream_al_format(player),
+                                               (ALsizei)player->format.sample_rate,
+                                               _mal_al_buffer_callback, player);
+        alSourcei(source, AL_BUFFER, (ALint)player->data.stream_buffers[0]);
+        alSourcePlay(source);
+        return (alGetError() == AL_NO_ERROR);
+    }
+    if (!_mal_context_start_stream_thread(context)) {
+        return false;
+    }
+    // The player isn't on the stream thread yet, so the buffers can be filled here.
+    player->data.stream_finished = false;
+    for (ALsizei i = 0; i < player->data.num_stream_buffers && !player->data.stream_finished;
+         i++) {
+        _mal_player_stream_queue_buffer(player, player->data.stream_buffers[i]);
+    }
+    alSourcePlay(source);
+    if (alGetError() != AL_NO_ERROR) {
+        alSourcei(source, AL_BUFFER, AL_NONE);
+        alGetError();
+        return false;
+    }
+    pthread_mutex_lock(&context->data.stream_mutex);
+    player->data.stream_active = true;
+    ok_vec_push(&context->data.stream_players, player);
+    pthread_mutex_unlock(&context->data.stream_mutex);
+    return true;
+}
+
+static void _mal_player_stream_stop(mal_player *player) {
+    mal_context *context = player->context;
+    if (_mal_player_uses_stream_queue(player)) {
+        // Wait for the stream thread to finish rendering the player
+        pthread_mutex_lock(&player->data.stream_render_mutex);
+        pthread_mutex_lock(&context->data.stream_mutex);
+        if (player->data.stream_active) {
+            player->data.stream_active = false;
+            (void)ok_vec_remove(&context->data.stream_players, player);
+        }
+        pthread_mutex_unlock(&context->data.stream_mutex);
+        pthread_mutex_unlock(&player->data.stream_render_mutex);
+    }
+    alSourceStop(player->data.al_source);
+    alSourcei(player->data.al_source, AL_BUFFER, AL_NONE);
+}
+
 // MARK: Player
 
 static bool _mal_player_init(mal_player *player) {
-    alGenSources(1, &player->data.al_source);
-    player->data.al_source_valid = (alGetError() == AL_NO_ERROR);
-    return player->data.al_source_valid;
+    mal_context *context = player->context;
+    if (!context) {
+        return false;
+    }
+    if (context->data.free_sources.count == 0) {
+        _mal_context_create_sources(context, 1);
+        if (context->data.free_sources.count == 0) {
+            return false;
+        }
+    }
+    player->data.al_source = *ok_vec_last(&context->data.free_sources);
+    context->data.free_sources.count--;
+    player->data.al_source_valid = true;
+
+    if (player->render_func) {
+        if (!player->data.stream_render_mutex_valid) {
+            pthread_mutex_init(&player->data.stream_render_mutex, NULL);
+            player->data.stream_render_mutex_valid = true;
+        }
+        const ALsizei num_buffers = (_mal_player_uses_stream_queue(player) ?
+                                     MAL_OPENAL_STREAM_BUFFERS : 1);
+        MAL_AL_CLEAR_ERROR();
+        alGenBuffers(num_buffers, player->data.stream_buffers);
+        if (alGetError() != AL_NO_ERROR) {
+            return false;
+        }
+        player->data.num_stream_buffers = num_buffers;
+    }
+    return true;
+}
+
+// Starts or stops watching the source for finished playback. Playing sources are always watched,
+// so that the player's cached state is updated when playback ends.
+static void _mal_player_watch(mal_player *player, bool watch) {
+    mal_context *context = player->context;
+    if (context && _mal_player_uses_stream_queue(player)) {
+        // The stream thread checks for finished playback
+        pthread_mutex_lock(&context->data.stream_mutex);
+        player->data.stream_on_finished_id = watch ? player->on_finished_id : 0;
+        pthread_mutex_unlock(&context->data.stream_mutex);
+    } else if (context && player->data.al_source_valid) {
+        if (watch) {
+            mal_al_watched_source watched = { player, player->on_finished_id };
+            ok_map_put(&context->data.watched_sources, player->data.al_source, watched);
+        } else {
+            ok_map_remove(&context->data.watched_sources, player->data.al_source);
+        }
+    }
 }
 
 static void _mal_player_dispose(mal_player *player) {
     if (player->data.al_source_valid) {
-        alSourcei(player->data.al_source, AL_BUFFER, AL_NONE);
-        alGetError();
-        alDeleteSources(1, &player->data.al_source);
+        _mal_player_watch(player, false);
+        if (player->render_func) {
+            _mal_player_stream_stop(player);
+        }
+
+        // Reset the source and return it to the pool
+        const ALuint source = player->data.al_source;
+        alSourceStop(source);
+        alSourcei(source, AL_BUFFER, AL_NONE);
+        alSourcei(source, AL_LOOPING, AL_FALSE);
+        alSourcef(source, AL_GAIN, 1.0f);
+        alSourceRewind(source);
         alGetError();
+        mal_context *context = player->context;
+        if (context) {
+            ok_vec_push(&context->data.free_sources, source);
+        }
         player->data.al_source_valid = false;
     }
+    if (player->data.num_stream_buffers > 0) {
+        alDeleteBuffers(player->data.num_stream_buffers, player->data.stream_buffers);
+        alGetError();
+        player->data.num_stream_buffers = 0;
+    }
+    free(player->data.stream_data);
+    free(player->data.stream_scratch);
+    player->data.stream_data = NULL;
+    player->data.stream_scratch = NULL;
+    if (player->data.stream_render_mutex_valid) {
+        pthread_mutex_destroy(&player->data.stream_render_mutex);
+        player->data.stream_render_mutex_valid = false;
+    }
 }
 
+static mal_player_state _mal_player_get_state(const mal_player *player);
+
 static void _mal_player_did_set_finished_callback(mal_player *player) {
-    // Do nothing
+    _mal_player_watch(player, _mal_player_get_state(player) != MAL_PLAYER_STATE_STOPPED);
 }
 
 static bool _mal_player_set_format(mal_player *player, mal_format format) {
-    // Do nothing
+    if (!player->render_func) {
+        // Do nothing
+        return true;
+    }
+    // The player is stopped. Allocate the stream memory for the new format.
+    free(player->data.stream_data);
+    free(player->data.stream_scratch);
+    player->data.stream_data = NULL;
+    player->data.stream_scratch = NULL;
+    player->data.stream_float = player->context->data.float32_supported;
+    const size_t sample_size = player->data.stream_float ? sizeof(float) : sizeof(int16_t);
+    const size_t num_samples = (size_t)MAL_OPENAL_STREAM_FRAMES * format.num_channels;
+    if (_mal_player_uses_stream_queue(player)) {
+        player->data.stream_data = malloc(num_samples * sample_size);
+        if (!player->data.stream_data) {
+            return false;
+        }
+    }
+    if (!player->data.stream_float) {
+        player->data.stream_scratch = malloc(num_samples * sizeof(float));
+        if (!player->data.stream_scratch) {
+            return false;
+        }
+    }
     return true;
 }
 
@@ -202,7 +985,7 @@ static bool _mal_player_set_buffer(mal_player *player, const mal_buffer *buffer)
         return false;
     }
     alSourcei(player->data.al_source, AL_BUFFER, AL_NONE);
-    alGetError();
+    MAL_AL_CLEAR_ERROR();
     if (!buffer) {
         return true;
     } else {
@@ -222,7 +1005,6 @@ static void _mal_player_set_mute(mal_player *player, bool mute) {
     if (player->data.al_source_valid) {
         player->mute = mute;
         alSourcef(player->data.al_source, AL_GAIN, player->mute ? 0 : player->gain);
-        alGetError();
     }
 }
 
@@ -230,15 +1012,13 @@ static void _mal_player_set_gain(mal_player *player, float gain) {
     if (player->data.al_source_valid) {
         player->gain = gain;
         alSourcef(player->data.al_source, AL_GAIN, player->mute ? 0 : player->gain);
-        alGetError();
     }
 }
 
 static void _mal_player_set_looping(mal_player *player, bool looping) {
-    if (player->data.al_source_valid) {
+    if (player->data.al_source_valid && !player->render_func) {
         player->looping = looping;
         alSourcei(player->data.al_source, AL_LOOPING, looping ? AL_TRUE : AL_FALSE);
-        alGetError();
     }
 }
 
@@ -246,7 +1026,15 @@ static mal_player_state _mal_player_get_state(const mal_player *player) {
     ALint state = AL_STOPPED;
     if (player->data.al_source_valid) {
         alGetSourcei(player->data.al_source, AL_SOURCE_STATE, &state);
-        alGetError();
+    }
+    if (state == AL_STOPPED && _mal_player_uses_stream_queue(player)) {
+        // The source stops if the queue underruns, but the stream is still playing.
+        mal_context *context = player->context;
+        pthread_mutex_lock(&context->data.stream_mutex);
+        if (player->data.stream_active) {
+            state = AL_PLAYING;
+        }
+        pthread_mutex_unlock(&context->data.stream_mutex);
     }
     if (state == AL_PLAYING) {
         return MAL_PLAYER_STATE_PLAYING;
@@ -257,15 +1045,46 @@ static mal_player_state _mal_player_get_state(const mal_player *player) {
     }
 }
 
+static uint32_t _mal_player_get_position(const mal_player *player) {
+    ALint offset = 0;
+    if (player->data.al_source_valid) {
+        alGetSourcei(player->data.al_source, AL_SAMPLE_OFFSET, &offset);
+    }
+    return offset > 0 ? (uint32_t)offset : 0;
+}
+
+static void _mal_player_set_position(mal_player *player, uint32_t frame) {
+    if (player->data.al_source_valid) {
+        alSourcei(player->data.al_source, AL_SAMPLE_OFFSET, (ALint)frame);
+    }
+}
+
 static bool _mal_player_set_state(mal_player *player, mal_player_state old_state,
                                   mal_player_state state) {
     if (player->data.al_source_valid) {
+        MAL_AL_CLEAR_ERROR();
         if (state == MAL_PLAYER_STATE_PLAYING) {
-            alSourcePlay(player->data.al_source);
+            if (player->render_func && old_state == MAL_PLAYER_STATE_STOPPED) {
+                if (!_mal_player_stream_start(player)) {
+                    return false;
+                }
+            } else {
+                alSourcePlay(player->data.al_source);
+                if (alGetError() != AL_NO_ERROR) {
+                    return false;
+                }
+            }
+            _mal_player_watch(player, true);
+            return true;
         } else if (state == MAL_PLAYER_STATE_PAUSED) {
             alSourcePause(player->data.al_source);
         } else {
-            alSourceStop(player->data.al_source);
+            _mal_player_watch(player, false);
+            if (player->render_func) {
+                _mal_player_stream_stop(player);
+            } else {
+                alSourceStop(player->data.al_source);
+            }
         }
         return (alGetError() == AL_NO_ERROR);
     } else {
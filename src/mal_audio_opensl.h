@@ -61,8 +61,24 @@ struct _mal_player {
     SLBufferQueueItf sl_buffer_queue;
 
     bool background_paused;
+    uint32_t first_frame;
+
+    // For players with a render function or an ADPCM format. Two buffers are rendered and
+    // enqueued alternately.
+    int16_t *render_buffers[2];
+    float *render_scratch;
+    unsigned int render_buffer_index;
+    unsigned int render_buffers_queued;
+    bool render_finished;
+
+    // ADPCM buffers are decoded one block at a time as the buffers are rendered.
+    int16_t *adpcm_block;
+    uint32_t adpcm_block_index;
+    uint32_t render_frame;
 };
 
+#define MAL_OPENSL_RENDER_FRAMES 1024
+
 #define MAL_USE_MUTEX
 #include "mal_audio_abstract.h"
 #include <math.h>
@@ -72,6 +88,10 @@ static void _mal_player_update_gain(mal_player *player);
 // MARK: Context
 
 static bool _mal_context_init(mal_context *context) {
+    if (context->loopback_num_channels > 0) {
+        // Not supported
+        return false;
+    }
     // Create engine
     SLresult result = slCreateEngine(&context->data.sl_object, 0, NULL, 0, NULL, NULL);
     if (result != SL_RESULT_SUCCESS) {
@@ -211,7 +231,7 @@ static void _mal_context_set_active(mal_context *context, bool active) {
         // Here, we'll pause playing sounds, and destroy unused players.
         ok_vec_foreach(&context->players, mal_player *player) {
             if (active) {
-                if (!player->data.sl_object) {
+                if (player->has_voice && !player->data.sl_object) {
                     mal_player_set_format(player, player->format);
                     _mal_player_set_gain(player, player->gain);
                     _mal_player_set_mute(player, player->mute);
@@ -250,13 +270,61 @@ static void _mal_context_set_gain(mal_context *context, float gain) {
     ok_vec_apply(&context->players, _mal_player_update_gain);
 }
 
+static bool _mal_context_format_is_valid(const mal_context *context, mal_format format) {
+    // Multichannel formats are downmixed by _mal_context_get_native_format()
+    return true;
+}
+
+static mal_format _mal_context_get_native_format(const mal_context *context, mal_format format) {
+    if (format.num_channels > 2) {
+        format.num_channels = 2;
+    }
+    // SLDataFormat_PCM supports 8-bit and 16-bit integer. ADPCM is decoded to 16-bit as it plays.
+    // Other formats are converted to 16-bit.
+    if (_mal_format_is_adpcm(format) ||
+        (format.sample_type == MAL_SAMPLE_TYPE_INT &&
+         (format.bit_depth == 8 || format.bit_depth == 16))) {
+        return format;
+    }
+    format.sample_type = MAL_SAMPLE_TYPE_INT;
+    format.bit_depth = 16;
+    return format;
+}
+
+static bool _mal_context_get_native_cache_format(const mal_context *context, mal_format format,
+                                                 mal_format *cache_format) {
+    // Not supported. The audio player's format is fixed when it is created.
+    return false;
+}
+
+static void _mal_context_begin_update(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_end_update(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_update(mal_context *context) {
+    // Do nothing
+}
+
+static bool _mal_context_render(mal_context *context, float *out, uint32_t num_frames) {
+    // Not supported
+    return false;
+}
+
+static bool _mal_context_set_num_render_threads(mal_context *context, uint32_t num_threads) {
+    // Not supported
+    return num_threads <= 1;
+}
+
 // MARK: Buffer
 
 static bool _mal_buffer_init(mal_context *context, mal_buffer *buffer,
                              const void *copied_data, void *managed_data,
                              const mal_deallocator_func data_deallocator) {
-    const size_t data_length = ((buffer->format.bit_depth / 8) *
-                                buffer->format.num_channels * buffer->num_frames);
+    const size_t data_length = mal_format_get_data_length(buffer->format, buffer->num_frames);
     if (managed_data) {
         buffer->managed_data = managed_data;
         buffer->managed_data_deallocator = data_deallocator;
@@ -278,6 +346,79 @@ static void _mal_buffer_dispose(mal_buffer *buffer) {
 
 // MARK: Player
 
+static void _mal_player_post_finished(mal_player *player) {
+#ifdef ANDROID
+    if (player->on_finished && player->context && player->context->data.looper) {
+        struct looper_message msg = {
+                .type = ON_PLAYER_FINISHED_MAGIC,
+                .on_finished_id = player->on_finished_id,
+        };
+        _mal_looper_post(player->context->data.looper_message_pipe[1], &msg);
+    }
+#endif
+}
+
+static bool _mal_player_is_rendered(const mal_player *player) {
+    return player->render_func || _mal_format_is_adpcm(player->format);
+}
+
+// Decodes the next frames of the player's ADPCM buffer. Returns the number of frames decoded,
+// which is less than MAL_OPENSL_RENDER_FRAMES at the end of the buffer (if not looping).
+static uint32_t _mal_player_render_adpcm(mal_player *player, int16_t *dst) {
+    const mal_buffer *buffer = player->buffer;
+    const uint32_t num_channels = player->format.num_channels;
+    uint32_t frames_rendered = 0;
+    while (buffer && buffer->managed_data && frames_rendered < MAL_OPENSL_RENDER_FRAMES) {
+        uint32_t frames = _mal_adpcm_read(buffer, player->data.adpcm_block,
+                                          &player->data.adpcm_block_index,
+                                          player->data.render_frame,
+                                          dst + frames_rendered * num_channels,
+                                          MAL_OPENSL_RENDER_FRAMES - frames_rendered);
+        player->data.render_frame += frames;
+        frames_rendered += frames;
+
+        if (player->data.render_frame >= buffer->num_frames && player->looping) {
+            player->data.render_frame = 0;
+        } else if (frames == 0 || player->data.render_frame >= buffer->num_frames) {
+            break;
+        }
+    }
+    return frames_rendered;
+}
+
+// Renders one buffer and enqueues it. Sets `render_finished` when the render function has
+// finished, or the end of the ADPCM buffer was reached.
+static void _mal_player_render_enqueue(mal_player *player) {
+    const uint32_t num_channels = player->format.num_channels;
+    int16_t *dst = player->data.render_buffers[player->data.render_buffer_index];
+    uint32_t frames;
+    if (player->render_func) {
+        frames = player->render_func(player->render_user_data, player->data.render_scratch,
+                                     MAL_OPENSL_RENDER_FRAMES, num_channels);
+        if (frames > MAL_OPENSL_RENDER_FRAMES) {
+            frames = MAL_OPENSL_RENDER_FRAMES;
+        }
+        _mal_convert_float_to_int16(dst, player->data.render_scratch, frames * num_channels);
+    } else {
+        frames = _mal_player_render_adpcm(player, dst);
+    }
+    if (frames < MAL_OPENSL_RENDER_FRAMES) {
+        player->data.render_finished = true;
+    }
+    if (frames > 0) {
+        const size_t num_samples = frames * num_channels;
+        SLresult result = (*player->data.sl_buffer_queue)->Enqueue(player->data.sl_buffer_queue,
+                                                                   dst,
+                                                                   num_samples * sizeof(int16_t));
+        if (result == SL_RESULT_SUCCESS) {
+            player->data.render_buffers_queued++;
+            player->data.render_buffer_index ^= 1;
+        } else {
+            player->data.render_finished = true;
+        }
+    }
+}
+
 // Buffer queue callback, which is called on a different thread.
 //
 // According to the Android team, "it is unspecified whether buffer queue callbacks are called upon
@@ -290,7 +431,20 @@ static void _mal_buffer_queue_callback(SLBufferQueueItf queue, void *void_player
     mal_player *player = (mal_player *)void_player;
     if (player && queue) {
         MAL_LOCK(player);
-        if (player->looping && player->buffer &&
+        if (_mal_player_is_rendered(player)) {
+            if (player->data.render_buffers_queued > 0) {
+                player->data.render_buffers_queued--;
+            }
+            if (!player->data.render_finished &&
+                _mal_player_get_state(player) == MAL_PLAYER_STATE_PLAYING) {
+                _mal_player_render_enqueue(player);
+            }
+            if (player->data.render_buffers_queued == 0 && player->data.sl_play) {
+                (*player->data.sl_play)->SetPlayState(player->data.sl_play, SL_PLAYSTATE_STOPPED);
+                _mal_player_did_finish(player);
+                _mal_player_post_finished(player);
+            }
+        } else if (player->looping && player->buffer &&
             player->buffer->managed_data &&
             _mal_player_get_state(player) == MAL_PLAYER_STATE_PLAYING) {
             const mal_buffer *buffer = player->buffer;
@@ -299,13 +453,8 @@ static void _mal_buffer_queue_callback(SLBufferQueueItf queue, void *void_player
             (*queue)->Enqueue(queue, buffer->managed_data, len);
         } else if (player->data.sl_play) {
             (*player->data.sl_play)->SetPlayState(player->data.sl_play, SL_PLAYSTATE_STOPPED);
-            if (player->on_finished && player->context && player->context->data.looper) {
-                struct looper_message msg = {
-                        .type = ON_PLAYER_FINISHED_MAGIC,
-                        .on_finished_id = player->on_finished_id,
-                };
-                _mal_looper_post(player->context->data.looper_message_pipe[1], &msg);
-            }
+            _mal_player_did_finish(player);
+            _mal_player_post_finished(player);
         }
         MAL_UNLOCK(player);
     }
@@ -345,6 +494,15 @@ static void _mal_player_dispose(mal_player *player) {
         player->data.sl_play = NULL;
         player->data.sl_volume = NULL;
     }
+    for (int i = 0; i < 2; i++) {
+        free(player->data.render_buffers[i]);
+        player->data.render_buffers[i] = NULL;
+    }
+    free(player->data.render_scratch);
+    player->data.render_scratch = NULL;
+    free(player->data.adpcm_block);
+    player->data.adpcm_block = NULL;
+    player->data.render_buffers_queued = 0;
 }
 
 static void _mal_player_did_set_finished_callback(mal_player *player) {
@@ -360,6 +518,27 @@ static bool _mal_player_set_format(mal_player *player, mal_format format) {
     const int n = 1;
     const bool system_is_little_endian = *(char *)&n == 1;
 
+    // Render functions output float, and ADPCM is decoded to 16-bit
+    const bool rendered = player->render_func || _mal_format_is_adpcm(format);
+    const uint8_t bit_depth = rendered ? 16 : format.bit_depth;
+    if (rendered) {
+        const size_t num_samples = MAL_OPENSL_RENDER_FRAMES * format.num_channels;
+        player->data.render_buffers[0] = malloc(num_samples * sizeof(int16_t));
+        player->data.render_buffers[1] = malloc(num_samples * sizeof(int16_t));
+        if (player->render_func) {
+            player->data.render_scratch = malloc(num_samples * sizeof(float));
+        } else {
+            const size_t block_length = (_mal_adpcm_frames_per_block(format) *
+                                         format.num_channels);
+            player->data.adpcm_block = malloc(block_length * sizeof(int16_t));
+        }
+        if (!player->data.render_buffers[0] || !player->data.render_buffers[1] ||
+            (!player->data.render_scratch && !player->data.adpcm_block)) {
+            _mal_player_dispose(player);
+            return false;
+        }
+    }
+
     SLDataLocator_BufferQueue sl_buffer_queue = {
         .locatorType = SL_DATALOCATOR_BUFFERQUEUE,
         .numBuffers = 2
@@ -369,9 +548,9 @@ static bool _mal_player_set_format(mal_player *player, mal_format format) {
         .formatType = SL_DATAFORMAT_PCM,
         .numChannels = format.num_channels,
         .samplesPerSec = (SLuint32)(format.sample_rate * 1000),
-        .bitsPerSample = (format.bit_depth == 8 ? SL_PCMSAMPLEFORMAT_FIXED_8 :
+        .bitsPerSample = (bit_depth == 8 ? SL_PCMSAMPLEFORMAT_FIXED_8 :
                           SL_PCMSAMPLEFORMAT_FIXED_16),
-        .containerSize = (format.bit_depth == 8 ? SL_PCMSAMPLEFORMAT_FIXED_8 :
+        .containerSize = (bit_depth == 8 ? SL_PCMSAMPLEFORMAT_FIXED_8 :
                           SL_PCMSAMPLEFORMAT_FIXED_16),
         .channelMask = (format.num_channels == 2 ?
                         (SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT) : SL_SPEAKER_FRONT_CENTER),
@@ -439,7 +618,10 @@ static bool _mal_player_set_format(mal_player *player, mal_format format) {
 }
 
 static bool _mal_player_set_buffer(mal_player *player, const mal_buffer *buffer) {
-    // Do nothing
+    // ADPCM players decode with a block buffer sized for the player's format
+    if (buffer && (_mal_format_is_adpcm(player->format) || _mal_format_is_adpcm(buffer->format))) {
+        return mal_formats_equal(player->format, buffer->format);
+    }
     return true;
 }
 
@@ -473,6 +655,25 @@ static mal_player_state _mal_player_get_state(const mal_player *player) {
     }
 }
 
+static uint32_t _mal_player_get_position(const mal_player *player) {
+    const mal_buffer *buffer = player->buffer;
+    SLmillisecond position = 0;
+    if (!buffer || buffer->num_frames == 0 || !player->data.sl_play) {
+        return 0;
+    }
+    SLresult result = (*player->data.sl_play)->GetPosition(player->data.sl_play, &position);
+    if (result != SL_RESULT_SUCCESS) {
+        return 0;
+    }
+    uint64_t frame = (player->data.first_frame +
+                      (uint64_t)(position * player->format.sample_rate / 1000));
+    return (uint32_t)(frame % buffer->num_frames);
+}
+
+static void _mal_player_set_position(mal_player *player, uint32_t frame) {
+    player->data.first_frame = frame;
+}
+
 static bool _mal_player_set_state(mal_player *player, mal_player_state old_state,
                                   mal_player_state state) {
     SLuint32 sl_state;
@@ -491,13 +692,35 @@ static bool _mal_player_set_state(mal_player *player, mal_player_state old_state
 
     // Queue if needed
     if (old_state != MAL_PLAYER_STATE_PAUSED && sl_state == SL_PLAYSTATE_PLAYING &&
-        player->data.sl_buffer_queue) {
+        player->data.sl_buffer_queue && _mal_player_is_rendered(player)) {
+        player->data.render_finished = false;
+        player->data.render_buffer_index = 0;
+        player->data.render_buffers_queued = 0;
+        player->data.render_frame = player->data.first_frame;
+        player->data.adpcm_block_index = UINT32_MAX;
+        if (player->buffer && player->data.render_frame >= player->buffer->num_frames) {
+            player->data.render_frame = 0;
+        }
+        _mal_player_render_enqueue(player);
+        if (!player->data.render_finished) {
+            _mal_player_render_enqueue(player);
+        }
+        if (player->data.render_buffers_queued == 0) {
+            sl_state = SL_PLAYSTATE_STOPPED;
+        }
+    } else if (old_state != MAL_PLAYER_STATE_PAUSED && sl_state == SL_PLAYSTATE_PLAYING &&
+               player->data.sl_buffer_queue) {
         const mal_buffer *buffer = player->buffer;
         if (buffer->managed_data) {
-            const size_t len = (buffer->num_frames * (buffer->format.bit_depth / 8) *
-                                buffer->format.num_channels);
+            const size_t frame_size = (buffer->format.bit_depth / 8) * buffer->format.num_channels;
+            uint32_t first_frame = player->data.first_frame;
+            if (first_frame >= buffer->num_frames) {
+                first_frame = 0;
+            }
+            const size_t len = (buffer->num_frames - first_frame) * frame_size;
             (*player->data.sl_buffer_queue)->Enqueue(player->data.sl_buffer_queue,
-                                                     buffer->managed_data, len);
+                                                     (uint8_t *)buffer->managed_data +
+                                                     first_frame * frame_size, len);
         }
     }
 
@@ -506,6 +729,8 @@ static bool _mal_player_set_state(mal_player *player, mal_player_state old_state
     // Clear buffer queue
     if (sl_state == SL_PLAYSTATE_STOPPED && player->data.sl_buffer_queue) {
         (*player->data.sl_buffer_queue)->Clear(player->data.sl_buffer_queue);
+        player->data.render_buffers_queued = 0;
+        player->data.first_frame = 0;
     }
 
     return true;
@@ -44,6 +44,10 @@ struct _mal_player {
 // MARK: Context
 
 static bool _mal_context_init(mal_context *context) {
+    if (context->loopback_num_channels > 0) {
+        // Not supported
+        return false;
+    }
     int success = EM_ASM_INT({
         mal_contexts = window.mal_contexts || {};
         var context;
@@ -105,6 +109,53 @@ static void _mal_context_set_gain(mal_context *context, float gain) {
     }
 }
 
+static bool _mal_context_format_is_valid(const mal_context *context, mal_format format) {
+    // Multichannel formats are downmixed by _mal_context_get_native_format()
+    return true;
+}
+
+static mal_format _mal_context_get_native_format(const mal_context *context, mal_format format) {
+    // Web Audio downmixes quad and 5.1 buffers itself (the "speakers" channel interpretation).
+    if (format.num_channels > 6) {
+        format.num_channels = 2;
+    }
+    // Buffers are read as 16-bit integer or float. Other formats are converted to float.
+    if (format.sample_type == MAL_SAMPLE_TYPE_INT && format.bit_depth == 16) {
+        return format;
+    }
+    format.sample_type = MAL_SAMPLE_TYPE_FLOAT;
+    format.bit_depth = 32;
+    return format;
+}
+
+static bool _mal_context_get_native_cache_format(const mal_context *context, mal_format format,
+                                                 mal_format *cache_format) {
+    // Not supported. Buffers are converted to AudioBuffers when they are created.
+    return false;
+}
+
+static void _mal_context_begin_update(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_end_update(mal_context *context) {
+    // Do nothing
+}
+
+static void _mal_context_update(mal_context *context) {
+    // Do nothing
+}
+
+static bool _mal_context_render(mal_context *context, float *out, uint32_t num_frames) {
+    // Not supported
+    return false;
+}
+
+static bool _mal_context_set_num_render_threads(mal_context *context, uint32_t num_threads) {
+    // Not supported
+    return num_threads <= 1;
+}
+
 // MARK: Buffer
 
 static bool _mal_buffer_init(mal_context *context, mal_buffer *buffer,
@@ -115,14 +166,17 @@ static bool _mal_buffer_init(mal_context *context, mal_buffer *buffer,
     }
     const void *data = copied_data ? copied_data : managed_data;
     mal_format format = buffer->format;
-    // Convert from interleaved 16-bit signed integer to non-interleaved 32-bit float.
-    // This uses Emscripten's HEAP16 Int16Array to access the data, and may not be future-proof.
+    const int is_float = (format.sample_type == MAL_SAMPLE_TYPE_FLOAT);
+    // Convert from interleaved 16-bit signed integer or 32-bit float to non-interleaved 32-bit
+    // float. This uses Emscripten's HEAP16 Int16Array and HEAPF32 Float32Array to access the data,
+    // and may not be future-proof.
     int success = EM_ASM_INT({
         var context_data = mal_contexts[$0];
         var channels = $2;
         var frames = $3;
         var sample_rate = $4;
-        var data = $5 >> 1;
+        var is_float = $6;
+        var data = is_float ? ($5 >> 2) : ($5 >> 1);
         var buffer;
         try {
             buffer = context_data.context.createBuffer(channels, frames, sample_rate);
@@ -132,9 +186,16 @@ static bool _mal_buffer_init(mal_context *context, mal_buffer *buffer,
             for (var i = 0; i < channels; i++) {
                 var dst = buffer.getChannelData(i);
                 var src = data + i;
-                for (var j = 0; j < frames; j++) {
-                    dst[j] = HEAP16[src] / 32768.0;
-                    src += channels;
+                if (is_float) {
+                    for (var j = 0; j < frames; j++) {
+                        dst[j] = HEAPF32[src];
+                        src += channels;
+                    }
+                } else {
+                    for (var j = 0; j < frames; j++) {
+                        dst[j] = HEAP16[src] / 32768.0;
+                        src += channels;
+                    }
                 }
             }
             context_data.buffers[$1] = buffer;
@@ -143,7 +204,7 @@ static bool _mal_buffer_init(mal_context *context, mal_buffer *buffer,
             return 0;
         }
     }, context->data.context_id, next_buffer_id,
-                format.num_channels, buffer->num_frames, format.sample_rate, data);
+                format.num_channels, buffer->num_frames, format.sample_rate, data, is_float);
     if (success) {
         buffer->data.buffer_id = next_buffer_id;
         next_buffer_id++;
@@ -171,7 +232,10 @@ static void _mal_buffer_dispose(mal_buffer *buffer) {
 
 static bool _mal_player_init(mal_player *player) {
     mal_context *context = player->context;
-    if (context && context->data.context_id) {
+    if (player->render_func) {
+        // Not supported
+        return false;
+    } else if (context && context->data.context_id) {
         player->data.player_id = next_player_id;
         next_player_id++;
         EM_ASM_ARGS({
@@ -192,6 +256,8 @@ static void _mal_player_dispose(mal_player *player) {
                 player.gainNode.disconnect();
             }
             if (player.sourceNode) {
+                // The onended handler refers to the mal_player, which is about to be freed
+                player.sourceNode.onended = null;
                 player.sourceNode.disconnect();
             }
             delete mal_contexts[$0].players[$1];
@@ -284,6 +350,44 @@ static mal_player_state _mal_player_get_state(const mal_player *player) {
     }
 }
 
+static uint32_t _mal_player_get_position(const mal_player *player) {
+    mal_context *context = player->context;
+    const mal_buffer *buffer = player->buffer;
+    if (!context || !context->data.context_id || !player->data.player_id || !buffer ||
+        buffer->num_frames == 0) {
+        return 0;
+    }
+    int ms = EM_ASM_INT({
+        var player = mal_contexts[$0].players[$1];
+        if (!player) {
+            return 0;
+        } else if (player.startTime) {
+            return Date.now() - player.startTime;
+        } else if (player.pausedTime) {
+            return player.pausedTime;
+        } else {
+            return 0;
+        }
+    }, context->data.context_id, player->data.player_id);
+    uint64_t frame = (uint64_t)(ms * buffer->format.sample_rate / 1000);
+    return (uint32_t)(frame % buffer->num_frames);
+}
+
+static void _mal_player_set_position(mal_player *player, uint32_t frame) {
+    mal_context *context = player->context;
+    const mal_buffer *buffer = player->buffer;
+    if (context && context->data.context_id && player->data.player_id && buffer) {
+        // Playback starts at `pausedTime`
+        double ms = frame * 1000.0 / buffer->format.sample_rate;
+        EM_ASM_ARGS({
+            var player = mal_contexts[$0].players[$1];
+            if (player) {
+                player.pausedTime = $2 > 0 ? $2 : null;
+            }
+        }, context->data.context_id, player->data.player_id, ms);
+    }
+}
+
 static bool _mal_player_set_state(mal_player *player, mal_player_state old_state,
                                   mal_player_state state) {
     mal_context *context = player->context;
@@ -338,6 +442,11 @@ static bool _mal_player_set_state(mal_player *player, mal_player_state old_state
             var player = context_data.players[$1];
             if (player) {
                 player.sourceNode.onended = function() {
+                    // Player ids aren't reused, so this is false if the player was disposed
+                    var context_data = mal_contexts[$0];
+                    if (!context_data || context_data.players[$1] !== player) {
+                        return;
+                    }
                     player.pausedTime = null;
                     player.startTime = null;
                     player.sourceNode.onended = null;
@@ -347,6 +456,9 @@ static bool _mal_player_set_state(mal_player *player, mal_player_state old_state
                         player.gainNode.disconnect();
                         player.gainNode = null;
                     }
+                    try {
+                        Module.ccall('_mal_player_did_finish2', 'void', ['number'], [$2]);
+                    } catch (e) { }
                     if (player.onFinishedIdLow || player.onFinishedIdHigh) {
                         try {
                             Module.ccall('_mal_handle_on_finished_callback2', 'void',
@@ -375,7 +487,7 @@ static bool _mal_player_set_state(mal_player *player, mal_player_state old_state
             } else {
                 return 0;
             }
-        }, context->data.context_id, player->data.player_id);
+        }, context->data.context_id, player->data.player_id, player);
         return success != 0;
     } else {
         return false;
@@ -389,4 +501,9 @@ static void _mal_handle_on_finished_callback2(uint32_t on_finished_id_high,
     _mal_handle_on_finished_callback(on_finished_id);
 }
 
+EMSCRIPTEN_KEEPALIVE
+static void _mal_player_did_finish2(mal_player *player) {
+    _mal_player_did_finish(player);
+}
+
 #endif
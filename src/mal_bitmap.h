@@ -0,0 +1,133 @@
+/*
+ mal
+ https://github.com/brackeen/mal
+ Copyright (c) 2014-2016 David Brackeen
+
+ This software is provided 'as-is', without any express or implied warranty.
+ In no event will the authors be held liable for any damages arising from the
+ use of this software. Permission is granted to anyone to use this software
+ for any purpose, including commercial applications, and to alter it and
+ redistribute it freely, subject to the following restrictions:
+
+ 1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software in a
+    product, an acknowledgment in the product documentation would be appreciated
+    but is not required.
+ 2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+ 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _MAL_BITMAP_H_
+#define _MAL_BITMAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A set of numbered slots (like mixer input buses), tracked one bit per slot. Acquiring a slot
+// returns the lowest free one, so released slots are reused before the set grows.
+//
+// This has no platform dependencies, so it can be used by any backend.
+
+typedef struct {
+    uint64_t *words; // Bit set for each taken slot
+    uint32_t num_words;
+    uint32_t num_slots;
+    uint32_t num_taken;
+    uint32_t first_free_word; // No free slots before this word
+} mal_bitmap;
+
+static inline uint32_t _mal_bitmap_ctz64(const uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (uint32_t)__builtin_ctzll(value);
+#else
+    uint32_t count = 0;
+    uint64_t v = value;
+    while ((v & 1) == 0) {
+        v >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+static void _mal_bitmap_init(mal_bitmap *bitmap) {
+    memset(bitmap, 0, sizeof(mal_bitmap));
+}
+
+static void _mal_bitmap_deinit(mal_bitmap *bitmap) {
+    free(bitmap->words);
+    _mal_bitmap_init(bitmap);
+}
+
+/**
+ * Grows the number of slots. New slots are free.
+ *
+ * @return true on success, false if out of memory or if `num_slots` is less than the current
+ * number of slots.
+ */
+static bool _mal_bitmap_grow(mal_bitmap *bitmap, const uint32_t num_slots) {
+    if (num_slots < bitmap->num_slots) {
+        return false;
+    }
+    const uint32_t num_words = (uint32_t)(((uint64_t)num_slots + 63) / 64);
+    if (num_words > bitmap->num_words) {
+        // Grow the storage geometrically so repeated growth is amortized
+        uint32_t new_num_words = bitmap->num_words * 2;
+        if (new_num_words < num_words) {
+            new_num_words = num_words;
+        }
+        uint64_t *words = realloc(bitmap->words, sizeof(uint64_t) * new_num_words);
+        if (!words) {
+            return false;
+        }
+        memset(words + bitmap->num_words, 0,
+               sizeof(uint64_t) * (new_num_words - bitmap->num_words));
+        bitmap->words = words;
+        bitmap->num_words = new_num_words;
+    }
+    bitmap->num_slots = num_slots;
+    return true;
+}
+
+/**
+ * Takes the lowest free slot.
+ *
+ * @return The slot, or UINT32_MAX if all slots are taken.
+ */
+static uint32_t _mal_bitmap_acquire(mal_bitmap *bitmap) {
+    const uint32_t used_words = (uint32_t)(((uint64_t)bitmap->num_slots + 63) / 64);
+    for (uint32_t i = bitmap->first_free_word; i < used_words; i++) {
+        const uint64_t free_bits = ~bitmap->words[i];
+        if (free_bits != 0) {
+            const uint32_t slot = i * 64 + _mal_bitmap_ctz64(free_bits);
+            if (slot >= bitmap->num_slots) {
+                break;
+            }
+            bitmap->words[i] |= (uint64_t)1 << (slot % 64);
+            bitmap->num_taken++;
+            bitmap->first_free_word = i;
+            return slot;
+        }
+    }
+    // The first free slot, if the bitmap grows, is the one at num_slots
+    bitmap->first_free_word = bitmap->num_slots / 64;
+    return UINT32_MAX;
+}
+
+static void _mal_bitmap_release(mal_bitmap *bitmap, const uint32_t slot) {
+    if (slot < bitmap->num_slots) {
+        const uint64_t bit = (uint64_t)1 << (slot % 64);
+        if (bitmap->words[slot / 64] & bit) {
+            bitmap->words[slot / 64] &= ~bit;
+            bitmap->num_taken--;
+            if (slot / 64 < bitmap->first_free_word) {
+                bitmap->first_free_word = slot / 64;
+            }
+        }
+    }
+}
+
+#endif
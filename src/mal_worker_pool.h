@@ -0,0 +1,335 @@
+/*
+ mal
+ https://github.com/brackeen/mal
+ Copyright (c) 2014-2016 David Brackeen
+
+ This software is provided 'as-is', without any express or implied warranty.
+ In no event will the authors be held liable for any damages arising from the
+ use of this software. Permission is granted to anyone to use this software
+ for any purpose, including commercial applications, and to alter it and
+ redistribute it freely, subject to the following restrictions:
+
+ 1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software in a
+    product, an acknowledgment in the product documentation would be appreciated
+    but is not required.
+ 2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+ 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _MAL_WORKER_POOL_H_
+#define _MAL_WORKER_POOL_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#else
+#include <semaphore.h>
+#include <time.h>
+#endif
+
+// A pool of worker threads that split a range of items into chunks, for work that must finish
+// within one render quantum (like rendering voices before the mixer pulls them).
+//
+// The thread that runs the work takes chunks too, and waits for chunks taken by workers by
+// spinning, up to a timeout, so it never blocks or allocates. Chunks are claimed from a shared
+// counter, so a worker that finishes early takes the next chunk instead of idling. Idle workers
+// spin briefly, then sleep on a semaphore until the next run.
+
+#define MAL_WORKER_POOL_SPIN_COUNT 4096
+
+// The chunk index of a run that is being published. See _mal_worker_pool_run().
+#define MAL_WORKER_POOL_CLOSED UINT32_MAX
+
+typedef void (*mal_worker_pool_func)(void *user_data, uint32_t begin, uint32_t end);
+
+typedef struct {
+    pthread_t *threads;
+    uint32_t num_threads;
+#if defined(__APPLE__)
+    semaphore_t semaphore; // Not dispatch_semaphore_t, which can't be in a struct with ARC
+#else
+    sem_t semaphore;
+#endif
+
+    // The current run. The high 32 bits of `work` are the run's generation, and the low 32 bits
+    // are the next chunk to claim (or MAL_WORKER_POOL_CLOSED). Packing them means a worker that is
+    // late to one run can't claim a chunk of the next. The other fields are written only while the
+    // run is closed, and read with relaxed atomics.
+    uint64_t work;
+    uint32_t num_chunks;
+    uint32_t num_chunks_done;
+    uint32_t count;
+    uint32_t chunk_size;
+    mal_worker_pool_func func;
+    void *user_data;
+
+    uint32_t num_sleeping;
+    bool quit;
+
+    // For the time-constraint policy on Apple platforms. See _mal_worker_pool_create().
+    double period;
+} mal_worker_pool;
+
+static inline void _mal_worker_pool_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline double _mal_worker_pool_time(void) {
+#if defined(__APPLE__)
+    static mach_timebase_info_data_t timebase = {0, 0};
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return (double)mach_absolute_time() * timebase.numer / timebase.denom / 1000000000.0;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+#endif
+}
+
+// Claims and runs chunks of the run with the specified generation, until none are left.
+static void _mal_worker_pool_run_chunks(mal_worker_pool *pool, const uint32_t generation) {
+    uint64_t work = __atomic_load_n(&pool->work, __ATOMIC_ACQUIRE);
+    while ((uint32_t)(work >> 32) == generation) {
+        const uint32_t chunk = (uint32_t)work;
+        if (chunk >= __atomic_load_n(&pool->num_chunks, __ATOMIC_RELAXED)) {
+            break;
+        }
+        // Read the run before claiming a chunk of it. If the fields read are from a later run,
+        // which closed this one first, the claim fails.
+        const uint32_t count = __atomic_load_n(&pool->count, __ATOMIC_RELAXED);
+        const uint32_t chunk_size = __atomic_load_n(&pool->chunk_size, __ATOMIC_RELAXED);
+        const mal_worker_pool_func func = __atomic_load_n(&pool->func, __ATOMIC_RELAXED);
+        void *user_data = __atomic_load_n(&pool->user_data, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_compare_exchange_n(&pool->work, &work, work + 1, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            const uint32_t begin = chunk * chunk_size;
+            const uint32_t end = count - begin < chunk_size ? count : begin + chunk_size;
+            func(user_data, begin, end);
+            __atomic_add_fetch(&pool->num_chunks_done, 1, __ATOMIC_RELEASE);
+            work = __atomic_load_n(&pool->work, __ATOMIC_ACQUIRE);
+        }
+    }
+}
+
+// Sets the calling worker's scheduling. Best effort: the thread running the work is usually a
+// real-time audio thread, and waits for chunks claimed by workers.
+static void _mal_worker_pool_set_realtime(const mal_worker_pool *pool) {
+#if defined(__APPLE__)
+    if (pool->period > 0.0) {
+        // Like the audio thread, so the scheduler treats the workers as part of its deadline
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        const double ticks_per_second = 1000000000.0 * timebase.denom / timebase.numer;
+        thread_time_constraint_policy_data_t policy;
+        policy.period = (uint32_t)(pool->period * ticks_per_second);
+        policy.computation = (uint32_t)(pool->period * 0.5 * ticks_per_second);
+        policy.constraint = (uint32_t)(pool->period * ticks_per_second);
+        policy.preemptible = true;
+        if (thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                              THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&policy,
+                              THREAD_TIME_CONSTRAINT_POLICY_COUNT) == KERN_SUCCESS) {
+            return;
+        }
+    }
+#endif
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+}
+
+static void *_mal_worker_pool_thread_func(void *user_data) {
+    mal_worker_pool *pool = user_data;
+    _mal_worker_pool_set_realtime(pool);
+
+    uint32_t generation = (uint32_t)(__atomic_load_n(&pool->work, __ATOMIC_ACQUIRE) >> 32);
+    while (true) {
+        // Spin, then sleep, until the next run is open (or quit)
+        uint32_t spin = 0;
+        uint32_t next_generation;
+        while (true) {
+            const uint64_t work = __atomic_load_n(&pool->work, __ATOMIC_SEQ_CST);
+            next_generation = (uint32_t)(work >> 32);
+            if ((next_generation != generation && (uint32_t)work != MAL_WORKER_POOL_CLOSED) ||
+                __atomic_load_n(&pool->quit, __ATOMIC_SEQ_CST)) {
+                break;
+            }
+            if (spin < MAL_WORKER_POOL_SPIN_COUNT) {
+                spin++;
+                _mal_worker_pool_pause();
+                continue;
+            }
+            __atomic_add_fetch(&pool->num_sleeping, 1, __ATOMIC_SEQ_CST);
+            // Check again after announcing, so a run published in between isn't missed
+            next_generation = (uint32_t)(__atomic_load_n(&pool->work, __ATOMIC_SEQ_CST) >> 32);
+            if (next_generation == generation && !__atomic_load_n(&pool->quit, __ATOMIC_SEQ_CST)) {
+#if defined(__APPLE__)
+                while (semaphore_wait(pool->semaphore) == KERN_ABORTED) { }
+#else
+                while (sem_wait(&pool->semaphore) != 0) { }
+#endif
+            }
+            __atomic_sub_fetch(&pool->num_sleeping, 1, __ATOMIC_SEQ_CST);
+            spin = 0;
+        }
+        if (__atomic_load_n(&pool->quit, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+        generation = next_generation;
+        _mal_worker_pool_run_chunks(pool, generation);
+    }
+    return NULL;
+}
+
+static void _mal_worker_pool_wake(mal_worker_pool *pool) {
+    uint32_t num_sleeping = __atomic_load_n(&pool->num_sleeping, __ATOMIC_SEQ_CST);
+    while (num_sleeping-- > 0) {
+        // Extra signals are harmless: a woken worker checks for a new run before sleeping again
+#if defined(__APPLE__)
+        semaphore_signal(pool->semaphore);
+#else
+        sem_post(&pool->semaphore);
+#endif
+    }
+}
+
+static void _mal_worker_pool_free(mal_worker_pool *pool) {
+    if (pool) {
+        __atomic_store_n(&pool->quit, true, __ATOMIC_SEQ_CST);
+        for (uint32_t i = 0; i < pool->num_threads; i++) {
+#if defined(__APPLE__)
+            semaphore_signal(pool->semaphore);
+#else
+            sem_post(&pool->semaphore);
+#endif
+        }
+        for (uint32_t i = 0; i < pool->num_threads; i++) {
+            pthread_join(pool->threads[i], NULL);
+        }
+#if defined(__APPLE__)
+        semaphore_destroy(mach_task_self(), pool->semaphore);
+#else
+        sem_destroy(&pool->semaphore);
+#endif
+        free(pool->threads);
+        free(pool);
+    }
+}
+
+/**
+ * Creates a worker pool.
+ *
+ * @param num_threads The number of worker threads, in addition to the thread that runs the work.
+ * @param period The duration of the render quantum the work must finish in, in seconds, or 0 if
+ * unknown. On Apple platforms, workers use the time-constraint policy with this period, like the
+ * audio thread. Otherwise (and if that fails), workers request `SCHED_FIFO`.
+ * @return The pool, or `NULL` if the threads couldn't be created.
+ */
+static mal_worker_pool *_mal_worker_pool_create(const uint32_t num_threads, const double period) {
+    mal_worker_pool *pool = calloc(1, sizeof(mal_worker_pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->period = period;
+#if defined(__APPLE__)
+    bool success = (semaphore_create(mach_task_self(), &pool->semaphore, SYNC_POLICY_FIFO, 0) ==
+                    KERN_SUCCESS);
+#else
+    bool success = sem_init(&pool->semaphore, 0, 0) == 0;
+#endif
+    if (!success) {
+        free(pool);
+        return NULL;
+    }
+    pool->threads = calloc(num_threads > 0 ? num_threads : 1, sizeof(pthread_t));
+    if (!pool->threads) {
+        _mal_worker_pool_free(pool);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, _mal_worker_pool_thread_func, pool) != 0) {
+            _mal_worker_pool_free(pool);
+            return NULL;
+        }
+        pool->num_threads++;
+    }
+    return pool;
+}
+
+/**
+ * Returns `true` if chunks of a run that timed out are still running on workers.
+ */
+static bool _mal_worker_pool_is_busy(mal_worker_pool *pool) {
+    return (__atomic_load_n(&pool->num_chunks_done, __ATOMIC_ACQUIRE) <
+            __atomic_load_n(&pool->num_chunks, __ATOMIC_RELAXED));
+}
+
+/**
+ * Runs `func` over the items in the range [0, `count`), in chunks of `chunk_size` items, on the
+ * workers and the calling thread. Only one thread may run work on a pool.
+ *
+ * The calling thread claims chunks until none are left, then waits up to `timeout` seconds for the
+ * chunks workers claimed. If they aren't done by then (for example, a worker was preempted), this
+ * function returns `false`, and those chunks finish later. Until they do,
+ * #_mal_worker_pool_is_busy() returns `true`, and runs happen on the calling thread alone.
+ *
+ * @return `true` if all chunks are done.
+ */
+static bool _mal_worker_pool_run(mal_worker_pool *pool, const uint32_t count,
+                                 const uint32_t chunk_size, const mal_worker_pool_func func,
+                                 void *user_data, const double timeout) {
+    if (count == 0 || chunk_size == 0) {
+        return true;
+    }
+    const uint32_t num_chunks = (uint32_t)(((uint64_t)count + chunk_size - 1) / chunk_size);
+    if (num_chunks == 1 || pool->num_threads == 0 || _mal_worker_pool_is_busy(pool)) {
+        func(user_data, 0, count);
+        return true;
+    }
+
+    // Publish the run. First, start the next generation closed: from then on, a worker late to the
+    // previous run fails to claim a chunk, so it can't run a chunk with this run's fields. Then
+    // set the fields, and open the run.
+    const uint64_t work = __atomic_load_n(&pool->work, __ATOMIC_RELAXED);
+    const uint32_t generation = (uint32_t)(work >> 32) + 1;
+    __atomic_store_n(&pool->work, ((uint64_t)generation << 32) | MAL_WORKER_POOL_CLOSED,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&pool->count, count, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->chunk_size, chunk_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->func, func, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->user_data, user_data, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->num_chunks_done, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->num_chunks, num_chunks, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->work, (uint64_t)generation << 32, __ATOMIC_SEQ_CST);
+    _mal_worker_pool_wake(pool);
+
+    // Help, then wait for the chunks workers claimed
+    _mal_worker_pool_run_chunks(pool, generation);
+    const double deadline = _mal_worker_pool_time() + timeout;
+    uint32_t spin = 0;
+    while (__atomic_load_n(&pool->num_chunks_done, __ATOMIC_ACQUIRE) < num_chunks) {
+        if ((++spin & 63) == 0 && _mal_worker_pool_time() >= deadline) {
+            return false;
+        }
+        _mal_worker_pool_pause();
+    }
+    return true;
+}
+
+#endif